@@ -0,0 +1,192 @@
+/*
+ * Check that the SIMD versions of video filters produce exactly the same
+ * output as their C versions.
+ *
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "config.h"
+#include "cpudetect.h"
+#include "mp_msg.h"
+#include "options.h"
+#include "defaultopts.h"
+#include "libmpcodecs/img_format.h"
+#include "libmpcodecs/mp_image.h"
+#include "libmpcodecs/vf.h"
+#include "libmpcodecs/vfcap.h"
+
+/* The filters pick their line functions from gCpuCaps when they are opened,
+ * so every test runs the filter once with all CPU extensions masked (the C
+ * code) and once with the detected ones, and compares all output frames. */
+
+#define NUM_FRAMES 6
+
+struct test {
+    const char *filter;
+    const char *args;
+};
+
+static const struct test tests[] = {
+    { "hqdn3d",   NULL },
+    { "hqdn3d",   "10:8:12:10" },
+    { "hqdn3d",   "4:3:0:0" },      // vertical only
+    { "hqdn3d",   "0:0:6:6" },      // temporal only
+    { "yadif",    "0" },
+    { "yadif",    "1" },
+    { "yadif",    "2:0" },
+    { "yadif",    "3:1" },
+    { "mctf",     NULL },
+    { "mctf",     "5:12:10:8" },
+    { NULL }
+};
+
+static const int sizes[][2] = {
+    { 34, 8 }, { 97, 13 }, { 720, 16 }, { 1922, 10 },
+};
+
+// all output frames of one run, plane by plane
+struct output {
+    uint8_t *data;
+    size_t size;
+};
+
+static const vf_info_t sink_info = { "output sink", "sink", "", "", NULL };
+
+static int sink_config(struct vf_instance *vf, int width, int height,
+                       int d_width, int d_height, unsigned int flags,
+                       unsigned int outfmt)
+{
+    return 1;
+}
+
+static int sink_query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    return fmt == IMGFMT_YV12 ? VFCAP_CSP_SUPPORTED | VFCAP_ACCEPT_STRIDE : 0;
+}
+
+static int sink_put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct output *out = (struct output *)vf->priv;
+    for (int p = 0; p < 3; p++) {
+        // chroma_width/height may include the padding of aligned buffers
+        int w = p ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+        int h = p ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+        out->data = realloc(out->data, out->size + w * h);
+        for (int y = 0; y < h; y++) {
+            memcpy(out->data + out->size, mpi->planes[p] + y * mpi->stride[p],
+                   w);
+            out->size += w;
+        }
+    }
+    return 1;
+}
+
+static void fill_frame(mp_image_t *mpi, int pattern, int frame)
+{
+    for (int p = 0; p < 3; p++) {
+        int w = p ? mpi->chroma_width : mpi->w;
+        int h = p ? mpi->chroma_height : mpi->h;
+        for (int y = 0; y < h; y++) {
+            uint8_t *line = mpi->planes[p] + y * mpi->stride[p];
+            for (int x = 0; x < w; x++) {
+                switch (pattern) {
+                case 0: line[x] = rand();                             break;
+                case 1: line[x] = (x * 7 + y * 3 + frame * 5) & 255;  break;
+                case 2: line[x] = ((x ^ y ^ frame) & 1) ? 255 : 0;     break;
+                }
+            }
+        }
+    }
+}
+
+static int run(struct MPOpts *opts, const struct test *t, int w, int h,
+               int pattern, struct output *out)
+{
+    vf_instance_t *sink = calloc(1, sizeof(*sink));
+    vf_instance_t *vf;
+    char *args[] = { "_oldargs_", (char *)t->args, NULL };
+    mp_image_t *mpi[NUM_FRAMES];
+
+    sink->info = &sink_info;
+    sink->config = sink_config;
+    sink->query_format = sink_query_format;
+    sink->put_image = sink_put_image;
+    sink->priv = (struct vf_priv_s *)out;
+    sink->opts = opts;
+    vf = vf_open_filter(opts, sink, t->filter, t->args ? args : NULL);
+    if (!vf || !vf_config_wrapper(vf, w, h, w, h, 0, IMGFMT_YV12)) {
+        printf("%s: could not open or configure the filter\n", t->filter);
+        return 0;
+    }
+    srand(w * h + pattern);
+    // the filters may keep pointers to previous input frames
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        mpi[i] = alloc_mpi(w, h, IMGFMT_YV12);
+        fill_frame(mpi[i], pattern, i);
+        vf->put_image(vf, mpi[i], i * 0.04);
+        while (vf_output_queued_frame(vf));
+    }
+    vf_uninit_filter_chain(vf);
+    for (int i = 0; i < NUM_FRAMES; i++)
+        free_mp_image(mpi[i]);
+    return 1;
+}
+
+int main(void)
+{
+    struct MPOpts opts;
+    CpuCaps caps;
+    int failed = 0;
+
+    mp_msg_init();
+    set_default_mplayer_options(&opts);
+    GetCpuCaps(&caps);
+    printf("Comparing C with:%s%s%s%s\n", caps.hasMMX2 ? " MMX2" : "",
+           caps.hasSSE2 ? " SSE2" : "", caps.hasSSSE3 ? " SSSE3" : "",
+           caps.hasAVX2 ? " AVX2" : "");
+
+    for (const struct test *t = tests; t->filter; t++) {
+        for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (int pattern = 0; pattern < 3; pattern++) {
+                struct output ref = {0}, simd = {0};
+                int w = sizes[s][0], h = sizes[s][1];
+                memset(&gCpuCaps, 0, sizeof(gCpuCaps));
+                if (!run(&opts, t, w, h, pattern, &ref))
+                    return 2;
+                gCpuCaps = caps;
+                if (!run(&opts, t, w, h, pattern, &simd))
+                    return 2;
+                if (ref.size != simd.size ||
+                    memcmp(ref.data, simd.data, ref.size)) {
+                    printf("%s=%s %dx%d pattern %d: output differs\n",
+                           t->filter, t->args ? t->args : "", w, h, pattern);
+                    failed = 1;
+                }
+                free(ref.data);
+                free(simd.data);
+            }
+        }
+        printf("%s=%s: done\n", t->filter, t->args ? t->args : "");
+    }
+    printf(failed ? "FAILED\n" : "all outputs match\n");
+    return failed;
+}
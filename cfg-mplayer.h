@@ -384,6 +384,8 @@ const m_option_t common_opts[] = {
 
     OPT_FLOATRANGE("cache-min", stream_cache_min_percent, 0, 0, 99),
     OPT_FLOATRANGE("cache-seek-min", stream_cache_seek_min_percent, 0, 0, 99),
+    OPT_STRING("cache-dir", stream_cache_dir, 0),
+    OPT_INTRANGE("cache-disk-size", stream_cache_disk_size, 0, 1024, 1 << 30),
 #else
     {"cache", "MPlayer was compiled without cache2 support.\n", CONF_TYPE_PRINT, CONF_NOCFG, 0, 0, NULL},
 #endif /* CONFIG_STREAM_CACHE */
@@ -498,6 +500,13 @@ const m_option_t common_opts[] = {
     OPT_STRING("audio-demuxer", audio_demuxer_name, 0),
     OPT_STRING("sub-demuxer", sub_demuxer_name, 0),
     OPT_MAKE_FLAGS("extbased", extension_parsing, 0),
+    OPT_INTRANGE("demuxer-max-packets", demuxer_max_packs, 0, 16, INT_MAX),
+    OPT_INTRANGE("demuxer-max-bytes", demuxer_max_bytes, 0, 65536, INT_MAX),
+    OPT_FLOATRANGE("demuxer-max-seconds", demuxer_max_secs, 0, 0, 3600),
+    OPT_FLOATRANGE("demuxer-readahead", demuxer_readahead_secs, 0, 0, 3600),
+#ifdef HAVE_PTHREADS
+    OPT_MAKE_FLAGS("demuxer-thread", demuxer_thread, 0),
+#endif
 
     {"mf", (void *) mfopts_conf, CONF_TYPE_SUBCONFIG, 0,0,0, NULL},
 #ifdef CONFIG_RADIO
@@ -583,6 +592,7 @@ const m_option_t common_opts[] = {
 
     // draw by slices or whole frame (useful with libmpeg2/libavcodec)
     OPT_MAKE_FLAGS("slices", vd_use_slices, 0),
+    OPT_INTRANGE("vf-threads", vf_threads, 0, 0, 16),
     {"field-dominance", &field_dominance, CONF_TYPE_INT, CONF_RANGE, -1, 1, NULL},
 
     {"lavdopts", (void *) lavc_decode_opts_conf, CONF_TYPE_SUBCONFIG, 0, 0, 0, NULL},
@@ -826,6 +836,9 @@ const m_option_t mplayer_opts[]={
     OPT_CHOICE("pts-association-mode", user_pts_assoc_mode, 0,
                ({"auto", 0}, {"decoder", 1}, {"sort", 2})),
     OPT_MAKE_FLAGS("initial-audio-sync", initial_audio_sync, 0),
+#ifdef HAVE_PTHREADS
+    OPT_FLOATRANGE("audio-decode-ahead", audio_decode_ahead, 0, 0, 10),
+#endif
     OPT_CHOICE("hr-seek", hr_seek, 0,
                ({"off", -1}, {"absolute", 0}, {"always", 1}, {"on", 1})),
     OPT_FLOATRANGE("hr-seek-demuxer-offset", hr_seek_demuxer_offset, 0, -9, 99),
@@ -363,6 +363,44 @@ static int mp_property_demuxer(m_option_t *prop, int action, void *arg,
                                 (char *) mpctx->demuxer->desc->name);
 }
 
+/// Demuxer packet queue of the audio or video stream (RO)
+static int mp_property_demuxer_queue(m_option_t *prop, int action, void *arg,
+                                     MPContext *mpctx)
+{
+    if (!mpctx->demuxer)
+        return M_PROPERTY_UNAVAILABLE;
+    bool video = !strncmp(prop->name, "demuxer_video_", 14);
+    struct demux_stream *ds = video ? mpctx->demuxer->video
+                                    : mpctx->demuxer->audio;
+    const char *field = strrchr(prop->name, '_') + 1;
+    if (!ds->sh)
+        return M_PROPERTY_UNAVAILABLE;
+    if (!strcmp(field, "packets"))
+        return m_property_int_ro(prop, action, arg, ds->packs);
+    if (!strcmp(field, "bytes"))
+        return m_property_int_ro(prop, action, arg, ds->bytes);
+    if (!strcmp(field, "seconds"))
+        return m_property_double_ro(prop, action, arg,
+                                    ds_buffered_duration(ds));
+    return M_PROPERTY_ERROR;
+}
+
+/// Demux packet pool counters (RO)
+static int mp_property_packet_pool(m_option_t *prop, int action, void *arg,
+                                   MPContext *mpctx)
+{
+    struct demux_packet_pool_stats stats;
+    switch (action) {
+    case M_PROPERTY_GET:
+        if (!arg)
+            return M_PROPERTY_ERROR;
+        demux_packet_pool_get_stats(&stats);
+        *(int64_t *)arg = *(int64_t *)((char *)&stats + prop->offset);
+        return M_PROPERTY_OK;
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 /// Position in the stream (RW)
 static int mp_property_stream_pos(m_option_t *prop, int action, void *arg,
                                   MPContext *mpctx)
@@ -1124,6 +1162,41 @@ static int mp_property_deinterlace(m_option_t *prop, int action,
     return m_property_flag_ro(prop, action, arg, value);
 }
 
+/// Statistics of the last frame from vf_stats (RO)
+static int mp_property_frame_stats(m_option_t *prop, int action, void *arg,
+                                   MPContext *mpctx)
+{
+    struct vf_frame_stats st;
+    vf_instance_t *vf;
+    if (!mpctx->sh_video || !mpctx->sh_video->vfilter)
+        return M_PROPERTY_UNAVAILABLE;
+    vf = mpctx->sh_video->vfilter;
+    if (vf->control(vf, VFCTRL_GET_FRAME_STATS, &st) != CONTROL_TRUE)
+        return M_PROPERTY_UNAVAILABLE;
+    const char *field = prop->name + 6;
+    if (!strcmp(field, "luma"))
+        return m_property_double_ro(prop, action, arg, st.avg);
+    if (!strcmp(field, "black"))
+        return m_property_double_ro(prop, action, arg, st.black * 100);
+    if (!strcmp(field, "mafd"))
+        return m_property_double_ro(prop, action, arg, st.mafd);
+    if (!strcmp(field, "scene"))
+        return m_property_double_ro(prop, action, arg, st.scene);
+    if (!strcmp(field, "crop")) {
+        switch (action) {
+        case M_PROPERTY_GET:
+        case M_PROPERTY_PRINT:
+            if (!arg)
+                return M_PROPERTY_ERROR;
+            *(char **)arg = talloc_asprintf(NULL, "%d:%d:%d:%d", st.crop_w,
+                                            st.crop_h, st.crop_x, st.crop_y);
+            return M_PROPERTY_OK;
+        }
+        return M_PROPERTY_NOT_IMPLEMENTED;
+    }
+    return M_PROPERTY_ERROR;
+}
+
 static int colormatrix_property_helper(m_option_t *prop, int action,
                                       void *arg, MPContext *mpctx)
 {
@@ -2204,6 +2277,30 @@ static const m_option_t mp_properties[] = {
       0, 0, 0, NULL },
     { "demuxer", mp_property_demuxer, CONF_TYPE_STRING,
       0, 0, 0, NULL },
+    { "demuxer_audio_packets", mp_property_demuxer_queue, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "demuxer_audio_bytes", mp_property_demuxer_queue, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "demuxer_audio_seconds", mp_property_demuxer_queue, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "demuxer_video_packets", mp_property_demuxer_queue, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "demuxer_video_bytes", mp_property_demuxer_queue, CONF_TYPE_INT,
+      0, 0, 0, NULL },
+    { "demuxer_video_seconds", mp_property_demuxer_queue, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "packet_pool_allocs", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, packet_allocs) },
+    { "packet_pool_hits", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, packet_hits) },
+    { "packet_pool_buffer_allocs", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, buffer_allocs) },
+    { "packet_pool_buffer_hits", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, buffer_hits) },
+    { "packet_pool_bytes", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, pooled_bytes) },
+    { "packet_copied_bytes", mp_property_packet_pool, CONF_TYPE_INT64,
+      0, 0, 0, .offset = offsetof(struct demux_packet_pool_stats, copied_bytes) },
     { "stream_pos", mp_property_stream_pos, CONF_TYPE_POSITION,
       M_OPT_MIN, 0, 0, NULL },
     { "stream_start", mp_property_stream_start, CONF_TYPE_POSITION,
@@ -2264,6 +2361,16 @@ static const m_option_t mp_properties[] = {
       M_OPT_RANGE, 0, 1, NULL },
     { "deinterlace", mp_property_deinterlace, CONF_TYPE_FLAG,
       M_OPT_RANGE, 0, 1, NULL },
+    { "stats_luma", mp_property_frame_stats, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "stats_black", mp_property_frame_stats, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "stats_mafd", mp_property_frame_stats, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "stats_scene", mp_property_frame_stats, CONF_TYPE_DOUBLE,
+      0, 0, 0, NULL },
+    { "stats_crop", mp_property_frame_stats, CONF_TYPE_STRING,
+      0, 0, 0, NULL },
     { "colormatrix", mp_property_colormatrix, &m_option_type_choice,
       0, 0, 0, "colormatrix" },
     { "colormatrix_input_range", mp_property_colormatrix_input_range, &m_option_type_choice,
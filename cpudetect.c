@@ -241,6 +241,17 @@ do_cpuid(unsigned int ax, unsigned int *p)
          : "0" (ax));
 }
 
+static void do_cpuid_count(unsigned int ax, unsigned int cx, unsigned int *p)
+{
+    __asm__ volatile
+        ("mov %%"REG_b", %%"REG_S"\n\t"
+         "cpuid\n\t"
+         "xchg %%"REG_b", %%"REG_S
+         : "=a" (p[0]), "=S" (p[1]),
+           "=c" (p[2]), "=d" (p[3])
+         : "0" (ax), "2" (cx));
+}
+
 void GetCpuCaps( CpuCaps *caps)
 {
     unsigned int regs[4];
@@ -288,6 +299,21 @@ void GetCpuCaps( CpuCaps *caps)
         cl_size = ((regs2[1] >> 8) & 0xFF)*8;
         if(cl_size) caps->cl_size = cl_size;
 
+        // AVX2 additionally needs the OS to save the ymm registers:
+        // check OSXSAVE and AVX, then XCR0 for the SSE and AVX state bits.
+        // This needs the cpuid level in regs[0], which
+        // GetCpuFriendlyName() below overwrites.
+        if (regs[0] >= 0x00000007 &&
+            (regs2[2] & (1 << 27)) && (regs2[2] & (1 << 28))) {
+            unsigned int xcr0;
+            __asm__ volatile (".byte 0x0f, 0x01, 0xd0" // xgetbv
+                              : "=a" (xcr0) : "c" (0) : "edx");
+            if ((xcr0 & 6) == 6) {
+                do_cpuid_count(0x00000007, 0, regs2);
+                caps->hasAVX2 = (regs2[1] & (1 << 5 )) >>  5; // 0x0000020
+            }
+        }
+
         ptmpstr=tmpstr=GetCpuFriendlyName(regs, regs2);
         while(*ptmpstr == ' ')    // strip leading spaces
             ptmpstr++;
@@ -295,7 +321,6 @@ void GetCpuCaps( CpuCaps *caps)
         free(tmpstr);
         mp_msg(MSGT_CPUDETECT,MSGL_V,"(Family: %d, Model: %d, Stepping: %d)\n",
                caps->cpuType, caps->cpuModel, caps->cpuStepping);
-
     }
     do_cpuid(0x80000000, regs);
     if (regs[0]>=0x80000001) {
@@ -330,6 +355,8 @@ void GetCpuCaps( CpuCaps *caps)
             check_os_katmai_support();
         if (!caps->hasSSE)
             caps->hasSSE2 = 0;
+        if (!caps->hasSSE2)
+            caps->hasAVX2 = 0;
 //          caps->has3DNow=1;
 //          caps->hasMMX2 = 0;
 //          caps->hasMMX = 0;
@@ -351,6 +378,10 @@ void GetCpuCaps( CpuCaps *caps)
         if(caps->hasSSE2) mp_msg(MSGT_CPUDETECT,MSGL_WARN,"SSE2 supported but disabled\n");
         caps->hasSSE2=0;
 #endif
+#if !HAVE_AVX2
+        if(caps->hasAVX2) mp_msg(MSGT_CPUDETECT,MSGL_WARN,"AVX2 supported but disabled\n");
+        caps->hasAVX2=0;
+#endif
 #if !HAVE_AMD3DNOW
         if(caps->has3DNow) mp_msg(MSGT_CPUDETECT,MSGL_WARN,"3DNow supported but disabled\n");
         caps->has3DNow=0;
@@ -427,6 +458,7 @@ void GetCpuCaps( CpuCaps *caps)
     caps->hasSSE3=0;
     caps->hasSSSE3=0;
     caps->hasSSE4a=0;
+    caps->hasAVX2=0;
     caps->isX86=0;
     caps->hasAltiVec = 0;
 #if HAVE_ALTIVEC
@@ -41,6 +41,7 @@ typedef struct cpucaps_s {
     int hasSSE3;
     int hasSSSE3;
     int hasSSE4a;
+    int hasAVX2;
     int isX86;
     unsigned cl_size; /* size of cache line */
     int hasAltiVec;
@@ -3,6 +3,7 @@
 #include "config.h"
 #include "defaultopts.h"
 #include "options.h"
+#include "libmpdemux/demuxer.h"
 
 void set_default_mplayer_options(struct MPOpts *opts)
 {
@@ -27,6 +28,7 @@ void set_default_mplayer_options(struct MPOpts *opts)
         .chapter_merge_threshold = 100,
         .stream_cache_min_percent = 20.0,
         .stream_cache_seek_min_percent = 50.0,
+        .stream_cache_disk_size = 256 * 1024,
         .chapterrange = {-1, -1},
         .edition_id = -1,
         .user_correct_pts = -1,
@@ -39,6 +41,8 @@ void set_default_mplayer_options(struct MPOpts *opts)
         .sub_id = -1,
         .sub_visibility = 1,
         .extension_parsing = 1,
+        .demuxer_max_packs = MAX_PACKS,
+        .demuxer_max_bytes = MAX_PACK_BYTES,
         .audio_output_channels = 2,
         .audio_output_format = -1,  // AF_FORMAT_UNKNOWN
         .playback_speed = 1.,
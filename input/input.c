@@ -1702,6 +1702,12 @@ void mp_input_wakeup(struct input_ctx *ictx)
         write(ictx->wakeup_pipe[1], &(char){0}, 1);
 }
 
+bool mp_input_abort_pending(struct input_ctx *ictx)
+{
+    return async_quit_request || ictx->key_cmd_queue.num_abort_cmds ||
+           ictx->control_cmd_queue.num_abort_cmds;
+}
+
 /**
  * \param time time to wait for an interruption in milliseconds
  */
@@ -265,6 +265,10 @@ void mp_input_wakeup(struct input_ctx *ictx);
 // Interruptible usleep:  (used by libmpdemux)
 int mp_input_check_interrupt(struct input_ctx *ictx, int time);
 
+// Like mp_input_check_interrupt(), but only looks at commands already
+// queued, without reading new events or sleeping.
+bool mp_input_abort_pending(struct input_ctx *ictx);
+
 extern int async_quit_request;
 
 #endif /* MPLAYER_INPUT_H */
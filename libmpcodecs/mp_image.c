@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "talloc.h"
@@ -30,15 +31,81 @@
 #include "libvo/fastmemcpy.h"
 #include "libavutil/mem.h"
 
+/* Image buffer pool: filter chains allocate all their frame buffers again
+ * whenever they are rebuilt, and shared buffers are replaced whenever a
+ * filter still holds a reference to a frame that is about to be
+ * overwritten. Keep released buffers around and hand them out again for
+ * the same size. Images are only allocated and freed by the playback
+ * thread, so there is no locking. */
+#define POOL_MAX_BUFFERS 16
+#define POOL_MAX_BYTES (256 * 1024 * 1024)
+
+struct mp_image_buffer {
+    struct mp_image_buffer *next;
+    int refcount;
+    size_t size;
+    uint8_t *data;
+};
+
+static struct image_pool {
+    struct mp_image_buffer *buffers; // most recently released first
+    int num_buffers;
+    size_t pooled_bytes;
+} image_pool;
+
+static struct mp_image_buffer *buffer_get(size_t size)
+{
+    struct mp_image_buffer **prev = &image_pool.buffers;
+    for (struct mp_image_buffer *b = *prev; b; prev = &b->next, b = b->next) {
+        if (b->size == size) {
+            *prev = b->next;
+            image_pool.num_buffers--;
+            image_pool.pooled_bytes -= size;
+            b->next = NULL;
+            b->refcount = 1;
+            return b;
+        }
+    }
+    struct mp_image_buffer *b = malloc(sizeof(*b));
+    if (!b)
+        abort(); //out of memory
+    *b = (struct mp_image_buffer){ .refcount = 1, .size = size };
+    b->data = av_malloc(size);
+    if (!b->data)
+        abort(); //out of memory
+    return b;
+}
+
+static void buffer_unref(struct mp_image_buffer *b)
+{
+    if (--b->refcount > 0)
+        return;
+    b->next = image_pool.buffers;
+    image_pool.buffers = b;
+    image_pool.num_buffers++;
+    image_pool.pooled_bytes += b->size;
+    // drop the least recently released buffers
+    while (image_pool.num_buffers > POOL_MAX_BUFFERS
+           || image_pool.pooled_bytes > POOL_MAX_BYTES) {
+        struct mp_image_buffer **last = &image_pool.buffers;
+        while ((*last)->next)
+            last = &(*last)->next;
+        image_pool.num_buffers--;
+        image_pool.pooled_bytes -= (*last)->size;
+        av_free((*last)->data);
+        free(*last);
+        *last = NULL;
+    }
+}
+
 void mp_image_alloc_planes(mp_image_t *mpi) {
   // IF09 - allocate space for 4. plane delta info - unused
   if (mpi->imgfmt == IMGFMT_IF09) {
-    mpi->planes[0]=av_malloc(mpi->bpp*mpi->width*(mpi->height+2)/8+
-                            mpi->chroma_width*mpi->chroma_height);
+    mpi->buf = buffer_get(mpi->bpp*mpi->width*(mpi->height+2)/8+
+                          mpi->chroma_width*mpi->chroma_height);
   } else
-    mpi->planes[0]=av_malloc(mpi->bpp*mpi->width*(mpi->height+2)/8);
-  if (!mpi->planes[0])
-    abort(); //out of memory
+    mpi->buf = buffer_get(mpi->bpp*mpi->width*(mpi->height+2)/8);
+  mpi->planes[0] = mpi->buf->data;
   if (mpi->flags&MP_IMGFLAG_PLANAR) {
     int bpp = IMGFMT_IS_YUVP16(mpi->imgfmt)? 2 : 1;
     // YV12/I420/YVU9/IF09. feel free to add other planar formats here...
@@ -86,8 +153,9 @@ void copy_mpi(mp_image_t *dmpi, mp_image_t *mpi) {
 	       dmpi->stride[0],mpi->stride[0]);
     memcpy_pic(dmpi->planes[1],mpi->planes[1], mpi->chroma_width, mpi->chroma_height,
 	       dmpi->stride[1],mpi->stride[1]);
-    memcpy_pic(dmpi->planes[2], mpi->planes[2], mpi->chroma_width, mpi->chroma_height,
-	       dmpi->stride[2],mpi->stride[2]);
+    if (mpi->num_planes > 2)
+      memcpy_pic(dmpi->planes[2], mpi->planes[2], mpi->chroma_width, mpi->chroma_height,
+	         dmpi->stride[2],mpi->stride[2]);
   } else {
     memcpy_pic(dmpi->planes[0],mpi->planes[0],
 	       mpi->w*(dmpi->bpp/8), mpi->h,
@@ -193,17 +261,74 @@ void mp_image_setfmt(mp_image_t* mpi,unsigned int out_fmt){
     mpi->bpp=0;
 }
 
-static int mp_image_destructor(void *ptr)
+void mp_image_free_planes(mp_image_t *mpi)
 {
-    mp_image_t *mpi = ptr;
+    if (!(mpi->flags & MP_IMGFLAG_ALLOCATED))
+        return;
+    /* because we allocate the whole image at once */
+    buffer_unref(mpi->buf);
+    mpi->buf = NULL;
+    mpi->planes[0] = NULL;
+    if (mpi->flags & MP_IMGFLAG_RGB_PALETTE)
+        av_freep(&mpi->planes[1]);
+    mpi->flags &= ~MP_IMGFLAG_ALLOCATED;
+}
 
-    if(mpi->flags&MP_IMGFLAG_ALLOCATED){
-        /* because we allocate the whole image at once */
-        av_free(mpi->planes[0]);
-        if (mpi->flags & MP_IMGFLAG_RGB_PALETTE)
-            av_free(mpi->planes[1]);
+void mp_image_make_writable(mp_image_t *mpi, int preserve)
+{
+    struct mp_image_buffer *old = mpi->buf;
+    if (!(mpi->flags & MP_IMGFLAG_ALLOCATED) || old->refcount < 2)
+        return;
+    struct mp_image_buffer *new = buffer_get(old->size);
+    if (preserve)
+        memcpy(new->data, old->data, old->size);
+    // the palette is not part of the buffer and stays where it is
+    for (int i = 0; i < MP_MAX_PLANES; i++) {
+        if (mpi->planes[i] >= old->data &&
+                mpi->planes[i] < old->data + old->size)
+            mpi->planes[i] = new->data + (mpi->planes[i] - old->data);
     }
+    buffer_unref(old);
+    mpi->buf = new;
+}
 
+mp_image_t *mp_image_new_ref(mp_image_t *mpi)
+{
+    mp_image_t *ref = new_mp_image(mpi->width, mpi->height);
+    if (mpi->flags & MP_IMGFLAG_ALLOCATED &&
+            !(mpi->flags & MP_IMGFLAG_RGB_PALETTE)) {
+        *ref = *mpi;
+        ref->buf->refcount++;
+        ref->flags &= ~MP_IMGFLAG_DRAW_CALLBACK;
+        ref->usage_count = 0;
+        ref->priv = NULL;
+    } else {
+        // memory owned by the codec or the VO, must copy
+        ref->flags |= mpi->flags & MP_IMGFLAG_RGB_PALETTE;
+        mp_image_setfmt(ref, mpi->imgfmt);
+        if (!ref->bpp) {
+            free_mp_image(ref);
+            return NULL;
+        }
+        ref->w = mpi->w;
+        ref->h = mpi->h;
+        mp_image_alloc_planes(ref);
+        copy_mpi(ref, mpi);
+        if (ref->flags & MP_IMGFLAG_RGB_PALETTE)
+            memcpy(ref->planes[1], mpi->planes[1], 1024);
+        ref->pict_type = mpi->pict_type;
+        ref->fields = mpi->fields;
+        ref->qscale_type = mpi->qscale_type;
+    }
+    // points into codec memory that is not kept alive by the reference
+    ref->qscale = NULL;
+    ref->stats = NULL;
+    return ref;
+}
+
+static int mp_image_destructor(void *ptr)
+{
+    mp_image_free_planes(ptr);
     return 0;
 }
 
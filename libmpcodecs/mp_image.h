@@ -96,6 +96,9 @@
 #define MP_IMGFIELD_BOTTOM 0x10
 #define MP_IMGFIELD_INTERLACED 0x20
 
+struct mp_image_buffer;
+struct vf_frame_stats;
+
 typedef struct mp_image {
     unsigned int flags;
     unsigned char type;
@@ -118,6 +121,10 @@ typedef struct mp_image {
     int chroma_x_shift; // horizontal
     int chroma_y_shift; // vertical
     int usage_count;
+    /* refcounted memory behind planes[], set if MP_IMGFLAG_ALLOCATED */
+    struct mp_image_buffer *buf;
+    /* set by vf_stats on its output, valid until put_image returns */
+    struct vf_frame_stats *stats;
     /* for private use by filter or vo driver (to store buffer id or dmpi) */
     void* priv;
 } mp_image_t;
@@ -128,6 +135,15 @@ void free_mp_image(mp_image_t* mpi);
 
 mp_image_t* alloc_mpi(int w, int h, unsigned long int fmt);
 void mp_image_alloc_planes(mp_image_t *mpi);
+void mp_image_free_planes(mp_image_t *mpi);
 void copy_mpi(mp_image_t *dmpi, mp_image_t *mpi);
 
+// Return a new image that shares the buffer of mpi (or a copy of it if mpi
+// does not own its memory). The reference is read-only; free it with
+// free_mp_image().
+mp_image_t *mp_image_new_ref(mp_image_t *mpi);
+// Give mpi a buffer of its own if other images still reference its current
+// one. If preserve is set, the old contents are copied over.
+void mp_image_make_writable(mp_image_t *mpi, int preserve);
+
 #endif /* MPLAYER_MP_IMAGE_H */
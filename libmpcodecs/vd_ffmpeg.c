@@ -64,6 +64,7 @@ typedef struct {
     enum PixelFormat pix_fmt;
     int do_slices;
     int do_dr1;
+    int dr1_numbered;
     int vo_initialized;
     int best_csp;
     int qp_stat[32];
@@ -163,11 +164,15 @@ static int init(sh_video_t *sh)
         ctx->do_slices = 1;
 
     if (lavc_codec->capabilities & CODEC_CAP_DR1 && !do_vis_debug
-            && lavc_codec->id != CODEC_ID_H264
             && lavc_codec->id != CODEC_ID_INTERPLAY_VIDEO
-            && lavc_codec->id != CODEC_ID_ROQ && lavc_codec->id != CODEC_ID_VP8
+            && lavc_codec->id != CODEC_ID_ROQ
             && lavc_codec->id != CODEC_ID_LAGARITH)
         ctx->do_dr1 = 1;
+    /* H.264 and VP8 keep more reference frames alive than the IP/IPB
+     * buffers can hold, so they only get direct rendering with numbered
+     * images when frame threading is used (see below). */
+    bool many_refs = lavc_codec->id == CODEC_ID_H264
+                     || lavc_codec->id == CODEC_ID_VP8;
     ctx->ip_count = ctx->b_count = 0;
 
     ctx->pic = avcodec_alloc_frame();
@@ -177,8 +182,9 @@ static int init(sh_video_t *sh)
     avctx->codec_type = AVMEDIA_TYPE_VIDEO;
     avctx->codec_id = lavc_codec->id;
 
-    if (lavc_codec->capabilities & CODEC_CAP_HWACCEL   // XvMC
-        || lavc_codec->capabilities & CODEC_CAP_HWACCEL_VDPAU) {
+    bool hwaccel = lavc_codec->capabilities & CODEC_CAP_HWACCEL   // XvMC
+                   || lavc_codec->capabilities & CODEC_CAP_HWACCEL_VDPAU;
+    if (hwaccel) {
         ctx->do_dr1    = true;
         ctx->do_slices = true;
         lavc_param->threads    = 1;
@@ -203,10 +209,20 @@ static int init(sh_video_t *sh)
         threads = FFMIN(threads, 16);
         lavc_param->threads = threads;
     }
-    /* Our get_buffer and draw_horiz_band callbacks are not safe to call
-     * from other threads. */
-    if (lavc_param->threads > 1) {
+    /* With frame threading, frames are allocated and released out of
+     * decoding order and many of them are in flight at once, which the
+     * IP/IPB buffer types can't express. Allocate numbered images instead;
+     * they stay reserved until release_buffer drops their usage count.
+     * libavcodec still calls get_buffer/release_buffer only from the thread
+     * calling avcodec_decode_video2() as long as thread_safe_callbacks is
+     * not set. Our draw_horiz_band callback is not safe to call from other
+     * threads, so slices stay disabled. init_vo turns direct rendering
+     * off again if the VO doesn't take the numbered images directly. */
+    if (lavc_param->threads > 1)
+        ctx->dr1_numbered = true;
+    else if (many_refs && !hwaccel)
         ctx->do_dr1 = false;
+    if (lavc_param->threads > 1) {
         ctx->do_slices = false;
         mp_tmsg(MSGT_DECVIDEO, MSGL_V, "Asking decoder to use "
                 "%d threads if supported.\n", lavc_param->threads);
@@ -432,6 +448,42 @@ static enum mp_csp_levels avcol_range_to_mp_csp_levels(enum AVColorRange range)
     }
 }
 
+static void disable_numbered_dr(vd_ffmpeg_ctx *ctx, const char *reason)
+{
+    mp_msg(MSGT_DECVIDEO, MSGL_V, "[VD_FFMPEG] %s, not using direct "
+           "rendering.\n", reason);
+    ctx->do_dr1 = 0;
+    // frame threads take the callbacks over from the main context
+    ctx->avctx->get_buffer = avcodec_default_get_buffer;
+    ctx->avctx->reget_buffer = avcodec_default_reget_buffer;
+}
+
+/* Numbered images only avoid a copy if the VO takes them directly. Images
+ * from the filter chain are copied to the VO later just like lavc's own
+ * buffers, while frame threading would use up their few slots. */
+static void check_numbered_dr(sh_video_t *sh)
+{
+    vd_ffmpeg_ctx *ctx = sh->context;
+    AVCodecContext *avctx = ctx->avctx;
+    int width = avctx->width;
+    int height = avctx->height;
+    mp_image_t *mpi;
+
+    if (!ctx->dr1_numbered || !ctx->do_dr1 || IMGFMT_IS_HWACCEL(ctx->best_csp))
+        return;
+    avcodec_align_dimensions(avctx, &width, &height);
+    mpi = mpcodecs_get_image(sh, MP_IMGTYPE_NUMBERED | (0xffff << 16),
+                             MP_IMGFLAG_PRESERVE | MP_IMGFLAG_READABLE |
+                             MP_IMGFLAG_ACCEPT_ALIGNED_STRIDE |
+                             MP_IMGFLAG_PREFER_ALIGNED_STRIDE, width, height);
+    if (mpi) {
+        mpi->usage_count--;
+        if (mpi->flags & MP_IMGFLAG_DIRECT)
+            return;
+    }
+    disable_numbered_dr(ctx, "VO doesn't accept numbered images");
+}
+
 static int init_vo(sh_video_t *sh, enum PixelFormat pix_fmt)
 {
     vd_ffmpeg_ctx *ctx = sh->context;
@@ -493,6 +545,7 @@ static int init_vo(sh_video_t *sh, enum PixelFormat pix_fmt)
                                  ctx->best_csp))
             return -1;
         ctx->vo_initialized = 1;
+        check_numbered_dr(sh);
     }
     return 0;
 }
@@ -529,7 +582,7 @@ static int get_buffer(AVCodecContext *avctx, AVFrame *pic)
         flags |= ctx->do_slices ? MP_IMGFLAG_DRAW_CALLBACK : 0;
         mp_msg(MSGT_DECVIDEO, MSGL_DBG2,
                type == MP_IMGTYPE_STATIC ? "using STATIC\n" : "using TEMP\n");
-    } else {
+    } else if (!ctx->dr1_numbered) {
         if (!pic->reference) {
             ctx->b_count++;
             flags |= ctx->do_slices ? MP_IMGFLAG_DRAW_CALLBACK : 0;
@@ -548,10 +601,22 @@ static int get_buffer(AVCodecContext *avctx, AVFrame *pic)
             release_buffer(avctx, pic);
         return avctx->get_buffer(avctx, pic);
     }
+    if (!ctx->do_dr1) {
+        // init_vo switched to lavc's buffers; this frame thread still has
+        // the old callback
+        if (pic->data[0])
+            release_buffer(avctx, pic);
+        return avcodec_default_get_buffer(avctx, pic);
+    }
 
     if (IMGFMT_IS_HWACCEL(ctx->best_csp))
         type =  MP_IMGTYPE_NUMBERED | (0xffff << 16);
-    else if (!pic->buffer_hints) {
+    else if (ctx->dr1_numbered) {
+        type = MP_IMGTYPE_NUMBERED | (0xffff << 16);
+        // the decoder may read from any frame it still holds
+        flags |= MP_IMGFLAG_PRESERVE | MP_IMGFLAG_READABLE;
+        flags &= ~MP_IMGFLAG_DRAW_CALLBACK;
+    } else if (!pic->buffer_hints) {
         if (ctx->b_count > 1 || ctx->ip_count > 2) {
             mp_tmsg(MSGT_DECVIDEO, MSGL_WARN, "[VD_FFMPEG] DRI failure.\n");
 
@@ -574,6 +639,11 @@ static int get_buffer(AVCodecContext *avctx, AVFrame *pic)
     if (ctx->best_csp == IMGFMT_RGB8 || ctx->best_csp == IMGFMT_BGR8)
         flags |= MP_IMGFLAG_RGB_PALETTE;
     mpi = mpcodecs_get_image(sh, type, flags, width, height);
+    if (!mpi && ctx->dr1_numbered && !IMGFMT_IS_HWACCEL(ctx->best_csp)) {
+        // all numbered images are in use
+        disable_numbered_dr(ctx, "Out of numbered images");
+        return avcodec_default_get_buffer(avctx, pic);
+    }
     if (!mpi)
         return -1;
 
@@ -620,7 +690,7 @@ static void release_buffer(struct AVCodecContext *avctx, AVFrame *pic)
     sh_video_t *sh = avctx->opaque;
     vd_ffmpeg_ctx *ctx = sh->context;
 
-    if (ctx->ip_count <= 2 && ctx->b_count <= 1) {
+    if (!ctx->dr1_numbered && ctx->ip_count <= 2 && ctx->b_count <= 1) {
         if (mpi->flags & MP_IMGFLAG_PRESERVE)
             ctx->ip_count--;
         else
@@ -633,6 +703,8 @@ static void release_buffer(struct AVCodecContext *avctx, AVFrame *pic)
             av_freep(&mpi->planes[1]);
         // release mpi (in case MPI_IMGTYPE_NUMBERED is used, e.g. for VDPAU)
         mpi->usage_count--;
+        // lavc reuses the frame, possibly for one of its own buffers
+        pic->opaque = NULL;
     }
 
     if (pic->type != FF_BUFFER_TYPE_USER) {
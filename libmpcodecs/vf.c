@@ -23,6 +23,10 @@
 
 #include "config.h"
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include "mp_msg.h"
 #include "m_option.h"
 #include "m_struct.h"
@@ -34,6 +38,9 @@
 
 #include "libvo/fastmemcpy.h"
 #include "libavutil/mem.h"
+#include "libavutil/common.h"
+#include "options.h"
+#include "osdep/numcores.h"
 
 extern const vf_info_t vf_info_vo;
 extern const vf_info_t vf_info_rectangle;
@@ -42,6 +49,7 @@ extern const vf_info_t vf_info_crop;
 extern const vf_info_t vf_info_expand;
 extern const vf_info_t vf_info_pp;
 extern const vf_info_t vf_info_scale;
+extern const vf_info_t vf_info_kscale;
 extern const vf_info_t vf_info_format;
 extern const vf_info_t vf_info_noformat;
 extern const vf_info_t vf_info_flip;
@@ -57,6 +65,8 @@ extern const vf_info_t vf_info_yvu9;
 extern const vf_info_t vf_info_lavcdeint;
 extern const vf_info_t vf_info_eq;
 extern const vf_info_t vf_info_eq2;
+extern const vf_info_t vf_info_coloreq;
+extern const vf_info_t vf_info_icc;
 extern const vf_info_t vf_info_gradfun;
 extern const vf_info_t vf_info_halfpack;
 extern const vf_info_t vf_info_dint;
@@ -74,6 +84,7 @@ extern const vf_info_t vf_info_down3dright;
 extern const vf_info_t vf_info_field;
 extern const vf_info_t vf_info_denoise3d;
 extern const vf_info_t vf_info_hqdn3d;
+extern const vf_info_t vf_info_mctf;
 extern const vf_info_t vf_info_detc;
 extern const vf_info_t vf_info_telecine;
 extern const vf_info_t vf_info_tinterlace;
@@ -105,6 +116,7 @@ extern const vf_info_t vf_info_screenshot;
 extern const vf_info_t vf_info_ass;
 extern const vf_info_t vf_info_yadif;
 extern const vf_info_t vf_info_blackframe;
+extern const vf_info_t vf_info_stats;
 extern const vf_info_t vf_info_geq;
 extern const vf_info_t vf_info_ow;
 extern const vf_info_t vf_info_fixpts;
@@ -119,6 +131,7 @@ static const vf_info_t *const filter_list[] = {
     &vf_info_crop,
     &vf_info_expand,
     &vf_info_scale,
+    &vf_info_kscale,
 //    &vf_info_osd,
     &vf_info_vo,
     &vf_info_format,
@@ -145,6 +158,10 @@ static const vf_info_t *const filter_list[] = {
     &vf_info_yvu9,
     &vf_info_eq,
     &vf_info_eq2,
+    &vf_info_coloreq,
+#ifdef CONFIG_LCMS2
+    &vf_info_icc,
+#endif
     &vf_info_gradfun,
     &vf_info_halfpack,
     &vf_info_dint,
@@ -162,6 +179,7 @@ static const vf_info_t *const filter_list[] = {
     &vf_info_field,
     &vf_info_denoise3d,
     &vf_info_hqdn3d,
+    &vf_info_mctf,
     &vf_info_detc,
     &vf_info_telecine,
     &vf_info_tinterlace,
@@ -192,6 +210,7 @@ static const vf_info_t *const filter_list[] = {
 #endif
     &vf_info_yadif,
     &vf_info_blackframe,
+    &vf_info_stats,
     &vf_info_ow,
     &vf_info_fixpts,
     &vf_info_stereo3d,
@@ -355,8 +374,7 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
             if (mpi->flags & MP_IMGFLAG_ALLOCATED) {
                 if (mpi->width < w2 || mpi->height < h) {
                     // need to re-allocate buffer memory:
-                    av_free(mpi->planes[0]);
-                    mpi->flags &= ~MP_IMGFLAG_ALLOCATED;
+                    mp_image_free_planes(mpi);
                     mp_msg(MSGT_VFILTER, MSGL_V,
                            "vf.c: have to REALLOCATE buffer memory :(\n");
                 }
@@ -370,6 +388,9 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
         }
         if (!mpi->bpp)
             mp_image_setfmt(mpi, outfmt);
+        // a filter may still hold a reference to the previous contents;
+        // static images are only partially updated and need them kept
+        mp_image_make_writable(mpi, mpi->type == MP_IMGTYPE_STATIC);
         if (!(mpi->flags & MP_IMGFLAG_ALLOCATED) &&
                 mpi->type > MP_IMGTYPE_EXPORT) {
             // check libvo first!
@@ -438,6 +459,7 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
             mpi->flags |= MP_IMGFLAG_TYPE_DISPLAYED;
         }
         mpi->qscale = NULL;
+        mpi->stats = NULL;
     }
     mpi->usage_count++;
     return mpi;
@@ -835,6 +857,135 @@ void vf_uninit_filter_chain(vf_instance_t *vf)
     }
 }
 
+//============================================================================
+
+/* Worker threads shared by all filters. The thread calling vf_run_jobs()
+ * takes part in the work and returns when all jobs are done, so filters
+ * keep their usual synchronous put_image(). The threads are started on first
+ * use and stay around until exit. */
+static struct vf_workers {
+    int num_threads;            // including the calling thread, 0 if unset
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // new jobs were queued
+    pthread_cond_t done;        // the last job of the batch finished
+    void (*fn)(void *ctx, int job);
+    void *ctx;
+    int num_jobs, next_job, jobs_done;
+#endif
+} vf_workers = {
+#ifdef HAVE_PTHREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+#endif
+};
+
+#ifdef HAVE_PTHREADS
+// Run queued jobs until there are none left. Called with the lock held.
+static void run_queued_jobs(struct vf_workers *w)
+{
+    while (w->next_job < w->num_jobs) {
+        int job = w->next_job++;
+        void (*fn)(void *ctx, int job) = w->fn;
+        void *ctx = w->ctx;
+        pthread_mutex_unlock(&w->lock);
+        fn(ctx, job);
+        pthread_mutex_lock(&w->lock);
+        if (++w->jobs_done == w->num_jobs)
+            pthread_cond_signal(&w->done);
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    struct vf_workers *w = arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        run_queued_jobs(w);
+        pthread_cond_wait(&w->wakeup, &w->lock);
+    }
+    return NULL;
+}
+#endif
+
+int vf_slice_threads(struct vf_instance *vf)
+{
+    struct vf_workers *w = &vf_workers;
+    if (w->num_threads)
+        return w->num_threads;
+    int threads = 1;
+#ifdef HAVE_PTHREADS
+    threads = vf->opts ? vf->opts->vf_threads : 1;
+    if (threads == 0)
+        threads = default_thread_count();
+    threads = av_clip(threads, 1, VF_MAX_SLICES);
+    for (int n = 1; n < threads; n++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_thread, w)) {
+            mp_msg(MSGT_VFILTER, MSGL_WARN, "[vf] Could not start worker "
+                   "thread, using %d threads.\n", n);
+            threads = n;
+            break;
+        }
+        pthread_detach(thread);
+    }
+    if (threads > 1)
+        mp_msg(MSGT_VFILTER, MSGL_V, "[vf] Using %d threads for filters.\n",
+               threads);
+#endif
+    w->num_threads = threads;
+    return threads;
+}
+
+void vf_run_jobs(struct vf_instance *vf, int num_jobs,
+                 void (*fn)(void *ctx, int job), void *ctx)
+{
+    if (num_jobs > 1 && vf_slice_threads(vf) > 1) {
+#ifdef HAVE_PTHREADS
+        struct vf_workers *w = &vf_workers;
+        pthread_mutex_lock(&w->lock);
+        w->fn = fn;
+        w->ctx = ctx;
+        w->num_jobs = num_jobs;
+        w->next_job = 0;
+        w->jobs_done = 0;
+        pthread_cond_broadcast(&w->wakeup);
+        run_queued_jobs(w);
+        while (w->jobs_done < w->num_jobs)
+            pthread_cond_wait(&w->done, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+        return;
+#endif
+    }
+    for (int n = 0; n < num_jobs; n++)
+        fn(ctx, n);
+}
+
+struct slice_batch {
+    void (*fn)(void *ctx, int index, int y0, int y1);
+    void *ctx;
+    int h, align, num_slices;
+};
+
+static void run_slice(void *ctx, int index)
+{
+    struct slice_batch *b = ctx;
+    int rows = (b->h + b->align - 1) / b->align;
+    int y0 = rows * index / b->num_slices * b->align;
+    int y1 = rows * (index + 1) / b->num_slices * b->align;
+    b->fn(b->ctx, index, y0, FFMIN(y1, b->h));
+}
+
+void vf_run_slices(struct vf_instance *vf, int h, int align,
+                   void (*fn)(void *ctx, int index, int y0, int y1), void *ctx)
+{
+    struct slice_batch b = {fn, ctx, h, FFMAX(align, 1)};
+    // keep bands large enough that the per-band setup doesn't dominate
+    b.num_slices = av_clip(h / VF_MIN_SLICE_ROWS, 1, vf_slice_threads(vf));
+    vf_run_jobs(vf, b.num_slices, run_slice, &b);
+}
+
 void vf_detc_init_pts_buf(struct vf_detc_pts_buf *p)
 {
     p->inpts_prev = MP_NOPTS_VALUE;
@@ -89,6 +89,23 @@ typedef struct vf_seteq {
     int value;
 } vf_equalizer_t;
 
+/* Luma statistics of one frame, computed by vf_stats. The filter attaches
+ * them to the images it outputs (mpi->stats), and returns the ones of the
+ * last frame for VFCTRL_GET_FRAME_STATS. */
+struct vf_frame_stats {
+    int frame;                  // number of the frame since config
+    int w, h;
+    unsigned int hist[256];     // luma histogram
+    int min, max;
+    double avg;
+    double black;               // fraction of pixels below the black threshold
+    double mafd;                // mean absolute difference to the previous frame
+    double scene;               // scene change score, 0-1
+    int crop_x, crop_y, crop_w, crop_h; // area inside the dark borders
+    // sum of the luma of each row/column; valid until the next frame
+    const unsigned int *row_sum, *col_sum;
+};
+
 struct vf_ctrl_screenshot {
     // When the screenshot is complete, pass it to this callback.
     void (*image_callback)(void *, mp_image_t *);
@@ -114,6 +131,7 @@ struct vf_ctrl_screenshot {
 #define VFCTRL_SET_OSD_OBJ 20
 #define VFCTRL_SET_YUV_COLORSPACE 22 // arg is struct mp_csp_details*
 #define VFCTRL_GET_YUV_COLORSPACE 23 // arg is struct mp_csp_details*
+#define VFCTRL_GET_FRAME_STATS 24 // arg is struct vf_frame_stats*
 
 // functions:
 void vf_mpi_clear(mp_image_t *mpi, int x0, int y0, int w, int h);
@@ -148,6 +166,23 @@ int vf_next_put_image(struct vf_instance *vf, mp_image_t *mpi, double pts);
 void vf_next_draw_slice(struct vf_instance *vf, unsigned char **src,
                         int *stride, int w, int h, int x, int y);
 
+/* Slice threading: vf_run_slices() splits the rows [0, h) into at most
+ * vf_slice_threads() horizontal bands, with boundaries at multiples of
+ * align, and calls fn(ctx, index, y0, y1) for each band. The calls may run
+ * in parallel on worker threads; the function returns when all bands are
+ * done. fn must only write rows [y0, y1) of its output, but may read any
+ * rows of its input, e.g. the neighbours needed by a kernel. index is
+ * unique among the bands of one call and can be used to select per-band
+ * scratch buffers. vf_run_jobs() is the same for num_jobs independent jobs,
+ * e.g. one per plane. Neither must be called from inside fn. */
+#define VF_MAX_SLICES 16
+#define VF_MIN_SLICE_ROWS 16
+int vf_slice_threads(struct vf_instance *vf);
+void vf_run_slices(struct vf_instance *vf, int h, int align,
+                   void (*fn)(void *ctx, int index, int y0, int y1), void *ctx);
+void vf_run_jobs(struct vf_instance *vf, int num_jobs,
+                 void (*fn)(void *ctx, int job), void *ctx);
+
 struct m_obj_settings;
 vf_instance_t *append_filters(vf_instance_t *last,
                               struct m_obj_settings *vf_settings);
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include "config.h"
 #include "mp_msg.h"
@@ -78,12 +79,19 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     int bamount = vf->priv->bamount;
     static const char *const picttypes[4] = { "unknown", "I", "P", "B" };
 
-    for (y=1; y<=h; y++) {
-	    for (x=0; x<w; x++)
-            nblack += yplane[x] < bthresh;
-	    pblack = nblack*100/(w*y);
-	    if (pblack < bamount) break;
-        yplane += ystride;
+    if (mpi->stats) {
+        // vf_stats already has the histogram
+        for (x=0; x<bthresh && x<256; x++)
+            nblack += mpi->stats->hist[x];
+        pblack = (uint64_t)nblack*100/(w*h);
+    } else {
+        for (y=1; y<=h; y++) {
+            for (x=0; x<w; x++)
+                nblack += yplane[x] < bthresh;
+            pblack = nblack*100/(w*y);
+            if (pblack < bamount) break;
+            yplane += ystride;
+        }
     }
 
     if (pict_type > 3 || pict_type < 0) pict_type = 0;
@@ -106,6 +114,7 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     dmpi->stride[2] = mpi->stride[2];
 
     vf_clone_mpi_attributes(dmpi, mpi);
+    dmpi->stats = mpi->stats;
 
     return vf_next_put_image(vf, dmpi, pts);
 }
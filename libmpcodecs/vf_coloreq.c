@@ -0,0 +1,388 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Combined software equalizer: brightness, contrast and gamma of eq2 and
+ * hue and saturation of hue in one pass over the image.
+ * Luma goes through a single lookup table; if there is no gamma, the table
+ * is affine and computed with SIMD arithmetic instead (same result).
+ * Chroma is rotated and scaled with a 2x2 matrix on (U, V).
+ * Planes that are left unchanged are passed on without copying.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <libavutil/common.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "cpudetect.h"
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+// fractional bits of the chroma matrix
+#define CHROMA_BITS 11
+
+struct vf_priv_s {
+    double gamma, contrast, brightness, saturation, hue; // hue in radians
+    int dirty;              // parameters changed since the tables were made
+    int luma, chroma;       // planes that need processing
+    uint8_t lut[256];
+    // if affine, lut[y] = clip((((y << 6) * ymul + (1 << 14) >> 15) + yadd) >> 3)
+    int affine;
+    int16_t ymul, yadd;
+    // pairs of int16 (cos, -sin) and (sin, cos), times saturation
+    int32_t umat, vmat;
+    int32_t cround;
+    mp_image_t *buf;
+    void (*luma_row)(uint8_t *dst, const uint8_t *src, int w,
+                     const struct vf_priv_s *p);
+    void (*chroma_row)(uint8_t *udst, uint8_t *vdst, const uint8_t *usrc,
+                       const uint8_t *vsrc, int w, const struct vf_priv_s *p);
+};
+
+static void luma_row_c(uint8_t *dst, const uint8_t *src, int w,
+                       const struct vf_priv_s *p)
+{
+    int x;
+    for (x = 0; x < w; x++)
+        dst[x] = p->lut[src[x]];
+}
+
+static void chroma_from(uint8_t *udst, uint8_t *vdst, const uint8_t *usrc,
+                        const uint8_t *vsrc, int x, int w,
+                        const struct vf_priv_s *p)
+{
+    int cu = (int16_t)p->umat, su = p->umat >> 16;
+    int sv = (int16_t)p->vmat, cv = p->vmat >> 16;
+    for (; x < w; x++) {
+        int u = usrc[x] - 128, v = vsrc[x] - 128;
+        udst[x] = av_clip_uint8((cu * u + su * v + p->cround) >> CHROMA_BITS);
+        vdst[x] = av_clip_uint8((sv * u + cv * v + p->cround) >> CHROMA_BITS);
+    }
+}
+
+static void chroma_row_c(uint8_t *udst, uint8_t *vdst, const uint8_t *usrc,
+                         const uint8_t *vsrc, int w, const struct vf_priv_s *p)
+{
+    chroma_from(udst, vdst, usrc, vsrc, 0, w, p);
+}
+
+#if HAVE_AVX2 && ARCH_X86_64
+static const int16_t pw_128 = 128;
+
+// 32 pixels per iteration; the unpacking interleaves lanes, vpermq fixes it
+static void luma_row_avx2(uint8_t *dst, const uint8_t *src, int w,
+                          const struct vf_priv_s *p)
+{
+    x86_reg x = -(x86_reg)(w & ~31);
+    if (x) {
+        __asm__ volatile(
+            "vpbroadcastw %[mul], %%ymm4     \n"
+            "vpbroadcastw %[add], %%ymm5     \n"
+            "1:                              \n"
+            "vpmovzxbw   (%[src],%[x]), %%ymm0 \n"
+            "vpmovzxbw 16(%[src],%[x]), %%ymm1 \n"
+            "vpsllw    $6, %%ymm0, %%ymm0    \n"
+            "vpsllw    $6, %%ymm1, %%ymm1    \n"
+            "vpmulhrsw %%ymm4, %%ymm0, %%ymm0 \n"
+            "vpmulhrsw %%ymm4, %%ymm1, %%ymm1 \n"
+            "vpaddw    %%ymm5, %%ymm0, %%ymm0 \n"
+            "vpaddw    %%ymm5, %%ymm1, %%ymm1 \n"
+            "vpsraw    $3, %%ymm0, %%ymm0    \n"
+            "vpsraw    $3, %%ymm1, %%ymm1    \n"
+            "vpackuswb %%ymm1, %%ymm0, %%ymm0 \n"
+            "vpermq    $0xD8, %%ymm0, %%ymm0 \n"
+            "vmovdqu   %%ymm0, (%[dst],%[x]) \n"
+            "add       $32, %[x]             \n"
+            "jnz 1b                          \n"
+            "vzeroupper                      \n"
+            :[x]"+r"(x)
+            :[src]"r"(src + (w & ~31)), [dst]"r"(dst + (w & ~31)),
+             [mul]"m"(p->ymul), [add]"m"(p->yadd)
+            :"memory", "xmm0", "xmm1", "xmm4", "xmm5"
+        );
+    }
+    for (x = w & ~31; x < w; x++)
+        dst[x] = p->lut[src[x]];
+}
+
+/* 16 pixels per iteration: interleave centered U and V words, so that
+ * vpmaddwd with a coefficient pair gives one output component per dword. */
+static void chroma_row_avx2(uint8_t *udst, uint8_t *vdst, const uint8_t *usrc,
+                            const uint8_t *vsrc, int w,
+                            const struct vf_priv_s *p)
+{
+    x86_reg x;
+    for (x = 0; x < (w & ~15); x += 16) {
+        __asm__ volatile(
+            "vpbroadcastw %[c128], %%ymm7      \n"
+            "vpmovzxbw (%[us],%[x]), %%ymm0    \n"
+            "vpmovzxbw (%[vs],%[x]), %%ymm1    \n"
+            "vpsubw    %%ymm7, %%ymm0, %%ymm0  \n"
+            "vpsubw    %%ymm7, %%ymm1, %%ymm1  \n"
+            "vpunpcklwd %%ymm1, %%ymm0, %%ymm2 \n"
+            "vpunpckhwd %%ymm1, %%ymm0, %%ymm3 \n"
+            "vpbroadcastd %[umat], %%ymm4      \n"
+            "vpbroadcastd %[vmat], %%ymm5      \n"
+            "vpbroadcastd %[round], %%ymm6     \n"
+            "vpmaddwd  %%ymm4, %%ymm2, %%ymm0  \n"
+            "vpmaddwd  %%ymm4, %%ymm3, %%ymm1  \n"
+            "vpmaddwd  %%ymm5, %%ymm2, %%ymm2  \n"
+            "vpmaddwd  %%ymm5, %%ymm3, %%ymm3  \n"
+            "vpaddd    %%ymm6, %%ymm0, %%ymm0  \n"
+            "vpaddd    %%ymm6, %%ymm1, %%ymm1  \n"
+            "vpaddd    %%ymm6, %%ymm2, %%ymm2  \n"
+            "vpaddd    %%ymm6, %%ymm3, %%ymm3  \n"
+            "vpsrad    $11, %%ymm0, %%ymm0 \n" // CHROMA_BITS
+            "vpsrad    $11, %%ymm1, %%ymm1 \n"
+            "vpsrad    $11, %%ymm2, %%ymm2 \n"
+            "vpsrad    $11, %%ymm3, %%ymm3 \n"
+            "vpackssdw %%ymm1, %%ymm0, %%ymm0  \n"
+            "vpackssdw %%ymm3, %%ymm2, %%ymm2  \n"
+            "vpackuswb %%ymm2, %%ymm0, %%ymm0  \n"
+            "vpermq    $0xD8, %%ymm0, %%ymm0   \n"
+            "vmovdqu   %%xmm0, (%[ud],%[x])    \n"
+            "vextracti128 $1, %%ymm0, (%[vd],%[x]) \n"
+            :
+            :[us]"r"(usrc), [vs]"r"(vsrc), [ud]"r"(udst), [vd]"r"(vdst),
+             [x]"r"(x), [umat]"m"(p->umat), [vmat]"m"(p->vmat),
+             [round]"m"(p->cround), [c128]"m"(pw_128)
+            :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+             "xmm6", "xmm7"
+        );
+    }
+    __asm__ volatile ("vzeroupper\n\t");
+
+    chroma_from(udst, vdst, usrc, vsrc, x, w, p);
+}
+#endif // HAVE_AVX2 && ARCH_X86_64
+
+// Rebuild the tables after a parameter change.
+static void update(struct vf_priv_s *p)
+{
+    double c = av_clipf(p->contrast, -8.0, 7.99);
+    double b = av_clipf(p->brightness, -1.0, 1.0);
+    double g = av_clipf(p->gamma, 0.1, 10.0);
+    double s = av_clipf(p->saturation, -8.0, 8.0);
+    int cs = lrint(cos(p->hue) * s * (1 << CHROMA_BITS));
+    int sn = lrint(sin(p->hue) * s * (1 << CHROMA_BITS));
+    int i;
+
+    p->affine = g == 1.0;
+    p->ymul = lrint(c * 4096);
+    p->yadd = lrint(((1.0 - c) * 0.5 + b) * 255 * 8) + 4;
+    p->luma = 0;
+    for (i = 0; i < 256; i++) {
+        if (p->affine) {
+            int t = ((i << 6) * p->ymul + (1 << 14)) >> 15;
+            p->lut[i] = av_clip_uint8((t + p->yadd) >> 3);
+        } else {
+            double v = c * (i / 255.0 - 0.5) + 0.5 + b;
+            p->lut[i] = v <= 0 ? 0 : av_clip_uint8(lrint(255 * pow(v, 1 / g)));
+        }
+        p->luma |= p->lut[i] != i;
+    }
+
+    p->umat = (uint16_t)cs | (uint32_t)(uint16_t)-sn << 16;
+    p->vmat = (uint16_t)sn | (uint32_t)(uint16_t)cs << 16;
+    p->cround = (128 << CHROMA_BITS) + (1 << (CHROMA_BITS - 1));
+    p->chroma = cs != 1 << CHROMA_BITS || sn;
+
+    p->luma_row = luma_row_c;
+    p->chroma_row = chroma_row_c;
+#if HAVE_AVX2 && ARCH_X86_64
+    if (gCpuCaps.hasAVX2) {
+        if (p->affine)
+            p->luma_row = luma_row_avx2;
+        p->chroma_row = chroma_row_avx2;
+    }
+#endif
+    p->dirty = 0;
+
+    mp_msg(MSGT_VFILTER, MSGL_V, "coloreq: g=%.2f c=%.2f b=%.2f s=%.2f h=%.1f\n",
+           g, c, b, s, p->hue * 180 / M_PI);
+}
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void coloreq_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    int y;
+
+    if (p->luma)
+        for (y = y0; y < y1; y++)
+            p->luma_row(dmpi->planes[0] + y * dmpi->stride[0],
+                        mpi->planes[0] + y * mpi->stride[0], mpi->w, p);
+    if (p->chroma && mpi->num_planes > 1) {
+        int ys = mpi->chroma_y_shift;
+        int c0 = y0 >> ys, c1 = FFMIN((y1 + (1 << ys) - 1) >> ys, mpi->chroma_height);
+        for (y = c0; y < c1; y++)
+            p->chroma_row(dmpi->planes[1] + y * dmpi->stride[1],
+                          dmpi->planes[2] + y * dmpi->stride[2],
+                          mpi->planes[1] + y * mpi->stride[1],
+                          mpi->planes[2] + y * mpi->stride[2],
+                          mpi->chroma_width, p);
+    }
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct vf_priv_s *p = vf->priv;
+    mp_image_t *dmpi;
+    struct slice_job job;
+    int i;
+
+    if (p->dirty)
+        update(p);
+
+    dmpi = vf_get_image(vf->next, mpi->imgfmt, MP_IMGTYPE_EXPORT, 0,
+                        mpi->w, mpi->h);
+    for (i = 0; i < 3; i++) {
+        dmpi->planes[i] = mpi->planes[i];
+        dmpi->stride[i] = mpi->stride[i];
+    }
+    if (!p->luma && (!p->chroma || mpi->num_planes == 1))
+        return vf_next_put_image(vf, dmpi, pts);
+
+    if (p->buf && (p->buf->w != mpi->w || p->buf->h != mpi->h ||
+                   p->buf->imgfmt != mpi->imgfmt)) {
+        free_mp_image(p->buf);
+        p->buf = NULL;
+    }
+    if (!p->buf)
+        p->buf = alloc_mpi(mpi->w, mpi->h, mpi->imgfmt);
+    for (i = 0; i < 3; i++) {
+        if (i ? p->chroma && mpi->num_planes > 1 : p->luma) {
+            dmpi->planes[i] = p->buf->planes[i];
+            dmpi->stride[i] = p->buf->stride[i];
+        }
+    }
+
+    job = (struct slice_job){ p, mpi, dmpi };
+    vf_run_slices(vf, mpi->h, mpi->num_planes > 1 ? 1 << mpi->chroma_y_shift : 1,
+                  coloreq_slice, &job);
+
+    return vf_next_put_image(vf, dmpi, pts);
+}
+
+static int control(struct vf_instance *vf, int request, void *data)
+{
+    struct vf_priv_s *p = vf->priv;
+    vf_equalizer_t *eq = data;
+
+    switch (request) {
+    case VFCTRL_SET_EQUALIZER:
+        if (!strcmp(eq->item, "gamma"))
+            p->gamma = exp(log(8.0) * eq->value / 100.0);
+        else if (!strcmp(eq->item, "contrast"))
+            p->contrast = (eq->value + 100) / 100.0;
+        else if (!strcmp(eq->item, "brightness"))
+            p->brightness = eq->value / 100.0;
+        else if (!strcmp(eq->item, "saturation"))
+            p->saturation = (eq->value + 100) / 100.0;
+        else if (!strcmp(eq->item, "hue"))
+            p->hue = eq->value * M_PI / 100;
+        else
+            break;
+        p->dirty = 1;
+        return CONTROL_TRUE;
+    case VFCTRL_GET_EQUALIZER:
+        if (!strcmp(eq->item, "gamma"))
+            eq->value = lrint(100.0 * log(p->gamma) / log(8.0));
+        else if (!strcmp(eq->item, "contrast"))
+            eq->value = lrint(100.0 * p->contrast) - 100;
+        else if (!strcmp(eq->item, "brightness"))
+            eq->value = lrint(100.0 * p->brightness);
+        else if (!strcmp(eq->item, "saturation"))
+            eq->value = lrint(100.0 * p->saturation) - 100;
+        else if (!strcmp(eq->item, "hue"))
+            eq->value = lrint(p->hue * 100 / M_PI);
+        else
+            break;
+        return CONTROL_TRUE;
+    }
+    return vf_next_control(vf, request, data);
+}
+
+static int query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    switch (fmt) {
+    case IMGFMT_YVU9:
+    case IMGFMT_IF09:
+    case IMGFMT_YV12:
+    case IMGFMT_I420:
+    case IMGFMT_IYUV:
+    case IMGFMT_Y800:
+    case IMGFMT_Y8:
+    case IMGFMT_444P:
+    case IMGFMT_422P:
+    case IMGFMT_411P:
+        return vf_next_query_format(vf, fmt);
+    }
+    return 0;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    if (vf->priv->buf)
+        free_mp_image(vf->priv->buf);
+    free(vf->priv);
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p;
+
+    vf->control = control;
+    vf->query_format = query_format;
+    vf->put_image = put_image;
+    vf->uninit = uninit;
+    vf->priv = p = calloc(1, sizeof(struct vf_priv_s));
+    if (!p)
+        return 0;
+
+    p->gamma = p->contrast = p->saturation = 1.0;
+    if (args)
+        sscanf(args, "%lf:%lf:%lf:%lf:%lf", &p->gamma, &p->contrast,
+               &p->brightness, &p->saturation, &p->hue);
+    p->hue *= M_PI / 180.0;
+    update(p);
+    return 1;
+}
+
+const vf_info_t vf_info_coloreq = {
+    "combined software equalizer",
+    "coloreq",
+    "",
+    "",
+    vf_open,
+    NULL
+};
@@ -58,6 +58,19 @@ static int checkline(unsigned char* src,int stride,int len,int bpp){
     return total;
 }
 
+// averages from vf_stats if it runs before this filter
+static int row_avg(mp_image_t *mpi, int bpp, int y){
+    if(mpi->stats)
+	return mpi->stats->row_sum[y]/mpi->w;
+    return checkline(mpi->planes[0]+mpi->stride[0]*y,bpp,mpi->w,bpp);
+}
+
+static int col_avg(mp_image_t *mpi, int bpp, int x){
+    if(mpi->stats)
+	return mpi->stats->col_sum[x]/mpi->h;
+    return checkline(mpi->planes[0]+bpp*x,mpi->stride[0],mpi->h,bpp);
+}
+
 //===========================================================================//
 
 static int config(struct vf_instance *vf,
@@ -89,6 +102,7 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     dmpi->stride[2]=mpi->stride[2];
     dmpi->width=mpi->width;
     dmpi->height=mpi->height;
+    dmpi->stats=mpi->stats;
 
 if(++vf->priv->fno>0){	// ignore first 2 frames - they may be empty
 
@@ -102,28 +116,28 @@ if(++vf->priv->fno>0){	// ignore first 2 frames - they may be empty
     }
 
     for(y=0;y<vf->priv->y1;y++){
-	if(checkline(mpi->planes[0]+mpi->stride[0]*y,bpp,mpi->w,bpp)>vf->priv->limit){
+	if(row_avg(mpi,bpp,y)>vf->priv->limit){
 	    vf->priv->y1=y;
 	    break;
 	}
     }
 
     for(y=mpi->h-1;y>vf->priv->y2;y--){
-	if(checkline(mpi->planes[0]+mpi->stride[0]*y,bpp,mpi->w,bpp)>vf->priv->limit){
+	if(row_avg(mpi,bpp,y)>vf->priv->limit){
 	    vf->priv->y2=y;
 	    break;
 	}
     }
 
     for(y=0;y<vf->priv->x1;y++){
-	if(checkline(mpi->planes[0]+bpp*y,mpi->stride[0],mpi->h,bpp)>vf->priv->limit){
+	if(col_avg(mpi,bpp,y)>vf->priv->limit){
 	    vf->priv->x1=y;
 	    break;
 	}
     }
 
     for(y=mpi->w-1;y>vf->priv->x2;y--){
-	if(checkline(mpi->planes[0]+bpp*y,mpi->stride[0],mpi->h,bpp)>vf->priv->limit){
+	if(col_avg(mpi,bpp,y)>vf->priv->limit){
 	    vf->priv->x2=y;
 	    break;
 	}
@@ -35,6 +35,8 @@ struct vf_priv_s {
 	int hi, lo;
 	float frac;
 	int max, last, cnt;
+	mp_image_t *ref; // last frame passed on, if it was from the image pool
+	int in_static;   // last frame passed on was copied to a static image
 };
 
 #if HAVE_MMX && HAVE_EBX_AVAILABLE
@@ -130,26 +132,47 @@ static int diff_to_drop(int hi, int lo, float frac, mp_image_t *old, mp_image_t
 
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
 {
-	mp_image_t *dmpi;
-
-	dmpi = vf_get_image(vf->next, mpi->imgfmt,
-		MP_IMGTYPE_STATIC, MP_IMGFLAG_ACCEPT_STRIDE |
-		MP_IMGFLAG_PRESERVE | MP_IMGFLAG_READABLE,
-		mpi->width, mpi->height);
-	dmpi->qscale = mpi->qscale;
-	dmpi->qstride = mpi->qstride;
-	dmpi->qscale_type = mpi->qscale_type;
-
-	if (diff_to_drop(vf->priv->hi, vf->priv->lo, vf->priv->frac, dmpi, mpi)) {
-		if (vf->priv->max == 0)
+	struct vf_priv_s *p = vf->priv;
+	// Frames from the image pool are kept by reference to compare the next
+	// frames against. Decoder (EXPORT) and VO memory can be reused behind
+	// our back, so those are copied to a static image of the next filter,
+	// which is passed on and compared against instead.
+	int pooled = (mpi->flags & MP_IMGFLAG_ALLOCATED) &&
+		!(mpi->flags & MP_IMGFLAG_RGB_PALETTE);
+	mp_image_t *dmpi = NULL, *old = p->ref;
+
+	if (!pooled) {
+		dmpi = vf_get_image(vf->next, mpi->imgfmt,
+			MP_IMGTYPE_STATIC, MP_IMGFLAG_ACCEPT_STRIDE |
+			MP_IMGFLAG_PRESERVE | MP_IMGFLAG_READABLE,
+			mpi->width, mpi->height);
+		dmpi->qscale = mpi->qscale;
+		dmpi->qstride = mpi->qstride;
+		dmpi->qscale_type = mpi->qscale_type;
+		if (p->in_static)
+			old = dmpi;
+	}
+
+	if (old && old->imgfmt == mpi->imgfmt && old->w == mpi->w
+		&& old->h == mpi->h
+		&& diff_to_drop(p->hi, p->lo, p->frac, old, mpi)) {
+		if (p->max == 0)
 			return 0;
-		else if ((vf->priv->max > 0) && (vf->priv->cnt++ < vf->priv->max))
+		else if ((p->max > 0) && (p->cnt++ < p->max))
 			return 0;
-		else if ((vf->priv->max < 0) && (vf->priv->last+1 >= -vf->priv->max))
-			return vf->priv->last=0;
+		else if ((p->max < 0) && (p->last+1 >= -p->max))
+			return p->last=0;
+	}
+	p->last++;
+	p->cnt=0;
+
+	free_mp_image(p->ref);
+	p->ref = NULL;
+	p->in_static = !pooled;
+	if (pooled) {
+		p->ref = mp_image_new_ref(mpi);
+		return vf_next_put_image(vf, mpi, pts);
 	}
-	vf->priv->last++;
-	vf->priv->cnt=0;
 
 	memcpy_pic(dmpi->planes[0], mpi->planes[0], mpi->w, mpi->h,
 		dmpi->stride[0], mpi->stride[0]);
@@ -166,6 +189,7 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
 
 static void uninit(struct vf_instance *vf)
 {
+	free_mp_image(vf->priv->ref);
 	free(vf->priv);
 }
 
@@ -24,6 +24,8 @@
 #include <inttypes.h>
 #include <math.h>
 
+#include <libavutil/common.h>
+
 #include "mp_msg.h"
 #include "img_format.h"
 #include "mp_image.h"
@@ -33,11 +35,15 @@
 #define PARAM2_DEFAULT 3.0
 #define PARAM3_DEFAULT 6.0
 
+// lines filtered together by the horizontal pass
+#define HLINES 4
+
 //===========================================================================//
 
 struct vf_priv_s {
         int Coefs[4][512];
-        unsigned char *Line;
+        unsigned char *Line[3];
+        unsigned char *LineCur[3];
 	mp_image_t *pmpi;
 };
 
@@ -49,8 +55,14 @@ static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
 
-	free(vf->priv->Line);
-        vf->priv->Line = malloc(width);
+	// one line buffer per plane, so that the planes can be filtered in
+	// parallel
+	for (int i = 0; i < 3; i++) {
+		free(vf->priv->Line[i]);
+		free(vf->priv->LineCur[i]);
+		vf->priv->Line[i]    = malloc(width);
+		vf->priv->LineCur[i] = malloc(HLINES*width);
+	}
 	vf->priv->pmpi=NULL;
 //        vf->default_caps &= !VFCAP_ACCEPT_STRIDE;
 
@@ -60,20 +72,79 @@ static int config(struct vf_instance *vf,
 
 static void uninit(struct vf_instance *vf)
 {
-    free(vf->priv->Line);
+    for (int i = 0; i < 3; i++) {
+        free(vf->priv->Line[i]);
+        free(vf->priv->LineCur[i]);
+    }
 }
 
 #define LowPass(Prev, Curr, Coef) (Curr + Coef[Prev - Curr])
 
+static void lineVerticalTemporal(const unsigned char *LineCur,
+                                 unsigned char *LineAnt,
+                                 const unsigned char *LinePrev,
+                                 unsigned char *Dest, int W,
+                                 int *Vertical, int *Temporal)
+{
+    int X;
+
+    for (X = 0; X < W; X++)
+    {
+        LineAnt[X] = LowPass(LineAnt[X], LineCur[X], Vertical);
+        Dest[X] = LowPass(LinePrev[X], LineAnt[X], Temporal);
+    }
+}
+
+/* Horizontal pass of Lines (at most HLINES) lines into LineCur, one line
+ * of W bytes after the other. The lines are independent, so filtering
+ * four of them interleaved hides the latency of the LowPass chain. */
+static void deNoiseHorizontal(unsigned char *Frame, int sStride,
+                              unsigned char *LineCur, int W, int Lines,
+                              int *Horizontal)
+{
+    int X;
+
+    if (Lines == HLINES) {
+        unsigned char *F0 = Frame,      *F1 = Frame+sStride;
+        unsigned char *F2 = F1+sStride, *F3 = F2+sStride;
+        unsigned char *L0 = LineCur,    *L1 = LineCur+W;
+        unsigned char *L2 = L1+W,       *L3 = L2+W;
+        unsigned char P0, P1, P2, P3;
+
+        /* First pixel on each line doesn't have previous pixel */
+        P0 = L0[0] = F0[0];
+        P1 = L1[0] = F1[0];
+        P2 = L2[0] = F2[0];
+        P3 = L3[0] = F3[0];
+        for (X = 1; X < W; X++)
+        {
+            L0[X] = P0 = LowPass(P0, F0[X], Horizontal);
+            L1[X] = P1 = LowPass(P1, F1[X], Horizontal);
+            L2[X] = P2 = LowPass(P2, F2[X], Horizontal);
+            L3[X] = P3 = LowPass(P3, F3[X], Horizontal);
+        }
+        return;
+    }
+
+    for (; Lines > 0; Lines--)
+    {
+        unsigned char PixelAnt = LineCur[0] = Frame[0];
+        for (X = 1; X < W; X++)
+            PixelAnt = LineCur[X] = LowPass(PixelAnt, Frame[X], Horizontal);
+        Frame += sStride;
+        LineCur += W;
+    }
+}
+
 static void deNoise(unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FramePrev,    // pmpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned char *LineAnt,      // vf->priv->Line (width bytes)
+                    unsigned char *LineCur,      // vf->priv->LineCur
                     int W, int H, int sStride, int pStride, int dStride,
                     int *Horizontal, int *Vertical, int *Temporal)
 {
     int X, Y;
-    int sLineOffs = 0, pLineOffs = 0, dLineOffs = 0;
     unsigned char PixelAnt;
 
     /* First pixel has no left nor top neighbor. Only previous frame */
@@ -89,31 +160,44 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
         FrameDest[X] = LowPass(FramePrev[X], LineAnt[X], Temporal);
     }
 
-    for (Y = 1; Y < H; Y++)
+    for (Y = 1; Y < H; Y += HLINES)
     {
-	sLineOffs += sStride, pLineOffs += pStride, dLineOffs += dStride;
-        /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs];
-        LineAnt[0] = LowPass(LineAnt[0], PixelAnt, Vertical);
-        FrameDest[dLineOffs] = LowPass(FramePrev[pLineOffs], LineAnt[0], Temporal);
-
-        for (X = 1; X < W; X++)
-        {
-            /* The rest are normal */
-            PixelAnt = LowPass(PixelAnt, Frame[sLineOffs+X], Horizontal);
-            LineAnt[X] = LowPass(LineAnt[X], PixelAnt, Vertical);
-            FrameDest[dLineOffs+X] = LowPass(FramePrev[pLineOffs+X], LineAnt[X], Temporal);
-        }
+        int Lines = FFMIN(H-Y, HLINES);
+        deNoiseHorizontal(Frame+Y*sStride, sStride, LineCur, W, Lines,
+                          Horizontal);
+        for (int i = 0; i < Lines; i++)
+            lineVerticalTemporal(LineCur+i*W, LineAnt,
+                                 FramePrev+(Y+i)*pStride,
+                                 FrameDest+(Y+i)*dStride, W,
+                                 Vertical, Temporal);
     }
 }
 
 
 
-static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
-	int cw= mpi->w >> mpi->chroma_x_shift;
-	int ch= mpi->h >> mpi->chroma_y_shift;
-        int W = mpi->w, H = mpi->h;
+struct plane_job {
+	struct vf_priv_s *priv;
+	mp_image_t *mpi, *pmpi, *dmpi;
+};
 
+/* The filter is recursive in both directions, so it can't be split into
+ * bands without changing the output; filter the planes in parallel. */
+static void deNoisePlane(void *ctx, int p)
+{
+	struct plane_job *job = ctx;
+	mp_image_t *mpi = job->mpi;
+	int W = p ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+	int H = p ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+	int *Spac = job->priv->Coefs[p ? 2 : 0] + 256;
+	int *Tmp  = job->priv->Coefs[p ? 3 : 1] + 256;
+
+	deNoise(mpi->planes[p], job->pmpi->planes[p], job->dmpi->planes[p],
+		job->priv->Line[p], job->priv->LineCur[p], W, H,
+		mpi->stride[p], job->pmpi->stride[p], job->dmpi->stride[p],
+		Spac, Spac, Tmp);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
 		MP_IMGTYPE_IP, MP_IMGFLAG_ACCEPT_STRIDE |
 		MP_IMGFLAG_PRESERVE | MP_IMGFLAG_READABLE,
@@ -122,24 +206,8 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	if(!dmpi) return 0;
         if (!vf->priv->pmpi) vf->priv->pmpi=mpi;
 
-        deNoise(mpi->planes[0], vf->priv->pmpi->planes[0], dmpi->planes[0],
-		vf->priv->Line, W, H,
-                mpi->stride[0], vf->priv->pmpi->stride[0], dmpi->stride[0],
-                vf->priv->Coefs[0] + 256,
-                vf->priv->Coefs[0] + 256,
-                vf->priv->Coefs[1] + 256);
-        deNoise(mpi->planes[1], vf->priv->pmpi->planes[1], dmpi->planes[1],
-		vf->priv->Line, cw, ch,
-                mpi->stride[1], vf->priv->pmpi->stride[1], dmpi->stride[1],
-                vf->priv->Coefs[2] + 256,
-                vf->priv->Coefs[2] + 256,
-                vf->priv->Coefs[3] + 256);
-        deNoise(mpi->planes[2], vf->priv->pmpi->planes[2], dmpi->planes[2],
-		vf->priv->Line, cw, ch,
-                mpi->stride[2], vf->priv->pmpi->stride[2], dmpi->stride[2],
-                vf->priv->Coefs[2] + 256,
-                vf->priv->Coefs[2] + 256,
-                vf->priv->Coefs[3] + 256);
+	vf_run_jobs(vf, 3, deNoisePlane,
+		    &(struct plane_job){vf->priv, mpi, vf->priv->pmpi, dmpi});
 
 	vf->priv->pmpi=dmpi; // save reference image
 	return vf_next_put_image(vf,dmpi, pts);
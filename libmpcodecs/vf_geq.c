@@ -21,11 +21,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <inttypes.h>
 
 #include <libavutil/eval.h>
 #include <libavutil/common.h>
+#include <libavutil/mem.h>
 
 #include "config.h"
 
@@ -36,32 +38,427 @@
 #include "mp_image.h"
 #include "vf.h"
 
+
+#define GEQ_MAX_CODE  256
+#define GEQ_MAX_DEPTH 32
+#define GEQ_MAX_NEST  100
+
+static const char * const const_names[]={
+    "PI",
+    "E",
+    "X",
+    "Y",
+    "W",
+    "H",
+    "N",
+    "SW",
+    "SH",
+    NULL
+};
+
+enum { VAR_PI, VAR_E, VAR_X, VAR_Y, VAR_W, VAR_H, VAR_N, VAR_SW, VAR_SH, VAR_NB };
+
+static const char * const func2_names[]={
+    "lum",
+    "cb",
+    "cr",
+    "p",
+    NULL
+};
+
+/* The expressions are compiled a second time here, following the grammar
+ * and evaluation rules of libavutil/eval.c, into a stack bytecode whose
+ * instructions process a whole row at once. Everything not depending on X
+ * is computed once per row. av_expr_eval() is kept for the expressions the
+ * compiler does not handle (st, ld, while, random, ...). */
+enum geq_op {
+    OP_VALUE,
+    OP_CONST,
+    // one argument
+    OP_FUNC0,
+    OP_SQUISH,
+    OP_GAUSS,
+    OP_ISNAN,
+    OP_FLOOR,
+    OP_CEIL,
+    OP_TRUNC,
+    OP_SQRT,
+    OP_NOT,
+    // two arguments
+    OP_ADD,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    OP_MOD,
+    OP_MAX,
+    OP_MIN,
+    OP_EQ,
+    OP_GTE,
+    OP_GT,
+    OP_HYPOT,
+    OP_IF,
+    OP_LAST,
+    OP_PIX,
+};
+
+static double (* const func0[])(double)={
+    sinh, cosh, tanh, sin, cos, tan, atan, asin, acos, exp, log, fabs
+};
+
+static const struct {
+    const char *name;
+    int op, arg;
+} func_names[]={
+    { "sinh",   OP_FUNC0, 0 },
+    { "cosh",   OP_FUNC0, 1 },
+    { "tanh",   OP_FUNC0, 2 },
+    { "sin",    OP_FUNC0, 3 },
+    { "cos",    OP_FUNC0, 4 },
+    { "tan",    OP_FUNC0, 5 },
+    { "atan",   OP_FUNC0, 6 },
+    { "asin",   OP_FUNC0, 7 },
+    { "acos",   OP_FUNC0, 8 },
+    { "exp",    OP_FUNC0, 9 },
+    { "log",    OP_FUNC0, 10 },
+    { "abs",    OP_FUNC0, 11 },
+    { "squish", OP_SQUISH },
+    { "gauss",  OP_GAUSS },
+    { "isnan",  OP_ISNAN },
+    { "floor",  OP_FLOOR },
+    { "ceil",   OP_CEIL },
+    { "trunc",  OP_TRUNC },
+    { "sqrt",   OP_SQRT },
+    { "not",    OP_NOT },
+    { "mod",    OP_MOD },
+    { "max",    OP_MAX },
+    { "min",    OP_MIN },
+    { "eq",     OP_EQ },
+    { "gte",    OP_GTE },
+    { "gt",     OP_GT },
+    { "lte",    OP_GTE, 1 }, // arguments swapped
+    { "lt",     OP_GT,  1 },
+    { "pow",    OP_POW },
+    { "hypot",  OP_HYPOT },
+    { "if",     OP_IF },
+    { NULL }
+};
+
+struct geq_node {
+    int op, arg;
+    double value;               // constant, or sign applied to the result
+    struct geq_node *param[2];
+};
+
+struct geq_insn {
+    int op, arg;
+    double value;
+};
+
+struct geq_prog {
+    struct geq_insn code[GEQ_MAX_CODE];
+    int len, depth;
+};
+
+struct geq_parser {
+    const char *s;
+    int plane, nest;
+};
+
+// a stack slot holds either one value for the row or one per pixel
+struct geq_slot {
+    const double *v;
+    double s;
+};
+
 struct vf_priv_s {
     AVExpr * e[3];
+    struct geq_prog *prog[3];
+    int checked;    // frames compared with av_expr_eval() so far
     int framenum;
     mp_image_t *mpi;
+    double *xramp;
+    double *buf[VF_MAX_SLICES];
 };
 
-static int config(struct vf_instance *vf,
-        int width, int height, int d_width, int d_height,
-        unsigned int flags, unsigned int outfmt){
-    return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
+static void free_node(struct geq_node *n){
+    if (!n) return;
+    free_node(n->param[0]);
+    free_node(n->param[1]);
+    av_free(n);
 }
 
-static inline double getpix(struct vf_instance *vf, double x, double y, int plane){
+static struct geq_node *new_node(int op, double value,
+                                 struct geq_node *p0, struct geq_node *p1){
+    struct geq_node *n= av_mallocz(sizeof(*n));
+    if (!n) {
+        free_node(p0);
+        free_node(p1);
+        return NULL;
+    }
+    n->op= op;
+    n->value= value;
+    n->param[0]= p0;
+    n->param[1]= p1;
+    return n;
+}
+
+static int strmatch(const char *s, const char *name){
+    int i;
+    for (i=0; name[i]; i++)
+        if (name[i] != s[i]) return 0;
+    return !(isalnum((unsigned char)s[i]) || s[i] == '_');
+}
+
+static struct geq_node *parse_expr(struct geq_parser *p);
+
+static struct geq_node *parse_primary(struct geq_parser *p){
+    struct geq_node *d;
+    const char *name= p->s;
+    char *next;
+    double value;
+    int i;
+
+    value= av_strtod(p->s, &next);
+    if (next != p->s) {
+        p->s= next;
+        return new_node(OP_VALUE, value, NULL, NULL);
+    }
+
+    for (i=0; const_names[i]; i++) {
+        if (strmatch(p->s, const_names[i])) {
+            p->s+= strlen(const_names[i]);
+            d= new_node(OP_CONST, 1, NULL, NULL);
+            if (d) d->arg= i;
+            return d;
+        }
+    }
+
+    p->s= strchr(p->s, '(');
+    if (!p->s) return NULL;
+    p->s++;
+    if (*name == '(') {
+        d= parse_expr(p);
+        if (d && *p->s != ')') {
+            free_node(d);
+            return NULL;
+        }
+        p->s++;
+        return d;
+    }
+
+    d= new_node(OP_VALUE, 1, NULL, NULL);
+    if (!d || !(d->param[0]= parse_expr(p)))
+        goto fail;
+    if (*p->s == ',') {
+        p->s++;
+        if (!(d->param[1]= parse_expr(p)))
+            goto fail;
+    }
+    if (*p->s != ')')
+        goto fail;
+    p->s++;
+
+    for (i=0; func_names[i].name; i++) {
+        if (strmatch(name, func_names[i].name)) {
+            d->op= func_names[i].op;
+            if (d->op == OP_GTE || d->op == OP_GT) {
+                if (func_names[i].arg) {
+                    struct geq_node *tmp= d->param[0];
+                    d->param[0]= d->param[1];
+                    d->param[1]= tmp;
+                }
+            } else
+                d->arg= func_names[i].arg;
+            break;
+        }
+    }
+    if (!func_names[i].name) {
+        for (i=0; func2_names[i]; i++) {
+            if (strmatch(name, func2_names[i])) {
+                d->op= OP_PIX;
+                d->arg= i < 3 ? i : p->plane;
+                break;
+            }
+        }
+        if (!func2_names[i]) goto fail;
+    }
+
+    // same argument count checks as av_expr_parse()
+    if (d->op < OP_ADD ? !!d->param[1] : !d->param[1])
+        goto fail;
+    return d;
+fail:
+    free_node(d);
+    return NULL;
+}
+
+static struct geq_node *parse_pow(struct geq_parser *p, int *sign){
+    *sign= (*p->s == '+') - (*p->s == '-');
+    p->s+= *sign&1;
+    return parse_primary(p);
+}
+
+static struct geq_node *parse_dB(struct geq_parser *p, int *sign){
+    // "-3dB" is not the same as "-(3dB)"
+    if (*p->s == '-') {
+        char *next;
+        av_strtod(p->s, &next);
+        if (next != p->s && next[0] == 'd' && next[1] == 'B') {
+            *sign= 0;
+            return parse_primary(p);
+        }
+    }
+    return parse_pow(p, sign);
+}
+
+static struct geq_node *parse_factor(struct geq_parser *p){
+    struct geq_node *e0, *e1;
+    int sign, sign2;
+
+    if (!(e0= parse_dB(p, &sign)))
+        return NULL;
+    while (*p->s == '^') {
+        p->s++;
+        if (!(e1= parse_dB(p, &sign2))) {
+            free_node(e0);
+            return NULL;
+        }
+        e1->value*= sign2|1;
+        if (!(e0= new_node(OP_POW, 1, e0, e1)))
+            return NULL;
+    }
+    e0->value*= sign|1;
+    return e0;
+}
+
+static struct geq_node *parse_term(struct geq_parser *p){
+    struct geq_node *e0, *e1;
+
+    if (!(e0= parse_factor(p)))
+        return NULL;
+    while (*p->s == '*' || *p->s == '/') {
+        int op= *p->s++ == '*' ? OP_MUL : OP_DIV;
+        if (!(e1= parse_factor(p))) {
+            free_node(e0);
+            return NULL;
+        }
+        if (!(e0= new_node(op, 1, e0, e1)))
+            return NULL;
+    }
+    return e0;
+}
+
+static struct geq_node *parse_subexpr(struct geq_parser *p){
+    struct geq_node *e0, *e1;
+
+    if (!(e0= parse_term(p)))
+        return NULL;
+    while (*p->s == '+' || *p->s == '-') {
+        if (!(e1= parse_term(p))) {
+            free_node(e0);
+            return NULL;
+        }
+        if (!(e0= new_node(OP_ADD, 1, e0, e1)))
+            return NULL;
+    }
+    return e0;
+}
+
+static struct geq_node *parse_expr(struct geq_parser *p){
+    struct geq_node *e0, *e1;
+
+    if (p->nest >= GEQ_MAX_NEST)
+        return NULL;
+    p->nest++;
+    if (!(e0= parse_subexpr(p)))
+        return NULL;
+    while (*p->s == ';') {
+        p->s++;
+        if (!(e1= parse_subexpr(p))) {
+            free_node(e0);
+            return NULL;
+        }
+        if (!(e0= new_node(OP_LAST, 1, e0, e1)))
+            return NULL;
+    }
+    p->nest--;
+    return e0;
+}
+
+/* Emits the code for n, leaving its value in stack slot depth. Nothing
+ * the compiler accepts has side effects, so both operands of if() and ';'
+ * can simply be evaluated. */
+static int compile_node(struct geq_prog *prog, const struct geq_node *n, int depth){
+    int i;
+
+    if (n->op == OP_LAST) {
+        if (compile_node(prog, n->param[1], depth) < 0)
+            return -1;
+        prog->code[prog->len-1].value*= n->value;
+        return 0;
+    }
+    for (i=0; i<2 && n->param[i]; i++)
+        if (compile_node(prog, n->param[i], depth + i) < 0)
+            return -1;
+    prog->depth= FFMAX(prog->depth, depth + FFMAX(i, 1));
+    if (prog->depth > GEQ_MAX_DEPTH || prog->len >= GEQ_MAX_CODE)
+        return -1;
+    prog->code[prog->len++]= (struct geq_insn){ n->op, n->arg, n->value };
+    return 0;
+}
+
+static struct geq_prog *compile_expr(const char *expr, int plane){
+    struct geq_parser p= { .plane= plane };
+    struct geq_prog *prog= NULL;
+    struct geq_node *root;
+    char *s, *w;
+
+    // av_expr_parse() ignores all whitespace, too
+    if (!(w= s= av_malloc(strlen(expr) + 1)))
+        return NULL;
+    for (; *expr; expr++)
+        if (!isspace((unsigned char)*expr))
+            *w++= *expr;
+    *w= 0;
+
+    p.s= s;
+    root= parse_expr(&p);
+    if (root && !*p.s && (prog= av_mallocz(sizeof(*prog)))) {
+        if (compile_node(prog, root, 0) < 0)
+            av_freep(&prog);
+    }
+    free_node(root);
+    av_free(s);
+    return prog;
+}
+
+static inline double getpix_plane(const uint8_t *src, int stride, int w, int h,
+                                  double x, double y){
     int xi, yi;
-    mp_image_t *mpi= vf->priv->mpi;
-    int stride= mpi->stride[plane];
-    uint8_t *src=  mpi->planes[plane];
-    xi=x= FFMIN(FFMAX(x, 0), (mpi->w >> (plane ? mpi->chroma_x_shift : 0))-1);
-    yi=y= FFMIN(FFMAX(y, 0), (mpi->h >> (plane ? mpi->chroma_y_shift : 0))-1);
+    xi=x= FFMIN(FFMAX(x, 0), w-1);
+    yi=y= FFMIN(FFMAX(y, 0), h-1);
 
     x-=xi;
     y-=yi;
+    src+= xi + yi * stride;
 
+    // the terms with zero weight would add exactly 0, and at the right and
+    // bottom edge they would read past the plane
+    if (y == 0) {
+        if (x == 0)
+            return src[0];
+        return (1-x)*src[0] + x*src[1];
+    }
     return
-     (1-y)*((1-x)*src[xi +  yi    * stride] + x*src[xi + 1 +  yi    * stride])
-    +   y *((1-x)*src[xi + (yi+1) * stride] + x*src[xi + 1 + (yi+1) * stride]);
+     (1-y)*((1-x)*src[0     ] + x*src[1         ])
+    +   y *((1-x)*src[stride] + x*src[stride + 1]);
+}
+
+static inline double getpix(struct vf_instance *vf, double x, double y, int plane){
+    mp_image_t *mpi= vf->priv->mpi;
+    return getpix_plane(mpi->planes[plane], mpi->stride[plane],
+                        mpi->w >> (plane ? mpi->chroma_x_shift : 0),
+                        mpi->h >> (plane ? mpi->chroma_y_shift : 0), x, y);
 }
 
 //FIXME cubic interpolate
@@ -78,8 +475,268 @@ static double cr(void *vf, double x, double y){
     return getpix(vf, x, y, 2);
 }
 
+static void pix_row(double *dst, const struct geq_slot *xs, const struct geq_slot *ys,
+                    double m, const mp_image_t *mpi, int plane, int n,
+                    const double *xramp){
+    const uint8_t *src= mpi->planes[plane];
+    int stride= mpi->stride[plane];
+    int w= mpi->w >> (plane ? mpi->chroma_x_shift : 0);
+    int h= mpi->h >> (plane ? mpi->chroma_y_shift : 0);
+    int x;
+
+    if (!ys->v) {
+        double y= FFMIN(FFMAX(ys->s, 0), h-1);
+        // p(X,Y), lum(X,Y+1) etc.: a plain copy of one source row
+        if (xs->v == xramp && n <= w && y == (int)y) {
+            src+= (int)y * stride;
+            for (x=0; x<n; x++)
+                dst[x]= m * src[x];
+            return;
+        }
+        for (x=0; x<n; x++)
+            dst[x]= m * getpix_plane(src, stride, w, h, xs->v[x], y);
+    } else if (!xs->v) {
+        for (x=0; x<n; x++)
+            dst[x]= m * getpix_plane(src, stride, w, h, xs->s, ys->v[x]);
+    } else {
+        for (x=0; x<n; x++)
+            dst[x]= m * getpix_plane(src, stride, w, h, xs->v[x], ys->v[x]);
+    }
+}
+
+/* isnan() may be folded to 0 when building with -ffast-math, so look at
+ * the bits: all exponent bits set and a nonzero mantissa. */
+static int is_nan(double d){
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return (bits & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL &&
+           (bits & 0x000fffffffffffffULL);
+}
+
+#define OP1(EXPR) \
+    if (!a->v) { \
+        double da= a->s; \
+        a->s= m * (EXPR); \
+    } else { \
+        for (x=0; x<n; x++) { \
+            double da= a->v[x]; \
+            r[x]= m * (EXPR); \
+        } \
+        a->v= r; \
+    }
+
+#define OP2(EXPR) \
+    if (!a->v && !b->v) { \
+        double da= a->s, db= b->s; \
+        a->s= m * (EXPR); \
+    } else { \
+        if (!a->v) { \
+            double da= a->s; \
+            for (x=0; x<n; x++) { \
+                double db= b->v[x]; \
+                r[x]= m * (EXPR); \
+            } \
+        } else if (!b->v) { \
+            double db= b->s; \
+            for (x=0; x<n; x++) { \
+                double da= a->v[x]; \
+                r[x]= m * (EXPR); \
+            } \
+        } else { \
+            for (x=0; x<n; x++) { \
+                double da= a->v[x], db= b->v[x]; \
+                r[x]= m * (EXPR); \
+            } \
+        } \
+        a->v= r; \
+    }
+
+/* Evaluates prog for the n pixels of one row. buf holds prog->depth rows
+ * of scratch space; the result is returned in slot 0. */
+static void run_row(const struct geq_prog *prog, struct geq_slot *st, double *buf,
+                    const double *var, int n, const double *xramp,
+                    const mp_image_t *mpi){
+    const struct geq_insn *in;
+    int sp= 0, x;
+
+    for (in= prog->code; in < prog->code + prog->len; in++) {
+        double m= in->value;
+        struct geq_slot *a, *b;
+        double *r;
+
+        if (in->op == OP_VALUE) {
+            st[sp++]= (struct geq_slot){ NULL, m };
+            continue;
+        }
+        if (in->op == OP_CONST) {
+            if (in->arg != VAR_X)
+                st[sp]= (struct geq_slot){ NULL, m * var[in->arg] };
+            else if (m == 1)
+                st[sp]= (struct geq_slot){ xramp };
+            else {
+                r= buf + sp * n;
+                for (x=0; x<n; x++)
+                    r[x]= m * xramp[x];
+                st[sp]= (struct geq_slot){ r };
+            }
+            sp++;
+            continue;
+        }
+        if (in->op >= OP_ADD)
+            sp--;
+        a= &st[sp-1];
+        b= &st[sp];
+        r= buf + (sp-1) * n;
+
+        switch (in->op) {
+        case OP_FUNC0:  OP1(func0[in->arg](da)); break;
+        case OP_SQUISH: OP1(1/(1+exp(4*da))); break;
+        case OP_GAUSS:  OP1(exp(-da*da/2)/sqrt(2*M_PI)); break;
+        case OP_ISNAN:  OP1(is_nan(da)); break;
+        case OP_FLOOR:  OP1(floor(da)); break;
+        case OP_CEIL:   OP1(ceil(da)); break;
+        case OP_TRUNC:  OP1(trunc(da)); break;
+        case OP_SQRT:   OP1(sqrt(da)); break;
+        case OP_NOT:    OP1(da == 0); break;
+        case OP_ADD:    OP2(da + db); break;
+        case OP_MUL:    OP2(da * db); break;
+        case OP_DIV:    OP2(da / db); break;
+        case OP_POW:    OP2(pow(da, db)); break;
+        case OP_MOD:    OP2(da - floor(da/db)*db); break;
+        case OP_MAX:    OP2(da > db ? da : db); break;
+        case OP_MIN:    OP2(da < db ? da : db); break;
+        case OP_EQ:     OP2(da == db ? 1.0 : 0.0); break;
+        case OP_GTE:    OP2(da >= db ? 1.0 : 0.0); break;
+        case OP_GT:     OP2(da >  db ? 1.0 : 0.0); break;
+        case OP_HYPOT:  OP2(hypot(da, db)); break;
+        case OP_IF:     OP2(da ? db : 0); break;
+        case OP_PIX:
+            if (!a->v && !b->v) {
+                a->s= m * getpix_plane(mpi->planes[in->arg], mpi->stride[in->arg],
+                                       mpi->w >> (in->arg ? mpi->chroma_x_shift : 0),
+                                       mpi->h >> (in->arg ? mpi->chroma_y_shift : 0),
+                                       a->s, b->s);
+            } else {
+                pix_row(r, a, b, m, mpi, in->arg, n, xramp);
+                a->v= r;
+            }
+            break;
+        }
+    }
+}
+
+static void store_row(uint8_t *dst, const struct geq_slot *res, int n){
+    int x;
+    if (!res->v)
+        memset(dst, (uint8_t)res->s, n);
+    else
+        for (x=0; x<n; x++)
+            dst[x]= res->v[x];
+}
+
+static void set_vars(double *var, const mp_image_t *mpi, int plane, int framenum){
+    int w= mpi->w >> (plane ? mpi->chroma_x_shift : 0);
+    int h= mpi->h >> (plane ? mpi->chroma_y_shift : 0);
+    var[VAR_PI]= M_PI;
+    var[VAR_E]=  M_E;
+    var[VAR_X]=  0;
+    var[VAR_Y]=  0;
+    var[VAR_W]=  w;
+    var[VAR_H]=  h;
+    var[VAR_N]=  framenum;
+    var[VAR_SW]= w/(double)mpi->w;
+    var[VAR_SH]= h/(double)mpi->h;
+}
+
+static int config(struct vf_instance *vf,
+        int width, int height, int d_width, int d_height,
+        unsigned int flags, unsigned int outfmt){
+    int i;
+
+    for (i=0; i<VF_MAX_SLICES; i++)
+        av_freep(&vf->priv->buf[i]);
+    av_freep(&vf->priv->xramp);
+
+    vf->priv->xramp= av_malloc(width * sizeof(double));
+    if (!vf->priv->xramp)
+        return 0;
+    for (i=0; i<width; i++)
+        vf->priv->xramp[i]= i;
+    for (i=0; i<vf_slice_threads(vf); i++) {
+        vf->priv->buf[i]= av_malloc(GEQ_MAX_DEPTH * width * sizeof(double));
+        if (!vf->priv->buf[i])
+            return 0;
+    }
+
+    return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
+}
+
+#define CHECK_FRAMES 3
+#define CHECK_ROWS 5
+
+/* The compiler duplicates the libavutil parser, whose details differ
+ * between versions (e.g. how function names are matched), so on the first
+ * CHECK_FRAMES frames some rows of every compiled plane, including the
+ * border rows, are compared with av_expr_eval(). */
+static void check_progs(struct vf_instance *vf, mp_image_t *mpi){
+    struct vf_priv_s *priv= vf->priv;
+    struct geq_slot st[GEQ_MAX_DEPTH];
+    double var[VAR_NB];
+    int plane, row, x;
+
+    for (plane=0; plane<3; plane++) {
+        int w= mpi->w >> (plane ? mpi->chroma_x_shift : 0);
+        int h= mpi->h >> (plane ? mpi->chroma_y_shift : 0);
+        set_vars(var, mpi, plane, priv->framenum);
+        for (row=0; row<CHECK_ROWS && priv->prog[plane]; row++) {
+            var[VAR_Y]= row * (h-1) / (CHECK_ROWS-1);
+            run_row(priv->prog[plane], st, priv->buf[0], var, w, priv->xramp, mpi);
+            for (x=0; x<w; x++) {
+                double v= st[0].v ? st[0].v[x] : st[0].s;
+                double ref;
+                var[VAR_X]= x;
+                ref= av_expr_eval(priv->e[plane], var, vf);
+                if (v != ref && !(is_nan(v) && is_nan(ref))) {
+                    mp_msg(MSGT_VFILTER, MSGL_V, "geq: compiled expression for plane %d "
+                           "differs from libavutil, using av_expr_eval()\n", plane);
+                    av_freep(&priv->prog[plane]);
+                    break;
+                }
+            }
+        }
+    }
+    priv->checked++;
+}
+
+struct slice_job {
+    struct vf_priv_s *priv;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void geq_slice(void *ctx, int index, int y0, int y1){
+    struct slice_job *job= ctx;
+    struct vf_priv_s *priv= job->priv;
+    mp_image_t *mpi= job->mpi, *dmpi= job->dmpi;
+    struct geq_slot st[GEQ_MAX_DEPTH];
+    double var[VAR_NB];
+    int plane, y;
+
+    for (plane=0; plane<3; plane++) {
+        int w= mpi->w >> (plane ? mpi->chroma_x_shift : 0);
+        int shift= plane ? mpi->chroma_y_shift : 0;
+        if (!priv->prog[plane]) continue;
+        set_vars(var, mpi, plane, priv->framenum);
+        for (y= y0 >> shift; y < y1 >> shift; y++) {
+            var[VAR_Y]= y;
+            run_row(priv->prog[plane], st, priv->buf[index], var, w, priv->xramp, mpi);
+            store_row(dmpi->planes[plane] + y * dmpi->stride[plane], &st[0], w);
+        }
+    }
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     mp_image_t *dmpi;
+    struct slice_job job;
     int x,y, plane;
 
     if(!(mpi->flags&MP_IMGFLAG_DIRECT)){
@@ -94,28 +751,26 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
     vf_clone_mpi_attributes(dmpi, mpi);
 
+    if (vf->priv->checked < CHECK_FRAMES)
+        check_progs(vf, mpi);
+
+    job= (struct slice_job){ vf->priv, mpi, dmpi };
+    vf_run_slices(vf, mpi->h, 1 << mpi->chroma_y_shift, geq_slice, &job);
+
+    // av_expr_eval() keeps state for st()/ld(), so this stays single threaded
     for(plane=0; plane<3; plane++){
         int w= mpi->w >> (plane ? mpi->chroma_x_shift : 0);
         int h= mpi->h >> (plane ? mpi->chroma_y_shift : 0);
         uint8_t *dst  = dmpi->planes[plane];
         int dst_stride= dmpi->stride[plane];
-        double const_values[]={
-            M_PI,
-            M_E,
-            0,
-            0,
-            w,
-            h,
-            vf->priv->framenum,
-            w/(double)mpi->w,
-            h/(double)mpi->h,
-            0
-        };
-        if (!vf->priv->e[plane]) continue;
+        double const_values[VAR_NB + 1];
+        if (!vf->priv->e[plane] || vf->priv->prog[plane]) continue;
+        set_vars(const_values, mpi, plane, vf->priv->framenum);
+        const_values[VAR_NB]= 0;
         for(y=0; y<h; y++){
-            const_values[3]=y;
+            const_values[VAR_Y]=y;
             for(x=0; x<w; x++){
-                const_values[2]=x;
+                const_values[VAR_X]=x;
                 dst[x + y * dst_stride] = av_expr_eval(vf->priv->e[plane],
                                                        const_values, vf);
             }
@@ -128,6 +783,14 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 }
 
 static void uninit(struct vf_instance *vf){
+    int i;
+    for (i=0; i<3; i++) {
+        av_expr_free(vf->priv->e[i]);
+        av_free(vf->priv->prog[i]);
+    }
+    for (i=0; i<VF_MAX_SLICES; i++)
+        av_free(vf->priv->buf[i]);
+    av_free(vf->priv->xramp);
     av_free(vf->priv);
     vf->priv=NULL;
 }
@@ -150,25 +813,6 @@ static int vf_open(vf_instance_t *vf, char *args){
     if (!eq[2][0]) strncpy(eq[2], eq[1], sizeof(eq[0])-1);
 
     for(plane=0; plane<3; plane++){
-        const char * const const_names[]={
-            "PI",
-            "E",
-            "X",
-            "Y",
-            "W",
-            "H",
-            "N",
-            "SW",
-            "SH",
-            NULL
-        };
-        const char * const func2_names[]={
-            "lum",
-            "cb",
-            "cr",
-            "p",
-            NULL
-        };
         double (*func2[])(void *, double, double)={
             lum,
             cb,
@@ -182,6 +826,10 @@ static int vf_open(vf_instance_t *vf, char *args){
             mp_msg(MSGT_VFILTER, MSGL_ERR, "geq: error loading equation `%s'\n", eq[plane]);
             return 0;
         }
+        vf->priv->prog[plane]= compile_expr(eq[plane], plane);
+        if (!vf->priv->prog[plane])
+            mp_msg(MSGT_VFILTER, MSGL_V, "geq: cannot compile `%s', "
+                   "evaluating it per pixel\n", eq[plane]);
     }
 
     return 1;
@@ -45,7 +45,7 @@
 struct vf_priv_s {
     int thresh;
     int radius;
-    uint16_t *buf;
+    uint16_t *buf[MP_MAX_PLANES]; // one per plane for parallel filtering
     void (*filter_line)(uint8_t *dst, uint8_t *src, uint16_t *dc,
                         int width, int thresh, const uint16_t *dithers);
     void (*blur_line)(uint16_t *dc, uint16_t *buf, uint16_t *buf1,
@@ -234,14 +234,15 @@ static void blur_line_sse2(uint16_t *dc, uint16_t *buf, uint16_t *buf1,
 }
 #endif // HAVE_6REGS && HAVE_SSE2
 
-static void filter(struct vf_priv_s *ctx, uint8_t *dst, uint8_t *src,
-                   int width, int height, int dstride, int sstride, int r)
+static void filter(struct vf_priv_s *ctx, uint16_t *tmp, uint8_t *dst,
+                   uint8_t *src, int width, int height, int dstride,
+                   int sstride, int r)
 {
     int bstride = ((width+15)&~15)/2;
     int y;
     uint32_t dc_factor = (1<<21)/(r*r);
-    uint16_t *dc = ctx->buf+16;
-    uint16_t *buf = ctx->buf+bstride+32;
+    uint16_t *dc = tmp+16;
+    uint16_t *buf = tmp+bstride+32;
     int thresh = ctx->thresh;
 
     memset(dc, 0, (bstride+16)*sizeof(*buf));
@@ -294,10 +295,37 @@ static void get_image(struct vf_instance *vf, mp_image_t *mpi)
     mpi->flags |= MP_IMGFLAG_DIRECT;
 }
 
+struct plane_job {
+    struct vf_priv_s *priv;
+    mp_image_t *mpi, *dmpi;
+};
+
+// The blur is a running sum over the rows of a plane, so rather than
+// splitting planes into bands, filter the planes in parallel.
+static void filter_plane(void *ctx, int p)
+{
+    struct plane_job *job = ctx;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    int w = mpi->w;
+    int h = mpi->h;
+    int r = job->priv->radius;
+    if (p) {
+        w >>= mpi->chroma_x_shift;
+        h >>= mpi->chroma_y_shift;
+        r = ((r>>mpi->chroma_x_shift) + (r>>mpi->chroma_y_shift)) / 2;
+        r = av_clip((r+1)&~1,4,32);
+    }
+    if (FFMIN(w,h) > 2*r)
+        filter(job->priv, job->priv->buf[p], dmpi->planes[p], mpi->planes[p],
+               w, h, dmpi->stride[p], mpi->stride[p], r);
+    else if (dmpi->planes[p] != mpi->planes[p])
+        memcpy_pic(dmpi->planes[p], mpi->planes[p], w, h,
+                   dmpi->stride[p], mpi->stride[p]);
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
 {
     mp_image_t *dmpi = vf->dmpi;
-    int p;
 
     if (!(mpi->flags&MP_IMGFLAG_DIRECT)) {
         // no DR, so get a new image. hope we'll get DR buffer:
@@ -307,23 +335,8 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
     }
     vf_clone_mpi_attributes(dmpi, mpi);
 
-    for (p=0; p<mpi->num_planes; p++) {
-        int w = mpi->w;
-        int h = mpi->h;
-        int r = vf->priv->radius;
-        if (p) {
-            w >>= mpi->chroma_x_shift;
-            h >>= mpi->chroma_y_shift;
-            r = ((r>>mpi->chroma_x_shift) + (r>>mpi->chroma_y_shift)) / 2;
-            r = av_clip((r+1)&~1,4,32);
-        }
-        if (FFMIN(w,h) > 2*r)
-            filter(vf->priv, dmpi->planes[p], mpi->planes[p], w, h,
-                             dmpi->stride[p], mpi->stride[p], r);
-        else if (dmpi->planes[p] != mpi->planes[p])
-            memcpy_pic(dmpi->planes[p], mpi->planes[p], w, h,
-                       dmpi->stride[p], mpi->stride[p]);
-    }
+    vf_run_jobs(vf, mpi->num_planes, filter_plane,
+                &(struct plane_job){vf->priv, mpi, dmpi});
 
     return vf_next_put_image(vf, dmpi, pts);
 }
@@ -354,15 +367,18 @@ static int config(struct vf_instance *vf,
                   int width, int height, int d_width, int d_height,
                   unsigned int flags, unsigned int outfmt)
 {
-    free(vf->priv->buf);
-    vf->priv->buf = av_mallocz((((width+15)&~15)*(vf->priv->radius+1)/2+32)*sizeof(uint16_t));
+    for (int p = 0; p < MP_MAX_PLANES; p++) {
+        av_free(vf->priv->buf[p]);
+        vf->priv->buf[p] = av_mallocz((((width+15)&~15)*(vf->priv->radius+1)/2+32)*sizeof(uint16_t));
+    }
     return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
 
 static void uninit(struct vf_instance *vf)
 {
     if (!vf->priv) return;
-    av_free(vf->priv->buf);
+    for (int p = 0; p < MP_MAX_PLANES; p++)
+        av_free(vf->priv->buf[p]);
     free(vf->priv);
     vf->priv = NULL;
 }
@@ -24,7 +24,11 @@
 #include <inttypes.h>
 #include <math.h>
 
+#include <libavutil/common.h>
+
+#include "config.h"
 #include "mp_msg.h"
+#include "cpudetect.h"
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
@@ -33,12 +37,27 @@
 #define PARAM2_DEFAULT 3.0
 #define PARAM3_DEFAULT 6.0
 
+// lines filtered together by the horizontal pass
+#define HLINES 4
+
 //===========================================================================//
 
 struct vf_priv_s {
         int Coefs[4][512*16];
-        unsigned int *Line;
+        unsigned int *Line[3];
+        unsigned int *LineCur[3];
 	unsigned short *Frame[3];
+        void (*lineVerticalTemporal)(const unsigned int *LineCur,
+                                     unsigned int *LineAnt,
+                                     unsigned short *LinePrev,
+                                     unsigned char *Dest, int W,
+                                     int *Vertical, int *Temporal);
+        void (*lineVertical)(const unsigned int *LineCur,
+                             unsigned int *LineAnt, unsigned char *Dest,
+                             int W, int *Vertical);
+        void (*lineTemporal)(const unsigned char *Frame,
+                             unsigned short *LinePrev, unsigned char *Dest,
+                             int W, int *Temporal);
 };
 
 
@@ -46,15 +65,14 @@ struct vf_priv_s {
 
 static void uninit(struct vf_instance *vf)
 {
-	free(vf->priv->Line);
-	free(vf->priv->Frame[0]);
-	free(vf->priv->Frame[1]);
-	free(vf->priv->Frame[2]);
-
-	vf->priv->Line     = NULL;
-	vf->priv->Frame[0] = NULL;
-	vf->priv->Frame[1] = NULL;
-	vf->priv->Frame[2] = NULL;
+	for (int i = 0; i < 3; i++) {
+		free(vf->priv->Line[i]);
+		free(vf->priv->LineCur[i]);
+		free(vf->priv->Frame[i]);
+		vf->priv->Line[i]    = NULL;
+		vf->priv->LineCur[i] = NULL;
+		vf->priv->Frame[i]   = NULL;
+	}
 }
 
 static int config(struct vf_instance *vf,
@@ -62,7 +80,12 @@ static int config(struct vf_instance *vf,
 	unsigned int flags, unsigned int outfmt){
 
 	uninit(vf);
-        vf->priv->Line = malloc(width*sizeof(int));
+	// one line buffer per plane, so that the planes can be filtered in
+	// parallel
+	for (int i = 0; i < 3; i++) {
+		vf->priv->Line[i]    = malloc(width*sizeof(int));
+		vf->priv->LineCur[i] = malloc(HLINES*width*sizeof(int));
+	}
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -74,37 +97,269 @@ static inline unsigned int LowPassMul(unsigned int PrevMul, unsigned int CurrMul
     return CurrMul + Coef[d];
 }
 
+/* The horizontal pass is recursive along the line and stays scalar; the
+ * vertical and temporal passes are independent per column and run through
+ * these line functions, which have SIMD versions below. */
+
+static void lineVerticalTemporal_c(const unsigned int *LineCur,
+                                   unsigned int *LineAnt,
+                                   unsigned short *LinePrev,
+                                   unsigned char *Dest, int W,
+                                   int *Vertical, int *Temporal)
+{
+    long X;
+    unsigned int PixelDst;
+
+    for (X = 0; X < W; X++){
+        LineAnt[X] = LowPassMul(LineAnt[X], LineCur[X], Vertical);
+        PixelDst = LowPassMul(LinePrev[X]<<8, LineAnt[X], Temporal);
+        LinePrev[X] = ((PixelDst+0x1000007F)>>8);
+        Dest[X]= ((PixelDst+0x10007FFF)>>16);
+    }
+}
+
+static void lineVertical_c(const unsigned int *LineCur, unsigned int *LineAnt,
+                           unsigned char *Dest, int W, int *Vertical)
+{
+    long X;
+    unsigned int PixelDst;
+
+    for (X = 0; X < W; X++){
+        PixelDst = LineAnt[X] = LowPassMul(LineAnt[X], LineCur[X], Vertical);
+        Dest[X]= ((PixelDst+0x10007FFF)>>16);
+    }
+}
+
+static void lineTemporal_c(const unsigned char *Frame, unsigned short *LinePrev,
+                           unsigned char *Dest, int W, int *Temporal)
+{
+    long X;
+    unsigned int PixelDst;
+
+    for (X = 0; X < W; X++){
+        PixelDst = LowPassMul(LinePrev[X]<<8, Frame[X]<<16, Temporal);
+        LinePrev[X] = ((PixelDst+0x1000007F)>>8);
+        Dest[X]= ((PixelDst+0x10007FFF)>>16);
+    }
+}
+
+#if HAVE_AVX2 && ARCH_X86_64
+static const unsigned int pd_lowpass = 0x10007FF;
+static const unsigned int pd_round8  = 0x1000007F;
+static const unsigned int pd_round16 = 0x10007FFF;
+
+#define LOAD_CONSTANTS \
+    "vpbroadcastd %[lowpass], %%ymm12 \n"\
+    "vpbroadcastd %[round8],  %%ymm13 \n"\
+    "vpbroadcastd %[round16], %%ymm14 \n"
+
+/* ymm0 = LowPassMul(prev, ymm0, coef) for 8 pixels; there is no SSE2
+ * equivalent of the table gather, which is what this filter spends its
+ * time on. */
+#define LOWPASS(prev, coef) \
+    "vpsubd        %%ymm0, "prev", %%ymm1 \n" /* dMul = prev - cur */\
+    "vpaddd       %%ymm12, %%ymm1, %%ymm1 \n"\
+    "vpsrld           $12, %%ymm1, %%ymm1 \n"\
+    "vpcmpeqd      %%ymm2, %%ymm2, %%ymm2 \n"\
+    "vpgatherdd    %%ymm2, ("coef",%%ymm1,4), %%ymm3 \n"\
+    "vpaddd        %%ymm3, %%ymm0, %%ymm0 \n"
+
+/* LinePrev = (ymm0 + 0x1000007F) >> 8, truncated to 16 bits */
+#define STORE_PREV(dst) \
+    "vpaddd       %%ymm13, %%ymm0, %%ymm1 \n"\
+    "vpslld            $8, %%ymm1, %%ymm1 \n"\
+    "vpsrld           $16, %%ymm1, %%ymm1 \n"\
+    "vextracti128 $1, %%ymm1, %%xmm3 \n"\
+    "vpackusdw     %%xmm3, %%xmm1, %%xmm1 \n"\
+    "vmovdqu       %%xmm1, ("dst",%[x],2) \n"
+
+/* Dest = (ymm0 + 0x10007FFF) >> 16, truncated to 8 bits */
+#define STORE_DEST(dst) \
+    "vpaddd       %%ymm14, %%ymm0, %%ymm1 \n"\
+    "vpslld            $8, %%ymm1, %%ymm1 \n"\
+    "vpsrld           $24, %%ymm1, %%ymm1 \n"\
+    "vextracti128 $1, %%ymm1, %%xmm3 \n"\
+    "vpackusdw     %%xmm3, %%xmm1, %%xmm1 \n"\
+    "vpackuswb     %%xmm1, %%xmm1, %%xmm1 \n"\
+    "vmovq         %%xmm1, ("dst",%[x]) \n"
+
+#define AVX2_CONSTANTS \
+    [lowpass]"m"(pd_lowpass), [round8]"m"(pd_round8), [round16]"m"(pd_round16)
+#define AVX2_CLOBBERS \
+    "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", \
+    "xmm12", "xmm13", "xmm14"
+
+static void lineVerticalTemporal_avx2(const unsigned int *LineCur,
+                                      unsigned int *LineAnt,
+                                      unsigned short *LinePrev,
+                                      unsigned char *Dest, int W,
+                                      int *Vertical, int *Temporal)
+{
+    intptr_t x;
+    if (W&7) {
+        x = W&~7;
+        lineVerticalTemporal_c(LineCur+x, LineAnt+x, LinePrev+x, Dest+x,
+                               W-x, Vertical, Temporal);
+        W = x;
+    }
+    if (!W)
+        return;
+    x = -W;
+    __asm__ volatile(
+        LOAD_CONSTANTS
+        "1: \n"
+        "vmovdqu  (%[cur],%[x],4), %%ymm0 \n"
+        "vmovdqu  (%[ant],%[x],4), %%ymm4 \n"
+        LOWPASS("%%ymm4", "%[vert]")
+        "vmovdqu   %%ymm0, (%[ant],%[x],4) \n"
+        "vpmovzxwd (%[prev],%[x],2), %%ymm4 \n"
+        "vpslld        $8, %%ymm4, %%ymm4 \n"
+        LOWPASS("%%ymm4", "%[temp]")
+        STORE_PREV("%[prev]")
+        STORE_DEST("%[dst]")
+        "add           $8, %[x] \n"
+        "jl 1b \n"
+        "vzeroupper \n"
+        :[x]"+&r"(x)
+        :[cur]"r"(LineCur+W), [ant]"r"(LineAnt+W), [prev]"r"(LinePrev+W),
+         [dst]"r"(Dest+W), [vert]"r"(Vertical), [temp]"r"(Temporal),
+         AVX2_CONSTANTS
+        :AVX2_CLOBBERS
+    );
+}
+
+static void lineVertical_avx2(const unsigned int *LineCur,
+                              unsigned int *LineAnt, unsigned char *Dest,
+                              int W, int *Vertical)
+{
+    intptr_t x;
+    if (W&7) {
+        x = W&~7;
+        lineVertical_c(LineCur+x, LineAnt+x, Dest+x, W-x, Vertical);
+        W = x;
+    }
+    if (!W)
+        return;
+    x = -W;
+    __asm__ volatile(
+        LOAD_CONSTANTS
+        "1: \n"
+        "vmovdqu  (%[cur],%[x],4), %%ymm0 \n"
+        "vmovdqu  (%[ant],%[x],4), %%ymm4 \n"
+        LOWPASS("%%ymm4", "%[vert]")
+        "vmovdqu   %%ymm0, (%[ant],%[x],4) \n"
+        STORE_DEST("%[dst]")
+        "add           $8, %[x] \n"
+        "jl 1b \n"
+        "vzeroupper \n"
+        :[x]"+&r"(x)
+        :[cur]"r"(LineCur+W), [ant]"r"(LineAnt+W), [dst]"r"(Dest+W),
+         [vert]"r"(Vertical), AVX2_CONSTANTS
+        :AVX2_CLOBBERS
+    );
+}
+
+static void lineTemporal_avx2(const unsigned char *Frame,
+                              unsigned short *LinePrev, unsigned char *Dest,
+                              int W, int *Temporal)
+{
+    intptr_t x;
+    if (W&7) {
+        x = W&~7;
+        lineTemporal_c(Frame+x, LinePrev+x, Dest+x, W-x, Temporal);
+        W = x;
+    }
+    if (!W)
+        return;
+    x = -W;
+    __asm__ volatile(
+        LOAD_CONSTANTS
+        "1: \n"
+        "vpmovzxbd (%[src],%[x]), %%ymm0 \n"
+        "vpslld       $16, %%ymm0, %%ymm0 \n"
+        "vpmovzxwd (%[prev],%[x],2), %%ymm4 \n"
+        "vpslld        $8, %%ymm4, %%ymm4 \n"
+        LOWPASS("%%ymm4", "%[temp]")
+        STORE_PREV("%[prev]")
+        STORE_DEST("%[dst]")
+        "add           $8, %[x] \n"
+        "jl 1b \n"
+        "vzeroupper \n"
+        :[x]"+&r"(x)
+        :[src]"r"(Frame+W), [prev]"r"(LinePrev+W), [dst]"r"(Dest+W),
+         [temp]"r"(Temporal), AVX2_CONSTANTS
+        :AVX2_CLOBBERS
+    );
+}
+#endif // HAVE_AVX2 && ARCH_X86_64
+
 static void deNoiseTemporal(
+                    struct vf_priv_s *p,
                     unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned short *FrameAnt,
                     int W, int H, int sStride, int dStride,
                     int *Temporal)
 {
-    long X, Y;
-    unsigned int PixelDst;
+    long Y;
 
     for (Y = 0; Y < H; Y++){
-        for (X = 0; X < W; X++){
-            PixelDst = LowPassMul(FrameAnt[X]<<8, Frame[X]<<16, Temporal);
-            FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
-        }
+        p->lineTemporal(Frame, FrameAnt, FrameDest, W, Temporal);
         Frame += sStride;
         FrameDest += dStride;
         FrameAnt += W;
     }
 }
 
+/* Horizontal pass of Lines (at most HLINES) lines into LineCur, one line
+ * of W entries after the other. The lines are independent, so filtering
+ * four of them interleaved hides the latency of the LowPassMul chain. */
+static void deNoiseHorizontal(unsigned char *Frame, int sStride,
+                              unsigned int *LineCur, int W, int Lines,
+                              int *Horizontal)
+{
+    long X;
+
+    if (Lines == HLINES) {
+        unsigned char *F0 = Frame,     *F1 = Frame+sStride;
+        unsigned char *F2 = F1+sStride, *F3 = F2+sStride;
+        unsigned int *L0 = LineCur,   *L1 = LineCur+W;
+        unsigned int *L2 = L1+W,      *L3 = L2+W;
+        unsigned int P0, P1, P2, P3;
+
+        /* First pixel on each line doesn't have previous pixel */
+        P0 = L0[0] = F0[0]<<16;
+        P1 = L1[0] = F1[0]<<16;
+        P2 = L2[0] = F2[0]<<16;
+        P3 = L3[0] = F3[0]<<16;
+        for (X = 1; X < W; X++){
+            L0[X] = P0 = LowPassMul(P0, F0[X]<<16, Horizontal);
+            L1[X] = P1 = LowPassMul(P1, F1[X]<<16, Horizontal);
+            L2[X] = P2 = LowPassMul(P2, F2[X]<<16, Horizontal);
+            L3[X] = P3 = LowPassMul(P3, F3[X]<<16, Horizontal);
+        }
+        return;
+    }
+
+    for (; Lines > 0; Lines--){
+        unsigned int PixelAnt = LineCur[0] = Frame[0]<<16;
+        for (X = 1; X < W; X++)
+            PixelAnt = LineCur[X] = LowPassMul(PixelAnt, Frame[X]<<16, Horizontal);
+        Frame += sStride;
+        LineCur += W;
+    }
+}
+
 static void deNoiseSpacial(
+                    struct vf_priv_s *p,
                     unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned int *LineAnt,       // vf->priv->Line (width bytes)
+                    unsigned int *LineCur,       // vf->priv->LineCur
                     int W, int H, int sStride, int dStride,
                     int *Horizontal, int *Vertical)
 {
     long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
     unsigned int PixelAnt;
     unsigned int PixelDst;
 
@@ -118,33 +373,26 @@ static void deNoiseSpacial(
         FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
     }
 
-    for (Y = 1; Y < H; Y++){
-	unsigned int PixelAnt;
-	sLineOffs += sStride, dLineOffs += dStride;
-        /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
-        PixelDst = LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
-
-        for (X = 1; X < W; X++){
-            unsigned int PixelDst;
-            /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
-            PixelDst = LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
-        }
+    for (Y = 1; Y < H; Y += HLINES){
+        int Lines = FFMIN(H-Y, HLINES);
+        deNoiseHorizontal(Frame+Y*sStride, sStride, LineCur, W, Lines,
+                          Horizontal);
+        for (int i = 0; i < Lines; i++)
+            p->lineVertical(LineCur+i*W, LineAnt,
+                            FrameDest+(Y+i)*dStride, W, Vertical);
     }
 }
 
-static void deNoise(unsigned char *Frame,        // mpi->planes[x]
+static void deNoise(struct vf_priv_s *p,
+                    unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned int *LineAnt,      // vf->priv->Line (width bytes)
+                    unsigned int *LineCur,      // vf->priv->LineCur
 		    unsigned short **FrameAntPtr,
                     int W, int H, int sStride, int dStride,
                     int *Horizontal, int *Vertical, int *Temporal)
 {
     long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
     unsigned int PixelAnt;
     unsigned int PixelDst;
     unsigned short* FrameAnt=(*FrameAntPtr);
@@ -159,12 +407,12 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
     }
 
     if(!Horizontal[0] && !Vertical[0]){
-        deNoiseTemporal(Frame, FrameDest, FrameAnt,
+        deNoiseTemporal(p, Frame, FrameDest, FrameAnt,
                         W, H, sStride, dStride, Temporal);
         return;
     }
     if(!Temporal[0]){
-        deNoiseSpacial(Frame, FrameDest, LineAnt,
+        deNoiseSpacial(p, Frame, FrameDest, LineAnt, LineCur,
                        W, H, sStride, dStride, Horizontal, Vertical);
         return;
     }
@@ -184,59 +432,49 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
         FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
     }
 
-    for (Y = 1; Y < H; Y++){
-	unsigned int PixelAnt;
-	unsigned short* LinePrev=&FrameAnt[Y*W];
-	sLineOffs += sStride, dLineOffs += dStride;
-        /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
-        LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
-	PixelDst = LowPassMul(LinePrev[0]<<8, LineAnt[0], Temporal);
-        LinePrev[0] = ((PixelDst+0x1000007F)>>8);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
-
-        for (X = 1; X < W; X++){
-            unsigned int PixelDst;
-            /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
-            LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
-	    PixelDst = LowPassMul(LinePrev[X]<<8, LineAnt[X], Temporal);
-            LinePrev[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
-        }
+    for (Y = 1; Y < H; Y += HLINES){
+        int Lines = FFMIN(H-Y, HLINES);
+        deNoiseHorizontal(Frame+Y*sStride, sStride, LineCur, W, Lines,
+                          Horizontal);
+        for (int i = 0; i < Lines; i++)
+            p->lineVerticalTemporal(LineCur+i*W, LineAnt, &FrameAnt[(Y+i)*W],
+                                    FrameDest+(Y+i)*dStride, W,
+                                    Vertical, Temporal);
     }
 }
 
+struct plane_job {
+	struct vf_priv_s *priv;
+	mp_image_t *mpi, *dmpi;
+};
 
-static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
-	int cw= mpi->w >> mpi->chroma_x_shift;
-	int ch= mpi->h >> mpi->chroma_y_shift;
-        int W = mpi->w, H = mpi->h;
+/* The filter is recursive in both directions, so it can't be split into
+ * bands without changing the output; filter the planes in parallel. */
+static void deNoisePlane(void *ctx, int p)
+{
+	struct plane_job *job = ctx;
+	struct vf_priv_s *priv = job->priv;
+	mp_image_t *mpi = job->mpi;
+	int W = p ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+	int H = p ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+	int *Spac = priv->Coefs[p ? 2 : 0];
+	int *Tmp  = priv->Coefs[p ? 3 : 1];
+
+	deNoise(priv, mpi->planes[p], job->dmpi->planes[p],
+		priv->Line[p], priv->LineCur[p], &priv->Frame[p], W, H,
+		mpi->stride[p], job->dmpi->stride[p],
+		Spac, Spac, Tmp);
+}
 
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
 		MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE,
                 mpi->w,mpi->h);
 
 	if(!dmpi) return 0;
 
-        deNoise(mpi->planes[0], dmpi->planes[0],
-		vf->priv->Line, &vf->priv->Frame[0], W, H,
-                mpi->stride[0], dmpi->stride[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[1]);
-        deNoise(mpi->planes[1], dmpi->planes[1],
-		vf->priv->Line, &vf->priv->Frame[1], cw, ch,
-                mpi->stride[1], dmpi->stride[1],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
-        deNoise(mpi->planes[2], dmpi->planes[2],
-		vf->priv->Line, &vf->priv->Frame[2], cw, ch,
-                mpi->stride[2], dmpi->stride[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
+	vf_run_jobs(vf, 3, deNoisePlane,
+		    &(struct plane_job){vf->priv, mpi, dmpi});
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
@@ -358,6 +596,17 @@ static int vf_open(vf_instance_t *vf, char *args){
         PrecalcCoefs(vf->priv->Coefs[2], ChromSpac);
         PrecalcCoefs(vf->priv->Coefs[3], ChromTmp);
 
+        vf->priv->lineVerticalTemporal = lineVerticalTemporal_c;
+        vf->priv->lineVertical = lineVertical_c;
+        vf->priv->lineTemporal = lineTemporal_c;
+#if HAVE_AVX2 && ARCH_X86_64
+        if (gCpuCaps.hasAVX2) {
+            vf->priv->lineVerticalTemporal = lineVerticalTemporal_avx2;
+            vf->priv->lineVertical = lineVertical_avx2;
+            vf->priv->lineTemporal = lineTemporal_avx2;
+        }
+#endif
+
 	return 1;
 }
 
@@ -0,0 +1,474 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * ICC color management in software, for video outputs that have none.
+ * The same 3D LUT as used by vo_gl3 is created with lcms2 (see libvo/icc.c)
+ * and applied to packed RGB with tetrahedral interpolation: the fractional
+ * position inside a cube cell selects one of six tetrahedra, and the output
+ * is a weighted sum of its four corners. The corner lookup is done in C, the
+ * weighted sums with SSE2 if available (same result as the C code).
+ * The LUT can be cached on disk, keyed by a hash of the ICC profile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <libavutil/common.h>
+#include <libavutil/md5.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "cpudetect.h"
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+#include "talloc.h"
+#include "bstr.h"
+#include "path.h"
+#include "libvo/icc.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+#include "m_option.h"
+#include "m_struct.h"
+
+#define LUT3D_CACHE_HEADER "mplayer2 3dlut cache 1.0\n"
+
+// fractional bits of the interpolation weights, and of the LUT entries
+#define WEIGHT_BITS 14
+#define LUT_BITS 6
+
+// pixels whose corners are looked up before they are interpolated
+#define CHUNK 256
+
+// the four corners of a tetrahedron, as LUT entry indexes, and the weights
+// (1-w1, w1-w2) and (w2-w3, w3) as pairs of int16
+struct tetra {
+    intptr_t o[4];
+    uint32_t w[2];
+};
+
+static struct vf_priv_s {
+    char *profile;
+    int intent;
+    int size;
+    char *cache;
+    uint16_t *lut3d;        // talloc'ed, as returned by mp_icc_create_lut3d
+    // size^3 entries of 4 int16, 8 bit output << LUT_BITS in pixel byte order
+    int16_t *lut;
+    int bpp, alpha;         // alpha byte position, or -1
+    int pos[3];             // byte positions of R, G, B
+    int32_t off[3][256];    // LUT entry index of the lower cell corner
+    uint16_t frac[3][256];  // position inside the cell
+    void (*interp)(uint8_t *dst, const struct tetra *t, int n,
+                   const int16_t *lut);
+} const vf_priv_dflt = {
+    NULL,
+    -1,
+    64,
+    NULL,
+};
+
+static void interp_c(uint8_t *dst, const struct tetra *t, int n,
+                     const int16_t *lut)
+{
+    int i, k;
+    for (i = 0; i < n; i++) {
+        const int16_t *c0 = lut + t[i].o[0] * 4, *c1 = lut + t[i].o[1] * 4;
+        const int16_t *c2 = lut + t[i].o[2] * 4, *c3 = lut + t[i].o[3] * 4;
+        int w0 = t[i].w[0] & 0xFFFF, w1 = t[i].w[0] >> 16;
+        int w2 = t[i].w[1] & 0xFFFF, w3 = t[i].w[1] >> 16;
+        for (k = 0; k < 4; k++) {
+            int v = c0[k] * w0 + c1[k] * w1 + c2[k] * w2 + c3[k] * w3;
+            dst[i * 4 + k] = av_clip_uint8((v + (1 << (WEIGHT_BITS + LUT_BITS - 1)))
+                                           >> (WEIGHT_BITS + LUT_BITS));
+        }
+    }
+}
+
+#if HAVE_SSE2
+DECLARE_ASM_CONST(16, int32_t, pd_round)[4] = {
+    1 << 19, 1 << 19, 1 << 19, 1 << 19 // 1 << (WEIGHT_BITS + LUT_BITS - 1)
+};
+
+/* One pixel per iteration: corners 0/1 and 2/3 are interleaved, so that
+ * pmaddwd with a weight pair sums two corners of each component at once. */
+static void interp_sse2(uint8_t *dst, const struct tetra *t, int n,
+                        const int16_t *lut)
+{
+    x86_reg o;
+    if (n <= 0)
+        return;
+    __asm__ volatile(
+        "movdqa     %[round], %%xmm7        \n"
+        "1:                                 \n"
+        "mov        (%[t]), %[o]            \n"
+        "movq       (%[lut],%[o],8), %%xmm0 \n"
+        "mov        %c[o1](%[t]), %[o]      \n"
+        "movq       (%[lut],%[o],8), %%xmm1 \n"
+        "mov        %c[o2](%[t]), %[o]      \n"
+        "movq       (%[lut],%[o],8), %%xmm2 \n"
+        "mov        %c[o3](%[t]), %[o]      \n"
+        "movq       (%[lut],%[o],8), %%xmm3 \n"
+        "movd       %c[w](%[t]), %%xmm4     \n"
+        "movd       %c[w]+4(%[t]), %%xmm5   \n"
+        "punpcklwd  %%xmm1, %%xmm0          \n"
+        "punpcklwd  %%xmm3, %%xmm2          \n"
+        "pshufd     $0, %%xmm4, %%xmm4      \n"
+        "pshufd     $0, %%xmm5, %%xmm5      \n"
+        "pmaddwd    %%xmm4, %%xmm0          \n"
+        "pmaddwd    %%xmm5, %%xmm2          \n"
+        "paddd      %%xmm2, %%xmm0          \n"
+        "paddd      %%xmm7, %%xmm0          \n"
+        "psrad      $20, %%xmm0             \n" // WEIGHT_BITS + LUT_BITS
+        "packssdw   %%xmm0, %%xmm0          \n"
+        "packuswb   %%xmm0, %%xmm0          \n"
+        "movd       %%xmm0, (%[dst])        \n"
+        "add        %[size], %[t]           \n"
+        "add        $4, %[dst]              \n"
+        "dec        %[n]                    \n"
+        "jnz 1b                             \n"
+        :[t]"+r"(t), [dst]"+r"(dst), [n]"+r"(n), [o]"=&r"(o)
+        :[lut]"r"(lut), [round]"m"(*pd_round),
+         [o1]"i"(offsetof(struct tetra, o[1])),
+         [o2]"i"(offsetof(struct tetra, o[2])),
+         [o3]"i"(offsetof(struct tetra, o[3])),
+         [w]"i"(offsetof(struct tetra, w)),
+         [size]"i"(sizeof(struct tetra))
+        :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm7"
+    );
+}
+#endif // HAVE_SSE2
+
+// Find the cell and the tetrahedron inside it for each pixel.
+static void setup_tetra(const struct vf_priv_s *p, struct tetra *t,
+                        const uint8_t *src, int n)
+{
+    const int dr = 1, dg = p->size, db = p->size * p->size;
+    int i;
+
+    for (i = 0; i < n; i++, src += p->bpp) {
+        int r = src[p->pos[0]], g = src[p->pos[1]], b = src[p->pos[2]];
+        int fr = p->frac[0][r], fg = p->frac[1][g], fb = p->frac[2][b];
+        intptr_t base = p->off[0][r] + p->off[1][g] + p->off[2][b];
+        int d1, d2, w1, w2, w3;
+
+        if (fr >= fg) {
+            if (fg >= fb)
+                d1 = dr, d2 = dr + dg, w1 = fr, w2 = fg, w3 = fb;
+            else if (fr >= fb)
+                d1 = dr, d2 = dr + db, w1 = fr, w2 = fb, w3 = fg;
+            else
+                d1 = db, d2 = db + dr, w1 = fb, w2 = fr, w3 = fg;
+        } else {
+            if (fr >= fb)
+                d1 = dg, d2 = dg + dr, w1 = fg, w2 = fr, w3 = fb;
+            else if (fg >= fb)
+                d1 = dg, d2 = dg + db, w1 = fg, w2 = fb, w3 = fr;
+            else
+                d1 = db, d2 = db + dg, w1 = fb, w2 = fg, w3 = fr;
+        }
+        t[i].o[0] = base;
+        t[i].o[1] = base + d1;
+        t[i].o[2] = base + d2;
+        t[i].o[3] = base + dr + dg + db;
+        t[i].w[0] = ((1 << WEIGHT_BITS) - w1) | (uint32_t)(w1 - w2) << 16;
+        t[i].w[1] = (w2 - w3) | (uint32_t)w3 << 16;
+    }
+}
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void icc_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    struct tetra t[CHUNK];
+    uint8_t out[CHUNK * 4];
+    int x, y, i;
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t *src = mpi->planes[0] + y * mpi->stride[0];
+        uint8_t *dst = dmpi->planes[0] + y * dmpi->stride[0];
+        for (x = 0; x < mpi->w; x += CHUNK) {
+            int n = FFMIN(CHUNK, mpi->w - x);
+            const uint8_t *s = src + x * p->bpp;
+            uint8_t *d = dst + x * p->bpp;
+            setup_tetra(p, t, s, n);
+            p->interp(out, t, n, p->lut);
+            for (i = 0; i < n; i++, s += p->bpp, d += p->bpp) {
+                memcpy(d, out + i * 4, p->bpp);
+                if (p->alpha >= 0)
+                    d[p->alpha] = s[p->alpha];
+            }
+        }
+    }
+}
+
+// Lay out the LUT and the per channel tables for the pixel format.
+static int setup_format(struct vf_priv_s *p, unsigned int fmt)
+{
+    int s = p->size, i, c;
+
+    p->bpp = 4;
+    p->alpha = -1;
+    switch (fmt) {
+    case IMGFMT_RGB24: p->bpp = 3; // fall through
+    case IMGFMT_RGBA:  p->pos[0] = 0; p->pos[1] = 1; p->pos[2] = 2; break;
+    case IMGFMT_BGR24: p->bpp = 3; // fall through
+    case IMGFMT_BGRA:  p->pos[0] = 2; p->pos[1] = 1; p->pos[2] = 0; break;
+    case IMGFMT_ARGB:  p->pos[0] = 1; p->pos[1] = 2; p->pos[2] = 3; break;
+    case IMGFMT_ABGR:  p->pos[0] = 3; p->pos[1] = 2; p->pos[2] = 1; break;
+    default:
+        return 0;
+    }
+    if (p->bpp == 4)
+        p->alpha = 6 - p->pos[0] - p->pos[1] - p->pos[2];
+
+    free(p->lut);
+    p->lut = calloc(s * s * s, 4 * sizeof(int16_t));
+    if (!p->lut)
+        return 0;
+    for (i = 0; i < s * s * s; i++)
+        for (c = 0; c < 3; c++)
+            p->lut[i * 4 + p->pos[c]] =
+                (p->lut3d[i * 3 + c] * (255 << LUT_BITS) + 32767) / 65535;
+
+    for (c = 0; c < 3; c++) {
+        int stride = c == 0 ? 1 : c == 1 ? s : s * s;
+        for (i = 0; i < 256; i++) {
+            int pos = i * (s - 1) * (1 << WEIGHT_BITS) / 255;
+            int idx = pos >> WEIGHT_BITS;
+            int frac = pos & ((1 << WEIGHT_BITS) - 1);
+            if (idx == s - 1) {
+                idx = s - 2;
+                frac = 1 << WEIGHT_BITS;
+            }
+            p->off[c][i] = idx * stride;
+            p->frac[c][i] = frac;
+        }
+    }
+    return 1;
+}
+
+static int config(struct vf_instance *vf, int width, int height,
+                  int d_width, int d_height, unsigned int flags,
+                  unsigned int outfmt)
+{
+    if (!setup_format(vf->priv, outfmt))
+        return 0;
+    return vf_next_config(vf, width, height, d_width, d_height, flags, outfmt);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    mp_image_t *dmpi;
+    struct slice_job job;
+
+    dmpi = vf_get_image(vf->next, mpi->imgfmt, MP_IMGTYPE_TEMP,
+                        MP_IMGFLAG_ACCEPT_STRIDE, mpi->w, mpi->h);
+    vf_clone_mpi_attributes(dmpi, mpi);
+
+    job = (struct slice_job){ vf->priv, mpi, dmpi };
+    vf_run_slices(vf, mpi->h, 1, icc_slice, &job);
+
+    return vf_next_put_image(vf, dmpi, pts);
+}
+
+static int query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    switch (fmt) {
+    case IMGFMT_RGB24:
+    case IMGFMT_BGR24:
+    case IMGFMT_RGBA:
+    case IMGFMT_BGRA:
+    case IMGFMT_ARGB:
+    case IMGFMT_ABGR:
+        return vf_next_query_format(vf, fmt);
+    }
+    return 0;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    talloc_free(vf->priv->lut3d);
+    free(vf->priv->lut);
+    free(vf->priv);
+}
+
+static struct bstr read_file(void *talloc_ctx, const char *filename)
+{
+    struct bstr res = {0};
+    FILE *f = fopen(filename, "rb");
+    long size;
+
+    if (!f)
+        return res;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+        fseek(f, 0, SEEK_SET) == 0) {
+        unsigned char *buf = talloc_size(talloc_ctx, size);
+        if (fread(buf, size, 1, f) == 1)
+            res = (struct bstr){ buf, size };
+    }
+    fclose(f);
+    return res;
+}
+
+/* The cache file is named after the MD5 of the profile and the LUT
+ * parameters, so that a changed or different profile gets a new file. */
+static char *cache_filename(void *talloc_ctx, const char *dir,
+                            struct bstr iccdata, const char *info)
+{
+    uint8_t md5[16];
+    char name[40];
+    void *key = talloc_size(NULL, iccdata.len + strlen(info));
+    int i;
+
+    memcpy(key, iccdata.start, iccdata.len);
+    memcpy((char *)key + iccdata.len, info, strlen(info));
+    av_md5_sum(md5, key, iccdata.len + strlen(info));
+    talloc_free(key);
+    for (i = 0; i < 16; i++)
+        sprintf(name + i * 2, "%02x", md5[i]);
+    strcpy(name + 32, ".3dlut");
+    mkdir(dir, 0700);
+    return mp_path_join(talloc_ctx, bstr(dir), bstr(name));
+}
+
+static int load_lut(struct vf_priv_s *p)
+{
+    void *tmp = talloc_new(NULL);
+    size_t lut_size = p->size * p->size * p->size * 3 * sizeof(uint16_t);
+    char *info, *filename = NULL;
+    struct bstr iccdata = read_file(tmp, p->profile);
+
+    if (!iccdata.len) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "icc: can't read ICC profile %s\n",
+               p->profile);
+        goto error;
+    }
+
+    info = talloc_asprintf(tmp, "intent=%d, size=%dx%dx%d\n", p->intent,
+                           p->size, p->size, p->size);
+    if (p->cache) {
+        struct bstr cachedata;
+        filename = cache_filename(tmp, p->cache, iccdata, info);
+        cachedata = read_file(tmp, filename);
+        if (bstr_eatstart(&cachedata, bstr(LUT3D_CACHE_HEADER))
+            && bstr_eatstart(&cachedata, bstr(info))
+            && cachedata.len == lut_size)
+        {
+            mp_msg(MSGT_VFILTER, MSGL_V, "icc: using cached 3D LUT %s\n",
+                   filename);
+            p->lut3d = talloc_memdup(NULL, cachedata.start, lut_size);
+            talloc_free(tmp);
+            return 1;
+        }
+    }
+
+    p->lut3d = mp_icc_create_lut3d(NULL, iccdata, p->intent,
+                                   p->size, p->size, p->size);
+    if (!p->lut3d) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "icc: error loading ICC profile %s\n",
+               p->profile);
+        goto error;
+    }
+
+    if (filename) {
+        FILE *out = fopen(filename, "wb");
+        if (out) {
+            fprintf(out, "%s%s", LUT3D_CACHE_HEADER, info);
+            fwrite(p->lut3d, lut_size, 1, out);
+            fclose(out);
+        } else {
+            mp_msg(MSGT_VFILTER, MSGL_WARN, "icc: can't write cache file %s\n",
+                   filename);
+        }
+    }
+    talloc_free(tmp);
+    return 1;
+
+error:
+    talloc_free(tmp);
+    return 0;
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p = vf->priv;
+
+    vf->config = config;
+    vf->put_image = put_image;
+    vf->query_format = query_format;
+    vf->uninit = uninit;
+
+    if (!p->profile) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "icc: no profile given\n");
+        free(p);
+        return 0;
+    }
+    if (p->size < 2 || p->size > 256) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "icc: size must be in 2-256\n");
+        free(p);
+        return 0;
+    }
+    if (!load_lut(p)) {
+        free(p);
+        return 0;
+    }
+
+    p->interp = interp_c;
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2)
+        p->interp = interp_sse2;
+#endif
+    return 1;
+}
+
+#define ST_OFF(f) M_ST_OFF(struct vf_priv_s,f)
+static const m_option_t vf_opts_fields[] = {
+    { "profile", ST_OFF(profile), CONF_TYPE_STRING, 0, 0, 0, NULL },
+    { "intent", ST_OFF(intent), CONF_TYPE_INT, M_OPT_RANGE, -1, 3, NULL },
+    { "size", ST_OFF(size), CONF_TYPE_INT, 0, 0, 0, NULL },
+    { "cache", ST_OFF(cache), CONF_TYPE_STRING, 0, 0, 0, NULL },
+    { NULL, NULL, 0, 0, 0, 0, NULL }
+};
+
+static const m_struct_t vf_opts = {
+    "icc",
+    sizeof(struct vf_priv_s),
+    &vf_priv_dflt,
+    vf_opts_fields
+};
+
+const vf_info_t vf_info_icc = {
+    "ICC color management with a 3D LUT",
+    "icc",
+    "",
+    "",
+    vf_open,
+    &vf_opts
+};
@@ -0,0 +1,546 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Separable software scaler using the filter kernels of vo_gl3
+ * (libvo/filter_kernels.c), so that output without a GPU can get the same
+ * scaling as the opengl output.
+ * The weights of every output pixel are computed once per configuration
+ * and stored as 14 bit fixed point coefficients. Each source row is scaled
+ * horizontally into 16 bit intermediate rows with 6 fractional bits, which
+ * are kept in a small ring buffer and combined vertically into the output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "cpudetect.h"
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+#include "libvo/filter_kernels.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+#define COEF_BITS 14
+#define MID_BITS 6
+#define MAX_SIZE 64
+
+static const int filter_sizes[] = {
+    2, 4, 6, 8, 10, 12, 14, 16, 20, 24, 28, 32, 40, 48, 56, 64, 0
+};
+
+// One dimension of one plane type (luma or chroma).
+struct scaler {
+    int src, dst;
+    int size;           // filter taps
+    int stride;         // taps rounded up to 8, distance between coefficient sets
+    int *pos;           // position of the first tap of each output pixel
+    int16_t *coef;      // [dst][stride]
+    int16_t *coef_avx2; // horizontal only: coef regrouped for hscale_avx2
+};
+
+struct vf_priv_s {
+    int cfg_w, cfg_h;
+    char kernel_name[2][32];
+    float params[2];
+    struct filter_kernel kernel[2];
+    struct scaler hs[2], vs[2];     // luma, chroma
+    int planes;
+    int pad;                        // border of the padded source rows
+    uint8_t *line[VF_MAX_SLICES];   // source row with replicated borders
+    int16_t *ring[VF_MAX_SLICES];   // [vs.size][hs.dst] horizontally scaled rows
+    void (*hscale)(int16_t *dst, const uint8_t *src, const struct scaler *s);
+    void (*vscale)(uint8_t *dst, const int16_t **src, const int16_t *coef,
+                   int size, int w);
+};
+
+// scale pixels [x, s->dst); the SIMD versions use it for the rest of the row
+static void hscale_from(int16_t *dst, const uint8_t *src,
+                        const struct scaler *s, int x)
+{
+    int t;
+    for (; x < s->dst; x++) {
+        const uint8_t *in = src + s->pos[x];
+        const int16_t *coef = s->coef + x * s->stride;
+        int sum = 1 << (COEF_BITS - MID_BITS - 1);
+        for (t = 0; t < s->size; t++)
+            sum += in[t] * coef[t];
+        dst[x] = av_clip_int16(sum >> (COEF_BITS - MID_BITS));
+    }
+}
+
+static void vscale_from(uint8_t *dst, const int16_t **src, const int16_t *coef,
+                        int size, int x, int w)
+{
+    int t;
+    for (; x < w; x++) {
+        int sum = 1 << (COEF_BITS + MID_BITS - 1);
+        for (t = 0; t < size; t++)
+            sum += src[t][x] * coef[t];
+        dst[x] = av_clip_uint8(sum >> (COEF_BITS + MID_BITS));
+    }
+}
+
+static void hscale_c(int16_t *dst, const uint8_t *src, const struct scaler *s)
+{
+    hscale_from(dst, src, s, 0);
+}
+
+static void vscale_c(uint8_t *dst, const int16_t **src, const int16_t *coef,
+                     int size, int w)
+{
+    vscale_from(dst, src, coef, size, 0, w);
+}
+
+#if HAVE_AVX2 && ARCH_X86_64
+static const int32_t pd_hround = 1 << (COEF_BITS - MID_BITS - 1);
+static const int32_t pd_vround = 1 << (COEF_BITS + MID_BITS - 1);
+
+/* Horizontal pass, 8 output pixels per iteration. Each register holds
+ * 8 taps of two pixels, x+i in the low and x+i+4 in the high lane, so that
+ * the three vphaddd leave the sums in order. coef_avx2 is laid out as
+ * [x/8][tap/8][i][lane][8] to be read sequentially. */
+#define HSCALE_PAIR(i, acc) \
+    "movslq    "#i"*4(%[pos]), %[tmp]    \n"\
+    "vmovq     (%[src],%[tmp]), %%xmm0   \n"\
+    "movslq    "#i"*4+16(%[pos]), %[tmp] \n"\
+    "vmovhps   (%[src],%[tmp]), %%xmm0, %%xmm0 \n"\
+    "vpmovzxbw %%xmm0, %%ymm0            \n"\
+    "vpmaddwd  "#i"*32(%[coef]), %%ymm0, %%ymm0 \n"\
+    "vpaddd    %%ymm0, "acc", "acc"      \n"
+
+static void hscale_avx2(int16_t *dst, const uint8_t *src, const struct scaler *s)
+{
+    const int16_t *coef = s->coef_avx2;
+    int chunks = s->stride >> 3;
+    int w = s->dst & ~7;
+    int x;
+
+    for (x = 0; x < w; x += 8) {
+        const uint8_t *in = src;
+        x86_reg tmp, cnt = chunks;
+        __asm__ volatile(
+            "vpxor  %%ymm4, %%ymm4, %%ymm4 \n"
+            "vpxor  %%ymm5, %%ymm5, %%ymm5 \n"
+            "vpxor  %%ymm6, %%ymm6, %%ymm6 \n"
+            "vpxor  %%ymm7, %%ymm7, %%ymm7 \n"
+            "1:                            \n"
+            HSCALE_PAIR(0, "%%ymm4")
+            HSCALE_PAIR(1, "%%ymm5")
+            HSCALE_PAIR(2, "%%ymm6")
+            HSCALE_PAIR(3, "%%ymm7")
+            "add    $8, %[src]             \n"
+            "add    $128, %[coef]          \n"
+            "dec    %[cnt]                 \n"
+            "jnz 1b                        \n"
+            "vphaddd %%ymm5, %%ymm4, %%ymm4 \n"
+            "vphaddd %%ymm7, %%ymm6, %%ymm6 \n"
+            "vphaddd %%ymm6, %%ymm4, %%ymm4 \n"
+            "vpbroadcastd %[round], %%ymm0 \n"
+            "vpaddd  %%ymm0, %%ymm4, %%ymm4 \n"
+            "vpsrad  $8, %%ymm4, %%ymm4 \n" // COEF_BITS - MID_BITS
+            "vpackssdw %%ymm4, %%ymm4, %%ymm4 \n"
+            "vpermq  $0x08, %%ymm4, %%ymm4 \n"
+            "vmovdqu %%xmm4, (%[dst])      \n"
+            :[src]"+r"(in), [coef]"+r"(coef), [cnt]"+r"(cnt), [tmp]"=&r"(tmp)
+            :[pos]"r"(s->pos + x), [dst]"r"(dst + x), [round]"m"(pd_hround)
+            :"memory", "xmm0", "xmm4", "xmm5", "xmm6", "xmm7"
+        );
+    }
+    __asm__ volatile ("vzeroupper\n\t");
+
+    hscale_from(dst, src, s, x);
+}
+
+/* Vertical pass, 16 output pixels per iteration: interleave two rows and
+ * multiply-add them with the matching pair of coefficients. */
+static void vscale_avx2(uint8_t *dst, const int16_t **src, const int16_t *coef,
+                        int size, int w)
+{
+    x86_reg x;
+    for (x = 0; x < (w & ~15); x += 16) {
+        x86_reg t = 0, row0, row1;
+        __asm__ volatile(
+            "vpbroadcastd %[round], %%ymm4       \n"
+            "vmovdqa %%ymm4, %%ymm5              \n"
+            "1:                                  \n"
+            "mov     (%[src],%[t],8), %[row0]    \n"
+            "mov    8(%[src],%[t],8), %[row1]    \n"
+            "vmovdqu (%[row0],%[x],2), %%ymm0    \n"
+            "vmovdqu (%[row1],%[x],2), %%ymm1    \n"
+            "vpbroadcastd (%[coef],%[t],2), %%ymm3 \n"
+            "vpunpcklwd %%ymm1, %%ymm0, %%ymm2   \n"
+            "vpunpckhwd %%ymm1, %%ymm0, %%ymm0   \n"
+            "vpmaddwd %%ymm3, %%ymm2, %%ymm2     \n"
+            "vpmaddwd %%ymm3, %%ymm0, %%ymm0     \n"
+            "vpaddd  %%ymm2, %%ymm4, %%ymm4      \n"
+            "vpaddd  %%ymm0, %%ymm5, %%ymm5      \n"
+            "add     $2, %[t]                    \n"
+            "cmp     %[size], %[t]               \n"
+            "jl 1b                               \n"
+            "vpsrad  $20, %%ymm4, %%ymm4 \n" // COEF_BITS + MID_BITS
+            "vpsrad  $20, %%ymm5, %%ymm5 \n"
+            "vpackssdw %%ymm5, %%ymm4, %%ymm4    \n"
+            "vpackuswb %%ymm4, %%ymm4, %%ymm4    \n"
+            "vpermq  $0x08, %%ymm4, %%ymm4       \n"
+            "vmovdqu %%xmm4, (%[dst],%[x])       \n"
+            :[t]"+r"(t), [row0]"=&r"(row0), [row1]"=&r"(row1)
+            :[src]"r"(src), [coef]"r"(coef), [size]"r"((x86_reg)size),
+             [x]"r"(x), [dst]"r"(dst), [round]"m"(pd_vround)
+            :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5"
+        );
+    }
+    __asm__ volatile ("vzeroupper\n\t");
+
+    vscale_from(dst, src, coef, size, x, w);
+}
+#endif // HAVE_AVX2 && ARCH_X86_64
+
+static void free_scaler(struct scaler *s)
+{
+    av_freep(&s->pos);
+    av_freep(&s->coef);
+    av_freep(&s->coef_avx2);
+}
+
+/* Like mp_compute_weights(), but taps beyond the kernel's support get no
+ * weight. The tap count is rounded up to the next available size, and some
+ * kernels (bilinear_slow) go strongly negative outside their support; the
+ * normalized weights then grow far beyond the int16 coefficient range. */
+static void compute_weights(struct filter_kernel *f, double frac, float *w)
+{
+    double sum = 0;
+    int t;
+    for (t = 0; t < f->size; t++) {
+        double x = fabs(frac - (t - f->size / 2 + 1)) / f->inv_scale;
+        w[t] = x < f->radius ? f->weight(f, x) : 0;
+        sum += w[t];
+    }
+    for (t = 0; t < f->size; t++)
+        w[t] /= sum;
+}
+
+static int init_scaler(struct scaler *s, const struct filter_kernel *kernel,
+                       int src, int dst, int pad)
+{
+    struct filter_kernel f = *kernel;
+    double scale = (double)src / dst;
+    float w[MAX_SIZE];
+    int x, t;
+
+    free_scaler(s);
+    mp_init_filter(&f, filter_sizes, FFMAX(1.0, scale));
+    s->src = src;
+    s->dst = dst;
+    s->size = f.size;
+    s->stride = FFALIGN(f.size, 8);
+    s->pos = av_malloc(dst * sizeof(int));
+    s->coef = av_mallocz(dst * s->stride * sizeof(int16_t));
+    if (!s->pos || !s->coef)
+        return 0;
+
+    for (x = 0; x < dst; x++) {
+        double c = (x + 0.5) * scale - 0.5;
+        int base = floor(c);
+        int16_t *coef = s->coef + x * s->stride;
+        int sum = 0, center = 0;
+        compute_weights(&f, c - base, w);
+        // quantize, and put the rounding error into the largest tap
+        for (t = 0; t < s->size; t++) {
+            int v = lrintf(w[t] * (1 << COEF_BITS));
+            if (v < INT16_MIN || v > INT16_MAX)
+                goto range_error;
+            coef[t] = v;
+            sum += coef[t];
+            if (abs(coef[t]) > abs(coef[center]))
+                center = t;
+        }
+        if (coef[center] + (1 << COEF_BITS) - sum > INT16_MAX ||
+            coef[center] + (1 << COEF_BITS) - sum < INT16_MIN)
+            goto range_error;
+        coef[center] += (1 << COEF_BITS) - sum;
+        s->pos[x] = base - s->size / 2 + 1 + pad;
+    }
+    return 1;
+
+range_error:
+    mp_msg(MSGT_VFILTER, MSGL_ERR, "kscale: filter %s can't scale %d to %d\n",
+           kernel->name, src, dst);
+    return 0;
+}
+
+static int init_avx2_coefs(struct scaler *s)
+{
+    int chunks = s->stride >> 3;
+    int x, j, i;
+    s->coef_avx2 = av_malloc((s->dst & ~7) * s->stride * sizeof(int16_t));
+    if (!s->coef_avx2)
+        return 0;
+    for (x = 0; x < (s->dst & ~7); x += 8)
+        for (j = 0; j < chunks; j++)
+            for (i = 0; i < 8; i++) {
+                int16_t *out = s->coef_avx2 + (x * chunks + j * 8 +
+                                               (i & 3) * 2 + (i >> 2)) * 8;
+                memcpy(out, s->coef + (x + i) * s->stride + j * 8,
+                       8 * sizeof(int16_t));
+            }
+    return 1;
+}
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void scale_plane(struct vf_priv_s *p, int index, const uint8_t *src,
+                        int src_stride, uint8_t *dst, int dst_stride,
+                        const struct scaler *hs, const struct scaler *vs,
+                        int y0, int y1)
+{
+    uint8_t *line = p->line[index];
+    int16_t *ring = p->ring[index];
+    const int16_t *rows[MAX_SIZE];
+    int tag[MAX_SIZE];
+    int y, t;
+
+    for (t = 0; t < vs->size; t++)
+        tag[t] = -1;
+
+    for (y = y0; y < y1; y++) {
+        for (t = 0; t < vs->size; t++) {
+            int r = av_clip(vs->pos[y] + t, 0, vs->src - 1);
+            int slot = r % vs->size;
+            int16_t *row = ring + slot * FFALIGN(hs->dst, 16);
+            if (tag[slot] != r) {
+                const uint8_t *in = src + r * src_stride;
+                memset(line, in[0], p->pad);
+                memcpy(line + p->pad, in, hs->src);
+                memset(line + p->pad + hs->src, in[hs->src - 1], p->pad);
+                p->hscale(row, line, hs);
+                tag[slot] = r;
+            }
+            rows[t] = row;
+        }
+        p->vscale(dst + y * dst_stride, rows, vs->coef + y * vs->stride,
+                  vs->size, hs->dst);
+    }
+}
+
+static void kscale_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    int plane;
+
+    for (plane = 0; plane < p->planes; plane++) {
+        int c = !!plane;
+        int ys = plane ? dmpi->chroma_y_shift : 0;
+        int py0 = y0 >> ys;
+        int py1 = y1 == dmpi->h ? p->vs[c].dst : y1 >> ys;
+        scale_plane(p, index, mpi->planes[plane], mpi->stride[plane],
+                    dmpi->planes[plane], dmpi->stride[plane],
+                    &p->hs[c], &p->vs[c], py0, py1);
+    }
+}
+
+static void free_buffers(struct vf_priv_s *p)
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+        free_scaler(&p->hs[i]);
+        free_scaler(&p->vs[i]);
+    }
+    for (i = 0; i < VF_MAX_SLICES; i++) {
+        av_freep(&p->line[i]);
+        av_freep(&p->ring[i]);
+    }
+}
+
+static int config(struct vf_instance *vf,
+                  int width, int height, int d_width, int d_height,
+                  unsigned int flags, unsigned int outfmt)
+{
+    struct vf_priv_s *p = vf->priv;
+    int w = p->cfg_w, h = p->cfg_h;
+    int xs, ys, i;
+
+    if (w <= 0 && h <= 0) {
+        w = width;
+        h = height;
+    } else if (w <= 0) {
+        w = lrint((double)h * d_width / d_height);
+    } else if (h <= 0) {
+        h = lrint((double)w * d_height / d_width);
+    }
+
+    mp_get_chroma_shift(outfmt, &xs, &ys, NULL);
+    p->planes = outfmt == IMGFMT_Y800 || outfmt == IMGFMT_Y8 ? 1 : 3;
+    if (p->planes == 1)
+        xs = ys = 0;
+    // the chroma planes must have a whole number of pixels
+    w = FFMAX(1 << xs, w & ~((1 << xs) - 1));
+    h = FFMAX(1 << ys, h & ~((1 << ys) - 1));
+
+    free_buffers(p);
+    p->pad = MAX_SIZE;
+    for (i = 0; i < p->planes && i < 2; i++) {
+        int sw = i ? -((-width)  >> xs) : width;
+        int sh = i ? -((-height) >> ys) : height;
+        if (!init_scaler(&p->hs[i], &p->kernel[i], sw, w >> (i ? xs : 0), p->pad) ||
+            !init_scaler(&p->vs[i], &p->kernel[i], sh, h >> (i ? ys : 0), 0))
+            return 0;
+#if HAVE_AVX2 && ARCH_X86_64
+        if (p->hscale == hscale_avx2 && !init_avx2_coefs(&p->hs[i]))
+            return 0;
+#endif
+    }
+    for (i = 0; i < vf_slice_threads(vf); i++) {
+        p->line[i] = av_malloc(width + 2 * p->pad);
+        p->ring[i] = av_malloc(FFMAX(p->vs[0].size, p->vs[1].size) *
+                               FFALIGN(w, 16) * sizeof(int16_t));
+        if (!p->line[i] || !p->ring[i])
+            return 0;
+    }
+
+    mp_msg(MSGT_VFILTER, MSGL_V, "kscale: %dx%d -> %dx%d, %d:%d taps\n",
+           width, height, w, h, p->hs[0].size, p->vs[0].size);
+
+    return vf_next_config(vf, w, h, d_width, d_height, flags, outfmt);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct vf_priv_s *p = vf->priv;
+    struct slice_job job;
+    mp_image_t *dmpi;
+
+    dmpi = vf_get_image(vf->next, mpi->imgfmt, MP_IMGTYPE_TEMP,
+                        MP_IMGFLAG_ACCEPT_STRIDE | MP_IMGFLAG_PREFER_ALIGNED_STRIDE,
+                        p->hs[0].dst, p->vs[0].dst);
+    vf_clone_mpi_attributes(dmpi, mpi);
+
+    job = (struct slice_job){ p, mpi, dmpi };
+    vf_run_slices(vf, dmpi->h, p->planes > 1 ? 1 << dmpi->chroma_y_shift : 1,
+                  kscale_slice, &job);
+
+    return vf_next_put_image(vf, dmpi, pts);
+}
+
+static int query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    switch (fmt) {
+    case IMGFMT_YV12:
+    case IMGFMT_I420:
+    case IMGFMT_IYUV:
+    case IMGFMT_YVU9:
+    case IMGFMT_444P:
+    case IMGFMT_422P:
+    case IMGFMT_411P:
+    case IMGFMT_Y800:
+    case IMGFMT_Y8:
+        return vf_next_query_format(vf, fmt);
+    }
+    return 0;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    if (!p)
+        return;
+    free_buffers(p);
+    free(p);
+    vf->priv = NULL;
+}
+
+static int init_kernel(struct filter_kernel *kernel, const char *name,
+                       const float *params, int num_params)
+{
+    const struct filter_kernel *k = mp_find_filter_kernel(name);
+    int n;
+    if (!k) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "kscale: unknown filter '%s'. Available:", name);
+        for (k = mp_filter_kernels; k->name; k++)
+            mp_msg(MSGT_VFILTER, MSGL_ERR, " %s", k->name);
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "\n");
+        return 0;
+    }
+    *kernel = *k;
+    for (n = 0; n < num_params; n++)
+        kernel->params[n] = params[n];
+    return 1;
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p;
+    int num_params = 0;
+
+    vf->config = config;
+    vf->put_image = put_image;
+    vf->query_format = query_format;
+    vf->uninit = uninit;
+    vf->priv = p = calloc(1, sizeof(struct vf_priv_s));
+    if (!p)
+        return 0;
+
+    strcpy(p->kernel_name[0], "spline36");
+    p->kernel_name[1][0] = '\0';
+    // count the given parameters; NaN can't mark them as unset, since
+    // -ffast-math folds isnan() to 0
+    if (args)
+        num_params = sscanf(args, "%d:%d:%31[^:]:%31[^:]:%f:%f",
+                            &p->cfg_w, &p->cfg_h, p->kernel_name[0],
+                            p->kernel_name[1], &p->params[0],
+                            &p->params[1]) - 4;
+    num_params = av_clip(num_params, 0, 2);
+    if (!p->kernel_name[1][0])
+        strcpy(p->kernel_name[1], p->kernel_name[0]);
+    if (!init_kernel(&p->kernel[0], p->kernel_name[0], p->params, num_params) ||
+        !init_kernel(&p->kernel[1], p->kernel_name[1], p->params, num_params))
+        return 0;
+
+    p->hscale = hscale_c;
+    p->vscale = vscale_c;
+#if HAVE_AVX2 && ARCH_X86_64
+    if (gCpuCaps.hasAVX2) {
+        p->hscale = hscale_avx2;
+        p->vscale = vscale_avx2;
+    }
+#endif
+
+    return 1;
+}
+
+const vf_info_t vf_info_kscale = {
+    "scale with the vo_gl3 filter kernels",
+    "kscale",
+    "",
+    "",
+    vf_open,
+    NULL
+};
@@ -0,0 +1,581 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Motion compensated temporal denoiser:
+ * Keep references to the last few input frames.
+ * Foreach 8x8 luma block, find the best match in every reference frame
+ * (predictive search: zero, left neighbour, same block in the previous
+ * frame, scaled vector of the next nearer reference; then a small diamond
+ * refinement). References whose best match is still far off are dropped.
+ * Average each pixel with its matches, weighted by how close they are to
+ * it, so that remaining mismatches don't ghost.
+ * No output delay, so it is usable for playback.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "cpudetect.h"
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+#define MAX_REFS 8
+#define BLOCK 8
+// weight of a match falls to 0 at a difference of RADIUS*strength
+#define RADIUS 3
+
+struct mv {
+    int16_t x, y;
+    int sad;
+};
+
+struct vf_priv_s {
+    int frames;
+    int range;
+    int block_thresh;   // max SAD per pixel of a usable match
+    // luma/chroma: q, radius and 64 for weight(d) = 64 - (min(d,radius)*q)^2/2^16
+    uint16_t __attribute__((aligned(16))) weight[2][3][8];
+    mp_image_t *ref[MAX_REFS]; // previous input frames, newest first
+    int num_refs, prev_refs;
+    int bw, bh;         // size of the block grid
+    struct mv *mv[2];   // this and the previous frame, [ref][by][bx]
+    int (*sad8x8)(const uint8_t *a, const uint8_t *b, int as, int bs);
+};
+
+static int sad_c(const uint8_t *a, const uint8_t *b, int as, int bs,
+                 int w, int h)
+{
+    int x, y, sad = 0;
+    for (y = 0; y < h; y++, a += as, b += bs)
+        for (x = 0; x < w; x++)
+            sad += abs(a[x] - b[x]);
+    return sad;
+}
+
+static int sad8x8_c(const uint8_t *a, const uint8_t *b, int as, int bs)
+{
+    return sad_c(a, b, as, bs, 8, 8);
+}
+
+#if HAVE_MMX2
+#define SAD_MMX2_2ROWS \
+        "movq        (%1), %%mm0 \n" \
+        "movq     (%1,%3), %%mm1 \n" \
+        "psadbw      (%2), %%mm0 \n" \
+        "psadbw   (%2,%4), %%mm1 \n" \
+        "lea    (%1,%3,2), %1    \n" \
+        "lea    (%2,%4,2), %2    \n" \
+        "paddw      %%mm0, %%mm2 \n" \
+        "paddw      %%mm1, %%mm2 \n"
+
+static int sad8x8_mmx2(const uint8_t *a, const uint8_t *b, int as, int bs)
+{
+    int sad;
+    __asm__ volatile(
+        "pxor       %%mm2, %%mm2 \n"
+        SAD_MMX2_2ROWS
+        SAD_MMX2_2ROWS
+        SAD_MMX2_2ROWS
+        SAD_MMX2_2ROWS
+        "movd       %%mm2, %0    \n"
+        :"=m"(sad), "+r"(a), "+r"(b)
+        :"r"((x86_reg)as), "r"((x86_reg)bs)
+        :"memory", "mm0", "mm1", "mm2"
+    );
+    return sad;
+}
+#endif
+
+#if HAVE_SSE2
+// two rows per register; psadbw with a memory operand would need alignment
+#define SAD_SSE2_4ROWS \
+        "movq        (%1), %%xmm0 \n" \
+        "movhps   (%1,%3), %%xmm0 \n" \
+        "movq        (%2), %%xmm1 \n" \
+        "movhps   (%2,%4), %%xmm1 \n" \
+        "lea    (%1,%3,2), %1     \n" \
+        "lea    (%2,%4,2), %2     \n" \
+        "movq        (%1), %%xmm2 \n" \
+        "movhps   (%1,%3), %%xmm2 \n" \
+        "movq        (%2), %%xmm3 \n" \
+        "movhps   (%2,%4), %%xmm3 \n" \
+        "lea    (%1,%3,2), %1     \n" \
+        "lea    (%2,%4,2), %2     \n" \
+        "psadbw    %%xmm1, %%xmm0 \n" \
+        "psadbw    %%xmm3, %%xmm2 \n" \
+        "paddw     %%xmm0, %%xmm4 \n" \
+        "paddw     %%xmm2, %%xmm4 \n"
+
+static int sad8x8_sse2(const uint8_t *a, const uint8_t *b, int as, int bs)
+{
+    int sad;
+    __asm__ volatile(
+        "pxor      %%xmm4, %%xmm4 \n"
+        SAD_SSE2_4ROWS
+        SAD_SSE2_4ROWS
+        "movhlps   %%xmm4, %%xmm0 \n"
+        "paddw     %%xmm0, %%xmm4 \n"
+        "movd      %%xmm4, %0     \n"
+        :"=m"(sad), "+r"(a), "+r"(b)
+        :"r"((x86_reg)as), "r"((x86_reg)bs)
+        :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4"
+    );
+    return sad;
+}
+#endif
+
+struct block {
+    const uint8_t *cur, *ref;
+    int stride, ref_stride;
+    int x, y, w, h;     // block position and size
+    int pw, ph;         // plane size
+    int range;
+};
+
+static int block_sad(struct vf_priv_s *p, const struct block *b, int mx, int my)
+{
+    const uint8_t *cur = b->cur + b->y * b->stride + b->x;
+    const uint8_t *ref = b->ref + (b->y + my) * b->ref_stride + b->x + mx;
+    if (b->w == BLOCK && b->h == BLOCK)
+        return p->sad8x8(cur, ref, b->stride, b->ref_stride);
+    return sad_c(cur, ref, b->stride, b->ref_stride, b->w, b->h);
+}
+
+static void check_mv(struct vf_priv_s *p, const struct block *b,
+                     struct mv *best, int mx, int my)
+{
+    int sad;
+    mx = av_clip(mx, FFMAX(-b->range, -b->x), FFMIN(b->range, b->pw - b->w - b->x));
+    my = av_clip(my, FFMAX(-b->range, -b->y), FFMIN(b->range, b->ph - b->h - b->y));
+    if (mx == best->x && my == best->y)
+        return;
+    sad = block_sad(p, b, mx, my);
+    if (sad < best->sad)
+        *best = (struct mv){ mx, my, sad };
+}
+
+static struct mv search(struct vf_priv_s *p, const struct block *b,
+                        const struct mv *cand, int num_cand)
+{
+    struct mv best = { 0, 0, block_sad(p, b, 0, 0) };
+    int i, dx = 0, dy = 0;
+
+    for (i = 0; i < num_cand; i++)
+        check_mv(p, b, &best, cand[i].x, cand[i].y);
+
+    // diamond refinement, skipping the point we came from
+    for (i = 0; i < 2 * b->range; i++) {
+        struct mv c = best;
+        if (dx != 1)
+            check_mv(p, b, &best, c.x - 1, c.y);
+        if (dx != -1)
+            check_mv(p, b, &best, c.x + 1, c.y);
+        if (dy != 1)
+            check_mv(p, b, &best, c.x, c.y - 1);
+        if (dy != -1)
+            check_mv(p, b, &best, c.x, c.y + 1);
+        dx = best.x - c.x;
+        dy = best.y - c.y;
+        if (!dx && !dy)
+            break;
+    }
+    return best;
+}
+
+/* Weight of a match is 64 - (d*q)^2 / 2^16 for a pixel difference d,
+ * falling to 0 at d = radius (q = 2048/radius). The current pixel itself
+ * has weight 64. */
+static void filter_block_c(uint8_t *dst, int dstride,
+                           const uint8_t *cur, int stride,
+                           const uint8_t *const *refs, const int *ref_strides,
+                           int num_refs, int w, int h, const uint16_t (*weight)[8])
+{
+    int q = weight[0][0], radius = weight[1][0];
+    int x, y, k;
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; x++) {
+            int c = cur[x];
+            int sum = c * 64, wsum = 64;
+            for (k = 0; k < num_refs; k++) {
+                int r = refs[k][y * ref_strides[k] + x];
+                int d = FFMIN(abs(c - r), radius) * q;
+                int wt = 64 - (d * d >> 16);
+                sum  += wt * r;
+                wsum += wt;
+            }
+            dst[x] = lrintf((float)sum / (float)wsum);
+        }
+        dst += dstride;
+        cur += stride;
+    }
+}
+
+#if HAVE_SSE2 && HAVE_6REGS
+/* 8 pixels, from two 4 pixel runs; src[0], src[1] are the current pixels,
+ * then follow num_refs pairs for the matches. Same result as the C code. */
+static void filter8_sse2(uint8_t *dst0, uint8_t *dst1, const uint8_t **src,
+                         x86_reg num_refs, const uint16_t (*weight)[8])
+{
+    x86_reg tmp;
+    __asm__ volatile(
+        "pxor         %%xmm7, %%xmm7 \n"
+        "mov            (%1), %0     \n"
+        "movd           (%0), %%xmm0 \n"
+        "mov         %c6(%1), %0     \n"
+        "movd           (%0), %%xmm1 \n"
+        "punpckldq    %%xmm1, %%xmm0 \n"
+        "punpcklbw    %%xmm7, %%xmm0 \n" // c
+        "movdqa       %%xmm0, %%xmm4 \n"
+        "psllw            $6, %%xmm4 \n"
+        "movdqa       %%xmm4, %%xmm5 \n"
+        "punpcklwd    %%xmm7, %%xmm4 \n"
+        "punpckhwd    %%xmm7, %%xmm5 \n" // sum = c*64
+        "movdqa       32(%5), %%xmm3 \n" // wsum = 64
+        "test             %2, %2     \n"
+        "jz 2f                       \n"
+        "1:                          \n"
+        "add         $2*%c6, %1      \n"
+        "mov            (%1), %0     \n"
+        "movd           (%0), %%xmm1 \n"
+        "mov         %c6(%1), %0     \n"
+        "movd           (%0), %%xmm2 \n"
+        "punpckldq    %%xmm2, %%xmm1 \n"
+        "punpcklbw    %%xmm7, %%xmm1 \n" // r
+        "movdqa       %%xmm0, %%xmm2 \n"
+        "psubw        %%xmm1, %%xmm2 \n"
+        "pxor         %%xmm6, %%xmm6 \n"
+        "psubw        %%xmm2, %%xmm6 \n"
+        "pmaxsw       %%xmm6, %%xmm2 \n" // d = |c-r|
+        "pminsw       16(%5), %%xmm2 \n"
+        "pmullw         (%5), %%xmm2 \n"
+        "pmulhuw      %%xmm2, %%xmm2 \n"
+        "movdqa       32(%5), %%xmm6 \n"
+        "psubw        %%xmm2, %%xmm6 \n" // weight
+        "paddw        %%xmm6, %%xmm3 \n"
+        "pmullw       %%xmm6, %%xmm1 \n"
+        "movdqa       %%xmm1, %%xmm2 \n"
+        "punpcklwd    %%xmm7, %%xmm1 \n"
+        "punpckhwd    %%xmm7, %%xmm2 \n"
+        "paddd        %%xmm1, %%xmm4 \n"
+        "paddd        %%xmm2, %%xmm5 \n"
+        "dec              %2         \n"
+        "jnz 1b                      \n"
+        "2:                          \n"
+        "movdqa       %%xmm3, %%xmm6 \n"
+        "punpcklwd    %%xmm7, %%xmm3 \n"
+        "punpckhwd    %%xmm7, %%xmm6 \n"
+        "cvtdq2ps     %%xmm4, %%xmm4 \n"
+        "cvtdq2ps     %%xmm5, %%xmm5 \n"
+        "cvtdq2ps     %%xmm3, %%xmm3 \n"
+        "cvtdq2ps     %%xmm6, %%xmm6 \n"
+        "divps        %%xmm3, %%xmm4 \n"
+        "divps        %%xmm6, %%xmm5 \n"
+        "cvtps2dq     %%xmm4, %%xmm4 \n"
+        "cvtps2dq     %%xmm5, %%xmm5 \n"
+        "packssdw     %%xmm5, %%xmm4 \n"
+        "packuswb     %%xmm4, %%xmm4 \n"
+        "movd         %%xmm4, (%3)   \n"
+        "psrlq           $32, %%xmm4 \n"
+        "movd         %%xmm4, (%4)   \n"
+        :"=&r"(tmp), "+r"(src), "+r"(num_refs)
+        :"r"(dst0), "r"(dst1), "r"(weight), "i"(sizeof(*src))
+        :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+         "xmm7"
+    );
+}
+#endif
+
+static void filter_block(uint8_t *dst, int dstride,
+                         const uint8_t *cur, int stride,
+                         const uint8_t *const *refs, const int *ref_strides,
+                         int num_refs, int w, int h, const uint16_t (*weight)[8])
+{
+#if HAVE_SSE2 && HAVE_6REGS
+    // whole rows of 8, or pairs of rows of 4
+    if (gCpuCaps.hasSSE2 && (w == 8 || (w == 4 && !(h & 1)))) {
+        const uint8_t *src[2 * (MAX_REFS + 1)];
+        int y, k, step = w == 8 ? 0 : 1;
+        for (y = 0; y < h; y += 1 + step) {
+            src[0] = cur + y * stride;
+            src[1] = step ? src[0] + stride : src[0] + 4;
+            for (k = 0; k < num_refs; k++) {
+                src[2*k+2] = refs[k] + y * ref_strides[k];
+                src[2*k+3] = step ? src[2*k+2] + ref_strides[k] : src[2*k+2] + 4;
+            }
+            filter8_sse2(dst + y * dstride,
+                         step ? dst + (y + 1) * dstride : dst + y * dstride + 4,
+                         src, num_refs, weight);
+        }
+        return;
+    }
+#endif
+    filter_block_c(dst, dstride, cur, stride, refs, ref_strides,
+                   num_refs, w, h, weight);
+}
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+    int planes;
+};
+
+static void mctf_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    struct mv *mv = p->mv[0], *prev = p->mv[1];
+    int grid = p->bw * p->bh;
+    int bx, by, k, plane;
+
+    for (by = y0 / BLOCK; by < (y1 + BLOCK - 1) / BLOCK; by++) {
+        for (bx = 0; bx < p->bw; bx++) {
+            int b = by * p->bw + bx;
+            int x = bx * BLOCK, y = by * BLOCK;
+            int w = FFMIN(BLOCK, mpi->w - x), h = FFMIN(BLOCK, mpi->h - y);
+            struct { int x, y, ref; } use[MAX_REFS];
+            int num_use = 0;
+
+            for (k = 0; k < p->num_refs; k++) {
+                struct block blk = {
+                    mpi->planes[0], p->ref[k]->planes[0],
+                    mpi->stride[0], p->ref[k]->stride[0],
+                    x, y, w, h, mpi->w, mpi->h, p->range,
+                };
+                struct mv cand[3], best;
+                int n = 0;
+                if (bx > 0)
+                    cand[n++] = mv[k * grid + b - 1];
+                if (k < p->prev_refs)
+                    cand[n++] = prev[k * grid + b];
+                if (k > 0) {
+                    struct mv m = mv[(k - 1) * grid + b];
+                    cand[n++] = (struct mv){ m.x * (k + 1) / k, m.y * (k + 1) / k };
+                }
+                best = search(p, &blk, cand, n);
+                mv[k * grid + b] = best;
+                if (best.sad <= p->block_thresh * w * h) {
+                    use[num_use].x = best.x;
+                    use[num_use].y = best.y;
+                    use[num_use++].ref = k;
+                }
+            }
+#if HAVE_MMX2
+            // leave the MMX state before filter_block_c uses the FPU
+            if (p->sad8x8 == sad8x8_mmx2)
+                __asm__ volatile ("emms\n\t");
+#endif
+
+            for (plane = 0; plane < job->planes; plane++) {
+                int xs = plane ? mpi->chroma_x_shift : 0;
+                int ys = plane ? mpi->chroma_y_shift : 0;
+                int pw = plane ? mpi->chroma_width  : mpi->w;
+                int ph = plane ? mpi->chroma_height : mpi->h;
+                int cx = x >> xs, cy = y >> ys;
+                // rounded up, but odd sizes have no chroma for the last row
+                // or column
+                int cw = FFMIN((x + w + (1 << xs) - 1) >> xs, pw) - cx;
+                int ch = FFMIN((y + h + (1 << ys) - 1) >> ys, ph) - cy;
+                const uint8_t *refs[MAX_REFS];
+                int ref_strides[MAX_REFS];
+                if (cw <= 0 || ch <= 0)
+                    continue;
+                for (k = 0; k < num_use; k++) {
+                    mp_image_t *ref = p->ref[use[k].ref];
+                    int mx = av_clip(use[k].x >> xs, -cx, pw - cw - cx);
+                    int my = av_clip(use[k].y >> ys, -cy, ph - ch - cy);
+                    ref_strides[k] = ref->stride[plane];
+                    refs[k] = ref->planes[plane] + (cy + my) * ref_strides[k] + cx + mx;
+                }
+                filter_block(dmpi->planes[plane] + cy * dmpi->stride[plane] + cx,
+                             dmpi->stride[plane],
+                             mpi->planes[plane] + cy * mpi->stride[plane] + cx,
+                             mpi->stride[plane], refs, ref_strides, num_use,
+                             cw, ch, p->weight[!!plane]);
+            }
+        }
+    }
+}
+
+static void free_refs(struct vf_priv_s *p)
+{
+    int k;
+    for (k = 0; k < p->num_refs; k++) {
+        free_mp_image(p->ref[k]);
+        p->ref[k] = NULL;
+    }
+    p->num_refs = p->prev_refs = 0;
+}
+
+static int config(struct vf_instance *vf,
+                  int width, int height, int d_width, int d_height,
+                  unsigned int flags, unsigned int outfmt)
+{
+    struct vf_priv_s *p = vf->priv;
+    int i;
+
+    free_refs(p);
+    p->bw = (width  + BLOCK - 1) / BLOCK;
+    p->bh = (height + BLOCK - 1) / BLOCK;
+    for (i = 0; i < 2; i++) {
+        free(p->mv[i]);
+        p->mv[i] = calloc(MAX_REFS * p->bw * p->bh, sizeof(struct mv));
+        if (!p->mv[i])
+            return 0;
+    }
+
+    return vf_next_config(vf, width, height, d_width, d_height, flags, outfmt);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct vf_priv_s *p = vf->priv;
+    mp_image_t *dmpi, *ref;
+    struct slice_job job;
+    struct mv *tmp;
+    int k;
+
+    if (p->num_refs && (p->ref[0]->w != mpi->w || p->ref[0]->h != mpi->h))
+        free_refs(p);
+
+    if (p->num_refs) {
+        dmpi = vf_get_image(vf->next, mpi->imgfmt, MP_IMGTYPE_TEMP,
+                            MP_IMGFLAG_ACCEPT_STRIDE | MP_IMGFLAG_PREFER_ALIGNED_STRIDE,
+                            mpi->w, mpi->h);
+        vf_clone_mpi_attributes(dmpi, mpi);
+
+        job = (struct slice_job){ p, mpi, dmpi, mpi->flags & MP_IMGFLAG_PLANAR ? 3 : 1 };
+        vf_run_slices(vf, mpi->h, BLOCK, mctf_slice, &job);
+
+        tmp = p->mv[0];
+        p->mv[0] = p->mv[1];
+        p->mv[1] = tmp;
+        p->prev_refs = p->num_refs;
+    } else
+        dmpi = mpi; // nothing to filter with yet
+
+    // Keep a reference to the input instead of a copy; it is only read.
+    ref = mp_image_new_ref(mpi);
+    if (p->num_refs == p->frames)
+        free_mp_image(p->ref[--p->num_refs]);
+    for (k = p->num_refs; k > 0; k--)
+        p->ref[k] = p->ref[k - 1];
+    p->ref[0] = ref;
+    p->num_refs++;
+    if (!ref)
+        free_refs(p);
+
+    return vf_next_put_image(vf, dmpi, pts);
+}
+
+static int query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    switch (fmt) {
+    case IMGFMT_YV12:
+    case IMGFMT_I420:
+    case IMGFMT_IYUV:
+    case IMGFMT_YVU9:
+    case IMGFMT_444P:
+    case IMGFMT_422P:
+    case IMGFMT_411P:
+    case IMGFMT_Y800:
+    case IMGFMT_Y8:
+        return vf_next_query_format(vf, fmt);
+    }
+    return 0;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    if (!p)
+        return;
+    free_refs(p);
+    free(p->mv[0]);
+    free(p->mv[1]);
+    av_free(p);
+    vf->priv = NULL;
+}
+
+static void init_weights(uint16_t (*weight)[8], double strength)
+{
+    int radius = av_clip(lrint(RADIUS * strength), 1, 255);
+    int i;
+    for (i = 0; i < 8; i++) {
+        weight[0][i] = 2048 / radius;
+        weight[1][i] = radius;
+        weight[2][i] = 64;
+    }
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p;
+    double luma = 6.0, chroma = 4.0;
+    int frames = 3, range = 16;
+
+    vf->config = config;
+    vf->put_image = put_image;
+    vf->query_format = query_format;
+    vf->uninit = uninit;
+    vf->priv = p = av_mallocz(sizeof(struct vf_priv_s));
+    if (!p)
+        return 0;
+
+    if (args)
+        sscanf(args, "%d:%lf:%lf:%d", &frames, &luma, &chroma, &range);
+    p->frames = av_clip(frames, 1, MAX_REFS);
+    p->range = av_clip(range, 0, 64);
+    p->block_thresh = FFMAX(1, lrint(3 * luma));
+    init_weights(p->weight[0], luma);
+    init_weights(p->weight[1], chroma);
+
+    p->sad8x8 = sad8x8_c;
+#if HAVE_MMX2
+    if (gCpuCaps.hasMMX2)
+        p->sad8x8 = sad8x8_mmx2;
+#endif
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2)
+        p->sad8x8 = sad8x8_sse2;
+#endif
+
+    mp_msg(MSGT_VFILTER, MSGL_V, "mctf: %d frames, strength %.1f:%.1f, range %d\n",
+           p->frames, luma, chroma, p->range);
+    return 1;
+}
+
+const vf_info_t vf_info_mctf = {
+    "motion compensated temporal denoiser",
+    "mctf",
+    "",
+    "",
+    vf_open,
+    NULL
+};
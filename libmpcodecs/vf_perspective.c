@@ -28,6 +28,7 @@
 #include "config.h"
 #include "mp_msg.h"
 
+#include "libavutil/common.h"
 #include "libavutil/mem.h"
 
 #include "img_format.h"
@@ -40,11 +41,16 @@
 
 //===========================================================================//
 
+// output is resampled in tiles, to keep the source area of each in cache
+#define TILE 32
+
 struct vf_priv_s {
 	double ref[4][2];
 	int32_t coeff[1<<SUB_PIXEL_BITS][4];
-	int32_t (*pv)[2];
+	int32_t (*pv)[2];   // source position of each luma pixel, in sub pixels
+	int32_t (*pvc)[2];  // same for chroma, already shifted
 	int pvStride;
+	int pvcStride;
 	int cubic;
 };
 
@@ -103,12 +109,31 @@ static double getCoeff(double d){
 static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
-	int i, j;
+	int i, j, x, y, cw, ch;
+	mp_image_t desc = {0};
 
+	av_free(vf->priv->pv);
+	av_free(vf->priv->pvc);
+	vf->priv->pvc= NULL;
 	vf->priv->pvStride= width;
 	vf->priv->pv= av_malloc(width*height*2*sizeof(int32_t));
+	if(!vf->priv->pv) return 0;
 	initPv(vf->priv, width, height);
 
+	mp_image_setfmt(&desc, outfmt);
+	cw= width  >> desc.chroma_x_shift;
+	ch= height >> desc.chroma_y_shift;
+	vf->priv->pvcStride= cw;
+	vf->priv->pvc= av_malloc(FFMAX(cw*ch, 1)*2*sizeof(int32_t));
+	if(!vf->priv->pvc) return 0;
+	for(y=0; y<ch; y++){
+		for(x=0; x<cw; x++){
+			const int32_t *pv= vf->priv->pv[(x << desc.chroma_x_shift) + (y << desc.chroma_y_shift)*width];
+			vf->priv->pvc[x + y*cw][0]= pv[0] >> desc.chroma_x_shift;
+			vf->priv->pvc[x + y*cw][1]= pv[1] >> desc.chroma_y_shift;
+		}
+	}
+
 	for(i=0; i<SUB_PIXELS; i++){
 		double d= i/(double)SUB_PIXELS;
 		double temp[4];
@@ -132,23 +157,26 @@ static void uninit(struct vf_instance *vf){
 
 	av_free(vf->priv->pv);
 	vf->priv->pv= NULL;
+	av_free(vf->priv->pvc);
+	vf->priv->pvc= NULL;
 
 	free(vf->priv);
 	vf->priv=NULL;
 }
 
-static inline void resampleCubic(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride, struct vf_priv_s *privParam, int xShift, int yShift){
+/* Resample the tile [x0, x1) x [y0, y1) of a w x h plane, with the source
+ * positions from pv. */
+static inline void resampleCubic(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride,
+				 const int32_t (*pv)[2], int pvStride, const int32_t (*coeff)[4],
+				 int x0, int y0, int x1, int y1){
 	int x, y;
-	struct vf_priv_s priv= *privParam;
 
-	for(y=0; y<h; y++){
-		for(x=0; x<w; x++){
-			int u, v, subU, subV, sum, sx, sy;
+	for(y=y0; y<y1; y++){
+		for(x=x0; x<x1; x++){
+			int u, v, subU, subV, sum;
 
-			sx= x << xShift;
-			sy= y << yShift;
-			u= priv.pv[sx + sy*priv.pvStride][0]>>xShift;
-			v= priv.pv[sx + sy*priv.pvStride][1]>>yShift;
+			u= pv[x + y*pvStride][0];
+			v= pv[x + y*pvStride][1];
 			subU= u & (SUB_PIXELS-1);
 			subV= v & (SUB_PIXELS-1);
 			u >>= SUB_PIXEL_BITS;
@@ -156,19 +184,19 @@ static inline void resampleCubic(uint8_t *dst, uint8_t *src, int w, int h, int d
 
 			if(u>0 && v>0 && u<w-2 && v<h-2){
 				const int index= u + v*srcStride;
-				const int a= priv.coeff[subU][0];
-				const int b= priv.coeff[subU][1];
-				const int c= priv.coeff[subU][2];
-				const int d= priv.coeff[subU][3];
+				const int a= coeff[subU][0];
+				const int b= coeff[subU][1];
+				const int c= coeff[subU][2];
+				const int d= coeff[subU][3];
 
 				sum=
-				 priv.coeff[subV][0]*(  a*src[index - 1 - srcStride] + b*src[index - 0 - srcStride]
+				 coeff[subV][0]*(  a*src[index - 1 - srcStride] + b*src[index - 0 - srcStride]
 				                      + c*src[index + 1 - srcStride] + d*src[index + 2 - srcStride])
-				+priv.coeff[subV][1]*(  a*src[index - 1            ] + b*src[index - 0            ]
+				+coeff[subV][1]*(  a*src[index - 1            ] + b*src[index - 0            ]
 				                      + c*src[index + 1            ] + d*src[index + 2            ])
-				+priv.coeff[subV][2]*(  a*src[index - 1 + srcStride] + b*src[index - 0 + srcStride]
+				+coeff[subV][2]*(  a*src[index - 1 + srcStride] + b*src[index - 0 + srcStride]
 				                      + c*src[index + 1 + srcStride] + d*src[index + 2 + srcStride])
-				+priv.coeff[subV][3]*(  a*src[index - 1+2*srcStride] + b*src[index - 0+2*srcStride]
+				+coeff[subV][3]*(  a*src[index - 1+2*srcStride] + b*src[index - 0+2*srcStride]
 				                      + c*src[index + 1+2*srcStride] + d*src[index + 2+2*srcStride]);
 			}else{
 				int dx, dy;
@@ -183,7 +211,7 @@ static inline void resampleCubic(uint8_t *dst, uint8_t *src, int w, int h, int d
 						if     (ix< 0) ix=0;
 						else if(ix>=w) ix=w-1;
 
-						sum+=  priv.coeff[subU][dx]*priv.coeff[subV][dy]
+						sum+=  coeff[subU][dx]*coeff[subV][dy]
 						      *src[ ix + iy*srcStride];
 					}
 				}
@@ -199,18 +227,16 @@ static inline void resampleCubic(uint8_t *dst, uint8_t *src, int w, int h, int d
 }
 
 static inline void resampleLinear(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride,
-				  struct vf_priv_s *privParam, int xShift, int yShift){
+				  const int32_t (*pv)[2], int pvStride,
+				  int x0, int y0, int x1, int y1){
 	int x, y;
-	struct vf_priv_s priv= *privParam;
 
-	for(y=0; y<h; y++){
-		for(x=0; x<w; x++){
-			int u, v, subU, subV, sum, sx, sy, index, subUI, subVI;
+	for(y=y0; y<y1; y++){
+		for(x=x0; x<x1; x++){
+			int u, v, subU, subV, sum, index, subUI, subVI;
 
-			sx= x << xShift;
-			sy= y << yShift;
-			u= priv.pv[sx + sy*priv.pvStride][0]>>xShift;
-			v= priv.pv[sx + sy*priv.pvStride][1]>>yShift;
+			u= pv[x + y*pvStride][0];
+			v= pv[x + y*pvStride][1];
 			subU= u & (SUB_PIXELS-1);
 			subV= v & (SUB_PIXELS-1);
 			u >>= SUB_PIXEL_BITS;
@@ -256,9 +282,48 @@ static inline void resampleLinear(uint8_t *dst, uint8_t *src, int w, int h, int
 	}
 }
 
-static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
+struct slice_job {
+	struct vf_priv_s *priv;
+	mp_image_t *mpi, *dmpi;
+};
+
+static void resamplePlane(struct vf_priv_s *priv, uint8_t *dst, uint8_t *src, int w, int h,
+			  int dstStride, int srcStride, const int32_t (*pv)[2], int pvStride,
+			  int y0, int y1){
+	int x, y;
+
+	for(y=y0; y<y1; y+=TILE){
+		for(x=0; x<w; x+=TILE){
+			int x1= FFMIN(x + TILE, w), ty1= FFMIN(y + TILE, y1);
+			if(priv->cubic)
+				resampleCubic(dst, src, w, h, dstStride, srcStride,
+					      pv, pvStride, priv->coeff, x, y, x1, ty1);
+			else
+				resampleLinear(dst, src, w, h, dstStride, srcStride,
+					       pv, pvStride, x, y, x1, ty1);
+		}
+	}
+}
+
+static void perspective_slice(void *ctx, int index, int y0, int y1){
+	struct slice_job *job= ctx;
+	struct vf_priv_s *priv= job->priv;
+	mp_image_t *mpi= job->mpi, *dmpi= job->dmpi;
 	int cw= mpi->w >> mpi->chroma_x_shift;
 	int ch= mpi->h >> mpi->chroma_y_shift;
+	int c0= FFMIN(y0 >> mpi->chroma_y_shift, ch);
+	int c1= y1 == mpi->h ? ch : y1 >> mpi->chroma_y_shift;
+	int i;
+
+	resamplePlane(priv, dmpi->planes[0], mpi->planes[0], mpi->w, mpi->h,
+		      dmpi->stride[0], mpi->stride[0], priv->pv, priv->pvStride, y0, y1);
+	for(i=1; i<3; i++)
+		resamplePlane(priv, dmpi->planes[i], mpi->planes[i], cw, ch,
+			      dmpi->stride[i], mpi->stride[i], priv->pvc, priv->pvcStride, c0, c1);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
+	struct slice_job job;
 
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
 		MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE,
@@ -266,21 +331,10 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
 	assert(mpi->flags&MP_IMGFLAG_PLANAR);
 
-	if(vf->priv->cubic){
-		resampleCubic(dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h, dmpi->stride[0], mpi->stride[0],
-				vf->priv, 0, 0);
-		resampleCubic(dmpi->planes[1], mpi->planes[1], cw    , ch   , dmpi->stride[1], mpi->stride[1],
-				vf->priv, mpi->chroma_x_shift, mpi->chroma_y_shift);
-		resampleCubic(dmpi->planes[2], mpi->planes[2], cw    , ch   , dmpi->stride[2], mpi->stride[2],
-				vf->priv, mpi->chroma_x_shift, mpi->chroma_y_shift);
-	}else{
-		resampleLinear(dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h, dmpi->stride[0], mpi->stride[0],
-				vf->priv, 0, 0);
-		resampleLinear(dmpi->planes[1], mpi->planes[1], cw    , ch   , dmpi->stride[1], mpi->stride[1],
-				vf->priv, mpi->chroma_x_shift, mpi->chroma_y_shift);
-		resampleLinear(dmpi->planes[2], mpi->planes[2], cw    , ch   , dmpi->stride[2], mpi->stride[2],
-				vf->priv, mpi->chroma_x_shift, mpi->chroma_y_shift);
-	}
+	job.priv= vf->priv;
+	job.mpi= mpi;
+	job.dmpi= dmpi;
+	vf_run_slices(vf, mpi->h, 1 << mpi->chroma_y_shift, perspective_slice, &job);
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
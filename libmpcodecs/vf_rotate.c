@@ -21,28 +21,29 @@
 #include <string.h>
 #include <inttypes.h>
 
+#include <libavutil/common.h>
+
 #include "config.h"
 #include "mp_msg.h"
+#include "cpudetect.h"
 
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+// transposed in tiles of TILE x TILE pixels, so that both fit in the cache
+#define TILE 64
 
 struct vf_priv_s {
     int direction;
+    // transpose a block of 8x8 bytes or 4x4 dwords
+    void (*transpose8)(uint8_t *dst, const uint8_t *src, intptr_t dststride, intptr_t srcstride);
+    void (*transpose4)(uint8_t *dst, const uint8_t *src, intptr_t dststride, intptr_t srcstride);
 };
 
-static void rotate(unsigned char* dst,unsigned char* src,int dststride,int srcstride,int w,int h,int bpp,int dir){
+static void transpose_c(unsigned char* dst,const unsigned char* src,int dststride,int srcstride,int w,int h,int bpp){
     int y;
-    if(dir&1){
-	src+=srcstride*(w-1);
-	srcstride*=-1;
-    }
-    if(dir&2){
-	dst+=dststride*(h-1);
-	dststride*=-1;
-    }
-
     for(y=0;y<h;y++){
 	int x;
 	switch(bpp){
@@ -50,7 +51,7 @@ static void rotate(unsigned char* dst,unsigned char* src,int dststride,int srcst
 	    for(x=0;x<w;x++) dst[x]=src[y+x*srcstride];
 	    break;
 	case 2:
-	    for(x=0;x<w;x++) *((short*)(dst+x*2))=*((short*)(src+y*2+x*srcstride));
+	    for(x=0;x<w;x++) *((short*)(dst+x*2))=*((const short*)(src+y*2+x*srcstride));
 	    break;
 	case 3:
 	    for(x=0;x<w;x++){
@@ -60,12 +61,168 @@ static void rotate(unsigned char* dst,unsigned char* src,int dststride,int srcst
 	    }
 	    break;
 	case 4:
-	    for(x=0;x<w;x++) *((int*)(dst+x*4))=*((int*)(src+y*4+x*srcstride));
+	    for(x=0;x<w;x++) *((int*)(dst+x*4))=*((const int*)(src+y*4+x*srcstride));
 	}
 	dst+=dststride;
     }
 }
 
+#if HAVE_SSE2
+static void transpose8_sse2(uint8_t *dst, const uint8_t *src, intptr_t dststride, intptr_t srcstride)
+{
+    __asm__ volatile(
+        "movq        (%1), %%xmm0 \n"
+        "movq     (%1,%3), %%xmm1 \n"
+        "lea    (%1,%3,2), %1     \n"
+        "movq        (%1), %%xmm2 \n"
+        "movq     (%1,%3), %%xmm3 \n"
+        "lea    (%1,%3,2), %1     \n"
+        "movq        (%1), %%xmm4 \n"
+        "movq     (%1,%3), %%xmm5 \n"
+        "lea    (%1,%3,2), %1     \n"
+        "movq        (%1), %%xmm6 \n"
+        "movq     (%1,%3), %%xmm7 \n"
+        "punpcklbw %%xmm1, %%xmm0 \n" // rows 0,1 interleaved
+        "punpcklbw %%xmm3, %%xmm2 \n"
+        "punpcklbw %%xmm5, %%xmm4 \n"
+        "punpcklbw %%xmm7, %%xmm6 \n"
+        "movdqa    %%xmm0, %%xmm1 \n"
+        "punpcklwd %%xmm2, %%xmm0 \n" // columns 0-3 of rows 0-3
+        "punpckhwd %%xmm2, %%xmm1 \n" // columns 4-7 of rows 0-3
+        "movdqa    %%xmm4, %%xmm5 \n"
+        "punpcklwd %%xmm6, %%xmm4 \n"
+        "punpckhwd %%xmm6, %%xmm5 \n"
+        "movdqa    %%xmm0, %%xmm2 \n"
+        "punpckldq %%xmm4, %%xmm0 \n" // columns 0,1
+        "punpckhdq %%xmm4, %%xmm2 \n" // columns 2,3
+        "movdqa    %%xmm1, %%xmm3 \n"
+        "punpckldq %%xmm5, %%xmm1 \n" // columns 4,5
+        "punpckhdq %%xmm5, %%xmm3 \n" // columns 6,7
+        "movq      %%xmm0, (%0)    \n"
+        "movhps    %%xmm0, (%0,%2) \n"
+        "lea    (%0,%2,2), %0     \n"
+        "movq      %%xmm2, (%0)    \n"
+        "movhps    %%xmm2, (%0,%2) \n"
+        "lea    (%0,%2,2), %0     \n"
+        "movq      %%xmm1, (%0)    \n"
+        "movhps    %%xmm1, (%0,%2) \n"
+        "lea    (%0,%2,2), %0     \n"
+        "movq      %%xmm3, (%0)    \n"
+        "movhps    %%xmm3, (%0,%2) \n"
+        :"+r"(dst), "+r"(src)
+        :"r"((x86_reg)dststride), "r"((x86_reg)srcstride)
+        :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+         "xmm7"
+    );
+}
+
+static void transpose4_sse2(uint8_t *dst, const uint8_t *src, intptr_t dststride, intptr_t srcstride)
+{
+    __asm__ volatile(
+        "movdqu         (%1), %%xmm0 \n"
+        "movdqu      (%1,%3), %%xmm1 \n"
+        "lea       (%1,%3,2), %1     \n"
+        "movdqu         (%1), %%xmm2 \n"
+        "movdqu      (%1,%3), %%xmm3 \n"
+        "movdqa       %%xmm0, %%xmm4 \n"
+        "punpckldq    %%xmm1, %%xmm0 \n"
+        "punpckhdq    %%xmm1, %%xmm4 \n"
+        "movdqa       %%xmm2, %%xmm5 \n"
+        "punpckldq    %%xmm3, %%xmm2 \n"
+        "punpckhdq    %%xmm3, %%xmm5 \n"
+        "movdqa       %%xmm0, %%xmm1 \n"
+        "punpcklqdq   %%xmm2, %%xmm0 \n"
+        "punpckhqdq   %%xmm2, %%xmm1 \n"
+        "movdqa       %%xmm4, %%xmm3 \n"
+        "punpcklqdq   %%xmm5, %%xmm4 \n"
+        "punpckhqdq   %%xmm5, %%xmm3 \n"
+        "movdqu       %%xmm0, (%0)    \n"
+        "movdqu       %%xmm1, (%0,%2) \n"
+        "lea       (%0,%2,2), %0     \n"
+        "movdqu       %%xmm4, (%0)    \n"
+        "movdqu       %%xmm3, (%0,%2) \n"
+        :"+r"(dst), "+r"(src)
+        :"r"((x86_reg)dststride), "r"((x86_reg)srcstride)
+        :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5"
+    );
+}
+#endif
+
+// One tile: whole blocks with the SIMD transpose, the rest in C.
+static void transpose_tile(struct vf_priv_s *p, uint8_t *dst, const uint8_t *src,
+                           int dststride, int srcstride, int w, int h, int bpp)
+{
+    void (*block)(uint8_t *, const uint8_t *, intptr_t, intptr_t) =
+        bpp == 1 ? p->transpose8 : bpp == 4 ? p->transpose4 : NULL;
+    int size = bpp == 1 ? 8 : 4;
+    int bw = w & ~(size - 1), bh = h & ~(size - 1);
+    int x, y;
+
+    if (!block) {
+        transpose_c(dst, src, dststride, srcstride, w, h, bpp);
+        return;
+    }
+    for (y = 0; y < bh; y += size)
+        for (x = 0; x < bw; x += size)
+            block(dst + y * dststride + x * bpp, src + x * srcstride + y * bpp,
+                  dststride, srcstride);
+    transpose_c(dst + bw * bpp, src + bw * srcstride, dststride, srcstride,
+                w - bw, h, bpp);
+    transpose_c(dst + bh * dststride, src + bh * bpp, dststride, srcstride,
+                bw, h - bh, bpp);
+}
+
+// Rows [y0, y1) of the w x h output.
+static void rotate(struct vf_priv_s *p, unsigned char* dst,unsigned char* src,int dststride,int srcstride,int w,int h,int y0,int y1,int bpp,int dir){
+    int x, y;
+    if(dir&1){
+	src+=srcstride*(w-1);
+	srcstride*=-1;
+    }
+    if(dir&2){
+	dst+=dststride*(h-1);
+	dststride*=-1;
+    }
+
+    for (y = y0; y < y1; y += TILE)
+        for (x = 0; x < w; x += TILE)
+            transpose_tile(p, dst + y * dststride + x * bpp,
+                           src + x * srcstride + y * bpp, dststride, srcstride,
+                           FFMIN(TILE, w - x), FFMIN(TILE, y1 - y), bpp);
+}
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void rotate_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    int dir = p->direction;
+
+    if(mpi->flags&MP_IMGFLAG_PLANAR){
+	int xs = mpi->chroma_x_shift, ys = mpi->chroma_y_shift;
+	int cw = dmpi->w >> xs, ch = dmpi->h >> ys;
+	int c0 = FFMIN(y0 >> ys, ch), c1 = y1 == dmpi->h ? ch : y1 >> ys;
+	rotate(p,dmpi->planes[0],mpi->planes[0],
+	       dmpi->stride[0],mpi->stride[0],
+	       dmpi->w,dmpi->h,y0,y1,1,dir);
+	rotate(p,dmpi->planes[1],mpi->planes[1],
+	       dmpi->stride[1],mpi->stride[1],
+	       cw,ch,c0,c1,1,dir);
+	rotate(p,dmpi->planes[2],mpi->planes[2],
+	       dmpi->stride[2],mpi->stride[2],
+	       cw,ch,c0,c1,1,dir);
+    } else {
+	rotate(p,dmpi->planes[0],mpi->planes[0],
+	       dmpi->stride[0],mpi->stride[0],
+	       dmpi->w,dmpi->h,y0,y1,dmpi->bpp>>3,dir);
+    }
+}
+
 //===========================================================================//
 
 static int config(struct vf_instance *vf,
@@ -86,28 +243,18 @@ static int config(struct vf_instance *vf,
 
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     mp_image_t *dmpi;
+    struct slice_job job;
 
     // hope we'll get DR buffer:
     dmpi=vf_get_image(vf->next,mpi->imgfmt,
 	MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE,
 	mpi->h, mpi->w);
 
-    if(mpi->flags&MP_IMGFLAG_PLANAR){
-	rotate(dmpi->planes[0],mpi->planes[0],
-	       dmpi->stride[0],mpi->stride[0],
-	       dmpi->w,dmpi->h,1,vf->priv->direction);
-	rotate(dmpi->planes[1],mpi->planes[1],
-	       dmpi->stride[1],mpi->stride[1],
-	       dmpi->w>>mpi->chroma_x_shift,dmpi->h>>mpi->chroma_y_shift,1,vf->priv->direction);
-	rotate(dmpi->planes[2],mpi->planes[2],
-	       dmpi->stride[2],mpi->stride[2],
-	       dmpi->w>>mpi->chroma_x_shift,dmpi->h>>mpi->chroma_y_shift,1,vf->priv->direction);
-    } else {
-	rotate(dmpi->planes[0],mpi->planes[0],
-	       dmpi->stride[0],mpi->stride[0],
-	       dmpi->w,dmpi->h,dmpi->bpp>>3,vf->priv->direction);
+    job = (struct slice_job){ vf->priv, mpi, dmpi };
+    vf_run_slices(vf, dmpi->h, mpi->flags & MP_IMGFLAG_PLANAR ? 8 << mpi->chroma_y_shift : 8,
+                  rotate_slice, &job);
+    if (!(mpi->flags&MP_IMGFLAG_PLANAR))
 	dmpi->planes[1] = mpi->planes[1]; // passthrough rgb8 palette
-    }
 
     return vf_next_put_image(vf,dmpi, pts);
 }
@@ -135,8 +282,14 @@ static int vf_open(vf_instance_t *vf, char *args){
     vf->config=config;
     vf->put_image=put_image;
     vf->query_format=query_format;
-    vf->priv=malloc(sizeof(struct vf_priv_s));
+    vf->priv=calloc(1, sizeof(struct vf_priv_s));
     vf->priv->direction=args?atoi(args):0;
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2) {
+        vf->priv->transpose8 = transpose8_sse2;
+        vf->priv->transpose4 = transpose4_sse2;
+    }
+#endif
     return 1;
 }
 
@@ -140,19 +140,23 @@ static void uninit(struct vf_instance *vf){
 	vf->priv=NULL;
 }
 
-static inline void blur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride, FilterParam *fp){
+struct blur_job {
+	uint8_t *dst, *src;
+	int w, h, dstStride, srcStride;
+	FilterParam *fp;
+};
+
+// Filter rows [y0, y1); the pre-filtered plane must be complete.
+static void blur_rows(void *ctx, int index, int y0, int y1){
+	struct blur_job *job= ctx;
+	uint8_t *dst= job->dst, *src= job->src;
+	const int w= job->w, h= job->h;
+	const int dstStride= job->dstStride, srcStride= job->srcStride;
 	int x, y;
-	FilterParam f= *fp;
+	FilterParam f= *job->fp;
 	const int radius= f.distWidth/2;
-	const uint8_t* const srcArray[MP_MAX_PLANES] = {src};
-	uint8_t *dstArray[MP_MAX_PLANES]= {f.preFilterBuf};
-	int srcStrideArray[MP_MAX_PLANES]= {srcStride};
-	int dstStrideArray[MP_MAX_PLANES]= {f.preFilterStride};
-
-//	f.preFilterContext->swScale(f.preFilterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
-	sws_scale(f.preFilterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
 
-	for(y=0; y<h; y++){
+	for(y=y0; y<y1; y++){
 		for(x=0; x<w; x++){
 			int sum=0;
 			int div=0;
@@ -208,6 +212,19 @@ if((x/32)&1){
 	}
 }
 
+static void blur(struct vf_instance *vf, uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride, FilterParam *fp){
+	const uint8_t* const srcArray[MP_MAX_PLANES] = {src};
+	uint8_t *dstArray[MP_MAX_PLANES]= {fp->preFilterBuf};
+	int srcStrideArray[MP_MAX_PLANES]= {srcStride};
+	int dstStrideArray[MP_MAX_PLANES]= {fp->preFilterStride};
+
+//	fp->preFilterContext->swScale(fp->preFilterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
+	sws_scale(fp->preFilterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
+
+	vf_run_slices(vf, h, 1, blur_rows,
+		      &(struct blur_job){dst, src, w, h, dstStride, srcStride, fp});
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	int cw= mpi->w >> mpi->chroma_x_shift;
 	int ch= mpi->h >> mpi->chroma_y_shift;
@@ -218,9 +235,9 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
 	assert(mpi->flags&MP_IMGFLAG_PLANAR);
 
-	blur(dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h, dmpi->stride[0], mpi->stride[0], &vf->priv->luma);
-	blur(dmpi->planes[1], mpi->planes[1], cw    , ch   , dmpi->stride[1], mpi->stride[1], &vf->priv->chroma);
-	blur(dmpi->planes[2], mpi->planes[2], cw    , ch   , dmpi->stride[2], mpi->stride[2], &vf->priv->chroma);
+	blur(vf, dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h, dmpi->stride[0], mpi->stride[0], &vf->priv->luma);
+	blur(vf, dmpi->planes[1], mpi->planes[1], cw    , ch   , dmpi->stride[1], mpi->stride[1], &vf->priv->chroma);
+	blur(vf, dmpi->planes[2], mpi->planes[2], cw    , ch   , dmpi->stride[2], mpi->stride[2], &vf->priv->chroma);
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
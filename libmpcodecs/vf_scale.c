@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include "config.h"
 #include "mp_msg.h"
@@ -33,15 +34,31 @@
 #include "mpbswap.h"
 
 #include "libswscale/swscale.h"
+#include "libavutil/mathematics.h"
 #include "vf_scale.h"
 
 #include "libvo/csputils.h"
 // VOFLAG_SWSCALE
 #include "libvo/video_out.h"
+#include "libvo/fastmemcpy.h"
 
 #include "m_option.h"
 #include "m_struct.h"
 
+/* Band of the output (of one field, if interlaced) that is scaled by its
+ * own context, so that the bands can be scaled in parallel. The context
+ * also gets enough rows above and below the band that the vertical filter
+ * sees the same input as for the whole frame. These margins are scaled into
+ * tmp too, and only the band itself is copied to the output. */
+struct sws_band {
+    struct SwsContext *sws;
+    int field;
+    int src_y, src_h;   // source rows given to the context (field rows)
+    int dst_y, dst_h;   // rows of the band in the output (field rows)
+    int skip;           // margin rows at the top of tmp
+    mp_image_t *tmp;
+};
+
 static struct vf_priv_s {
     int w,h;
     int cfg_w, cfg_h;
@@ -55,6 +72,8 @@ static struct vf_priv_s {
     int noup;
     int accurate_rnd;
     struct mp_csp_details colorspace;
+    struct sws_band *bands;
+    int num_bands;
 } const vf_priv_dflt = {
   0, 0,
   -1,-1,
@@ -191,6 +210,139 @@ static unsigned int find_best_out(vf_instance_t *vf, int in_format){
     return best;
 }
 
+static void start_slice(struct vf_instance *vf, mp_image_t *mpi);
+static void draw_slice(struct vf_instance *vf, unsigned char **src,
+                       int *stride, int w, int h, int x, int y);
+
+// source filter settings from the command line, see below
+extern float sws_lum_gblur, sws_chr_gblur, sws_lum_sharpen, sws_chr_sharpen;
+extern int sws_chr_vshift;
+
+static void free_bands(struct vf_priv_s *p)
+{
+    int i;
+    for (i = 0; i < p->num_bands; i++) {
+        if (p->bands[i].sws)
+            sws_freeContext(p->bands[i].sws);
+        if (p->bands[i].tmp)
+            free_mp_image(p->bands[i].tmp);
+    }
+    free(p->bands);
+    p->bands = NULL;
+    p->num_bands = 0;
+}
+
+// Half the size of the vertical filter swscale uses, in source rows, when
+// not downscaling.
+static int sws_filter_radius(int flags, double param)
+{
+    if (flags & SWS_LANCZOS)
+        return param != SWS_PARAM_DEFAULT ? ceil(param) : 3;
+    if (flags & (SWS_SINC | SWS_SPLINE))
+        return 10;
+    if (flags & (SWS_GAUSS | SWS_X))
+        return 4;
+    if (flags & (SWS_BICUBIC | SWS_BICUBLIN))
+        return 2;
+    return 1;
+}
+
+// Only formats whose rows can be copied out of the band images.
+static int band_format_ok(unsigned int fmt)
+{
+    mp_image_t desc = {0};
+    mp_image_setfmt(&desc, fmt);
+    if (desc.flags & MP_IMGFLAG_PLANAR)
+        return !!(desc.flags & MP_IMGFLAG_YUV);
+    return desc.bpp >= 16 || fmt == IMGFMT_Y8 || fmt == IMGFMT_Y800;
+}
+
+// Vertical chroma subsampling that band boundaries must be aligned to. Gray
+// formats are handled as packed, and leave a meaningless shift behind.
+static int band_chroma_shift(unsigned int fmt)
+{
+    mp_image_t desc = {0};
+    mp_image_setfmt(&desc, fmt);
+    return desc.flags & MP_IMGFLAG_PLANAR ? desc.chroma_y_shift : 0;
+}
+
+/* Split the output into bands for slice threading. Band boundaries must map
+ * to whole source rows, and be aligned to the chroma subsampling of both
+ * formats, so that each band context uses exactly the filter positions of
+ * the whole frame. Returns 0 if the scale factor doesn't allow this, or the
+ * margins would cost more than the band itself. */
+static int init_bands(struct vf_instance *vf, int width, int height,
+                      unsigned int srcfmt, enum PixelFormat sfmt,
+                      enum PixelFormat dfmt, int sws_flags,
+                      SwsFilter *srcFilter, SwsFilter *dstFilter)
+{
+    struct vf_priv_s *p = vf->priv;
+    int fields = 1 + p->interlaced;
+    int sh = height >> p->interlaced, dh = p->h >> p->interlaced;
+    int src_shift, dst_shift;
+    int align, g, unit_s, unit_d, units, need, margin, n, i, f;
+
+    if (vf_slice_threads(vf) < 2 || p->v_chr_drop || p->palette ||
+        sfmt == PIX_FMT_PAL8 || !band_format_ok(p->fmt) ||
+        sws_lum_gblur || sws_chr_gblur || sws_lum_sharpen ||
+        sws_chr_sharpen || sws_chr_vshift)
+        return 0;
+
+    src_shift = band_chroma_shift(srcfmt);
+    dst_shift = band_chroma_shift(p->fmt);
+    align = 1 << FFMAX(src_shift, dst_shift);
+    g = av_gcd(sh, dh);
+    unit_s = sh / g;
+    unit_d = dh / g;
+    while (unit_s % (1 << src_shift) || unit_d % (1 << dst_shift)) {
+        unit_s *= 2;
+        unit_d *= 2;
+    }
+    units = dh / unit_d;
+
+    need = (sws_filter_radius(sws_flags, p->param[0]) *
+            FFMAX(1, (sh + dh - 1) / dh) + 2) * align;
+    margin = (need + unit_s - 1) / unit_s;
+    n = FFMIN(vf_slice_threads(vf), units / (2 * margin));
+    n = FFMIN(n, dh / VF_MIN_SLICE_ROWS);
+    if (n < 2)
+        return 0;
+
+    p->bands = calloc(n * fields, sizeof(struct sws_band));
+    if (!p->bands)
+        return 0;
+    p->num_bands = n * fields;
+    for (i = 0; i < n; i++) {
+        int u0 = i * units / n, u1 = (i + 1) * units / n;
+        int top = i > 0 ? margin : 0;
+        int y0 = u0 * unit_d, y1 = i < n - 1 ? u1 * unit_d : dh;
+        int s0 = (u0 - top) * unit_s;
+        int s1 = i < n - 1 ? (u1 + margin) * unit_s : sh;
+        int d0 = (u0 - top) * unit_d;
+        int d1 = i < n - 1 ? (u1 + margin) * unit_d : dh;
+        for (f = 0; f < fields; f++) {
+            struct sws_band *b = &p->bands[i * fields + f];
+            b->field = f;
+            b->src_y = s0;
+            b->src_h = s1 - s0;
+            b->dst_y = y0;
+            b->dst_h = y1 - y0;
+            b->skip = top * unit_d;
+            b->sws = sws_getContext(width, b->src_h, sfmt, p->w, d1 - d0, dfmt,
+                                    sws_flags | get_sws_cpuflags(),
+                                    srcFilter, dstFilter, p->param);
+            b->tmp = alloc_mpi(p->w, d1 - d0, p->fmt);
+            if (!b->sws || !b->tmp) {
+                free_bands(p);
+                return 0;
+            }
+        }
+    }
+    mp_msg(MSGT_VFILTER, MSGL_V, "SwScale: %d bands, %d margin rows\n",
+           n, margin * unit_s);
+    return 1;
+}
+
 static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
@@ -334,6 +486,7 @@ static int config(struct vf_instance *vf,
     }
     vf->priv->fmt=best;
 
+    free_bands(vf->priv);
     free(vf->priv->palette);
     vf->priv->palette=NULL;
     switch(best){
@@ -379,6 +532,17 @@ static int config(struct vf_instance *vf,
 	break; }
     }
 
+    // Slices from the decoder would have to be scaled serially; bands are
+    // only used for whole frames.
+    if (init_bands(vf, width, height, outfmt, sfmt, dfmt, int_sws_flags,
+                   srcFilter, dstFilter)) {
+        vf->start_slice = NULL;
+        vf->draw_slice = NULL;
+    } else {
+        vf->start_slice = start_slice;
+        vf->draw_slice = draw_slice;
+    }
+
     if (!opts->screen_size_x && !opts->screen_size_y
         && !(opts->screen_size_xy >= 0.001)) {
 	// Compute new d_width and d_height, preserving aspect
@@ -447,6 +611,56 @@ static void draw_slice(struct vf_instance *vf,
     scale(vf->priv->ctx, vf->priv->ctx2, src, stride, y, h, dmpi->planes, dmpi->stride, vf->priv->interlaced);
 }
 
+struct band_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void scale_band(void *ctx, int index)
+{
+    struct band_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    struct sws_band *b = &p->bands[index];
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi, *tmp = b->tmp;
+    int fields = 1 + p->interlaced;
+    uint8_t *src[MP_MAX_PLANES];
+    int src_stride[MP_MAX_PLANES];
+    int i, bits;
+
+    for (i = 0; i < MP_MAX_PLANES; i++) {
+        int ys = i == 1 || i == 2 ? mpi->chroma_y_shift : 0;
+        src[i] = mpi->planes[i];
+        src_stride[i] = mpi->stride[i] * fields;
+        // planes[1] of packed formats is the palette
+        if (src[i] && (i == 0 || mpi->flags & MP_IMGFLAG_PLANAR))
+            src[i] += b->field * mpi->stride[i] + (b->src_y >> ys) * src_stride[i];
+    }
+    scale(b->sws, b->sws, src, src_stride, 0, b->src_h,
+          tmp->planes, tmp->stride, 0);
+
+    if (!(tmp->flags & MP_IMGFLAG_PLANAR)) {
+        memcpy_pic2(dmpi->planes[0] + b->field * dmpi->stride[0] +
+                    b->dst_y * dmpi->stride[0] * fields,
+                    tmp->planes[0] + b->skip * tmp->stride[0],
+                    tmp->w * tmp->bpp / 8, b->dst_h,
+                    dmpi->stride[0] * fields, tmp->stride[0], 1);
+        return;
+    }
+    mp_get_chroma_shift(tmp->imgfmt, NULL, NULL, &bits);
+    for (i = 0; i < tmp->num_planes; i++) {
+        int xs = i == 1 || i == 2 ? tmp->chroma_x_shift : 0;
+        int ys = i == 1 || i == 2 ? tmp->chroma_y_shift : 0;
+        int y0 = b->dst_y >> ys;
+        int y1 = -(-(b->dst_y + b->dst_h) >> ys);
+        memcpy_pic2(dmpi->planes[i] + b->field * dmpi->stride[i] +
+                    y0 * dmpi->stride[i] * fields,
+                    tmp->planes[i] + (b->skip >> ys) * tmp->stride[i],
+                    (i == 1 && tmp->num_planes == 2 ? tmp->chroma_width :
+                     -(-tmp->w >> xs)) * ((bits + 7) / 8),
+                    y1 - y0, dmpi->stride[i] * fields, tmp->stride[i], 1);
+    }
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     mp_image_t *dmpi=mpi->priv;
 
@@ -460,6 +674,10 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE | MP_IMGFLAG_PREFER_ALIGNED_STRIDE,
 	vf->priv->w, vf->priv->h);
 
+    if (vf->priv->num_bands) {
+        struct band_job job = { vf->priv, mpi, dmpi };
+        vf_run_jobs(vf, vf->priv->num_bands, scale_band, &job);
+    } else
       scale(vf->priv->ctx, vf->priv->ctx, mpi->planes,mpi->stride,0,mpi->h,dmpi->planes,dmpi->stride, vf->priv->interlaced);
   }
 
@@ -480,6 +698,7 @@ static int control(struct vf_instance *vf, int request, void* data){
     int r;
     int brightness, contrast, saturation, srcRange, dstRange;
     vf_equalizer_t *eq;
+    int i;
 
   if(vf->priv->ctx)
     switch(request){
@@ -524,6 +743,8 @@ static int control(struct vf_instance *vf, int request, void* data){
             r= sws_setColorspaceDetails(vf->priv->ctx2, inv_table, srcRange, table, dstRange, brightness, contrast, saturation);
             if(r<0) break;
         }
+        for (i = 0; i < vf->priv->num_bands; i++)
+            sws_setColorspaceDetails(vf->priv->bands[i].sws, inv_table, srcRange, table, dstRange, brightness, contrast, saturation);
 
 	return CONTROL_TRUE;
     case VFCTRL_SET_YUV_COLORSPACE: {
@@ -531,6 +752,10 @@ static int control(struct vf_instance *vf, int request, void* data){
         if (mp_sws_set_colorspace(vf->priv->ctx, &colorspace) >= 0) {
             if (vf->priv->ctx2)
                 mp_sws_set_colorspace(vf->priv->ctx2, &colorspace);
+            for (i = 0; i < vf->priv->num_bands; i++) {
+                struct mp_csp_details csp = *(struct mp_csp_details *)data;
+                mp_sws_set_colorspace(vf->priv->bands[i].sws, &csp);
+            }
             vf->priv->colorspace = colorspace;
             return 1;
         }
@@ -629,6 +854,7 @@ static int query_format(struct vf_instance *vf, unsigned int fmt){
 static void uninit(struct vf_instance *vf){
     if(vf->priv->ctx) sws_freeContext(vf->priv->ctx);
     if(vf->priv->ctx2) sws_freeContext(vf->priv->ctx2);
+    free_bands(vf->priv);
     free(vf->priv->palette);
     free(vf->priv);
 }
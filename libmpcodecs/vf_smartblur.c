@@ -40,7 +40,9 @@ typedef struct FilterParam{
 	float strength;
 	int threshold;
 	float quality;
-	struct SwsContext *filterContext;
+	// a context can't be used by two threads at once, so chroma has one
+	// for each plane
+	struct SwsContext *filterContext[2];
 }FilterParam;
 
 struct vf_priv_s {
@@ -51,17 +53,19 @@ struct vf_priv_s {
 
 /***************************************************************************/
 
-static int allocStuff(FilterParam *f, int width, int height){
+static int allocStuff(FilterParam *f, int width, int height, int contexts){
 	SwsVector *vec;
 	SwsFilter swsF;
+	int i;
 
 	vec = sws_getGaussianVec(f->radius, f->quality);
 	sws_scaleVec(vec, f->strength);
 	vec->coeff[vec->length/2]+= 1.0 - f->strength;
 	swsF.lumH= swsF.lumV= vec;
 	swsF.chrH= swsF.chrV= NULL;
-	f->filterContext= sws_getContext(
-		width, height, PIX_FMT_GRAY8, width, height, PIX_FMT_GRAY8, SWS_BICUBIC | get_sws_cpuflags(), &swsF, NULL, NULL);
+	for(i=0; i<contexts; i++)
+		f->filterContext[i]= sws_getContext(
+			width, height, PIX_FMT_GRAY8, width, height, PIX_FMT_GRAY8, SWS_BICUBIC | get_sws_cpuflags(), &swsF, NULL, NULL);
 
 	sws_freeVec(vec);
 
@@ -74,17 +78,19 @@ static int config(struct vf_instance *vf,
 
 	int sw, sh;
 
-	allocStuff(&vf->priv->luma, width, height);
+	allocStuff(&vf->priv->luma, width, height, 1);
 
 	mp_get_chroma_shift(outfmt, &sw, &sh, NULL);
-	allocStuff(&vf->priv->chroma, width>>sw, height>>sh);
+	allocStuff(&vf->priv->chroma, width>>sw, height>>sh, 2);
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
 
 static void freeBuffers(FilterParam *f){
-	if(f->filterContext) sws_freeContext(f->filterContext);
-	f->filterContext=NULL;
+	for(int i=0; i<2; i++){
+		if(f->filterContext[i]) sws_freeContext(f->filterContext[i]);
+		f->filterContext[i]=NULL;
+	}
 }
 
 static void uninit(struct vf_instance *vf){
@@ -97,7 +103,7 @@ static void uninit(struct vf_instance *vf){
 	vf->priv=NULL;
 }
 
-static inline void blur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride, FilterParam *fp){
+static inline void blur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int srcStride, FilterParam *fp, struct SwsContext *filterContext){
 	int x, y;
 	FilterParam f= *fp;
 	const uint8_t* const srcArray[MP_MAX_PLANES] = {src};
@@ -105,7 +111,7 @@ static inline void blur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride,
 	int srcStrideArray[MP_MAX_PLANES]= {srcStride};
 	int dstStrideArray[MP_MAX_PLANES]= {dstStride};
 
-	sws_scale(f.filterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
+	sws_scale(filterContext, srcArray, srcStrideArray, 0, h, dstArray, dstStrideArray);
 
 	if(f.threshold > 0){
 		for(y=0; y<h; y++){
@@ -154,9 +160,25 @@ static inline void blur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride,
 	}
 }
 
+struct plane_job {
+	struct vf_priv_s *priv;
+	mp_image_t *mpi, *dmpi;
+};
+
+// The blur runs in swscale, which can't be split into bands; filter the
+// planes in parallel instead.
+static void blur_plane(void *ctx, int p){
+	struct plane_job *job= ctx;
+	mp_image_t *mpi= job->mpi, *dmpi= job->dmpi;
+	int w= p ? mpi->w >> mpi->chroma_x_shift : mpi->w;
+	int h= p ? mpi->h >> mpi->chroma_y_shift : mpi->h;
+	FilterParam *fp= p ? &job->priv->chroma : &job->priv->luma;
+
+	blur(dmpi->planes[p], mpi->planes[p], w, h, dmpi->stride[p], mpi->stride[p],
+	     fp, fp->filterContext[p == 2]);
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
-	int cw= mpi->w >> mpi->chroma_x_shift;
-	int ch= mpi->h >> mpi->chroma_y_shift;
 	bool threshold = vf->priv->luma.threshold || vf->priv->chroma.threshold;
 
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
@@ -166,9 +188,7 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
 	assert(mpi->flags&MP_IMGFLAG_PLANAR);
 
-	blur(dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h, dmpi->stride[0], mpi->stride[0], &vf->priv->luma);
-	blur(dmpi->planes[1], mpi->planes[1], cw    , ch   , dmpi->stride[1], mpi->stride[1], &vf->priv->chroma);
-	blur(dmpi->planes[2], mpi->planes[2], cw    , ch   , dmpi->stride[2], mpi->stride[2], &vf->priv->chroma);
+	vf_run_jobs(vf, 3, blur_plane, &(struct plane_job){vf->priv, mpi, dmpi});
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
@@ -0,0 +1,429 @@
+/*
+ * This file is part of MPlayer.
+ *
+ * MPlayer is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * MPlayer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with MPlayer; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Frame statistics: luma histogram, difference to the previous frame,
+ * row/column sums for crop detection, computed in a single pass over the
+ * luma plane. The results are attached to the passed through image as
+ * mpi->stats, and can be queried with VFCTRL_GET_FRAME_STATS (which the
+ * stats_* properties use).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include "config.h"
+#include "mp_msg.h"
+#include "cpudetect.h"
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+#include "ffmpeg_files/x86_cpu.h"
+
+struct slice_stats {
+    // four histograms, so that runs of equal pixels don't serialize
+    unsigned int hist[4][256];
+    uint64_t sad;
+    unsigned int *col_sum;
+    int used;           // vf_run_slices() may use fewer slices than threads
+};
+
+struct vf_priv_s {
+    int bthresh;        // black threshold
+    int limit;          // crop detection limit, like vf_cropdetect
+    int print;
+    struct vf_frame_stats stats;
+    double prev_mafd;
+    int has_prev;
+    // previous frame: a reference if it came from the image pool, else a
+    // copy of its luma, made while the rows are read for the statistics
+    mp_image_t *prev;
+    uint8_t *luma;
+    int luma_w, luma_h;
+    unsigned int *row_sum, *col_sum;
+    struct slice_stats slice[VF_MAX_SLICES];
+    void (*stats_row)(const uint8_t *cur, const uint8_t *prev,
+                      unsigned int *col_sum, int w,
+                      unsigned int *sum, unsigned int *sad);
+};
+
+static void stats_row_c(const uint8_t *cur, const uint8_t *prev,
+                        unsigned int *col_sum, int w,
+                        unsigned int *sum, unsigned int *sad)
+{
+    unsigned int s = 0, d = 0;
+    int x;
+    for (x = 0; x < w; x++) {
+        s += cur[x];
+        d += abs(cur[x] - prev[x]);
+        col_sum[x] += cur[x];
+    }
+    *sum = s;
+    *sad = d;
+}
+
+#if HAVE_SSE2
+/* 16 pixels per iteration; psadbw against 0 and against the previous row
+ * give the row sum and the SAD, the column sums need widening to dwords.
+ * col_sum must be 16 byte aligned. */
+static void stats_row_sse2(const uint8_t *cur, const uint8_t *prev,
+                           unsigned int *col_sum, int w,
+                           unsigned int *sum, unsigned int *sad)
+{
+    int w16 = w & ~15;
+    x86_reg x = -w16;
+    unsigned int s, d;
+
+    if (w16) {
+        __asm__ volatile(
+            "pxor      %%xmm7, %%xmm7 \n"
+            "pxor      %%xmm5, %%xmm5 \n"
+            "pxor      %%xmm6, %%xmm6 \n"
+            "1:                       \n"
+            "movdqu    (%[cur],%[x]), %%xmm0 \n"
+            "movdqu    (%[prev],%[x]), %%xmm1 \n"
+            "movdqa    %%xmm0, %%xmm2 \n"
+            "psadbw    %%xmm0, %%xmm1 \n"
+            "psadbw    %%xmm7, %%xmm2 \n"
+            "paddq     %%xmm1, %%xmm6 \n"
+            "paddq     %%xmm2, %%xmm5 \n"
+            "movdqa    %%xmm0, %%xmm1 \n"
+            "punpcklbw %%xmm7, %%xmm0 \n"
+            "punpckhbw %%xmm7, %%xmm1 \n"
+            "movdqa    %%xmm0, %%xmm2 \n"
+            "movdqa    %%xmm1, %%xmm3 \n"
+            "punpcklwd %%xmm7, %%xmm0 \n"
+            "punpckhwd %%xmm7, %%xmm2 \n"
+            "punpcklwd %%xmm7, %%xmm1 \n"
+            "punpckhwd %%xmm7, %%xmm3 \n"
+            "paddd       (%[col],%[x],4), %%xmm0 \n"
+            "paddd     16(%[col],%[x],4), %%xmm2 \n"
+            "paddd     32(%[col],%[x],4), %%xmm1 \n"
+            "paddd     48(%[col],%[x],4), %%xmm3 \n"
+            "movdqa    %%xmm0,   (%[col],%[x],4) \n"
+            "movdqa    %%xmm2, 16(%[col],%[x],4) \n"
+            "movdqa    %%xmm1, 32(%[col],%[x],4) \n"
+            "movdqa    %%xmm3, 48(%[col],%[x],4) \n"
+            "add       $16, %[x]  \n"
+            "jl 1b                \n"
+            "pshufd    $0xEE, %%xmm5, %%xmm0 \n"
+            "pshufd    $0xEE, %%xmm6, %%xmm1 \n"
+            "paddq     %%xmm0, %%xmm5 \n"
+            "paddq     %%xmm1, %%xmm6 \n"
+            "movd      %%xmm5, %[s] \n"
+            "movd      %%xmm6, %[d] \n"
+            :[x]"+&r"(x), [s]"=r"(s), [d]"=r"(d)
+            :[cur]"r"(cur + w16), [prev]"r"(prev + w16), [col]"r"(col_sum + w16)
+            :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6", "xmm7"
+        );
+    } else
+        s = d = 0;
+
+    stats_row_c(cur + w16, prev + w16, col_sum + w16, w - w16, sum, sad);
+    *sum += s;
+    *sad += d;
+}
+#endif
+
+struct slice_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi;
+    const uint8_t *prev;
+    int prev_stride;
+    uint8_t *copy;      // p->luma if this frame's luma is kept as a copy
+};
+
+static void stats_slice(void *ctx, int index, int y0, int y1)
+{
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    struct slice_stats *s = &p->slice[index];
+    mp_image_t *mpi = job->mpi;
+    int w = mpi->w;
+    int x, y;
+
+    memset(s->hist, 0, sizeof(s->hist));
+    memset(s->col_sum, 0, w * sizeof(unsigned int));
+    s->sad = 0;
+    s->used = 1;
+
+    for (y = y0; y < y1; y++) {
+        const uint8_t *cur = mpi->planes[0] + y * mpi->stride[0];
+        unsigned int sad;
+        p->stats_row(cur, job->prev + y * job->prev_stride, s->col_sum, w,
+                     &p->row_sum[y], &sad);
+        // the previous frame's row was read above, so it can be replaced
+        if (job->copy)
+            memcpy(job->copy + y * w, cur, w);
+        s->sad += sad;
+        for (x = 0; x < (w & ~3); x += 4) {
+            s->hist[0][cur[x    ]]++;
+            s->hist[1][cur[x + 1]]++;
+            s->hist[2][cur[x + 2]]++;
+            s->hist[3][cur[x + 3]]++;
+        }
+        for (; x < w; x++)
+            s->hist[0][cur[x]]++;
+    }
+}
+
+// first and last index whose average is above limit, like vf_cropdetect
+static void find_bounds(const unsigned int *sum, int n, int len, int limit,
+                        int *start, int *size)
+{
+    int a, b;
+    for (a = 0; a < n && sum[a] / len <= limit; a++);
+    for (b = n - 1; b > a && sum[b] / len <= limit; b--);
+    *start = a < n ? a : 0;
+    *size = a < n ? b - a + 1 : 0;
+}
+
+static void compute_stats(struct vf_priv_s *p, mp_image_t *mpi)
+{
+    struct vf_frame_stats *st = &p->stats;
+    int w = mpi->w, h = mpi->h;
+    double n = (double)w * h, sum = 0;
+    uint64_t sad = 0;
+    unsigned int black = 0;
+    int i, j, x;
+
+    memset(st->hist, 0, sizeof(st->hist));
+    memset(p->col_sum, 0, w * sizeof(unsigned int));
+    for (i = 0; i < VF_MAX_SLICES; i++) {
+        struct slice_stats *s = &p->slice[i];
+        if (!s->used)
+            continue;
+        s->used = 0;
+        for (j = 0; j < 256; j++)
+            st->hist[j] += s->hist[0][j] + s->hist[1][j] +
+                           s->hist[2][j] + s->hist[3][j];
+        for (x = 0; x < w; x++)
+            p->col_sum[x] += s->col_sum[x];
+        sad += s->sad;
+    }
+
+    for (j = 0; j < 256; j++) {
+        sum += (double)j * st->hist[j];
+        if (j < p->bthresh)
+            black += st->hist[j];
+    }
+    for (st->min = 0; st->min < 255 && !st->hist[st->min]; st->min++);
+    for (st->max = 255; st->max > 0 && !st->hist[st->max]; st->max--);
+    st->w = w;
+    st->h = h;
+    st->avg = sum / n;
+    st->black = black / n;
+
+    // scene change score as in libavfilter's select filter
+    if (p->has_prev) {
+        st->mafd = sad / n;
+        st->scene = av_clipf(FFMIN(st->mafd, fabs(st->mafd - p->prev_mafd))
+                             / 100.0, 0, 1);
+    } else
+        st->mafd = st->scene = 0;
+    p->prev_mafd = st->mafd;
+
+    find_bounds(p->row_sum, h, w, p->limit, &st->crop_y, &st->crop_h);
+    find_bounds(p->col_sum, w, h, p->limit, &st->crop_x, &st->crop_w);
+    st->row_sum = p->row_sum;
+    st->col_sum = p->col_sum;
+}
+
+static void free_buffers(struct vf_priv_s *p)
+{
+    int i;
+    if (p->prev)
+        free_mp_image(p->prev);
+    p->prev = NULL;
+    p->has_prev = 0;
+    av_freep(&p->luma);
+    p->luma_w = p->luma_h = 0;
+    av_freep(&p->row_sum);
+    av_freep(&p->col_sum);
+    for (i = 0; i < VF_MAX_SLICES; i++)
+        av_freep(&p->slice[i].col_sum);
+}
+
+static int config(struct vf_instance *vf,
+                  int width, int height, int d_width, int d_height,
+                  unsigned int flags, unsigned int outfmt)
+{
+    struct vf_priv_s *p = vf->priv;
+    int i;
+
+    free_buffers(p);
+    p->row_sum = av_malloc(height * sizeof(unsigned int));
+    p->col_sum = av_malloc(width * sizeof(unsigned int));
+    if (!p->row_sum || !p->col_sum)
+        return 0;
+    for (i = 0; i < vf_slice_threads(vf); i++) {
+        p->slice[i].col_sum = av_malloc(FFALIGN(width, 16) * sizeof(unsigned int));
+        if (!p->slice[i].col_sum)
+            return 0;
+    }
+    p->stats.frame = -1;
+
+    return vf_next_config(vf, width, height, d_width, d_height, flags, outfmt);
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct vf_priv_s *p = vf->priv;
+    struct vf_frame_stats *st = &p->stats;
+    struct slice_job job;
+    mp_image_t *dmpi;
+
+    if (p->has_prev && (p->prev ? p->prev->w != mpi->w || p->prev->h != mpi->h
+                                : p->luma_w != mpi->w || p->luma_h != mpi->h)) {
+        if (p->prev)
+            free_mp_image(p->prev);
+        p->prev = NULL;
+        p->has_prev = 0;
+    }
+
+    job = (struct slice_job){ p, mpi, mpi->planes[0], mpi->stride[0], NULL };
+    if (p->prev) {
+        job.prev = p->prev->planes[0];
+        job.prev_stride = p->prev->stride[0];
+    } else if (p->has_prev) {
+        job.prev = p->luma;
+        job.prev_stride = p->luma_w;
+    }
+    // Images from the pool are kept by reference; decoder or VO memory
+    // (EXPORT images) would need a copy of all planes, so copy only luma.
+    if (!(mpi->flags & MP_IMGFLAG_ALLOCATED)) {
+        if (p->luma_w != mpi->w || p->luma_h != mpi->h) {
+            av_freep(&p->luma);
+            p->luma = av_malloc(mpi->w * mpi->h);
+            p->luma_w = p->luma ? mpi->w : 0;
+            p->luma_h = p->luma ? mpi->h : 0;
+        }
+        job.copy = p->luma;
+    }
+    vf_run_slices(vf, mpi->h, 1, stats_slice, &job);
+    compute_stats(p, mpi);
+    st->frame++;
+
+    if (p->prev)
+        free_mp_image(p->prev);
+    p->prev = job.copy ? NULL : mp_image_new_ref(mpi);
+    p->has_prev = job.copy || p->prev;
+
+    if (p->print)
+        mp_msg(MSGT_VFILTER, MSGL_INFO, "stats: %d avg %.1f min %d max %d "
+               "black %.1f%% mafd %.2f scene %.3f crop %d:%d:%d:%d\n",
+               st->frame, st->avg, st->min, st->max, st->black * 100,
+               st->mafd, st->scene, st->crop_w, st->crop_h,
+               st->crop_x, st->crop_y);
+
+    dmpi = vf_get_image(vf->next, mpi->imgfmt, MP_IMGTYPE_EXPORT, 0,
+                        mpi->width, mpi->height);
+    memcpy(dmpi->planes, mpi->planes, sizeof(dmpi->planes));
+    memcpy(dmpi->stride, mpi->stride, sizeof(dmpi->stride));
+    vf_clone_mpi_attributes(dmpi, mpi);
+    dmpi->stats = st;
+
+    return vf_next_put_image(vf, dmpi, pts);
+}
+
+static int control(struct vf_instance *vf, int request, void *data)
+{
+    struct vf_priv_s *p = vf->priv;
+    switch (request) {
+    case VFCTRL_GET_FRAME_STATS:
+        if (p->stats.frame < 0)
+            break;
+        *(struct vf_frame_stats *)data = p->stats;
+        return CONTROL_TRUE;
+    }
+    return vf_next_control(vf, request, data);
+}
+
+static int query_format(struct vf_instance *vf, unsigned int fmt)
+{
+    switch (fmt) {
+    case IMGFMT_YVU9:
+    case IMGFMT_IF09:
+    case IMGFMT_YV12:
+    case IMGFMT_I420:
+    case IMGFMT_IYUV:
+    case IMGFMT_CLPL:
+    case IMGFMT_Y800:
+    case IMGFMT_Y8:
+    case IMGFMT_NV12:
+    case IMGFMT_NV21:
+    case IMGFMT_444P:
+    case IMGFMT_422P:
+    case IMGFMT_411P:
+        return vf_next_query_format(vf, fmt);
+    }
+    return 0;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    if (!p)
+        return;
+    free_buffers(p);
+    free(p);
+    vf->priv = NULL;
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p;
+
+    vf->config = config;
+    vf->put_image = put_image;
+    vf->control = control;
+    vf->query_format = query_format;
+    vf->uninit = uninit;
+    vf->priv = p = calloc(1, sizeof(struct vf_priv_s));
+    if (!p)
+        return 0;
+
+    p->bthresh = 0x20;
+    p->limit = 24;
+    p->stats.frame = -1;
+    if (args)
+        sscanf(args, "%d:%d:%d", &p->bthresh, &p->limit, &p->print);
+
+    p->stats_row = stats_row_c;
+#if HAVE_SSE2
+    if (gCpuCaps.hasSSE2)
+        p->stats_row = stats_row_sse2;
+#endif
+
+    return 1;
+}
+
+const vf_info_t vf_info_stats = {
+    "frame statistics for scene change, black frame and crop detection",
+    "stats",
+    "",
+    "",
+    vf_open,
+    NULL
+};
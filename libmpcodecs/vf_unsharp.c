@@ -42,7 +42,7 @@
 typedef struct FilterParam {
     int msizeX, msizeY;
     double amount;
-    uint32_t *SC[MAX_MATRIX_SIZE-1];
+    uint32_t *SC[VF_MAX_SLICES][MAX_MATRIX_SIZE-1]; // per slice
 } FilterParam;
 
 struct vf_priv_s {
@@ -64,11 +64,10 @@ Originally published Boston, Nov 98
 
 */
 
-static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp ) {
+// Filter rows [y0, y1) of a plane, reading the stepsY rows around them.
+static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, int y0, int y1, FilterParam *fp, uint32_t **SC ) {
 
-    uint32_t **SC = fp->SC;
     uint32_t SR[MAX_MATRIX_SIZE-1], Tmp1, Tmp2;
-    uint8_t* src2 = src; // avoid gcc warning
 
     int32_t res;
     int x, y, z;
@@ -82,18 +81,21 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
 	if( src == dst )
 	    return;
 	if( dstStride == srcStride )
-	    fast_memcpy( dst, src, srcStride*height );
+	    fast_memcpy( dst+y0*dstStride, src+y0*srcStride, srcStride*(y1-y0) );
 	else
-	    for( y=0; y<height; y++, dst+=dstStride, src+=srcStride )
-		fast_memcpy( dst, src, width );
+	    for( y=y0; y<y1; y++ )
+		fast_memcpy( dst+y*dstStride, src+y*srcStride, width );
 	return;
     }
 
     for( y=0; y<2*stepsY; y++ )
 	memset( SC[y], 0, sizeof(SC[y][0]) * (width+2*stepsX) );
 
-    for( y=-stepsY; y<height+stepsY; y++ ) {
-	if( y < height ) src2 = src;
+    /* The column sums only depend on the last 2*stepsY+1 rows, so starting
+     * stepsY rows above the band gives the same result as filtering the
+     * whole plane. */
+    for( y=y0-stepsY; y<y1+stepsY; y++ ) {
+	uint8_t* src2 = src + av_clip(y, 0, height-1)*srcStride;
 	memset( SR, 0, sizeof(SR[0]) * (2*stepsX-1) );
 	for( x=-stepsX; x<width+stepsX; x++ ) {
 	    Tmp1 = x<=0 ? src2[0] : x>=width ? src2[width-1] : src2[x];
@@ -105,50 +107,59 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
 		Tmp2 = SC[z+0][x+stepsX] + Tmp1; SC[z+0][x+stepsX] = Tmp1;
 		Tmp1 = SC[z+1][x+stepsX] + Tmp2; SC[z+1][x+stepsX] = Tmp2;
 	    }
-	    if( x>=stepsX && y>=stepsY ) {
-		uint8_t* srx = src - stepsY*srcStride + x - stepsX;
-		uint8_t* dsx = dst - stepsY*dstStride + x - stepsX;
+	    if( x>=stepsX && y>=y0+stepsY ) {
+		uint8_t* srx = src + (y-stepsY)*srcStride + x - stepsX;
+		uint8_t* dsx = dst + (y-stepsY)*dstStride + x - stepsX;
 
 		res = (int32_t)*srx + ( ( ( (int32_t)*srx - (int32_t)((Tmp1+halfscale) >> scalebits) ) * amount ) >> 16 );
 		*dsx = res>255 ? 255 : res<0 ? 0 : (uint8_t)res;
 	    }
 	}
-	if( y >= 0 ) {
-	    dst += dstStride;
-	    src += srcStride;
-	}
     }
 }
 
 //===========================================================================//
 
+static void free_buffers( struct vf_instance *vf ) {
+    FilterParam *fps[2] = { &vf->priv->lumaParam, &vf->priv->chromaParam };
+
+    for( int n=0; n<2; n++ )
+	for( int i=0; i<VF_MAX_SLICES; i++ )
+	    for( int z=0; z<MAX_MATRIX_SIZE-1; z++ ) {
+		av_free( fps[n]->SC[i][z] );
+		fps[n]->SC[i][z] = NULL;
+	    }
+}
+
 static int config( struct vf_instance *vf,
 		   int width, int height, int d_width, int d_height,
 		   unsigned int flags, unsigned int outfmt ) {
 
-    int z, stepsX, stepsY;
+    int i, z, stepsX, stepsY;
     FilterParam *fp;
     char *effect;
 
-    // allocate buffers
+    // allocate buffers, one set for each slice
+
+    free_buffers( vf );
 
     fp = &vf->priv->lumaParam;
     effect = fp->amount == 0 ? "don't touch" : fp->amount < 0 ? "blur" : "sharpen";
     mp_msg( MSGT_VFILTER, MSGL_INFO, "unsharp: %dx%d:%0.2f (%s luma) \n", fp->msizeX, fp->msizeY, fp->amount, effect );
-    memset( fp->SC, 0, sizeof( fp->SC ) );
     stepsX = fp->msizeX/2;
     stepsY = fp->msizeY/2;
-    for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
+    for( i=0; i<vf_slice_threads(vf); i++ )
+	for( z=0; z<2*stepsY; z++ )
+	    fp->SC[i][z] = av_malloc(sizeof(*(fp->SC[i][z])) * (width+2*stepsX));
 
     fp = &vf->priv->chromaParam;
     effect = fp->amount == 0 ? "don't touch" : fp->amount < 0 ? "blur" : "sharpen";
     mp_msg( MSGT_VFILTER, MSGL_INFO, "unsharp: %dx%d:%0.2f (%s chroma)\n", fp->msizeX, fp->msizeY, fp->amount, effect );
-    memset( fp->SC, 0, sizeof( fp->SC ) );
     stepsX = fp->msizeX/2;
     stepsY = fp->msizeY/2;
-    for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
+    for( i=0; i<vf_slice_threads(vf); i++ )
+	for( z=0; z<2*stepsY; z++ )
+	    fp->SC[i][z] = av_malloc(sizeof(*(fp->SC[i][z])) * (width+2*stepsX));
 
     return vf_next_config( vf, width, height, d_width, d_height, flags, outfmt );
 }
@@ -160,6 +171,8 @@ static void get_image( struct vf_instance *vf, mp_image_t *mpi ) {
 	return; // don't change
     if( mpi->imgfmt!=vf->priv->outfmt )
 	return; // colorspace differ
+    if( vf_slice_threads(vf) > 1 )
+	return; // slices would read rows other slices already overwrote
 
     vf->dmpi = vf_get_image( vf->next, mpi->imgfmt, mpi->type, mpi->flags, mpi->w, mpi->h );
     mpi->planes[0] = vf->dmpi->planes[0];
@@ -174,17 +187,35 @@ static void get_image( struct vf_instance *vf, mp_image_t *mpi ) {
     mpi->flags |= MP_IMGFLAG_DIRECT;
 }
 
+struct slice_job {
+    struct vf_priv_s *priv;
+    mp_image_t *mpi, *dmpi;
+};
+
+static void unsharp_slice( void *ctx, int index, int y0, int y1 ) {
+    struct slice_job *job = ctx;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+    FilterParam *luma = &job->priv->lumaParam, *chroma = &job->priv->chromaParam;
+
+    unsharp( dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w,   mpi->h,   y0,   y1,   luma,   luma->SC[index] );
+    unsharp( dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, y0/2, y1/2, chroma, chroma->SC[index] );
+    unsharp( dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, y0/2, y1/2, chroma, chroma->SC[index] );
+}
+
 static int put_image( struct vf_instance *vf, mp_image_t *mpi, double pts) {
     mp_image_t *dmpi;
+    struct slice_job job;
 
     if( !(mpi->flags & MP_IMGFLAG_DIRECT) )
 	// no DR, so get a new image! hope we'll get DR buffer:
 	vf->dmpi = vf_get_image( vf->next,vf->priv->outfmt, MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE, mpi->w, mpi->h);
     dmpi= vf->dmpi;
 
-    unsharp( dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w,   mpi->h,   &vf->priv->lumaParam );
-    unsharp( dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
-    unsharp( dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
+    job = (struct slice_job){ vf->priv, mpi, dmpi };
+    if( dmpi->planes[0] == mpi->planes[0] )
+	unsharp_slice( &job, 0, 0, mpi->h ); // in-place
+    else
+	vf_run_slices( vf, mpi->h, 2, unsharp_slice, &job );
 
     vf_clone_mpi_attributes(dmpi, mpi);
 
@@ -201,21 +232,9 @@ static int put_image( struct vf_instance *vf, mp_image_t *mpi, double pts) {
 }
 
 static void uninit( struct vf_instance *vf ) {
-    unsigned int z;
-    FilterParam *fp;
-
     if( !vf->priv ) return;
 
-    fp = &vf->priv->lumaParam;
-    for( z=0; z<sizeof(fp->SC)/sizeof(fp->SC[0]); z++ ) {
-	av_free( fp->SC[z] );
-	fp->SC[z] = NULL;
-    }
-    fp = &vf->priv->chromaParam;
-    for( z=0; z<sizeof(fp->SC)/sizeof(fp->SC[0]); z++ ) {
-	av_free( fp->SC[z] );
-	fp->SC[z] = NULL;
-    }
+    free_buffers( vf );
 
     free( vf->priv );
     vf->priv = NULL;
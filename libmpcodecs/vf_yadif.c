@@ -47,6 +47,7 @@ struct vf_priv_s {
     mp_image_t *buffered_mpi;
     int stride[3];
     uint8_t *ref[4][3];
+    int bytes;          // bytes per pixel: 2 for the 9 to 16 bit formats
     int do_deinterlace;
 };
 
@@ -61,201 +62,265 @@ static void store_ref(struct vf_priv_s *p, uint8_t *src[3], int src_stride[3], i
     for(i=0; i<3; i++){
         int is_chroma= !!i;
 
-        memcpy_pic(p->ref[2][i], src[i], width>>is_chroma, height>>is_chroma, p->stride[i], src_stride[i]);
+        memcpy_pic(p->ref[2][i], src[i], (width>>is_chroma)*p->bytes, height>>is_chroma, p->stride[i], src_stride[i]);
     }
 }
 
+#define CHECK(j)\
+    {   int score= FFABS(cur[x-refs-1+j] - cur[x+refs-1-j])\
+                 + FFABS(cur[x-refs  +j] - cur[x+refs  -j])\
+                 + FFABS(cur[x-refs+1+j] - cur[x+refs+1-j]);\
+        if(score < spatial_score){\
+            spatial_score= score;\
+            spatial_pred= (cur[x-refs  +j] + cur[x+refs  -j])>>1;\
+
+/* Shared by the 8 and 16 bit C versions, which only differ in the type of
+ * the pointers; refs is in pixels. */
+#define FILTER_LINE_C \
+    for(x=0; x<w; x++){\
+        int c= cur[x-refs];\
+        int d= (prev2[x] + next2[x])>>1;\
+        int e= cur[x+refs];\
+        int temporal_diff0= FFABS(prev2[x] - next2[x]);\
+        int temporal_diff1=( FFABS(prev[x-refs] - c) + FFABS(prev[x+refs] - e) )>>1;\
+        int temporal_diff2=( FFABS(next[x-refs] - c) + FFABS(next[x+refs] - e) )>>1;\
+        int diff= FFMAX3(temporal_diff0>>1, temporal_diff1, temporal_diff2);\
+        int spatial_pred= (c+e)>>1;\
+        int spatial_score= FFABS(cur[x-refs-1] - cur[x+refs-1]) + FFABS(c-e)\
+                         + FFABS(cur[x-refs+1] - cur[x+refs+1]) - 1;\
+\
+        CHECK(-1) CHECK(-2) }} }}\
+        CHECK( 1) CHECK( 2) }} }}\
+\
+        if(p->mode<2){\
+            int b= (prev2[x-2*refs] + next2[x-2*refs])>>1;\
+            int f= (prev2[x+2*refs] + next2[x+2*refs])>>1;\
+            int max= FFMAX3(d-e, d-c, FFMIN(b-c, f-e));\
+            int min= FFMIN3(d-e, d-c, FFMAX(b-c, f-e));\
+\
+            diff= FFMAX3(diff, min, -max);\
+        }\
+\
+        if(spatial_pred > d + diff)\
+           spatial_pred = d + diff;\
+        else if(spatial_pred < d - diff)\
+           spatial_pred = d - diff;\
+\
+        dst[x] = spatial_pred;\
+    }
+
+static void filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
+    int x;
+    uint8_t *prev2= parity ? prev : cur ;
+    uint8_t *next2= parity ? cur  : next;
+
+    FILTER_LINE_C
+}
+
+static void filter_line_c_16bit(struct vf_priv_s *p, uint8_t *dst1, uint8_t *prev1, uint8_t *cur1, uint8_t *next1, int w, int refs, int parity){
+    int x;
+    uint16_t *dst = (uint16_t *)dst1;
+    uint16_t *prev= (uint16_t *)prev1;
+    uint16_t *cur = (uint16_t *)cur1;
+    uint16_t *next= (uint16_t *)next1;
+    uint16_t *prev2= parity ? prev : cur ;
+    uint16_t *next2= parity ? cur  : next;
+
+    FILTER_LINE_C
+}
+#undef CHECK
+#undef FILTER_LINE_C
+
 #if HAVE_MMX
 
-#define LOAD4(mem,dst) \
-            "movd      "mem", "#dst" \n\t"\
-            "punpcklbw %%mm7, "#dst" \n\t"
-
-#define PABS(tmp,dst) \
-            "pxor     "#tmp", "#tmp" \n\t"\
-            "psubw    "#dst", "#tmp" \n\t"\
-            "pmaxsw   "#tmp", "#dst" \n\t"
-
-#define CHECK(pj,mj) \
-            "movq "#pj"(%[cur],%[mrefs]), %%mm2 \n\t" /* cur[x-refs-1+j] */\
-            "movq "#mj"(%[cur],%[prefs]), %%mm3 \n\t" /* cur[x+refs-1-j] */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "movq      %%mm2, %%mm5 \n\t"\
-            "pxor      %%mm3, %%mm4 \n\t"\
-            "pavgb     %%mm3, %%mm5 \n\t"\
-            "pand     %[pb1], %%mm4 \n\t"\
-            "psubusb   %%mm4, %%mm5 \n\t"\
-            "psrlq     $8,    %%mm5 \n\t"\
-            "punpcklbw %%mm7, %%mm5 \n\t" /* (cur[x-refs+j] + cur[x+refs-j])>>1 */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "psubusb   %%mm3, %%mm2 \n\t"\
-            "psubusb   %%mm4, %%mm3 \n\t"\
-            "pmaxub    %%mm3, %%mm2 \n\t"\
-            "movq      %%mm2, %%mm3 \n\t"\
-            "movq      %%mm2, %%mm4 \n\t" /* ABS(cur[x-refs-1+j] - cur[x+refs-1-j]) */\
-            "psrlq      $8,   %%mm3 \n\t" /* ABS(cur[x-refs  +j] - cur[x+refs  -j]) */\
-            "psrlq     $16,   %%mm4 \n\t" /* ABS(cur[x-refs+1+j] - cur[x+refs+1-j]) */\
-            "punpcklbw %%mm7, %%mm2 \n\t"\
-            "punpcklbw %%mm7, %%mm3 \n\t"\
-            "punpcklbw %%mm7, %%mm4 \n\t"\
-            "paddw     %%mm3, %%mm2 \n\t"\
-            "paddw     %%mm4, %%mm2 \n\t" /* score */
+static const uint16_t __attribute__((aligned(32))) pw_1[16] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+static const uint8_t __attribute__((aligned(16))) pb_1[16] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+#define COMPILE_TEMPLATE_SSE2 0
+#define COMPILE_TEMPLATE_SSSE3 0
+#define RENAME(a) a ## _mmx2
+#include "yadif_template.c"
+#undef RENAME
+
+#if HAVE_SSE2
+#undef COMPILE_TEMPLATE_SSE2
+#define COMPILE_TEMPLATE_SSE2 1
+#define RENAME(a) a ## _sse2
+#include "yadif_template.c"
+#undef RENAME
+#endif
+
+#if HAVE_SSSE3
+#undef COMPILE_TEMPLATE_SSSE3
+#define COMPILE_TEMPLATE_SSSE3 1
+#define RENAME(a) a ## _ssse3
+#include "yadif_template.c"
+#undef RENAME
+#endif
+
+#endif /* HAVE_MMX */
+
+#if HAVE_AVX2 && ARCH_X86_64
+
+#define LOADW(mem,dst) \
+            "vpmovzxbw "mem", "dst" \n\t"
+
+#define ABSDIFF(m1,m2,dst,tmp) \
+            LOADW(m1, dst)\
+            LOADW(m2, tmp)\
+            "vpsubw    "tmp", "dst", "dst" \n\t"\
+            "vpabsw    "dst", "dst" \n\t"
+
+/* Same steps as the MMX2 version, 16 pixels at a time. The neighbours are
+ * loaded at their own offsets rather than shifted into place, since
+ * vpsrldq does not cross the 128 bit lanes. */
+/* score and average for direction j, with (a0,b0), (a1,b1), (a2,b2) the
+ * offsets (j-1,-1-j), (j,-j), (j+1,1-j) of the upper and lower pixels */
+#define CHECK(a0,b0,a1,b1,a2,b2) \
+            ABSDIFF(#a0"(%[cur],%[mrefs])", #b0"(%[cur],%[prefs])", "%%ymm2", "%%ymm3")\
+            LOADW(#a1"(%[cur],%[mrefs])", "%%ymm4")\
+            LOADW(#b1"(%[cur],%[prefs])", "%%ymm5")\
+            "vpaddw    %%ymm5, %%ymm4, %%ymm6 \n\t"\
+            "vpsrlw    $1,     %%ymm6, %%ymm6 \n\t" /* (cur[x-refs+j] + cur[x+refs-j])>>1 */\
+            "vpsubw    %%ymm5, %%ymm4, %%ymm4 \n\t"\
+            "vpabsw    %%ymm4, %%ymm4 \n\t"\
+            "vpaddw    %%ymm4, %%ymm2, %%ymm2 \n\t"\
+            ABSDIFF(#a2"(%[cur],%[mrefs])", #b2"(%[cur],%[prefs])", "%%ymm4", "%%ymm5")\
+            "vpaddw    %%ymm4, %%ymm2, %%ymm2 \n\t" /* score */
 
 #define CHECK1 \
-            "movq      %%mm0, %%mm3 \n\t"\
-            "pcmpgtw   %%mm2, %%mm3 \n\t" /* if(score < spatial_score) */\
-            "pminsw    %%mm2, %%mm0 \n\t" /* spatial_score= score; */\
-            "movq      %%mm3, %%mm6 \n\t"\
-            "pand      %%mm3, %%mm5 \n\t"\
-            "pandn     %%mm1, %%mm3 \n\t"\
-            "por       %%mm5, %%mm3 \n\t"\
-            "movq      %%mm3, %%mm1 \n\t" /* spatial_pred= (cur[x-refs+j] + cur[x+refs-j])>>1; */
-
-#define CHECK2 /* pretend not to have checked dir=2 if dir=1 was bad.\
-                  hurts both quality and speed, but matches the C version. */\
-            "paddw    %[pw1], %%mm6 \n\t"\
-            "psllw     $14,   %%mm6 \n\t"\
-            "paddsw    %%mm6, %%mm2 \n\t"\
-            "movq      %%mm0, %%mm3 \n\t"\
-            "pcmpgtw   %%mm2, %%mm3 \n\t"\
-            "pminsw    %%mm2, %%mm0 \n\t"\
-            "pand      %%mm3, %%mm5 \n\t"\
-            "pandn     %%mm1, %%mm3 \n\t"\
-            "por       %%mm5, %%mm3 \n\t"\
-            "movq      %%mm3, %%mm1 \n\t"
-
-static void filter_line_mmx2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
-    static const uint64_t pw_1 = 0x0001000100010001ULL;
-    static const uint64_t pb_1 = 0x0101010101010101ULL;
+            "vpcmpgtw  %%ymm2, %%ymm11, %%ymm7 \n\t" /* if(score < spatial_score) */\
+            "vpminsw   %%ymm2, %%ymm11, %%ymm11 \n\t" /* spatial_score= score; */\
+            "vpblendvb %%ymm7, %%ymm6, %%ymm10, %%ymm10 \n\t" /* spatial_pred= ... */
+
+#define CHECK2 /* pretend not to have checked dir=2 if dir=1 was bad */\
+            "vpaddw    %%ymm12, %%ymm7, %%ymm13 \n\t"\
+            "vpsllw    $14,     %%ymm13, %%ymm13 \n\t"\
+            "vpaddsw   %%ymm13, %%ymm2, %%ymm2 \n\t"\
+            CHECK1
+
+static void filter_line_avx2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
     const int mode = p->mode;
-    uint64_t tmp0, tmp1, tmp2, tmp3;
-    int x;
+    x86_reg x;
+
+    if (w & 15) {
+        x = w & ~15;
+        filter_line_c(p, dst+x, prev+x, cur+x, next+x, w-x, refs, parity);
+        w = x;
+    }
+    if (!w)
+        return;
+    x = w;
 
 #define FILTER\
-    for(x=0; x<w; x+=4){\
         __asm__ volatile(\
-            "pxor      %%mm7, %%mm7 \n\t"\
-            LOAD4("(%[cur],%[mrefs])", %%mm0) /* c = cur[x-refs] */\
-            LOAD4("(%[cur],%[prefs])", %%mm1) /* e = cur[x+refs] */\
-            LOAD4("(%["prev2"])", %%mm2) /* prev2[x] */\
-            LOAD4("(%["next2"])", %%mm3) /* next2[x] */\
-            "movq      %%mm3, %%mm4 \n\t"\
-            "paddw     %%mm2, %%mm3 \n\t"\
-            "psraw     $1,    %%mm3 \n\t" /* d = (prev2[x] + next2[x])>>1 */\
-            "movq      %%mm0, %[tmp0] \n\t" /* c */\
-            "movq      %%mm3, %[tmp1] \n\t" /* d */\
-            "movq      %%mm1, %[tmp2] \n\t" /* e */\
-            "psubw     %%mm4, %%mm2 \n\t"\
-            PABS(      %%mm4, %%mm2) /* temporal_diff0 */\
-            LOAD4("(%[prev],%[mrefs])", %%mm3) /* prev[x-refs] */\
-            LOAD4("(%[prev],%[prefs])", %%mm4) /* prev[x+refs] */\
-            "psubw     %%mm0, %%mm3 \n\t"\
-            "psubw     %%mm1, %%mm4 \n\t"\
-            PABS(      %%mm5, %%mm3)\
-            PABS(      %%mm5, %%mm4)\
-            "paddw     %%mm4, %%mm3 \n\t" /* temporal_diff1 */\
-            "psrlw     $1,    %%mm2 \n\t"\
-            "psrlw     $1,    %%mm3 \n\t"\
-            "pmaxsw    %%mm3, %%mm2 \n\t"\
-            LOAD4("(%[next],%[mrefs])", %%mm3) /* next[x-refs] */\
-            LOAD4("(%[next],%[prefs])", %%mm4) /* next[x+refs] */\
-            "psubw     %%mm0, %%mm3 \n\t"\
-            "psubw     %%mm1, %%mm4 \n\t"\
-            PABS(      %%mm5, %%mm3)\
-            PABS(      %%mm5, %%mm4)\
-            "paddw     %%mm4, %%mm3 \n\t" /* temporal_diff2 */\
-            "psrlw     $1,    %%mm3 \n\t"\
-            "pmaxsw    %%mm3, %%mm2 \n\t"\
-            "movq      %%mm2, %[tmp3] \n\t" /* diff */\
-\
-            "paddw     %%mm0, %%mm1 \n\t"\
-            "paddw     %%mm0, %%mm0 \n\t"\
-            "psubw     %%mm1, %%mm0 \n\t"\
-            "psrlw     $1,    %%mm1 \n\t" /* spatial_pred */\
-            PABS(      %%mm2, %%mm0)      /* ABS(c-e) */\
+            "vmovdqa   %[pw1], %%ymm12 \n\t"\
+            "1: \n\t"\
+            LOADW("(%[cur],%[mrefs])", "%%ymm0") /* c = cur[x-refs] */\
+            LOADW("(%[cur],%[prefs])", "%%ymm1") /* e = cur[x+refs] */\
+            LOADW("(%["prev2"])", "%%ymm2") /* prev2[x] */\
+            LOADW("(%["next2"])", "%%ymm3") /* next2[x] */\
+            "vpaddw    %%ymm3, %%ymm2, %%ymm8 \n\t"\
+            "vpsrlw    $1,     %%ymm8, %%ymm8 \n\t" /* d = (prev2[x] + next2[x])>>1 */\
+            "vpsubw    %%ymm3, %%ymm2, %%ymm2 \n\t"\
+            "vpabsw    %%ymm2, %%ymm2 \n\t"\
+            "vpsrlw    $1,     %%ymm2, %%ymm2 \n\t" /* temporal_diff0>>1 */\
+            LOADW("(%[prev],%[mrefs])", "%%ymm3") /* prev[x-refs] */\
+            LOADW("(%[prev],%[prefs])", "%%ymm4") /* prev[x+refs] */\
+            "vpsubw    %%ymm0, %%ymm3, %%ymm3 \n\t"\
+            "vpsubw    %%ymm1, %%ymm4, %%ymm4 \n\t"\
+            "vpabsw    %%ymm3, %%ymm3 \n\t"\
+            "vpabsw    %%ymm4, %%ymm4 \n\t"\
+            "vpaddw    %%ymm4, %%ymm3, %%ymm3 \n\t"\
+            "vpsrlw    $1,     %%ymm3, %%ymm3 \n\t" /* temporal_diff1 */\
+            "vpmaxsw   %%ymm3, %%ymm2, %%ymm2 \n\t"\
+            LOADW("(%[next],%[mrefs])", "%%ymm3") /* next[x-refs] */\
+            LOADW("(%[next],%[prefs])", "%%ymm4") /* next[x+refs] */\
+            "vpsubw    %%ymm0, %%ymm3, %%ymm3 \n\t"\
+            "vpsubw    %%ymm1, %%ymm4, %%ymm4 \n\t"\
+            "vpabsw    %%ymm3, %%ymm3 \n\t"\
+            "vpabsw    %%ymm4, %%ymm4 \n\t"\
+            "vpaddw    %%ymm4, %%ymm3, %%ymm3 \n\t"\
+            "vpsrlw    $1,     %%ymm3, %%ymm3 \n\t" /* temporal_diff2 */\
+            "vpmaxsw   %%ymm3, %%ymm2, %%ymm9 \n\t" /* diff */\
 \
-            "movq -1(%[cur],%[mrefs]), %%mm2 \n\t" /* cur[x-refs-1] */\
-            "movq -1(%[cur],%[prefs]), %%mm3 \n\t" /* cur[x+refs-1] */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "psubusb   %%mm3, %%mm2 \n\t"\
-            "psubusb   %%mm4, %%mm3 \n\t"\
-            "pmaxub    %%mm3, %%mm2 \n\t"\
-            "pshufw $9,%%mm2, %%mm3 \n\t"\
-            "punpcklbw %%mm7, %%mm2 \n\t" /* ABS(cur[x-refs-1] - cur[x+refs-1]) */\
-            "punpcklbw %%mm7, %%mm3 \n\t" /* ABS(cur[x-refs+1] - cur[x+refs+1]) */\
-            "paddw     %%mm2, %%mm0 \n\t"\
-            "paddw     %%mm3, %%mm0 \n\t"\
-            "psubw    %[pw1], %%mm0 \n\t" /* spatial_score */\
+            "vpaddw    %%ymm1, %%ymm0, %%ymm10 \n\t"\
+            "vpsrlw    $1,     %%ymm10, %%ymm10 \n\t" /* spatial_pred */\
+            "vpsubw    %%ymm1, %%ymm0, %%ymm11 \n\t"\
+            "vpabsw    %%ymm11, %%ymm11 \n\t" /* ABS(c-e) */\
+            ABSDIFF("-1(%[cur],%[mrefs])", "-1(%[cur],%[prefs])", "%%ymm2", "%%ymm3")\
+            ABSDIFF( "1(%[cur],%[mrefs])",  "1(%[cur],%[prefs])", "%%ymm4", "%%ymm5")\
+            "vpaddw    %%ymm2, %%ymm11, %%ymm11 \n\t"\
+            "vpaddw    %%ymm4, %%ymm11, %%ymm11 \n\t"\
+            "vpsubw    %%ymm12, %%ymm11, %%ymm11 \n\t" /* spatial_score */\
 \
-            CHECK(-2,0)\
+            CHECK(-2, 0, -1, 1,  0, 2)\
             CHECK1\
-            CHECK(-3,1)\
+            CHECK(-3, 1, -2, 2, -1, 3)\
             CHECK2\
-            CHECK(0,-2)\
+            CHECK( 0,-2,  1,-1,  2, 0)\
             CHECK1\
-            CHECK(1,-3)\
+            CHECK( 1,-3,  2,-2,  3,-1)\
             CHECK2\
 \
             /* if(p->mode<2) ... */\
-            "movq    %[tmp3], %%mm6 \n\t" /* diff */\
             "cmpl      $2, %[mode] \n\t"\
-            "jge       1f \n\t"\
-            LOAD4("(%["prev2"],%[mrefs],2)", %%mm2) /* prev2[x-2*refs] */\
-            LOAD4("(%["next2"],%[mrefs],2)", %%mm4) /* next2[x-2*refs] */\
-            LOAD4("(%["prev2"],%[prefs],2)", %%mm3) /* prev2[x+2*refs] */\
-            LOAD4("(%["next2"],%[prefs],2)", %%mm5) /* next2[x+2*refs] */\
-            "paddw     %%mm4, %%mm2 \n\t"\
-            "paddw     %%mm5, %%mm3 \n\t"\
-            "psrlw     $1,    %%mm2 \n\t" /* b */\
-            "psrlw     $1,    %%mm3 \n\t" /* f */\
-            "movq    %[tmp0], %%mm4 \n\t" /* c */\
-            "movq    %[tmp1], %%mm5 \n\t" /* d */\
-            "movq    %[tmp2], %%mm7 \n\t" /* e */\
-            "psubw     %%mm4, %%mm2 \n\t" /* b-c */\
-            "psubw     %%mm7, %%mm3 \n\t" /* f-e */\
-            "movq      %%mm5, %%mm0 \n\t"\
-            "psubw     %%mm4, %%mm5 \n\t" /* d-c */\
-            "psubw     %%mm7, %%mm0 \n\t" /* d-e */\
-            "movq      %%mm2, %%mm4 \n\t"\
-            "pminsw    %%mm3, %%mm2 \n\t"\
-            "pmaxsw    %%mm4, %%mm3 \n\t"\
-            "pmaxsw    %%mm5, %%mm2 \n\t"\
-            "pminsw    %%mm5, %%mm3 \n\t"\
-            "pmaxsw    %%mm0, %%mm2 \n\t" /* max */\
-            "pminsw    %%mm0, %%mm3 \n\t" /* min */\
-            "pxor      %%mm4, %%mm4 \n\t"\
-            "pmaxsw    %%mm3, %%mm6 \n\t"\
-            "psubw     %%mm2, %%mm4 \n\t" /* -max */\
-            "pmaxsw    %%mm4, %%mm6 \n\t" /* diff= MAX3(diff, min, -max); */\
-            "1: \n\t"\
+            "jge       2f \n\t"\
+            LOADW("(%["prev2"],%[mrefs],2)", "%%ymm2") /* prev2[x-2*refs] */\
+            LOADW("(%["next2"],%[mrefs],2)", "%%ymm4") /* next2[x-2*refs] */\
+            LOADW("(%["prev2"],%[prefs],2)", "%%ymm3") /* prev2[x+2*refs] */\
+            LOADW("(%["next2"],%[prefs],2)", "%%ymm5") /* next2[x+2*refs] */\
+            "vpaddw    %%ymm4, %%ymm2, %%ymm2 \n\t"\
+            "vpaddw    %%ymm5, %%ymm3, %%ymm3 \n\t"\
+            "vpsrlw    $1,     %%ymm2, %%ymm2 \n\t" /* b */\
+            "vpsrlw    $1,     %%ymm3, %%ymm3 \n\t" /* f */\
+            "vpsubw    %%ymm0, %%ymm2, %%ymm2 \n\t" /* b-c */\
+            "vpsubw    %%ymm1, %%ymm3, %%ymm3 \n\t" /* f-e */\
+            "vpsubw    %%ymm0, %%ymm8, %%ymm4 \n\t" /* d-c */\
+            "vpsubw    %%ymm1, %%ymm8, %%ymm5 \n\t" /* d-e */\
+            "vpminsw   %%ymm3, %%ymm2, %%ymm6 \n\t"\
+            "vpmaxsw   %%ymm3, %%ymm2, %%ymm7 \n\t"\
+            "vpmaxsw   %%ymm4, %%ymm6, %%ymm6 \n\t"\
+            "vpminsw   %%ymm4, %%ymm7, %%ymm7 \n\t"\
+            "vpmaxsw   %%ymm5, %%ymm6, %%ymm6 \n\t" /* max */\
+            "vpminsw   %%ymm5, %%ymm7, %%ymm7 \n\t" /* min */\
+            "vpxor     %%ymm4, %%ymm4, %%ymm4 \n\t"\
+            "vpsubw    %%ymm6, %%ymm4, %%ymm4 \n\t" /* -max */\
+            "vpmaxsw   %%ymm7, %%ymm9, %%ymm9 \n\t"\
+            "vpmaxsw   %%ymm4, %%ymm9, %%ymm9 \n\t" /* diff= MAX3(diff, min, -max); */\
+            "2: \n\t"\
 \
-            "movq    %[tmp1], %%mm2 \n\t" /* d */\
-            "movq      %%mm2, %%mm3 \n\t"\
-            "psubw     %%mm6, %%mm2 \n\t" /* d-diff */\
-            "paddw     %%mm6, %%mm3 \n\t" /* d+diff */\
-            "pmaxsw    %%mm2, %%mm1 \n\t"\
-            "pminsw    %%mm3, %%mm1 \n\t" /* d = clip(spatial_pred, d-diff, d+diff); */\
-            "packuswb  %%mm1, %%mm1 \n\t"\
+            "vpsubw    %%ymm9, %%ymm8, %%ymm2 \n\t" /* d-diff */\
+            "vpaddw    %%ymm9, %%ymm8, %%ymm3 \n\t" /* d+diff */\
+            "vpmaxsw   %%ymm2, %%ymm10, %%ymm10 \n\t"\
+            "vpminsw   %%ymm3, %%ymm10, %%ymm10 \n\t" /* d = clip(spatial_pred, d-diff, d+diff); */\
+            "vpackuswb %%ymm10, %%ymm10, %%ymm10 \n\t"\
+            "vpermq    $8, %%ymm10, %%ymm10 \n\t"\
+            "vmovdqu   %%xmm10, (%[dst]) \n\t"\
 \
-            :[tmp0]"=m"(tmp0),\
-             [tmp1]"=m"(tmp1),\
-             [tmp2]"=m"(tmp2),\
-             [tmp3]"=m"(tmp3)\
-            :[prev] "r"(prev),\
-             [cur]  "r"(cur),\
-             [next] "r"(next),\
-             [prefs]"r"((x86_reg)refs),\
+            "add       $16, %[dst] \n\t"\
+            "add       $16, %[prev] \n\t"\
+            "add       $16, %[cur] \n\t"\
+            "add       $16, %[next] \n\t"\
+            "sub       $16, %[x] \n\t"\
+            "jg        1b \n\t"\
+            "vzeroupper \n\t"\
+            :[dst]  "+r"(dst),\
+             [prev] "+r"(prev),\
+             [cur]  "+r"(cur),\
+             [next] "+r"(next),\
+             [x]    "+r"(x)\
+            :[prefs]"r"((x86_reg)refs),\
              [mrefs]"r"((x86_reg)-refs),\
-             [pw1]  "m"(pw_1),\
-             [pb1]  "m"(pb_1),\
-             [mode] "g"(mode)\
-        );\
-        __asm__ volatile("movd %%mm1, %0" :"=m"(*dst));\
-        dst += 4;\
-        prev+= 4;\
-        cur += 4;\
-        next+= 4;\
-    }
+             [pw1]  "m"(*pw_1),\
+             [mode] "r"(mode)\
+            :"memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",\
+             "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13"\
+        );
 
     if(parity){
 #define prev2 "prev"
@@ -271,92 +336,48 @@ static void filter_line_mmx2(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, u
 #undef next2
     }
 }
-#undef LOAD4
-#undef PABS
+#undef LOADW
+#undef ABSDIFF
 #undef CHECK
 #undef CHECK1
 #undef CHECK2
 #undef FILTER
 
-#endif /* HAVE_MMX */
-
-static void filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity){
-    int x;
-    uint8_t *prev2= parity ? prev : cur ;
-    uint8_t *next2= parity ? cur  : next;
-    for(x=0; x<w; x++){
-        int c= cur[-refs];
-        int d= (prev2[0] + next2[0])>>1;
-        int e= cur[+refs];
-        int temporal_diff0= FFABS(prev2[0] - next2[0]);
-        int temporal_diff1=( FFABS(prev[-refs] - c) + FFABS(prev[+refs] - e) )>>1;
-        int temporal_diff2=( FFABS(next[-refs] - c) + FFABS(next[+refs] - e) )>>1;
-        int diff= FFMAX3(temporal_diff0>>1, temporal_diff1, temporal_diff2);
-        int spatial_pred= (c+e)>>1;
-        int spatial_score= FFABS(cur[-refs-1] - cur[+refs-1]) + FFABS(c-e)
-                         + FFABS(cur[-refs+1] - cur[+refs+1]) - 1;
+#endif /* HAVE_AVX2 && ARCH_X86_64 */
 
-#define CHECK(j)\
-    {   int score= FFABS(cur[-refs-1+j] - cur[+refs-1-j])\
-                 + FFABS(cur[-refs  +j] - cur[+refs  -j])\
-                 + FFABS(cur[-refs+1+j] - cur[+refs+1-j]);\
-        if(score < spatial_score){\
-            spatial_score= score;\
-            spatial_pred= (cur[-refs  +j] + cur[+refs  -j])>>1;\
-
-        CHECK(-1) CHECK(-2) }} }}
-        CHECK( 1) CHECK( 2) }} }}
-
-        if(p->mode<2){
-            int b= (prev2[-2*refs] + next2[-2*refs])>>1;
-            int f= (prev2[+2*refs] + next2[+2*refs])>>1;
-#if 0
-            int a= cur[-3*refs];
-            int g= cur[+3*refs];
-            int max= FFMAX3(d-e, d-c, FFMIN3(FFMAX(b-c,f-e),FFMAX(b-c,b-a),FFMAX(f-g,f-e)) );
-            int min= FFMIN3(d-e, d-c, FFMAX3(FFMIN(b-c,f-e),FFMIN(b-c,b-a),FFMIN(f-g,f-e)) );
-#else
-            int max= FFMAX3(d-e, d-c, FFMIN(b-c, f-e));
-            int min= FFMIN3(d-e, d-c, FFMAX(b-c, f-e));
-#endif
-
-            diff= FFMAX3(diff, min, -max);
-        }
-
-        if(spatial_pred > d + diff)
-           spatial_pred = d + diff;
-        else if(spatial_pred < d - diff)
-           spatial_pred = d - diff;
-
-        dst[0] = spatial_pred;
-
-        dst++;
-        cur++;
-        prev++;
-        next++;
-        prev2++;
-        next2++;
-    }
-}
+struct slice_job {
+    struct vf_priv_s *p;
+    uint8_t **dst;
+    int *dst_stride;
+    int width, height, parity, tff;
+};
 
-static void filter(struct vf_priv_s *p, uint8_t *dst[3], int dst_stride[3], int width, int height, int parity, int tff){
+// Deinterlace luma rows [y0, y1) and the matching chroma rows.
+static void filter_slice(void *ctx, int index, int y0, int y1){
+    struct slice_job *job = ctx;
+    struct vf_priv_s *p = job->p;
+    uint8_t **dst = job->dst;
+    int *dst_stride = job->dst_stride;
+    int parity = job->parity, tff = job->tff;
+    int bytes = p->bytes;
+    void (*line)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity) =
+        bytes == 2 ? filter_line_c_16bit : filter_line;
     int y, i;
 
     for(i=0; i<3; i++){
         int is_chroma= !!i;
-        int w= width >>is_chroma;
-        int h= height>>is_chroma;
+        int w= job->width >>is_chroma;
         int refs= p->stride[i];
 
-        for(y=0; y<h; y++){
+        for(y=y0>>is_chroma; y<y1>>is_chroma; y++){
             if((y ^ parity) & 1){
                 uint8_t *prev= &p->ref[0][i][y*refs];
                 uint8_t *cur = &p->ref[1][i][y*refs];
                 uint8_t *next= &p->ref[2][i][y*refs];
                 uint8_t *dst2= &dst[i][y*dst_stride[i]];
-                filter_line(p, dst2, prev, cur, next, w, refs, parity ^ tff);
+                line(p, dst2, prev, cur, next, w, refs / bytes, parity ^ tff);
             }else{
-                fast_memcpy(&dst[i][y*dst_stride[i]], &p->ref[1][i][y*refs], w);
+                fast_memcpy(&dst[i][y*dst_stride[i]], &p->ref[1][i][y*refs], w*bytes);
             }
         }
     }
@@ -365,19 +386,28 @@ static void filter(struct vf_priv_s *p, uint8_t *dst[3], int dst_stride[3], int
 #endif
 }
 
+static void filter(struct vf_instance *vf, uint8_t *dst[3], int dst_stride[3], int width, int height, int parity, int tff){
+    // every row only depends on the reference frames, so any split works
+    vf_run_slices(vf, height, 2, filter_slice,
+                  &(struct slice_job){vf->priv, dst, dst_stride, width, height, parity, tff});
+}
+
 static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
         int i, j;
 
+        vf->priv->bytes= IMGFMT_IS_YUVP16(outfmt) ? 2 : 1;
         for(i=0; i<3; i++){
             int is_chroma= !!i;
-            int w= ((width   + 31) & (~31))>>is_chroma;
+            int w= (((width  + 31) & (~31))>>is_chroma)*vf->priv->bytes;
             int h= ((height+6+ 31) & (~31))>>is_chroma;
 
             vf->priv->stride[i]= w;
+            // the line filters read a few pixels past the borders; zero
+            // them so the output doesn't depend on what malloc returned
             for(j=0; j<3; j++)
-                vf->priv->ref[j][i]= (char *)malloc(w*h*sizeof(uint8_t))+3*w;
+                vf->priv->ref[j][i]= (char *)calloc(w*h, 1)+3*w;
         }
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
@@ -440,7 +470,7 @@ static int continue_buffered_image(struct vf_instance *vf)
             MP_IMGFLAG_ACCEPT_STRIDE|MP_IMGFLAG_PREFER_ALIGNED_STRIDE,
             mpi->width,mpi->height);
         vf_clone_mpi_attributes(dmpi, mpi);
-        filter(vf->priv, dmpi->planes, dmpi->stride, mpi->w, mpi->h, i ^ tff ^ 1, tff);
+        filter(vf, dmpi->planes, dmpi->stride, mpi->w, mpi->h, i ^ tff ^ 1, tff);
         if (i < (vf->priv->mode & 1))
             vf_queue_frame(vf, continue_buffered_image);
         ret |= vf_next_put_image(vf, dmpi, pts);
@@ -471,6 +501,9 @@ static int query_format(struct vf_instance *vf, unsigned int fmt){
 	case IMGFMT_IYUV:
 	case IMGFMT_Y800:
 	case IMGFMT_Y8:
+	case IMGFMT_420P16:
+	case IMGFMT_420P10:
+	case IMGFMT_420P9:
 	    return vf_next_query_format(vf,fmt);
     }
     return 0;
@@ -508,6 +541,15 @@ static int vf_open(vf_instance_t *vf, char *args){
 #if HAVE_MMX
     if(gCpuCaps.hasMMX2) filter_line = filter_line_mmx2;
 #endif
+#if HAVE_SSE2
+    if(gCpuCaps.hasSSE2) filter_line = filter_line_sse2;
+#endif
+#if HAVE_SSSE3
+    if(gCpuCaps.hasSSSE3) filter_line = filter_line_ssse3;
+#endif
+#if HAVE_AVX2 && ARCH_X86_64
+    if(gCpuCaps.hasAVX2) filter_line = filter_line_avx2;
+#endif
 
     return 1;
 }
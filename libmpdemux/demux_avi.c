@@ -24,6 +24,7 @@
 #include <unistd.h>
 
 #include "config.h"
+#include "options.h"
 #include "mp_msg.h"
 
 #include "stream/stream.h"
@@ -282,7 +283,8 @@ do{
 
   ds=demux_avi_select_stream(demux,id);
   if(ds)
-    if(ds->packs+1>=MAX_PACKS || ds->bytes+len>=MAX_PACK_BYTES){
+    if(ds->packs+1>=demux->opts->demuxer_max_packs ||
+       ds->bytes+len>=demux->opts->demuxer_max_bytes){
 	// this packet will cause a buffer overflow, switch to -ni mode!!!
 	mp_tmsg(MSGT_DEMUX,MSGL_WARN,"\nBadly interleaved AVI file detected - switching to -ni mode...\n");
 	if(priv->idx_size>0){
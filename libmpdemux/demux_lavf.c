@@ -775,8 +775,11 @@ static int demux_lavf_fill_buffer(demuxer_t *demux, demux_stream_t *dsds)
     // If the packet has pointers to temporary fields that could be
     // overwritten/freed by next av_read_frame(), copy them to persistent
     // allocations so we can safely queue the packet for any length of time.
+    uint8_t *data = pkt->data;
     if (av_dup_packet(pkt) < 0)
         abort();
+    if (pkt->data != data)
+        demux_count_copied_bytes(pkt->size);
     dp = new_demux_packet_fromdata(pkt->data, pkt->size);
     dp->avpacket = pkt;
 
@@ -28,6 +28,9 @@
 #include <sys/stat.h>
 
 #include "config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "options.h"
 #include "talloc.h"
 #include "mp_msg.h"
@@ -163,6 +166,163 @@ const demuxer_desc_t *const demuxer_list[] = {
     NULL
 };
 
+/* Packet pool: demux packets are allocated and freed at a high rate, so
+ * keep freed packet headers and payload buffers around for reuse instead of
+ * going through malloc/free for every packet. Buffers are kept in size
+ * classes spaced a quarter octave apart, so a packet wastes at most 25% of
+ * its buffer (power of two classes could nearly double the memory used by
+ * queued packets). The pool is shared by all demuxers, since packets are
+ * allocated without reference to a demuxer, and freed from whichever thread
+ * consumes them; the free buffers it retains are capped at POOL_MAX_BYTES. */
+#define POOL_MIN_SHIFT 8    // smallest buffer class: 256 bytes
+#define POOL_CLASSES 49     // 4 classes per octave, largest class: 1 MiB
+#define POOL_MAX_BYTES (16 * 1024 * 1024)
+#define POOL_MAX_HEADERS 1024
+
+struct pool_entry {
+    struct pool_entry *next;
+};
+
+static struct packet_pool {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock;
+#endif
+    struct pool_entry *headers;
+    int num_headers;
+    struct pool_entry *buffers[POOL_CLASSES];
+    struct demux_packet_pool_stats stats;
+} packet_pool = {
+#ifdef HAVE_PTHREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void pool_lock(void)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&packet_pool.lock);
+#endif
+}
+
+static void pool_unlock(void)
+{
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&packet_pool.lock);
+#endif
+}
+
+static size_t pool_class_size(int c)
+{
+    return (size_t)(4 + (c & 3)) << (c / 4 + POOL_MIN_SHIFT - 2);
+}
+
+static int pool_class(size_t size)
+{
+    if (size <= 1 << POOL_MIN_SHIFT)
+        return 0;
+    if (size > pool_class_size(POOL_CLASSES - 1))
+        return -1;
+    // (size - 1) is in [2^k, 2^(k+1)), and the classes in that octave are
+    // spaced 2^(k-2) apart; pick the first one that is >= size.
+    int k = av_log2(size - 1);
+    return (k - POOL_MIN_SHIFT) * 4 + ((size - 1) >> (k - 2)) - 3;
+}
+
+// Allocate a buffer of at least size bytes, set *class to its size class
+// (-1 for buffers that are too large to be pooled).
+static void *pool_get_buffer(size_t size, int *class)
+{
+    void *buf = NULL;
+    int c = pool_class(size);
+    pool_lock();
+    packet_pool.stats.buffer_allocs++;
+    if (c >= 0 && packet_pool.buffers[c]) {
+        struct pool_entry *e = packet_pool.buffers[c];
+        packet_pool.buffers[c] = e->next;
+        packet_pool.stats.buffer_hits++;
+        packet_pool.stats.pooled_bytes -= pool_class_size(c);
+        buf = e;
+    }
+    pool_unlock();
+    if (!buf)
+        buf = malloc(c >= 0 ? pool_class_size(c) : size);
+    if (!buf) {
+        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
+        abort();
+    }
+    *class = c;
+    return buf;
+}
+
+static void pool_put_buffer(void *buf, int class)
+{
+    if (class >= 0) {
+        size_t size = pool_class_size(class);
+        pool_lock();
+        if (packet_pool.stats.pooled_bytes + size <= POOL_MAX_BYTES) {
+            struct pool_entry *e = buf;
+            e->next = packet_pool.buffers[class];
+            packet_pool.buffers[class] = e;
+            packet_pool.stats.pooled_bytes += size;
+            buf = NULL;
+        }
+        pool_unlock();
+    }
+    free(buf);
+}
+
+static struct demux_packet *pool_get_header(void)
+{
+    struct demux_packet *dp = NULL;
+    pool_lock();
+    packet_pool.stats.packet_allocs++;
+    if (packet_pool.headers) {
+        dp = (struct demux_packet *)packet_pool.headers;
+        packet_pool.headers = packet_pool.headers->next;
+        packet_pool.num_headers--;
+        packet_pool.stats.packet_hits++;
+    }
+    pool_unlock();
+    if (!dp)
+        dp = malloc(sizeof(struct demux_packet));
+    if (!dp) {
+        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
+        abort();
+    }
+    return dp;
+}
+
+static void pool_put_header(struct demux_packet *dp)
+{
+    pool_lock();
+    if (packet_pool.num_headers < POOL_MAX_HEADERS) {
+        struct pool_entry *e = (struct pool_entry *)dp;
+        e->next = packet_pool.headers;
+        packet_pool.headers = e;
+        packet_pool.num_headers++;
+        dp = NULL;
+    }
+    pool_unlock();
+    free(dp);
+}
+
+/* Count packet payload bytes copied on the way from the demuxer to the
+ * decoders. Packets are normally handed to decoders by reference, so this
+ * stays near zero for demuxers and decoders that use the packet API. */
+void demux_count_copied_bytes(int64_t bytes)
+{
+    pool_lock();
+    packet_pool.stats.copied_bytes += bytes;
+    pool_unlock();
+}
+
+void demux_packet_pool_get_stats(struct demux_packet_pool_stats *stats)
+{
+    pool_lock();
+    *stats = packet_pool.stats;
+    pool_unlock();
+}
+
 static struct demux_packet *create_packet(size_t len)
 {
     if (len > 1000000000) {
@@ -170,7 +330,7 @@ static struct demux_packet *create_packet(size_t len)
                "over 1 GB!\n");
         abort();
     }
-    struct demux_packet *dp = malloc(sizeof(struct demux_packet));
+    struct demux_packet *dp = pool_get_header();
     dp->len = len;
     dp->next = NULL;
     dp->pts = MP_NOPTS_VALUE;
@@ -181,6 +341,7 @@ static struct demux_packet *create_packet(size_t len)
     dp->refcount = 1;
     dp->master = NULL;
     dp->buffer = NULL;
+    dp->buffer_class = -1;
     dp->avpacket = NULL;
     return dp;
 }
@@ -188,11 +349,8 @@ static struct demux_packet *create_packet(size_t len)
 struct demux_packet *new_demux_packet(size_t len)
 {
     struct demux_packet *dp = create_packet(len);
-    dp->buffer = malloc(len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
-        abort();
-    }
+    dp->buffer = pool_get_buffer(len + MP_INPUT_BUFFER_PADDING_SIZE,
+                                 &dp->buffer_class);
     memset(dp->buffer + len, 0, 8);
     return dp;
 }
@@ -212,10 +370,23 @@ void resize_demux_packet(struct demux_packet *dp, size_t len)
                "over 1 GB!\n");
         abort();
     }
-    dp->buffer = realloc(dp->buffer, len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
-        abort();
+    size_t size = len + MP_INPUT_BUFFER_PADDING_SIZE;
+    if (dp->buffer_class >= 0) {
+        if (size > pool_class_size(dp->buffer_class)) {
+            int class;
+            unsigned char *buf = pool_get_buffer(size, &class);
+            memcpy(buf, dp->buffer, FFMIN(dp->len, len));
+            demux_count_copied_bytes(FFMIN(dp->len, len));
+            pool_put_buffer(dp->buffer, dp->buffer_class);
+            dp->buffer = buf;
+            dp->buffer_class = class;
+        }
+    } else {
+        dp->buffer = realloc(dp->buffer, size);
+        if (!dp->buffer) {
+            mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
+            abort();
+        }
     }
     memset(dp->buffer + len, 0, 8);
     dp->len = len;
@@ -223,7 +394,7 @@ void resize_demux_packet(struct demux_packet *dp, size_t len)
 
 struct demux_packet *clone_demux_packet(struct demux_packet *pack)
 {
-    struct demux_packet *dp = malloc(sizeof(struct demux_packet));
+    struct demux_packet *dp = pool_get_header();
     while (pack->master)
         pack = pack->master;  // find the master
     memcpy(dp, pack, sizeof(struct demux_packet));
@@ -242,14 +413,14 @@ void free_demux_packet(struct demux_packet *dp)
             if (dp->avpacket)
                 talloc_free(dp->avpacket);
             else
-                free(dp->buffer);
-            free(dp);
+                pool_put_buffer(dp->buffer, dp->buffer_class);
+            pool_put_header(dp);
         }
         return;
     }
     // dp is a clone:
     free_demux_packet(dp->master);
-    free(dp);
+    pool_put_header(dp);
 }
 
 static void free_demuxer_stream(struct demux_stream *ds)
@@ -573,7 +744,15 @@ int ds_parse(demux_stream_t *ds, uint8_t **buffer, int *len, double pts, off_t p
     get_parser(ds->sh, &avctx, &parser);
     if (!parser)
         return *len;
-    return av_parser_parse2(parser, avctx, buffer, len, *buffer, *len, pts, pts, pos);
+    uint8_t *in = *buffer;
+    int in_len = *len;
+    int consumed = av_parser_parse2(parser, avctx, buffer, len, in, in_len,
+                                    pts, pts, pos);
+    // the parser returns a pointer into its own buffer if it had to
+    // assemble the frame from several input chunks
+    if (*len > 0 && (*buffer < in || *buffer + *len > in + in_len))
+        demux_count_copied_bytes(*len);
+    return consumed;
 }
 
 static void clear_parser(sh_common_t *sh)
@@ -603,6 +782,61 @@ void ds_read_packet(demux_stream_t *ds, stream_t *stream, int len,
     ds_add_packet(ds, dp);
 }
 
+/// Time span covered by the queued packets, 0 if unknown.
+double ds_buffered_duration(struct demux_stream *ds)
+{
+    if (!ds->first || ds->first->pts == MP_NOPTS_VALUE
+        || ds->last->pts == MP_NOPTS_VALUE)
+        return 0;
+    return FFMAX(ds->last->pts - ds->first->pts, 0);
+}
+
+/// Whether the packet queue of ds reached one of the configured limits.
+bool ds_queue_full(struct demux_stream *ds)
+{
+    struct MPOpts *opts = ds->demuxer->opts;
+    return ds->packs >= opts->demuxer_max_packs
+        || ds->bytes >= opts->demuxer_max_bytes
+        || (opts->demuxer_max_secs > 0
+            && ds_buffered_duration(ds) >= opts->demuxer_max_secs);
+}
+
+static bool ds_wants_readahead(struct demux_stream *ds, double secs)
+{
+    if (!ds->sh || ds->eof || ds_queue_full(ds))
+        return false;
+    if (!ds->first)
+        return true;
+    // Can't tell how much is buffered without timestamps
+    if (ds->first->pts == MP_NOPTS_VALUE || ds->last->pts == MP_NOPTS_VALUE)
+        return false;
+    return ds_buffered_duration(ds) < secs;
+}
+
+/**
+ * Read one packet if the audio or video queue holds less than secs seconds.
+ * Meant to be called repeatedly while the player would otherwise be idle,
+ * or from the demuxer thread.
+ * \return 1 if a packet was read, 0 if nothing needs to (or can) be read
+ */
+int demux_readahead(struct demuxer *demux, double secs)
+{
+    if (secs <= 0)
+        return 0;
+    // Don't read more if any queue is full, that would only make the
+    // other streams run into the limit later.
+    if (ds_queue_full(demux->audio) || ds_queue_full(demux->video))
+        return 0;
+    struct demux_stream *ds = NULL;
+    if (ds_wants_readahead(demux->video, secs))
+        ds = demux->video;
+    else if (ds_wants_readahead(demux->audio, secs))
+        ds = demux->audio;
+    if (!ds)
+        return 0;
+    return demux_fill_buffer(demux, ds);
+}
+
 // return value:
 //     0 = EOF or no stream found or invalid type
 //     1 = successfully read a packet
@@ -664,15 +898,13 @@ int ds_fill_buffer(demux_stream_t *ds)
 #define MaybeNI _("Maybe you are playing a non-interleaved stream/file or the codec failed?\n" \
                 "For AVI files, try to force non-interleaved mode with the -ni option.\n")
 
-        if (demux->audio->packs >= MAX_PACKS
-            || demux->audio->bytes >= MAX_PACK_BYTES) {
+        if (ds_queue_full(demux->audio)) {
             mp_tmsg(MSGT_DEMUXER, MSGL_ERR, "\nToo many audio packets in the buffer: (%d in %d bytes).\n",
                    demux->audio->packs, demux->audio->bytes);
             mp_tmsg(MSGT_DEMUXER, MSGL_HINT, MaybeNI);
             break;
         }
-        if (demux->video->packs >= MAX_PACKS
-            || demux->video->bytes >= MAX_PACK_BYTES) {
+        if (ds_queue_full(demux->video)) {
             mp_tmsg(MSGT_DEMUXER, MSGL_ERR, "\nToo many video packets in the buffer: (%d in %d bytes).\n",
                    demux->video->packs, demux->video->bytes);
             mp_tmsg(MSGT_DEMUXER, MSGL_HINT, MaybeNI);
@@ -701,7 +933,7 @@ int demux_read_data(demux_stream_t *ds, unsigned char *mem, int len)
         x = ds->buffer_size - ds->buffer_pos;
         if (x == 0) {
             if (!ds_fill_buffer(ds))
-                return bytes;
+                break;
         } else {
             if (x > len)
                 x = len;
@@ -712,6 +944,8 @@ int demux_read_data(demux_stream_t *ds, unsigned char *mem, int len)
             ds->buffer_pos += x;
         }
     }
+    if (mem)
+        demux_count_copied_bytes(bytes);
     return bytes;
 }
 
@@ -762,8 +996,7 @@ void ds_free_packs(demux_stream_t *ds)
     }
     if (ds->asf_packet) {
         // free unfinished .asf fragments:
-        free(ds->asf_packet->buffer);
-        free(ds->asf_packet);
+        free_demux_packet(ds->asf_packet);
         ds->asf_packet = NULL;
     }
     ds->first = ds->last = NULL;
@@ -839,15 +1072,13 @@ double ds_get_next_pts(demux_stream_t *ds)
     // if we have not read from the "current" packet, consider it
     // as the next, otherwise we never get the pts for the first packet.
     while (!ds->first && (!ds->current || ds->buffer_pos)) {
-        if (demux->audio->packs >= MAX_PACKS
-            || demux->audio->bytes >= MAX_PACK_BYTES) {
+        if (ds_queue_full(demux->audio)) {
             mp_tmsg(MSGT_DEMUXER, MSGL_ERR, "\nToo many audio packets in the buffer: (%d in %d bytes).\n",
                    demux->audio->packs, demux->audio->bytes);
             mp_tmsg(MSGT_DEMUXER, MSGL_HINT, MaybeNI);
             return MP_NOPTS_VALUE;
         }
-        if (demux->video->packs >= MAX_PACKS
-            || demux->video->bytes >= MAX_PACK_BYTES) {
+        if (ds_queue_full(demux->video)) {
             mp_tmsg(MSGT_DEMUXER, MSGL_ERR, "\nToo many video packets in the buffer: (%d in %d bytes).\n",
                    demux->video->packs, demux->video->bytes);
             mp_tmsg(MSGT_DEMUXER, MSGL_HINT, MaybeNI);
@@ -39,6 +39,7 @@ struct MPOpts;
 #define unlikely(x) (x)
 #endif
 
+// Default queue limits, see --demuxer-max-packets/--demuxer-max-bytes.
 #define MAX_PACKS 4096
 #define MAX_PACK_BYTES 0x8000000  // 128 MiB
 
@@ -286,12 +287,23 @@ typedef struct {
     int aid, vid, sid; //audio, video and subtitle id
 } demux_program_t;
 
+struct demux_packet_pool_stats {
+    int64_t packet_allocs;  // packet headers allocated
+    int64_t packet_hits;    // ... of which were taken from the pool
+    int64_t buffer_allocs;  // payload buffers allocated
+    int64_t buffer_hits;    // ... of which were taken from the pool
+    int64_t pooled_bytes;   // size of free buffers kept in the pool
+    int64_t copied_bytes;   // packet data copied instead of passed on
+};
+
 struct demux_packet *new_demux_packet(size_t len);
 // data must already have suitable padding
 struct demux_packet *new_demux_packet_fromdata(void *data, size_t len);
 void resize_demux_packet(struct demux_packet *dp, size_t len);
 struct demux_packet *clone_demux_packet(struct demux_packet *pack);
 void free_demux_packet(struct demux_packet *dp);
+void demux_packet_pool_get_stats(struct demux_packet_pool_stats *stats);
+void demux_count_copied_bytes(int64_t bytes);
 
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t)-1)
@@ -312,6 +324,9 @@ struct demuxer *new_demuxer(struct MPOpts *opts, struct stream *stream,
 void free_demuxer(struct demuxer *demuxer);
 
 void ds_add_packet(struct demux_stream *ds, struct demux_packet *dp);
+double ds_buffered_duration(struct demux_stream *ds);
+bool ds_queue_full(struct demux_stream *ds);
+int demux_readahead(struct demuxer *demux, double secs);
 void ds_read_packet(struct demux_stream *ds, struct stream *stream, int len,
                     double pts, off_t pos, bool keyframe);
 
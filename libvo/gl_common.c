@@ -351,6 +351,22 @@ static const extfunc_desc_t extfuncs[] = {
                  ("glUnmapBuffer", "glUnmapBufferARB")),
     DEF_EXT_DESC(BufferData, NULL,
                  ("glBufferData", "glBufferDataARB")),
+    DEF_EXT_DESC(MapBufferRange, "_map_buffer_range",
+                 ("glMapBufferRange")),
+    DEF_EXT_DESC(BufferStorage, "_buffer_storage",
+                 ("glBufferStorage")),
+    DEF_EXT_DESC(FenceSync, "GL_ARB_sync",
+                 ("glFenceSync")),
+    DEF_EXT_DESC(ClientWaitSync, "GL_ARB_sync",
+                 ("glClientWaitSync")),
+    DEF_EXT_DESC(DeleteSync, "GL_ARB_sync",
+                 ("glDeleteSync")),
+    DEF_EXT_DESC(GetProgramBinary, "_get_program_binary",
+                 ("glGetProgramBinary")),
+    DEF_EXT_DESC(ProgramBinary, "_get_program_binary",
+                 ("glProgramBinary")),
+    DEF_EXT_DESC(ProgramParameteri, "_get_program_binary",
+                 ("glProgramParameteri")),
     DEF_EXT_DESC(ActiveTexture, NULL,
                  ("glActiveTexture", "glActiveTextureARB")),
     DEF_EXT_DESC(BindTexture, NULL,
@@ -2312,6 +2328,7 @@ struct egl_context {
     EGLSurface egl_surface;
 
     struct wl_egl_window *egl_window;
+    unsigned int frame_count;
 
     struct {
         EGLDisplay dpy;
@@ -2475,6 +2492,7 @@ static void swapGlBuffers_wayland(MPGLContext *ctx)
     struct egl_context * egl_ctx = ctx->priv;
     struct vo_wayland_state *wl = ctx->vo->wayland;
 
+    vo_wayland_request_frame(ctx->vo);
     eglSwapBuffers(egl_ctx->egl.dpy, egl_ctx->egl_surface);
 
     if (wl->window->resize_needed) {
@@ -2485,6 +2503,20 @@ static void swapGlBuffers_wayland(MPGLContext *ctx)
     }
 }
 
+static bool get_vsync_wayland(MPGLContext *ctx, unsigned int *time,
+                              int timeout_ms)
+{
+    struct egl_context *egl_ctx = ctx->priv;
+    struct vo_wayland_window *window = ctx->vo->wayland->window;
+
+    vo_wayland_wait_frame(ctx->vo, timeout_ms);
+    if (window->frame_count == egl_ctx->frame_count)
+        return false;
+    egl_ctx->frame_count = window->frame_count;
+    *time = window->frame_time;
+    return true;
+}
+
 #endif
 
 #ifdef CONFIG_GL_SDL
@@ -2643,6 +2675,9 @@ MPGLContext *init_mpglcontext(enum MPGLType type, struct vo *vo)
         ctx->releaseGlContext = releaseGlContext_x11;
         ctx->swapGlBuffers = swapGlBuffers_x11;
         ctx->update_xinerama_info = update_xinerama_info;
+#ifdef CONFIG_XF86VM
+        ctx->get_display_fps = vo_vm_get_fps;
+#endif
         ctx->border = vo_x11_border;
         ctx->check_events = vo_x11_check_events;
         ctx->fullscreen = vo_x11_fullscreen;
@@ -2659,6 +2694,8 @@ MPGLContext *init_mpglcontext(enum MPGLType type, struct vo *vo)
         ctx->setGlWindow = setGlWindow_wayland;
         ctx->releaseGlContext = releaseGlContext_wayland;
         ctx->swapGlBuffers = swapGlBuffers_wayland;
+        ctx->get_vsync = get_vsync_wayland;
+        ctx->get_display_fps = vo_wayland_get_fps;
         ctx->update_xinerama_info = vo_wayland_update_xinerama_info;
         ctx->border = vo_wayland_border;
         ctx->check_events = vo_wayland_check_events;
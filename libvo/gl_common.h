@@ -211,6 +211,13 @@ typedef struct MPGLContext {
     void (*ontop)(struct vo *vo);
     void (*border)(struct vo *vo);
     void (*update_xinerama_info)(struct vo *vo);
+    // Set *time to the GetTimer() time at which the windowing system last
+    // reported a frame as presented, waiting at most timeout_ms for it.
+    // Return false if there was no such report since the previous call.
+    bool (*get_vsync)(struct MPGLContext *ctx, unsigned int *time,
+                      int timeout_ms);
+    // Return the display refresh rate in Hz, or 0 if unknown.
+    double (*get_display_fps)(struct vo *vo);
 } MPGLContext;
 
 int mpgl_find_backend(const char *name);
@@ -296,6 +303,17 @@ struct GL {
     GLvoid * (GLAPIENTRY * MapBuffer)(GLenum, GLenum);
     GLboolean (GLAPIENTRY *UnmapBuffer)(GLenum);
     void (GLAPIENTRY *BufferData)(GLenum, intptr_t, const GLvoid *, GLenum);
+    GLvoid * (GLAPIENTRY *MapBufferRange)(GLenum, intptr_t, intptr_t,
+                                          GLbitfield);
+    void (GLAPIENTRY *BufferStorage)(GLenum, intptr_t, const GLvoid *,
+                                     GLbitfield);
+    GLsync (GLAPIENTRY *FenceSync)(GLenum, GLbitfield);
+    GLenum (GLAPIENTRY *ClientWaitSync)(GLsync, GLbitfield, uint64_t);
+    void (GLAPIENTRY *DeleteSync)(GLsync);
+    void (GLAPIENTRY *GetProgramBinary)(GLuint, GLsizei, GLsizei *, GLenum *,
+                                        GLvoid *);
+    void (GLAPIENTRY *ProgramBinary)(GLuint, GLenum, const GLvoid *, GLsizei);
+    void (GLAPIENTRY *ProgramParameteri)(GLuint, GLenum, GLint);
     void (GLAPIENTRY *ActiveTexture)(GLenum);
     void (GLAPIENTRY *BindTexture)(GLenum, GLuint);
     void (GLAPIENTRY *MultiTexCoord2f)(GLenum, GLfloat, GLfloat);
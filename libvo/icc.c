@@ -0,0 +1,84 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <lcms2.h>
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "icc.h"
+
+static void lcms2_error_handler(cmsContext ctx, cmsUInt32Number code,
+                                const char *msg)
+{
+    mp_msg(MSGT_VO, MSGL_ERR, "lcms2: %s\n", msg);
+}
+
+uint16_t *mp_icc_create_lut3d(void *talloc_ctx, struct bstr iccdata,
+                              int intent, int s_r, int s_g, int s_b)
+{
+    if (intent == -1)
+        intent = INTENT_ABSOLUTE_COLORIMETRIC;
+
+    cmsSetLogErrorHandler(lcms2_error_handler);
+
+    cmsHPROFILE profile = cmsOpenProfileFromMem(iccdata.start, iccdata.len);
+    if (!profile)
+        return NULL;
+
+    cmsCIExyY d65;
+    cmsWhitePointFromTemp(&d65, 6504);
+    static const cmsCIExyYTRIPLE bt709prim = {
+        .Red   = {0.64, 0.33, 1.0},
+        .Green = {0.30, 0.60, 1.0},
+        .Blue  = {0.15, 0.06, 1.0},
+    };
+    cmsToneCurve *tonecurve = cmsBuildGamma(NULL, 2.2);
+    cmsHPROFILE vid_profile = cmsCreateRGBProfile(&d65, &bt709prim,
+                        (cmsToneCurve*[3]){tonecurve, tonecurve, tonecurve});
+    cmsFreeToneCurve(tonecurve);
+    cmsHTRANSFORM trafo = cmsCreateTransform(vid_profile, TYPE_RGB_16,
+                                             profile, TYPE_RGB_16,
+                                             intent,
+                                             cmsFLAGS_HIGHRESPRECALC);
+    cmsCloseProfile(profile);
+    cmsCloseProfile(vid_profile);
+
+    if (!trafo)
+        return NULL;
+
+    uint16_t *output = talloc_array(talloc_ctx, uint16_t, s_r * s_g * s_b * 3);
+
+    // transform a (s_r)x(s_g)x(s_b) cube, with 3 components per channel
+    uint16_t *input = talloc_array(NULL, uint16_t, s_r * 3);
+    for (int b = 0; b < s_b; b++) {
+        for (int g = 0; g < s_g; g++) {
+            for (int r = 0; r < s_r; r++) {
+                input[r * 3 + 0] = r * 65535 / (s_r - 1);
+                input[r * 3 + 1] = g * 65535 / (s_g - 1);
+                input[r * 3 + 2] = b * 65535 / (s_b - 1);
+            }
+            size_t base = (b * s_r * s_g + g * s_r) * 3;
+            cmsDoTransform(trafo, input, output + base, s_r);
+        }
+    }
+    talloc_free(input);
+
+    cmsDeleteTransform(trafo);
+
+    return output;
+}
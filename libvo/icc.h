@@ -0,0 +1,35 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MPLAYER_ICC_H
+#define MPLAYER_ICC_H
+
+#include <stdint.h>
+
+#include "bstr.h"
+
+/* Compute a 3D LUT that converts RGB (BT.709 primaries, gamma 2.2, as video
+ * is assumed to be) to the colorspace of the given ICC profile. The LUT has
+ * s_r * s_g * s_b entries of 3 components each, with R varying fastest.
+ * intent is an lcms2 rendering intent, -1 for absolute colorimetric.
+ * Returns a talloc'ed array, or NULL on error.
+ */
+uint16_t *mp_icc_create_lut3d(void *talloc_ctx, struct bstr iccdata,
+                              int intent, int s_r, int s_g, int s_b);
+
+#endif /* MPLAYER_ICC_H */
@@ -187,6 +187,7 @@ static int vo_preinit(struct vo *vo, char *arg)
         if (r < 0)
             return r;
     }
+    vo->timed_flips = !!vo->driver->flip_page_timed;
     return vo->driver->preinit(vo, arg);
 }
 
@@ -288,7 +289,7 @@ void vo_flip_page(struct vo *vo, unsigned int pts_us, int duration)
     }
     vo->want_redraw = false;
     vo->redrawing = false;
-    if (vo->driver->flip_page_timed)
+    if (vo->timed_flips)
         vo->driver->flip_page_timed(vo, pts_us, duration);
     else
         vo->driver->flip_page(vo);
@@ -345,6 +346,7 @@ struct vo *init_best_video_out(struct MPOpts *opts, struct mp_fifo *key_fifo,
         .input_ctx = input_ctx,
         .event_fd = -1,
         .registered_fd = -1,
+        .next_pts2 = MP_NOPTS_VALUE,
     };
     // first try the preferred drivers, with their optional subdevice param:
     if (vo_list && vo_list[0])
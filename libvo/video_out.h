@@ -255,6 +255,7 @@ struct vo {
     bool hasframe;      // >= 1 frame has been drawn, so redraw is possible
 
     double flip_queue_offset; // queue flip events at most this much in advance
+    bool timed_flips;   // flip_page_timed() is used, and times the flip itself
 
     const struct vo_driver *driver;
     void *priv;
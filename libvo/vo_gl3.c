@@ -33,10 +33,12 @@
 
 #ifdef CONFIG_LCMS2
 #include <lcms2.h>
-#include "stream/stream.h"
+#include "icc.h"
 #endif
+#include "stream/stream.h"
 
 #include "talloc.h"
+#include "mpcommon.h"
 #include "bstr.h"
 #include "mp_msg.h"
 #include "subopt-helper.h"
@@ -52,6 +54,7 @@
 #include "filter_kernels.h"
 #include "aspect.h"
 #include "fastmemcpy.h"
+#include "osdep/timer.h"
 #include "sub/ass_mp.h"
 
 static const char vo_gl3_shaders[] =
@@ -120,9 +123,22 @@ struct vertex {
 struct texplane {
     int shift_x, shift_y;
     GLuint gl_texture;
-    int gl_buffer;
-    int buffer_size;
-    void *buffer_ptr;
+    int pbo_offset;             // position of the plane in the video PBO
+};
+
+// Video frames are uploaded from a ring of PBOs, so that the decoder can
+// write the next frame while the previous ones are still being uploaded.
+#define MAX_PBOS 8
+
+// Swaps between two glFinish vsync measurements once the timing is known.
+#define VSYNC_RESAMPLE_FRAMES 120
+
+struct video_pbo {
+    GLuint buffer;
+    int size;
+    void *ptr;                  // mapped (always, if persistent)
+    bool in_use;                // handed to the decoder, not drawn yet
+    GLsync fence;               // signals when the upload from it is done
 };
 
 struct scaler {
@@ -137,6 +153,38 @@ struct scaler {
     struct filter_kernel kernel_storage;
 };
 
+// Uniform values that are the same for all programs. Programs that don't use
+// a uniform simply ignore it.
+struct program_uniforms {
+    float transform[3][3];
+    float colormatrix[3][4];
+    float inv_gamma[3];
+    float dither_quantization;
+    float dither_multiply;
+    float filter_param1;
+};
+
+// Linked programs are kept across reinit_rendering(), so that toggling
+// fullscreen or changing the scaler doesn't recompile everything.
+#define MAX_CACHED_PROGRAMS 32
+
+struct cached_program {
+    char *source;               // full vertex + fragment source, the key
+    GLuint program;
+    unsigned int last_used;     // value of gl_priv.program_gen
+    GLint loc_transform, loc_colormatrix, loc_inv_gamma;
+    GLint loc_dither_quantization, loc_dither_multiply, loc_filter_param1;
+    struct program_uniforms uniforms;   // last uploaded values
+    bool uniforms_valid;
+};
+
+// Program binaries from/for the shader-cache file.
+struct program_binary {
+    char *source;
+    GLenum format;
+    struct bstr data;
+};
+
 struct fbotex {
     GLuint fbo;
     GLuint texture;
@@ -158,12 +206,15 @@ struct gl_priv {
     int use_lut_3d;
     int use_npot;
     int use_pbo;
+    int pbo_frames;
     int use_glFinish;
     int use_gl_debug;
     int use_gl2;
 
     int dither_depth;
     int swap_interval;
+    int use_vsync_timing;
+    float vsync_fps;
     GLint fbo_format;
     int stereo_mode;
 
@@ -173,6 +224,16 @@ struct gl_priv {
     GLuint osd_program, eosd_program;
     GLuint indirect_program, scale_sep_program, final_program;
 
+    struct cached_program programs[MAX_CACHED_PROGRAMS];
+    int num_programs;
+    unsigned int program_gen;   // incremented on each compile_shaders()
+
+    char *shader_cache;         // file name, or NULL
+    char *shader_cache_id;      // GL renderer/version the binaries are for
+    struct program_binary *binaries;
+    int num_binaries;
+    bool binaries_changed;      // shader cache file needs to be written
+
     GLuint osd_textures[MAX_OSD_PARTS];
     int osd_textures_count;
     struct vertex osd_va[MAX_OSD_PARTS * VERTICES_PER_QUAD];
@@ -215,6 +276,21 @@ struct gl_priv {
     int plane_count;
     struct texplane planes[3];
 
+    struct video_pbo pbos[MAX_PBOS];
+    int pbo_index;              // next to be used
+    bool pbo_persistent;        // use persistent, coherent mappings
+
+    // vsync timing for flip_page_timed (all times in GetTimer() units)
+    double vsync_interval;      // 0 if unknown
+    bool vsync_fixed;           // interval from the display or the user
+    unsigned int recent_vsync;  // time of a recent presentation
+    int vsync_samples;          // presentations seen on the vsync grid
+    int vsync_skipped;          // swaps since the last glFinish measurement
+    unsigned int last_queue_time;
+    unsigned int last_ideal_time;
+    unsigned int dropped_time;
+    bool dropped_frame;
+
     struct fbotex indirect_fbo;         // RGB target
     struct fbotex scale_sep_fbo;        // first pass when doing 2 pass scaling
 
@@ -405,16 +481,8 @@ static void matrix_ortho2d(float m[3][3], float x0, float x1,
     m[2][2] = 1.0f;
 }
 
-static void update_uniforms(struct gl_priv *p, GLuint program)
+static void get_uniforms(struct gl_priv *p, struct program_uniforms *u)
 {
-    GL *gl = p->gl;
-    GLint loc;
-
-    if (program == 0)
-        return;
-
-    gl->UseProgram(program);
-
     struct mp_csp_params cparams = {
         .colorspace = p->colorspace,
         .input_bits = p->plane_bits,
@@ -422,61 +490,78 @@ static void update_uniforms(struct gl_priv *p, GLuint program)
     };
     mp_csp_copy_equalizer_values(&cparams, &p->video_eq);
 
-    loc = gl->GetUniformLocation(program, "transform");
-    if (loc >= 0) {
-        float matrix[3][3];
-        matrix_ortho2d(matrix, 0, p->vp_w, p->vp_h, 0);
-        gl->UniformMatrix3fv(loc, 1, GL_FALSE, &matrix[0][0]);
-    }
-
-    loc = gl->GetUniformLocation(program, "colormatrix");
-    if (loc >= 0) {
-        float yuv2rgb[3][4] = {{0}};
-        if (p->is_yuv)
-            mp_get_yuv2rgb_coeffs(&cparams, yuv2rgb);
-        gl->UniformMatrix4x3fv(loc, 1, GL_TRUE, &yuv2rgb[0][0]);
-    }
-
-    gl->Uniform3f(gl->GetUniformLocation(program, "inv_gamma"),
-                  1.0 / cparams.rgamma,
-                  1.0 / cparams.ggamma,
-                  1.0 / cparams.bgamma);
-
-    gl->Uniform1i(gl->GetUniformLocation(program, "texture1"), 0);
-    gl->Uniform1i(gl->GetUniformLocation(program, "texture2"), 1);
-    gl->Uniform1i(gl->GetUniformLocation(program, "texture3"), 2);
-
-    gl->Uniform1i(gl->GetUniformLocation(program, "lut_3d"), TEXUNIT_3DLUT);
+    *u = (struct program_uniforms) {
+        .inv_gamma = {1.0 / cparams.rgamma,
+                      1.0 / cparams.ggamma,
+                      1.0 / cparams.bgamma},
+        .dither_quantization = p->dither_quantization,
+        .dither_multiply = p->dither_multiply,
+        .filter_param1 = isnan(p->scaler_params[0]) ? 0.5f
+                                                    : p->scaler_params[0],
+    };
+    matrix_ortho2d(u->transform, 0, p->vp_w, p->vp_h, 0);
+    if (p->is_yuv)
+        mp_get_yuv2rgb_coeffs(&cparams, u->colormatrix);
+}
 
-    for (int n = 0; n < 2; n++) {
-        const char *lut = p->scalers[n].lut_name;
-        if (lut)
-            gl->Uniform1i(gl->GetUniformLocation(program, lut),
-                          TEXUNIT_SCALERS + n);
-    }
+#define UNIFORM_CHANGED(c, u, field) \
+    (!(c)->uniforms_valid || \
+     memcmp(&(c)->uniforms.field, &(u)->field, sizeof((u)->field)))
 
-    gl->Uniform1i(gl->GetUniformLocation(program, "dither"), TEXUNIT_DITHER);
-    gl->Uniform1f(gl->GetUniformLocation(program, "dither_quantization"),
-                  p->dither_quantization);
-    gl->Uniform1f(gl->GetUniformLocation(program, "dither_multiply"),
-                  p->dither_multiply);
+// Upload the uniforms that changed since the last call for this program.
+static void update_uniforms(struct gl_priv *p, struct cached_program *c,
+                            const struct program_uniforms *u)
+{
+    GL *gl = p->gl;
 
-    float sparam1 = p->scaler_params[0];
-    gl->Uniform1f(gl->GetUniformLocation(program, "filter_param1"),
-                  isnan(sparam1) ? 0.5f : sparam1);
+    gl->UseProgram(c->program);
+
+    if (c->loc_transform >= 0 && UNIFORM_CHANGED(c, u, transform))
+        gl->UniformMatrix3fv(c->loc_transform, 1, GL_FALSE,
+                             &u->transform[0][0]);
+    if (c->loc_colormatrix >= 0 && UNIFORM_CHANGED(c, u, colormatrix))
+        gl->UniformMatrix4x3fv(c->loc_colormatrix, 1, GL_TRUE,
+                               &u->colormatrix[0][0]);
+    if (c->loc_inv_gamma >= 0 && UNIFORM_CHANGED(c, u, inv_gamma))
+        gl->Uniform3f(c->loc_inv_gamma,
+                      u->inv_gamma[0], u->inv_gamma[1], u->inv_gamma[2]);
+    if (c->loc_dither_quantization >= 0 &&
+        UNIFORM_CHANGED(c, u, dither_quantization))
+        gl->Uniform1f(c->loc_dither_quantization, u->dither_quantization);
+    if (c->loc_dither_multiply >= 0 && UNIFORM_CHANGED(c, u, dither_multiply))
+        gl->Uniform1f(c->loc_dither_multiply, u->dither_multiply);
+    if (c->loc_filter_param1 >= 0 && UNIFORM_CHANGED(c, u, filter_param1))
+        gl->Uniform1f(c->loc_filter_param1, u->filter_param1);
+
+    c->uniforms = *u;
+    c->uniforms_valid = true;
 
     gl->UseProgram(0);
 
     debug_check_gl(p, "update_uniforms()");
 }
 
+static struct cached_program *find_program(struct gl_priv *p, GLuint program)
+{
+    for (int n = 0; n < p->num_programs; n++) {
+        if (p->programs[n].program == program)
+            return &p->programs[n];
+    }
+    return NULL;
+}
+
 static void update_all_uniforms(struct gl_priv *p)
 {
-    update_uniforms(p, p->osd_program);
-    update_uniforms(p, p->eosd_program);
-    update_uniforms(p, p->indirect_program);
-    update_uniforms(p, p->scale_sep_program);
-    update_uniforms(p, p->final_program);
+    GLuint programs[] = {p->osd_program, p->eosd_program, p->indirect_program,
+                         p->scale_sep_program, p->final_program};
+    struct program_uniforms u;
+    get_uniforms(p, &u);
+    for (int n = 0; n < FF_ARRAY_ELEMS(programs); n++) {
+        struct cached_program *c = programs[n] ? find_program(p, programs[n])
+                                               : NULL;
+        if (c)
+            update_uniforms(p, c, &u);
+    }
 }
 
 #define SECTION_HEADER "#!section "
@@ -567,20 +652,141 @@ static void bind_attrib_locs(GL *gl, GLuint program)
     gl->BindAttribLocation(program, VERTEX_ATTRIB_TEXCOORD, "vertex_texcoord");
 }
 
-static GLuint create_program(GL *gl, const char *name, const char *header,
-                             const char *vertex, const char *frag)
+static struct program_binary *find_binary(struct gl_priv *p,
+                                          const char *source)
 {
-    mp_msg(MSGT_VO, MSGL_V, "[gl] compiling shader program '%s'\n", name);
-    mp_msg(MSGT_VO, MSGL_V, "[gl] header:\n");
-    mp_log_source(MSGT_VO, MSGL_V, header);
+    for (int n = 0; n < p->num_binaries; n++) {
+        if (strcmp(p->binaries[n].source, source) == 0)
+            return &p->binaries[n];
+    }
+    return NULL;
+}
+
+// Try to create the program from a binary of the shader cache.
+static GLuint load_program_binary(struct gl_priv *p, const char *source)
+{
+    GL *gl = p->gl;
+
+    struct program_binary *bin = find_binary(p, source);
+    if (!bin || !gl->ProgramBinary)
+        return 0;
     GLuint prog = gl->CreateProgram();
-    prog_create_shader(gl, prog, GL_VERTEX_SHADER, header, vertex);
-    prog_create_shader(gl, prog, GL_FRAGMENT_SHADER, header, frag);
-    bind_attrib_locs(gl, prog);
-    link_shader(gl, prog);
+    gl->ProgramBinary(prog, bin->format, bin->data.start, bin->data.len);
+    GLint status;
+    gl->GetProgramiv(prog, GL_LINK_STATUS, &status);
+    if (!status) {
+        // e.g. after a driver update
+        mp_msg(MSGT_VO, MSGL_V, "[gl] cached program binary rejected\n");
+        gl->DeleteProgram(prog);
+        return 0;
+    }
     return prog;
 }
 
+static void store_program_binary(struct gl_priv *p, GLuint prog,
+                                 const char *source)
+{
+    GL *gl = p->gl;
+
+    if (!p->shader_cache || !gl->GetProgramBinary || find_binary(p, source))
+        return;
+    GLint size = 0;
+    gl->GetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+    struct program_binary bin = {
+        .source = talloc_strdup(p, source),
+        .data = { talloc_size(p, size), size },
+    };
+    gl->GetProgramBinary(prog, size, NULL, &bin.format, bin.data.start);
+    MP_RESIZE_ARRAY(p, p->binaries, p->num_binaries + 1);
+    p->binaries[p->num_binaries++] = bin;
+    p->binaries_changed = true;
+}
+
+static GLuint create_program(struct gl_priv *p, const char *name,
+                             const char *header, const char *vertex,
+                             const char *frag)
+{
+    GL *gl = p->gl;
+
+    char *source = talloc_asprintf(p, "%s%s%s%s", header, vertex, header, frag);
+
+    struct cached_program *c = NULL;
+    for (int n = 0; n < p->num_programs; n++) {
+        if (strcmp(p->programs[n].source, source) == 0) {
+            c = &p->programs[n];
+            talloc_free(source);
+            goto done;
+        }
+    }
+
+    if (p->num_programs == MAX_CACHED_PROGRAMS) {
+        // evict the least recently used program not used currently
+        c = NULL;
+        for (int n = 0; n < p->num_programs; n++) {
+            struct cached_program *e = &p->programs[n];
+            if (e->last_used != p->program_gen &&
+                (!c || e->last_used < c->last_used))
+                c = e;
+        }
+        assert(c);
+        gl->DeleteProgram(c->program);
+        talloc_free(c->source);
+    } else {
+        c = &p->programs[p->num_programs++];
+    }
+    *c = (struct cached_program) { .source = source };
+
+    c->program = load_program_binary(p, source);
+    if (c->program) {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] loaded shader program '%s' from cache\n",
+               name);
+    } else {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] compiling shader program '%s'\n", name);
+        mp_msg(MSGT_VO, MSGL_V, "[gl] header:\n");
+        mp_log_source(MSGT_VO, MSGL_V, header);
+        GLuint prog = gl->CreateProgram();
+        prog_create_shader(gl, prog, GL_VERTEX_SHADER, header, vertex);
+        prog_create_shader(gl, prog, GL_FRAGMENT_SHADER, header, frag);
+        bind_attrib_locs(gl, prog);
+        if (p->shader_cache && gl->ProgramParameteri)
+            gl->ProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                                  GL_TRUE);
+        link_shader(gl, prog);
+        store_program_binary(p, prog, source);
+        c->program = prog;
+    }
+
+    GLuint prog = c->program;
+    c->loc_transform = gl->GetUniformLocation(prog, "transform");
+    c->loc_colormatrix = gl->GetUniformLocation(prog, "colormatrix");
+    c->loc_inv_gamma = gl->GetUniformLocation(prog, "inv_gamma");
+    c->loc_dither_quantization =
+        gl->GetUniformLocation(prog, "dither_quantization");
+    c->loc_dither_multiply = gl->GetUniformLocation(prog, "dither_multiply");
+    c->loc_filter_param1 = gl->GetUniformLocation(prog, "filter_param1");
+
+    // Texture units are fixed for a given program source.
+    gl->UseProgram(prog);
+    gl->Uniform1i(gl->GetUniformLocation(prog, "texture1"), 0);
+    gl->Uniform1i(gl->GetUniformLocation(prog, "texture2"), 1);
+    gl->Uniform1i(gl->GetUniformLocation(prog, "texture3"), 2);
+    gl->Uniform1i(gl->GetUniformLocation(prog, "lut_3d"), TEXUNIT_3DLUT);
+    for (int n = 0; n < 2; n++) {
+        const char *lut = p->scalers[n].lut_name;
+        if (lut)
+            gl->Uniform1i(gl->GetUniformLocation(prog, lut),
+                          TEXUNIT_SCALERS + n);
+    }
+    gl->Uniform1i(gl->GetUniformLocation(prog, "dither"), TEXUNIT_DITHER);
+    gl->UseProgram(0);
+
+done:
+    c->last_used = p->program_gen;
+    return c->program;
+}
+
 static void shader_def(char **shader, const char *name,
                        const char *value)
 {
@@ -627,9 +833,8 @@ static bool input_is_subsampled(struct gl_priv *p)
 
 static void compile_shaders(struct gl_priv *p)
 {
-    GL *gl = p->gl;
-
     delete_shaders(p);
+    p->program_gen++;
 
     void *tmp = talloc_new(NULL);
 
@@ -647,10 +852,10 @@ static void compile_shaders(struct gl_priv *p)
     shader_def_opt(&header_eosd, "USE_3DLUT", p->use_lut_3d);
 
     p->eosd_program =
-        create_program(gl, "eosd", header_eosd, vertex_shader, s_eosd);
+        create_program(p, "eosd", header_eosd, vertex_shader, s_eosd);
 
     p->osd_program =
-        create_program(gl, "osd", header, vertex_shader, s_osd);
+        create_program(p, "osd", header, vertex_shader, s_osd);
 
     char *header_conv = talloc_strdup(tmp, "");
     char *header_final = talloc_strdup(tmp, "");
@@ -719,7 +924,7 @@ static void compile_shaders(struct gl_priv *p)
         shader_def_opt(&header_conv, "FIXED_SCALE", true);
         header_conv = t_concat(tmp, header, header_conv);
         p->indirect_program =
-            create_program(gl, "indirect", header_conv, vertex_shader, s_video);
+            create_program(p, "indirect", header_conv, vertex_shader, s_video);
     } else if (header_sep) {
         header_sep = t_concat(tmp, header_sep, header_conv);
     } else {
@@ -729,33 +934,38 @@ static void compile_shaders(struct gl_priv *p)
     if (header_sep) {
         header_sep = t_concat(tmp, header, header_sep);
         p->scale_sep_program =
-            create_program(gl, "scale_sep", header_sep, vertex_shader, s_video);
+            create_program(p, "scale_sep", header_sep, vertex_shader, s_video);
     }
 
     header_final = t_concat(tmp, header, header_final);
     p->final_program =
-        create_program(gl, "final", header_final, vertex_shader, s_video);
+        create_program(p, "final", header_final, vertex_shader, s_video);
 
     debug_check_gl(p, "shader compilation");
 
     talloc_free(tmp);
 }
 
-static void delete_program(GL *gl, GLuint *prog)
+// The programs stay in the cache until delete_program_cache().
+static void delete_shaders(struct gl_priv *p)
 {
-    gl->DeleteProgram(*prog);
-    *prog = 0;
+    p->osd_program = 0;
+    p->eosd_program = 0;
+    p->indirect_program = 0;
+    p->scale_sep_program = 0;
+    p->final_program = 0;
 }
 
-static void delete_shaders(struct gl_priv *p)
+static void delete_program_cache(struct gl_priv *p)
 {
     GL *gl = p->gl;
 
-    delete_program(gl, &p->osd_program);
-    delete_program(gl, &p->eosd_program);
-    delete_program(gl, &p->indirect_program);
-    delete_program(gl, &p->scale_sep_program);
-    delete_program(gl, &p->final_program);
+    delete_shaders(p);
+    for (int n = 0; n < p->num_programs; n++) {
+        gl->DeleteProgram(p->programs[n].program);
+        talloc_free(p->programs[n].source);
+    }
+    p->num_programs = 0;
 }
 
 static double get_scale_factor(struct gl_priv *p)
@@ -1006,12 +1216,22 @@ static void uninit_video(struct gl_priv *p)
 
         gl->DeleteTextures(1, &plane->gl_texture);
         plane->gl_texture = 0;
-        gl->DeleteBuffers(1, &plane->gl_buffer);
-        plane->gl_buffer = 0;
-        plane->buffer_ptr = NULL;
-        plane->buffer_size = 0;
     }
 
+    for (int n = 0; n < MAX_PBOS; n++) {
+        struct video_pbo *pbo = &p->pbos[n];
+        if (pbo->ptr) {
+            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+            gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        if (pbo->fence)
+            gl->DeleteSync(pbo->fence);
+        gl->DeleteBuffers(1, &pbo->buffer);
+        *pbo = (struct video_pbo) {0};
+    }
+    p->pbo_index = 0;
+
     fbotex_uninit(p, &p->indirect_fbo);
     fbotex_uninit(p, &p->scale_sep_fbo);
 }
@@ -1211,6 +1431,178 @@ static void flip_page(struct vo *vo)
     }
 }
 
+// Set the refresh interval from the vsync-fps suboption or the display. If
+// neither knows it, it is estimated from the presentation times.
+static void init_vsync_timing(struct gl_priv *p)
+{
+    double fps = p->vsync_fps;
+
+    if (!p->use_vsync_timing)
+        return;
+    if (fps <= 0 && p->glctx->get_display_fps)
+        fps = p->glctx->get_display_fps(p->vo);
+    p->vsync_fixed = fps > 0;
+    p->vsync_interval = fps > 0 ? 1e6 / fps : 0;
+    p->vsync_samples = 0;
+    if (fps > 0)
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Display refresh rate %.3f Hz.\n", fps);
+    else
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Display refresh rate unknown, "
+               "estimating it.\n");
+}
+
+// Number of refresh periods in delta, or 0 if delta is off that grid.
+static int vsync_periods(double delta, double interval)
+{
+    double n = floor(delta / interval + 0.5);
+    return n >= 1 && n <= 8 && fabs(delta - n * interval) < interval / 8
+           ? n : 0;
+}
+
+// Take the time of a presentation as the vsync phase. Without a known
+// interval, estimate it as the longest period all gaps between presentations
+// are multiples of: frames are rarely shown at every refresh (24 fps on 60 Hz
+// gives gaps of 2 and 3 periods). This can't tell a steady cadence apart from
+// a slower display (30 fps on 60 Hz looks like 30 Hz), which only delays
+// frames that aren't on that cadence by a period.
+static void add_vsync_sample(struct gl_priv *p, unsigned int t)
+{
+    double delta = (int)(t - p->recent_vsync);
+    double interval = p->vsync_interval;
+    double n = interval ? floor(delta / interval + 0.5) : 0;
+
+    p->recent_vsync = t;
+    if (!p->vsync_samples || delta <= 0) {
+        p->vsync_samples = 1;
+    } else if (n >= 1 && fabs(delta - n * interval) < interval / 8) {
+        // on the grid, possibly after a pause or between sparse samples
+        if (!p->vsync_fixed && n <= 8)
+            p->vsync_interval += (delta / n - interval) / 16;
+        p->vsync_samples++;
+    } else if (p->vsync_fixed) {
+        // missed the grid (e.g. a late timestamp); the phase is still new
+        p->vsync_samples = 1;
+    } else {
+        // a shorter period that both the guess and this gap are multiples of
+        for (int k = 2; interval && k <= 4; k++) {
+            if (interval / k >= 5000 && vsync_periods(delta, interval / k)) {
+                p->vsync_interval = interval / k;
+                p->vsync_samples++;
+                return;
+            }
+        }
+        // otherwise start over with this gap as the guess
+        p->vsync_interval = delta >= 5000 && delta <= 50000 ? delta : 0;
+        p->vsync_samples = p->vsync_interval ? 2 : 1;
+    }
+}
+
+static bool vsync_known(struct gl_priv *p)
+{
+    return p->vsync_interval > 0 &&
+           p->vsync_samples >= (p->vsync_fixed ? 2 : 8);
+}
+
+// Take the presentation time of the last swap, if there is one.
+static void update_vsync(struct gl_priv *p, bool after_swap)
+{
+    unsigned int t;
+
+    if (p->glctx->get_vsync) {
+        if (!p->glctx->get_vsync(p->glctx, &t, 0))
+            return;
+    } else {
+        // With a swap interval, glFinish returns when the buffers were
+        // swapped. It stalls the pipeline though, so once the timing is
+        // known only measure now and then to follow drift.
+        if (!after_swap || p->swap_interval <= 0)
+            return;
+        if (vsync_known(p) && ++p->vsync_skipped < VSYNC_RESAMPLE_FRAMES)
+            return;
+        p->vsync_skipped = 0;
+        p->gl->Finish();
+        t = GetTimer();
+    }
+    add_vsync_sample(p, t);
+}
+
+// Last vsync at or before ts, where times are relative to p->recent_vsync.
+static int64_t prev_vsync(struct gl_priv *p, int64_t ts)
+{
+    int64_t interval = p->vsync_interval;
+    int64_t offset = ts % interval;
+    return ts - (offset < 0 ? offset + interval : offset);
+}
+
+// Like flip_page, but swap such that the frame is shown at the first vsync
+// after pts_us, or not at all if the next frame (due duration µs later)
+// would replace it at the same vsync. duration is unknown (<= 0) unless the
+// player got the pts of the next frame from vo->next_pts2, which this VO
+// doesn't provide. See flip_page_timed() in vo_vdpau.c, whose logic this
+// follows with the swap chain as presentation queue.
+static void flip_page_timed(struct vo *vo, unsigned int pts_us, int duration)
+{
+    struct gl_priv *p = vo->priv;
+
+    update_vsync(p, false);
+    if (!vsync_known(p)) {
+        flip_page(vo);
+        update_vsync(p, true);
+        return;
+    }
+
+    int64_t interval = p->vsync_interval;
+    vo->flip_queue_offset = FFMIN(interval * 3 / 2, 50000) / 1e6;
+
+    // all times relative to the most recent known vsync
+    unsigned int base = p->recent_vsync;
+    int64_t now = (int)(GetTimer() - base);
+    int64_t pts = pts_us ? (int)(pts_us - base) : now;
+    int64_t ideal_pts = pts;
+    int64_t npts = duration > 0 ? pts + duration : INT64_MAX;
+    int64_t last_queue = (int)(p->last_queue_time - base);
+    int64_t last_ideal = (int)(p->last_ideal_time - base);
+    int64_t dropped_time = (int)(p->dropped_time - base);
+
+    // after a pause or on the first frame
+    if (last_queue < now - 8 * interval || last_queue > now + 8 * interval)
+        last_queue = last_ideal = now - interval;
+
+    // When late, only drop if another frame is queued for the next vsync.
+    if (now > prev_vsync(p, FFMAX(pts, last_queue + interval)))
+        npts = INT64_MAX;
+
+    // Move the flip a vsync earlier if that matches the timestamp delta to
+    // the previous frame better (this keeps e.g. 24 fps on 60 Hz at a
+    // regular 2-3 cadence), or if the previous frame was dropped needlessly.
+    int64_t vsync = prev_vsync(p, pts);
+    if (pts < vsync + interval / 4
+        && (vsync - prev_vsync(p, last_queue) > pts - last_ideal + interval / 2
+            || (p->dropped_frame && vsync > dropped_time)))
+        pts -= interval / 2;
+
+    p->dropped_frame = true; // changed at end if false
+    p->dropped_time = base + ideal_pts;
+
+    pts = FFMAX(pts, last_queue + interval);
+    pts = FFMAX(pts, now);
+    vsync = prev_vsync(p, pts);
+    if (npts < vsync + interval)
+        return;
+
+    // A swap during the refresh period ending at vsync + interval is shown at
+    // its end. Swap at the start of it, leaving the most time for rendering.
+    pts = vsync + interval / 4;
+    if (pts > now)
+        usec_sleep(pts - now);
+    flip_page(vo);
+    update_vsync(p, true);
+
+    p->last_queue_time = base + pts;
+    p->last_ideal_time = base + ideal_pts;
+    p->dropped_frame = false;
+}
+
 static int draw_slice(struct vo *vo, uint8_t *src[], int stride[], int w, int h,
                       int x, int y)
 {
@@ -1231,10 +1623,72 @@ static int draw_slice(struct vo *vo, uint8_t *src[], int stride[], int w, int h,
     return 0;
 }
 
+static void wait_pbo(struct gl_priv *p, struct video_pbo *pbo)
+{
+    GL *gl = p->gl;
+
+    if (!pbo->fence)
+        return;
+    // normally long done, as the buffer was used MAX_PBOS frames ago
+    GLenum res = gl->ClientWaitSync(pbo->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                    1000000000);
+    if (res == GL_TIMEOUT_EXPIRED || res == GL_WAIT_FAILED)
+        mp_msg(MSGT_VO, MSGL_WARN, "[gl] Waiting for video PBO failed.\n");
+    gl->DeleteSync(pbo->fence);
+    pbo->fence = NULL;
+}
+
+// Make sure the buffer has at least size bytes and is mapped for writing.
+static void *map_pbo(struct gl_priv *p, struct video_pbo *pbo, int size)
+{
+    GL *gl = p->gl;
+    GLbitfield persistent = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                            GL_MAP_COHERENT_BIT;
+
+    wait_pbo(p, pbo);
+    if (pbo->ptr && size <= pbo->size)
+        return pbo->ptr;
+
+    if (!pbo->buffer)
+        gl->GenBuffers(1, &pbo->buffer);
+    gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+    if (size > pbo->size) {
+        if (pbo->ptr)
+            gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pbo->ptr = NULL;
+        pbo->size = size;
+        if (p->pbo_persistent) {
+            // immutable storage can't be resized, only replaced
+            gl->DeleteBuffers(1, &pbo->buffer);
+            gl->GenBuffers(1, &pbo->buffer);
+            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+            gl->BufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, persistent);
+        } else {
+            gl->BufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+    }
+    if (!pbo->ptr) {
+        if (p->pbo_persistent) {
+            pbo->ptr = gl->MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                          persistent);
+        } else if (gl->MapBufferRange) {
+            // With a fence, the GPU is known to be done with the buffer.
+            // Without, let the driver orphan it instead of stalling.
+            GLbitfield flags = GL_MAP_WRITE_BIT | (gl->FenceSync ?
+                GL_MAP_UNSYNCHRONIZED_BIT : GL_MAP_INVALIDATE_BUFFER_BIT);
+            pbo->ptr = gl->MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                          pbo->size, flags);
+        } else {
+            pbo->ptr = gl->MapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        }
+    }
+    gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return pbo->ptr;
+}
+
 static uint32_t get_image(struct vo *vo, mp_image_t *mpi)
 {
     struct gl_priv *p = vo->priv;
-    GL *gl = p->gl;
 
     if (!p->use_pbo)
         return VO_FALSE;
@@ -1249,25 +1703,25 @@ static uint32_t get_image(struct vo *vo, mp_image_t *mpi)
     if (mpi->type != MP_IMGTYPE_STATIC && mpi->type != MP_IMGTYPE_TEMP &&
         (mpi->type != MP_IMGTYPE_NUMBERED || mpi->number))
         return VO_FALSE;
+    // the next frame goes to another buffer of the ring
+    if (p->pbo_frames > 1 && (mpi->type == MP_IMGTYPE_STATIC ||
+                              (mpi->flags & MP_IMGFLAG_PRESERVE)))
+        return VO_FALSE;
     mpi->flags &= ~MP_IMGFLAG_COMMON_PLANE;
+    int size = 0;
     for (int n = 0; n < p->plane_count; n++) {
         struct texplane *plane = &p->planes[n];
         mpi->stride[n] = (mpi->width >> plane->shift_x) * p->plane_bytes;
-        int needed_size = (mpi->height >> plane->shift_y) * mpi->stride[n];
-        if (!plane->gl_buffer)
-            gl->GenBuffers(1, &plane->gl_buffer);
-        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, plane->gl_buffer);
-        if (needed_size > plane->buffer_size) {
-            plane->buffer_size = needed_size;
-            gl->BufferData(GL_PIXEL_UNPACK_BUFFER, plane->buffer_size,
-                           NULL, GL_DYNAMIC_DRAW);
-        }
-        if (!plane->buffer_ptr)
-            plane->buffer_ptr = gl->MapBuffer(GL_PIXEL_UNPACK_BUFFER,
-                                              GL_WRITE_ONLY);
-        mpi->planes[n] = plane->buffer_ptr;
-        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        plane->pbo_offset = size;
+        size += FFALIGN((mpi->height >> plane->shift_y) * mpi->stride[n], 64);
     }
+    struct video_pbo *pbo = &p->pbos[p->pbo_index];
+    uint8_t *ptr = map_pbo(p, pbo, size);
+    if (!ptr)
+        return VO_FALSE;
+    for (int n = 0; n < p->plane_count; n++)
+        mpi->planes[n] = ptr + p->planes[n].pbo_offset;
+    pbo->in_use = true;
     mpi->flags |= MP_IMGFLAG_DIRECT;
     return VO_TRUE;
 }
@@ -1288,7 +1742,7 @@ static uint32_t draw_image(struct gl_priv *p, mp_image_t *mpi)
     mpi2.width = mpi2.w;
     mpi2.height = mpi2.h;
     if (!(mpi->flags & MP_IMGFLAG_DIRECT)
-        && !p->planes[0].buffer_ptr
+        && !p->pbos[p->pbo_index].in_use
         && get_image(p->vo, &mpi2) == VO_TRUE)
     {
         for (n = 0; n < p->plane_count; n++) {
@@ -1301,24 +1755,34 @@ static uint32_t draw_image(struct gl_priv *p, mp_image_t *mpi)
         mpi = &mpi2;
     }
     p->mpi_flipped = mpi->stride[0] < 0;
-    for (n = 0; n < p->plane_count; n++) {
-        struct texplane *plane = &p->planes[n];
-        int xs = plane->shift_x, ys = plane->shift_y;
-        void *plane_ptr = mpi->planes[n];
-        if (mpi->flags & MP_IMGFLAG_DIRECT) {
-            gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, plane->gl_buffer);
+    struct video_pbo *pbo = &p->pbos[p->pbo_index];
+    if (mpi->flags & MP_IMGFLAG_DIRECT) {
+        gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+        if (!p->pbo_persistent) {
             if (!gl->UnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
                 mp_msg(MSGT_VO, MSGL_FATAL, "[gl] Video PBO upload failed. "
                        "Remove the 'pbo' suboption.\n");
-            plane->buffer_ptr = NULL;
-            plane_ptr = NULL; // PBO offset 0
+            pbo->ptr = NULL;
         }
+    }
+    for (n = 0; n < p->plane_count; n++) {
+        struct texplane *plane = &p->planes[n];
+        int xs = plane->shift_x, ys = plane->shift_y;
+        void *plane_ptr = mpi->planes[n];
+        if (mpi->flags & MP_IMGFLAG_DIRECT)
+            plane_ptr = (void *)(intptr_t)plane->pbo_offset;
         gl->ActiveTexture(GL_TEXTURE0 + n);
         gl->BindTexture(GL_TEXTURE_2D, plane->gl_texture);
         glUploadTex(gl, GL_TEXTURE_2D, p->gl_format, p->gl_type, plane_ptr,
                     mpi->stride[n], 0, 0, w >> xs, h >> ys, 0);
     }
     gl->ActiveTexture(GL_TEXTURE0);
+    if (mpi->flags & MP_IMGFLAG_DIRECT) {
+        if (gl->FenceSync)
+            pbo->fence = gl->FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        pbo->in_use = false;
+        p->pbo_index = (p->pbo_index + 1) % p->pbo_frames;
+    }
     gl->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 skip_upload:
     do_render(p);
@@ -1610,6 +2074,97 @@ static void setup_vertex_array(GL *gl)
                             stride, (void*)offsetof(struct vertex, texcoord));
 }
 
+static struct bstr load_file(struct gl_priv *p, void *talloc_ctx,
+                             const char *filename)
+{
+    struct bstr res = {0};
+    stream_t *s = open_stream(filename, p->vo->opts, NULL);
+    if (s) {
+        res = stream_read_complete(s, talloc_ctx, 1000000000, 0);
+        free_stream(s);
+    }
+    return res;
+}
+
+#define SHADER_CACHE_HEADER "mplayer2 shader cache 1.0\n"
+
+// Binaries are only valid for the exact GL implementation they came from.
+static void load_shader_cache(struct gl_priv *p)
+{
+    GL *gl = p->gl;
+
+    if (!p->shader_cache || p->shader_cache_id)
+        return;
+    p->shader_cache_id = talloc_asprintf(p, "%s\n%s\n",
+                                         gl->GetString(GL_RENDERER),
+                                         gl->GetString(GL_VERSION));
+    if (!gl->ProgramBinary || !gl->GetProgramBinary) {
+        mp_msg(MSGT_VO, MSGL_WARN, "[gl] Program binaries not supported, "
+               "shader cache disabled.\n");
+        p->shader_cache = NULL;
+        return;
+    }
+
+    void *tmp = talloc_new(NULL);
+    mp_msg(MSGT_VO, MSGL_V, "[gl] Opening shader cache in file '%s'.\n",
+           p->shader_cache);
+    struct bstr data = load_file(p, tmp, p->shader_cache);
+    if (!data.len)
+        goto done;
+    if (!bstr_eatstart(&data, bstr(SHADER_CACHE_HEADER))
+        || !bstr_eatstart(&data, bstr(p->shader_cache_id)))
+    {
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Shader cache is for a different "
+               "driver, ignoring it.\n");
+        goto done;
+    }
+    while (data.len) {
+        struct bstr line = bstr_getline(data, &data);
+        int source_len, format, size;
+        if (bstr_sscanf(line, "%d %d %d", &source_len, &format, &size) != 3
+            || source_len < 0 || size <= 0
+            || data.len < (size_t)source_len + size)
+        {
+            mp_msg(MSGT_VO, MSGL_WARN, "[gl] Shader cache invalid!\n");
+            break;
+        }
+        struct program_binary bin = {
+            .source = bstrdup0(p, bstr_splice(data, 0, source_len)),
+            .format = format,
+            .data = bstrdup(p, bstr_splice(data, source_len,
+                                           source_len + size)),
+        };
+        data = bstr_cut(data, source_len + size);
+        MP_RESIZE_ARRAY(p, p->binaries, p->num_binaries + 1);
+        p->binaries[p->num_binaries++] = bin;
+    }
+
+done:
+    talloc_free(tmp);
+}
+
+static void save_shader_cache(struct gl_priv *p)
+{
+    if (!p->shader_cache || !p->binaries_changed)
+        return;
+    FILE *out = fopen(p->shader_cache, "wb");
+    if (!out) {
+        mp_msg(MSGT_VO, MSGL_WARN, "[gl] Can't write shader cache '%s'.\n",
+               p->shader_cache);
+        return;
+    }
+    fprintf(out, "%s%s", SHADER_CACHE_HEADER, p->shader_cache_id);
+    for (int n = 0; n < p->num_binaries; n++) {
+        struct program_binary *bin = &p->binaries[n];
+        fprintf(out, "%d %d %d\n", (int)strlen(bin->source), (int)bin->format,
+                (int)bin->data.len);
+        fwrite(bin->source, strlen(bin->source), 1, out);
+        fwrite(bin->data.start, bin->data.len, 1, out);
+    }
+    fclose(out);
+    p->binaries_changed = false;
+}
+
 static int init_gl(struct gl_priv *p)
 {
     GL *gl = p->gl;
@@ -1661,6 +2216,16 @@ static int init_gl(struct gl_priv *p)
     if (gl->SwapInterval && p->swap_interval >= 0)
         gl->SwapInterval(p->swap_interval);
 
+    load_shader_cache(p);
+
+    // Without fences, it can't be known when a PBO is free again.
+    p->pbo_frames = gl->FenceSync ? av_clip(p->pbo_frames, 1, MAX_PBOS) : 1;
+    p->pbo_persistent = gl->FenceSync && gl->BufferStorage &&
+                        gl->MapBufferRange;
+    if (p->use_pbo)
+        mp_msg(MSGT_VO, MSGL_V, "[gl] Using %d video PBOs%s.\n", p->pbo_frames,
+               p->pbo_persistent ? ", persistently mapped" : "");
+
     debug_check_gl(p, "after init_gl");
 
     return 1;
@@ -1676,6 +2241,9 @@ static void uninit_gl(struct gl_priv *p)
 
     uninit_video(p);
 
+    delete_program_cache(p);
+    save_shader_cache(p);
+
     gl->DeleteVertexArrays(1, &p->vao);
     p->vao = 0;
     gl->DeleteBuffers(1, &p->vertex_buffer);
@@ -1806,6 +2374,8 @@ static int config(struct vo *vo, uint32_t width, uint32_t height,
     if (!config_window(p, d_width, d_height, flags))
         return -1;
 
+    init_vsync_timing(p);
+
     p->vo_flipped = !!(flags & VOFLAG_FLIPPING);
 
     if (p->image_format != format || p->image_width != width
@@ -1875,6 +2445,7 @@ static int control(struct vo *vo, uint32_t request, void *data)
         p->glctx->pause(vo);
         return VO_TRUE;
     case VOCTRL_RESUME:
+        p->dropped_frame = false;
         if (!p->glctx->resume)
             break;
         p->glctx->resume(vo);
@@ -1955,24 +2526,6 @@ static void uninit(struct vo *vo)
 
 #ifdef CONFIG_LCMS2
 
-static void lcms2_error_handler(cmsContext ctx, cmsUInt32Number code,
-                                const char *msg)
-{
-    mp_msg(MSGT_VO, MSGL_ERR, "[gl] lcms2: %s\n", msg);
-}
-
-static struct bstr load_file(struct gl_priv *p, void *talloc_ctx,
-                             const char *filename)
-{
-    struct bstr res = {0};
-    stream_t *s = open_stream(filename, p->vo->opts, NULL);
-    if (s) {
-        res = stream_read_complete(s, talloc_ctx, 1000000000, 0);
-        free_stream(s);
-    }
-    return res;
-}
-
 #define LUT3D_CACHE_HEADER "mplayer2 3dlut cache 1.0\n"
 
 static bool load_icc(struct gl_priv *p, const char *icc_file,
@@ -1981,6 +2534,7 @@ static bool load_icc(struct gl_priv *p, const char *icc_file,
 {
     void *tmp = talloc_new(p);
     uint16_t *output = talloc_array(tmp, uint16_t, s_r * s_g * s_b * 3);
+    size_t output_size = talloc_get_size(output);
 
     if (icc_intent == -1)
         icc_intent = INTENT_ABSOLUTE_COLORIMETRIC;
@@ -2001,7 +2555,7 @@ static bool load_icc(struct gl_priv *p, const char *icc_file,
         if (bstr_eatstart(&cachedata, bstr(LUT3D_CACHE_HEADER))
             && bstr_eatstart(&cachedata, bstr(cache_info))
             && bstr_eatstart(&cachedata, iccdata)
-            && cachedata.len == talloc_get_size(output))
+            && cachedata.len == output_size)
         {
             memcpy(output, cachedata.start, cachedata.len);
             goto done;
@@ -2010,49 +2564,10 @@ static bool load_icc(struct gl_priv *p, const char *icc_file,
         }
     }
 
-    cmsSetLogErrorHandler(lcms2_error_handler);
-
-    cmsHPROFILE profile = cmsOpenProfileFromMem(iccdata.start, iccdata.len);
-    if (!profile)
-        goto error_exit;
-
-    cmsCIExyY d65;
-    cmsWhitePointFromTemp(&d65, 6504);
-    static const cmsCIExyYTRIPLE bt709prim = {
-        .Red   = {0.64, 0.33, 1.0},
-        .Green = {0.30, 0.60, 1.0},
-        .Blue  = {0.15, 0.06, 1.0},
-    };
-    cmsToneCurve *tonecurve = cmsBuildGamma(NULL, 2.2);
-    cmsHPROFILE vid_profile = cmsCreateRGBProfile(&d65, &bt709prim,
-                        (cmsToneCurve*[3]){tonecurve, tonecurve, tonecurve});
-    cmsFreeToneCurve(tonecurve);
-    cmsHTRANSFORM trafo = cmsCreateTransform(vid_profile, TYPE_RGB_16,
-                                             profile, TYPE_RGB_16,
-                                             icc_intent,
-                                             cmsFLAGS_HIGHRESPRECALC);
-    cmsCloseProfile(profile);
-    cmsCloseProfile(vid_profile);
-
-    if (!trafo)
+    output = mp_icc_create_lut3d(tmp, iccdata, icc_intent, s_r, s_g, s_b);
+    if (!output)
         goto error_exit;
 
-    // transform a (s_r)x(s_g)x(s_b) cube, with 3 components per channel
-    uint16_t *input = talloc_array(tmp, uint16_t, s_r * 3);
-    for (int b = 0; b < s_b; b++) {
-        for (int g = 0; g < s_g; g++) {
-            for (int r = 0; r < s_r; r++) {
-                input[r * 3 + 0] = r * 65535 / (s_r - 1);
-                input[r * 3 + 1] = g * 65535 / (s_g - 1);
-                input[r * 3 + 2] = b * 65535 / (s_b - 1);
-            }
-            size_t base = (b * s_r * s_g + g * s_r) * 3;
-            cmsDoTransform(trafo, input, output + base, s_r);
-        }
-    }
-
-    cmsDeleteTransform(trafo);
-
     if (icc_cache) {
         FILE *out = fopen(icc_cache, "wb");
         if (out) {
@@ -2192,6 +2707,7 @@ static int preinit(struct vo *vo, const char *arg)
         .colorspace = MP_CSP_DETAILS_DEFAULTS,
         .use_npot = 1,
         .use_pbo = 0,
+        .pbo_frames = 3,
         .swap_interval = 1,
         .fbo_format = GL_RGB16,
         .use_scale_sep = 1,
@@ -2209,6 +2725,7 @@ static int preinit(struct vo *vo, const char *arg)
     char *fbo_format = NULL;
     char *icc_profile = NULL;
     char *icc_cache = NULL;
+    char *shader_cache = NULL;
     int icc_intent = -1;
     char *icc_size_str = NULL;
 
@@ -2217,8 +2734,11 @@ static int preinit(struct vo *vo, const char *arg)
         {"srgb",                OPT_ARG_BOOL,   &p->use_srgb},
         {"npot",                OPT_ARG_BOOL,   &p->use_npot},
         {"pbo",                 OPT_ARG_BOOL,   &p->use_pbo},
+        {"pbo-frames",          OPT_ARG_INT,    &p->pbo_frames},
         {"glfinish",            OPT_ARG_BOOL,   &p->use_glFinish},
         {"swapinterval",        OPT_ARG_INT,    &p->swap_interval},
+        {"vsync-timing",        OPT_ARG_BOOL,   &p->use_vsync_timing},
+        {"vsync-fps",           OPT_ARG_FLOAT,  &p->vsync_fps},
         {"stereo",              OPT_ARG_INT,    &p->stereo_mode},
         {"lscale",              OPT_ARG_MSTRZ,  &scalers[0], scaler_valid},
         {"cscale",              OPT_ARG_MSTRZ,  &scalers[1], scaler_valid},
@@ -2233,6 +2753,7 @@ static int preinit(struct vo *vo, const char *arg)
         {"backend",             OPT_ARG_MSTRZ,  &backend_arg, backend_valid},
         {"icc-profile",         OPT_ARG_MSTRZ,  &icc_profile},
         {"icc-cache",           OPT_ARG_MSTRZ,  &icc_cache},
+        {"shader-cache",        OPT_ARG_MSTRZ,  &shader_cache},
         {"icc-intent",          OPT_ARG_INT,    &icc_intent},
         {"3dlut-size",          OPT_ARG_MSTRZ,  &icc_size_str,
          lut3d_size_valid},
@@ -2248,6 +2769,9 @@ static int preinit(struct vo *vo, const char *arg)
     int backend = backend_arg ? mpgl_find_backend(backend_arg) : GLTYPE_AUTO;
     free(backend_arg);
 
+    // without vsync-timing, leave flip timing and A/V sync to the player
+    vo->timed_flips = p->use_vsync_timing;
+
     if (fbo_format)
         p->fbo_format = find_fbo_format(fbo_format);
     free(fbo_format);
@@ -2271,6 +2795,10 @@ static int preinit(struct vo *vo, const char *arg)
     free(icc_profile);
     free(icc_cache);
 
+    if (shader_cache)
+        p->shader_cache = talloc_strdup(p, shader_cache);
+    free(shader_cache);
+
     if (!success)
         goto err_out;
 
@@ -2315,6 +2843,7 @@ const struct vo_driver video_out_gl3 = {
     .draw_slice = draw_slice,
     .draw_osd = draw_osd,
     .flip_page = flip_page,
+    .flip_page_timed = flip_page_timed,
     .check_events = check_events,
     .uninit = uninit,
 };
@@ -2356,6 +2885,10 @@ static const char help_text[] =
 "  pbo\n"
 "    Enable use of PBOs. This is faster, but can sometimes lead to\n"
 "    sporadic and temporary image corruption.\n"
+"  pbo-frames=<n>\n"
+"    Number of PBOs used in turn with 'pbo', so that decoding a frame\n"
+"    can overlap with the upload of the previous ones (1-8).\n"
+"    Needs OpenGL sync objects, else 1 is used. Default: 3.\n"
 "  dither-depth=<n>\n"
 "    Positive non-zero values select the target bit depth.\n"
 "    -1: Disable any dithering done by mplayer.\n"
@@ -2374,6 +2907,12 @@ static const char help_text[] =
 "  swapinterval=<n>\n"
 "    Interval in displayed frames between to buffer swaps.\n"
 "    1 is equivalent to enable VSYNC, 0 to disable VSYNC.\n"
+"  vsync-timing\n"
+"    Time buffer swaps to the display refresh, for smoother frame pacing.\n"
+"    Uses frame callbacks on Wayland, and requires swapinterval=1\n"
+"    elsewhere.\n"
+"  vsync-fps=<fps>\n"
+"    Display refresh rate for vsync-timing. Default: 0 (ask the display).\n"
 "  no-scale-sep\n"
 "    When using a separable scale filter for luma, usually two filter\n"
 "    passes are done. This is often faster. However, it forces\n"
@@ -2426,6 +2965,9 @@ static const char help_text[] =
 "    this file. This can be used to speed up loading, since\n"
 "    LittleCMS2 can take a while to create the 3D LUT.\n"
 "    Note that this file will be at most about 100 MB big.\n"
+"  shader-cache=<file>\n"
+"    Store and load linked shader programs in this file, if the\n"
+"    driver supports program binaries.\n"
 "  icc-intent=<value>\n"
 "    0: perceptual\n"
 "    1: relative colorimetric\n"
@@ -109,6 +109,30 @@ const struct wl_shell_surface_listener shell_surface_listener = {
     ssurface_handle_popup_done
 };
 
+/* FRAME CALLBACK LISTENER */
+static void frame_handle_done (void *data, struct wl_callback *callback,
+        uint32_t time)
+{
+    struct vo_wayland_window *window = data;
+    /* the compositor's timestamp (in ms) has an unspecified base: map it to
+     * GetTimer() with the smallest offset seen, which is the one least
+     * delayed by event dispatch. Let it creep up to follow clock drift. */
+    unsigned int offset = GetTimer() - time * 1000;
+
+    wl_callback_destroy(callback);
+    window->callback = NULL;
+    if (!window->frame_count || (int)(offset - window->frame_offset) < 0)
+        window->frame_offset = offset;
+    else
+        window->frame_offset += (offset - window->frame_offset) / 64;
+    window->frame_time = time * 1000 + window->frame_offset;
+    window->frame_count++;
+}
+
+static const struct wl_callback_listener frame_listener = {
+    frame_handle_done
+};
+
 /* OUTPUT LISTENER */
 static void output_handle_geometry (void *data, struct wl_output *wl_output,
         int32_t x, int32_t y, int32_t physical_width, int32_t physical_height,
@@ -139,6 +163,8 @@ static void output_handle_mode (void *data, struct wl_output *wl_output,
         d->output_width = width;
         d->mode_received = 1;
     }
+    if (flags & WL_OUTPUT_MODE_CURRENT)
+        d->output_refresh = refresh;
 }
 
 const struct wl_output_listener output_listener = {
@@ -873,7 +899,6 @@ int vo_wayland_check_events (struct vo *vo)
     struct task *task;
     struct vo_wayland_state *wl = vo->wayland;
     int i, ret, count;
-    wl->input->events = 0;
     struct epoll_event ep[16];
 
     wl_display_dispatch_pending(wl->display->display);
@@ -906,6 +931,55 @@ int vo_wayland_check_events (struct vo *vo)
     return ret;
 }
 
+/* Ask for a frame callback with the next commit of the window surface, which
+ * tells when the compositor has shown the frame and wants a new one. */
+void vo_wayland_request_frame (struct vo *vo)
+{
+    struct vo_wayland_window *window = vo->wayland->window;
+
+    if (window->callback)
+        return;
+
+    window->callback = wl_surface_frame(window->surface);
+    wl_callback_add_listener(window->callback, &frame_listener, window);
+}
+
+/* Handle display events until the requested frame callback arrived, or at
+ * most timeout_ms. Returns 1 if no frame callback is pending anymore.
+ * Events other than the frame callback are kept for check_events. */
+int vo_wayland_wait_frame (struct vo *vo, int timeout_ms)
+{
+    struct vo_wayland_state *wl = vo->wayland;
+    struct epoll_event ep[16];
+    unsigned int start = GetTimerMS();
+    int i, count, left;
+
+    wl_display_dispatch_pending(wl->display->display);
+    wl_display_flush(wl->display->display);
+
+    while (wl->window->callback) {
+        left = timeout_ms - (int)(GetTimerMS() - start);
+        if (left < 0)
+            break;
+        count = epoll_wait(wl->display->epoll_fd,
+                ep, ARRAY_LENGTH(ep), left);
+        if (count <= 0)
+            break;
+        for (i = 0; i < count; i++) {
+            struct task *task = ep[i].data.ptr;
+            task->run(task, ep[i].events);
+        }
+    }
+
+    return !wl->window->callback;
+}
+
+/* Refresh rate of the output in Hz, 0 if the compositor didn't tell. */
+double vo_wayland_get_fps (struct vo *vo)
+{
+    return vo->wayland->display->output_refresh / 1000.0;
+}
+
 void vo_wayland_update_xinerama_info (struct vo *vo)
 {
     struct vo_wayland_state *wl = vo->wayland;
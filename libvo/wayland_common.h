@@ -66,6 +66,7 @@ struct vo_wayland_display {
     int mode_received;
     uint32_t output_width;
     uint32_t output_height;
+    int32_t output_refresh; /* of the current mode in mHz, 0 if unknown */
 
     uint32_t formats;
     uint32_t mask;
@@ -86,6 +87,9 @@ struct vo_wayland_window {
     struct wl_shell_surface *shell_surface;
     struct wl_buffer *buffer;
     struct wl_callback *callback;
+    unsigned int frame_time; /* GetTimer() when the last frame was shown */
+    unsigned int frame_offset; /* GetTimer() - frame callback time in us */
+    unsigned int frame_count; /* frame callbacks received */
 
     int events; /* mplayer events */
 
@@ -133,6 +137,9 @@ void vo_wayland_border(struct vo *vo);
 void vo_wayland_fullscreen(struct vo *vo);
 void vo_wayland_update_xinerama_info(struct vo *vo);
 int vo_wayland_check_events(struct vo *vo);
+void vo_wayland_request_frame(struct vo *vo);
+int vo_wayland_wait_frame(struct vo *vo, int timeout_ms);
+double vo_wayland_get_fps(struct vo *vo);
 
 #endif /* MPLAYER_WAYLAND_COMMON_H */
 
@@ -217,6 +217,9 @@ typedef struct MPContext {
 
     struct screenshot_ctx *screenshot_ctx;
 
+    // audio decoding thread, only while playing with -audio-decode-ahead
+    struct decode_thread *decode_thread;
+
 #ifdef CONFIG_DVDNAV
     struct mp_image *nav_smpi; ///< last decoded dvdnav video image
     unsigned char *nav_buffer;   ///< last read dvdnav video frame
@@ -28,6 +28,9 @@
 #include <libavutil/intreadwrite.h>
 
 #include "config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include "talloc.h"
 
 #include "osdep/io.h"
@@ -2411,6 +2414,359 @@ static int write_to_ao(struct MPContext *mpctx, void *data, int len, int flags,
     return played;
 }
 
+// Bytes the stream cache must hold before reading ahead, about the largest
+// packet that a read is expected to pull in.
+#define READAHEAD_MIN_CACHED (512 * 1024)
+
+/* Whether reading ahead is unlikely to block on the stream. Reading ahead
+ * happens while a frame may be due, so it has to stop before the cache runs
+ * dry, and isn't done at all on uncached network or device streams. */
+static bool readahead_is_safe(struct demuxer *demuxer)
+{
+    struct stream *s = demuxer->stream;
+#ifdef CONFIG_STREAM_CACHE
+    if (s->cached)
+        return cache_can_read(s, READAHEAD_MIN_CACHED);
+#endif
+    return s->type == STREAMTYPE_FILE || s->type == STREAMTYPE_MEMORY;
+}
+
+#ifdef HAVE_PTHREADS
+/* Optional audio decoding thread (-audio-decode-ahead) and demuxer thread
+ * (-demuxer-thread).
+ * The main thread owns the player state at all times, except while it
+ * decodes and filters a video frame or sleeps until the next frame is due.
+ * During that time the audio thread runs the audio decoder and filter chain
+ * ahead into ao->buffer, and the demuxer thread reads packets ahead into the
+ * demuxer queues, so that the time spent in the video chain, the audio chain
+ * and the demuxer overlaps instead of adding up. Only one thread owns the
+ * state at a time, so the rest of the code does not need to be aware of the
+ * threads at all. The helper threads work in small steps and don't start a
+ * new one while the main thread waits to take the state back. They leave
+ * stream reads that might block to the main thread (readahead_is_safe()). */
+enum {
+    OWNER_NONE,
+    OWNER_MAIN,
+    OWNER_HELPER,
+};
+
+struct decode_thread {
+    pthread_t thread;
+    bool have_thread;
+    pthread_t demux_thread;
+    bool have_demux_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    // fields below are protected by lock
+    int owner;
+    bool main_waiting;
+    // changes whenever the state was released after doing something with it
+    unsigned int generation;
+    bool quit;
+    // decode_audio() error not yet seen by fill_audio_out_buffers()
+    int audio_error;
+    // audio decoding time not yet added to audio_time_usage
+    double audio_time;
+};
+
+// How many bytes of filtered audio the thread should keep in ao->buffer.
+static int decode_thread_audio_target(struct MPContext *mpctx)
+{
+    struct ao *ao = mpctx->ao;
+    if (!mpctx->sh_audio || !(mpctx->initialized_flags & INITIALIZED_ACODEC)
+        || !ao || !ao->initialized || ao->untimed
+        || (ao->format & AF_FORMAT_SPECIAL_MASK))
+        return 0;
+    // Leave anything related to A/V sync and seeking to the main thread
+    if (mpctx->paused || mpctx->restart_playback || mpctx->syncing_audio
+        || mpctx->hrseek_active)
+        return 0;
+    // The main thread can't take the state back during a stream read, so
+    // slow reads are left to it as well.
+    if (!readahead_is_safe(mpctx->sh_audio->ds->demuxer))
+        return 0;
+    int unitsize = ao->channels * af_fmt2bits(ao->format) / 8;
+    int target = mpctx->opts.audio_decode_ahead * ao->bps
+                 / mpctx->opts.playback_speed;
+    return target - target % unitsize;
+}
+
+/* Call step() with the player state owned whenever the main thread doesn't
+ * need it. Once step() returns false, wait until someone else changed the
+ * state before trying again. */
+static void run_helper(struct MPContext *mpctx,
+                       bool (*step)(struct MPContext *mpctx))
+{
+    struct decode_thread *t = mpctx->decode_thread;
+
+    pthread_mutex_lock(&t->lock);
+    unsigned int idle_generation = t->generation - 1;
+    while (!t->quit) {
+        if (t->owner != OWNER_NONE || t->main_waiting
+            || t->generation == idle_generation) {
+            pthread_cond_wait(&t->wakeup, &t->lock);
+            continue;
+        }
+        t->owner = OWNER_HELPER;
+        pthread_mutex_unlock(&t->lock);
+        bool progress = step(mpctx);
+        pthread_mutex_lock(&t->lock);
+        t->owner = OWNER_NONE;
+        if (progress)
+            t->generation++;
+        else
+            idle_generation = t->generation;
+        pthread_cond_broadcast(&t->wakeup);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+static bool decode_thread_step(struct MPContext *mpctx)
+{
+    struct decode_thread *t = mpctx->decode_thread;
+    struct ao *ao = mpctx->ao;
+    pthread_mutex_lock(&t->lock);
+    bool error = t->audio_error;
+    pthread_mutex_unlock(&t->lock);
+    int target = error ? 0 : decode_thread_audio_target(mpctx);
+    if (target <= 0 || ao->buffer.len >= target)
+        return false;
+    // Work in steps of about 20 ms so that the main thread never has to
+    // wait long for the state once its video frame is done.
+    int step = FFMAX(ao->bps / 50, 1);
+    unsigned int start = GetTimer();
+    int res = decode_audio(mpctx->sh_audio, &ao->buffer,
+                           FFMIN(target, ao->buffer.len + step));
+    pthread_mutex_lock(&t->lock);
+    t->audio_time += (GetTimer() - start) * 0.000001;
+    if (res < 0)
+        t->audio_error = res;
+    pthread_mutex_unlock(&t->lock);
+    return true;
+}
+
+static void *decode_thread_run(void *arg)
+{
+    run_helper(arg, decode_thread_step);
+    return NULL;
+}
+
+static double demux_thread_target(struct MPContext *mpctx)
+{
+    double secs = mpctx->opts.demuxer_readahead_secs;
+    return secs > 0 ? secs : 1.0;
+}
+
+// one packet at a time, see decode_thread_step()
+static bool demux_thread_step(struct MPContext *mpctx)
+{
+    return !mpctx->paused && !mpctx->stop_play && mpctx->demuxer
+           && readahead_is_safe(mpctx->demuxer)
+           && demux_readahead(mpctx->demuxer, demux_thread_target(mpctx));
+}
+
+static void *demux_thread_run(void *arg)
+{
+    run_helper(arg, demux_thread_step);
+    return NULL;
+}
+
+static void stop_decode_thread(struct MPContext *mpctx);
+
+static void start_decode_thread(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = &mpctx->opts;
+    bool audio = opts->audio_decode_ahead > 0 && mpctx->sh_video;
+    if (!audio && !opts->demuxer_thread)
+        return;
+    struct decode_thread *t = talloc_zero(NULL, struct decode_thread);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wakeup, NULL);
+    t->owner = OWNER_MAIN;
+    t->generation = 1;
+    mpctx->decode_thread = t;
+    if (audio) {
+        if (pthread_create(&t->thread, NULL, decode_thread_run, mpctx)) {
+            mp_msg(MSGT_CPLAYER, MSGL_ERR, "Could not start decoding thread, "
+                   "decoding audio on the main thread.\n");
+        } else {
+            t->have_thread = true;
+            mp_msg(MSGT_CPLAYER, MSGL_V, "Decoding up to %.2f seconds of "
+                   "audio ahead on a separate thread.\n",
+                   opts->audio_decode_ahead);
+        }
+    }
+    if (opts->demuxer_thread) {
+        if (pthread_create(&t->demux_thread, NULL, demux_thread_run, mpctx)) {
+            mp_msg(MSGT_CPLAYER, MSGL_ERR, "Could not start demuxer "
+                   "thread.\n");
+        } else {
+            t->have_demux_thread = true;
+            mp_msg(MSGT_CPLAYER, MSGL_V, "Demuxing up to %.2f seconds ahead "
+                   "on a separate thread.\n", demux_thread_target(mpctx));
+        }
+    }
+    if (!t->have_thread && !t->have_demux_thread)
+        stop_decode_thread(mpctx);
+}
+
+static void stop_decode_thread(struct MPContext *mpctx)
+{
+    struct decode_thread *t = mpctx->decode_thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->quit = true;
+    pthread_cond_broadcast(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    if (t->have_thread)
+        pthread_join(t->thread, NULL);
+    if (t->have_demux_thread)
+        pthread_join(t->demux_thread, NULL);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+    mpctx->decode_thread = NULL;
+}
+
+// Called by the main thread before doing video work or sleeping, which
+// doesn't touch shared player state; lets the other threads run meanwhile.
+static void decode_thread_release(struct MPContext *mpctx)
+{
+    struct decode_thread *t = mpctx->decode_thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->owner = OWNER_NONE;
+    t->generation++;
+    pthread_cond_broadcast(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// Wait for the current step of a helper thread to finish, and take the
+// state back before either of them starts another one.
+static void decode_thread_acquire(struct MPContext *mpctx)
+{
+    struct decode_thread *t = mpctx->decode_thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->main_waiting = true;
+    while (t->owner != OWNER_NONE)
+        pthread_cond_wait(&t->wakeup, &t->lock);
+    t->owner = OWNER_MAIN;
+    t->main_waiting = false;
+    audio_time_usage += t->audio_time;
+    t->audio_time = 0;
+    pthread_mutex_unlock(&t->lock);
+}
+
+static bool demux_thread_active(struct MPContext *mpctx)
+{
+    return mpctx->decode_thread && mpctx->decode_thread->have_demux_thread;
+}
+
+// Return (and clear) an audio decoding error hit by the decoding thread.
+static int decode_thread_audio_error(struct MPContext *mpctx)
+{
+    struct decode_thread *t = mpctx->decode_thread;
+    if (!t)
+        return 0;
+    pthread_mutex_lock(&t->lock);
+    int res = t->audio_error;
+    t->audio_error = 0;
+    pthread_mutex_unlock(&t->lock);
+    return res;
+}
+
+/* The input context may only be touched by the main thread, but the stream
+ * layer polls it for abort commands from within reads, which the helper
+ * threads do as well. They only see this flag, which the main thread sets
+ * while it waits for input with the player state released. */
+static pthread_mutex_t interrupt_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool interrupt_request;
+static pthread_t main_thread;
+
+static void set_interrupt_request(bool state)
+{
+    pthread_mutex_lock(&interrupt_lock);
+    interrupt_request = state;
+    pthread_mutex_unlock(&interrupt_lock);
+}
+
+static int check_stream_interrupt(struct input_ctx *ictx, int time)
+{
+    if (pthread_equal(pthread_self(), main_thread))
+        return mp_input_check_interrupt(ictx, time);
+    for (;;) {
+        pthread_mutex_lock(&interrupt_lock);
+        bool res = interrupt_request;
+        pthread_mutex_unlock(&interrupt_lock);
+        if (res || time <= 0)
+            return res;
+        usec_sleep(FFMIN(time, 10) * 1000);
+        time -= 10;
+    }
+}
+
+static void init_stream_interrupt(struct MPContext *mpctx)
+{
+    main_thread = pthread_self();
+    stream_set_interrupt_callback(check_stream_interrupt, mpctx->input);
+}
+
+// Wait up to secs seconds for input, letting the other threads run meanwhile.
+static void wait_for_input(struct MPContext *mpctx, float secs)
+{
+    if (!mpctx->decode_thread) {
+        mp_input_get_cmd(mpctx->input, secs * 1000, true);
+        return;
+    }
+    decode_thread_release(mpctx);
+    mp_input_get_cmd(mpctx->input, secs * 1000, true);
+    // A helper thread might be stuck in a slow stream read; the state is
+    // only needed back once the read has been aborted.
+    if (mp_input_abort_pending(mpctx->input))
+        set_interrupt_request(true);
+    decode_thread_acquire(mpctx);
+    set_interrupt_request(false);
+}
+#else
+static void start_decode_thread(struct MPContext *mpctx) {}
+static void stop_decode_thread(struct MPContext *mpctx) {}
+static void decode_thread_release(struct MPContext *mpctx) {}
+static void decode_thread_acquire(struct MPContext *mpctx) {}
+static int decode_thread_audio_error(struct MPContext *mpctx) { return 0; }
+static bool demux_thread_active(struct MPContext *mpctx) { return false; }
+
+static void init_stream_interrupt(struct MPContext *mpctx)
+{
+    stream_set_interrupt_callback(mp_input_check_interrupt, mpctx->input);
+}
+
+static void wait_for_input(struct MPContext *mpctx, float secs)
+{
+    mp_input_get_cmd(mpctx->input, secs * 1000, true);
+}
+#endif
+
+/* Spend up to secs seconds of otherwise idle time reading packets ahead
+ * (--demuxer-readahead), unless the demuxer thread does that. Returns the
+ * time used. */
+static float idle_readahead(struct MPContext *mpctx, float secs)
+{
+    if (!mpctx->demuxer || mpctx->opts.demuxer_readahead_secs <= 0
+        || demux_thread_active(mpctx))
+        return 0;
+    current_module = "demux_readahead";
+    unsigned int start = GetTimer();
+    float used = 0;
+    while (used < secs && readahead_is_safe(mpctx->demuxer)
+           && demux_readahead(mpctx->demuxer, mpctx->opts.demuxer_readahead_secs))
+        used = (GetTimer() - start) * 0.000001;
+    return used;
+}
+
 #define ASYNC_PLAY_DONE -3
 static int audio_start_sync(struct MPContext *mpctx, int playsize)
 {
@@ -2535,8 +2891,10 @@ static int fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
         mpctx->hrseek_active = false;
     }
 
-    int res;
-    if (mpctx->syncing_audio || mpctx->hrseek_active)
+    int res = decode_thread_audio_error(mpctx);
+    if (res < 0)
+        ; // already hit by the decoding thread, handle it below
+    else if (mpctx->syncing_audio || mpctx->hrseek_active)
         res = audio_start_sync(mpctx, playsize);
     else
         res = decode_audio(sh_audio, &ao->buffer, playsize);
@@ -2768,15 +3126,22 @@ static double update_video_nocorrect_pts(struct MPContext *mpctx)
         decoded_frame = mp_dvdnav_restore_smpi(mpctx, &in_size, &packet, NULL);
         if (in_size >= 0 && !decoded_frame)
 #endif
-        decoded_frame = decode_video(sh_video, sh_video->ds->current, packet,
-                                     in_size, framedrop_type, sh_video->pts);
+        {
+            decode_thread_release(mpctx);
+            decoded_frame = decode_video(sh_video, sh_video->ds->current,
+                                         packet, in_size, framedrop_type,
+                                         sh_video->pts);
+            decode_thread_acquire(mpctx);
+        }
 #ifdef CONFIG_DVDNAV
         // Save last still frame for future display
         mp_dvdnav_save_smpi(mpctx, in_size, packet, decoded_frame);
 #endif
         if (decoded_frame) {
             current_module = "filter video";
+            decode_thread_release(mpctx);
             filter_video(sh_video, decoded_frame, sh_video->pts);
+            decode_thread_acquire(mpctx);
         }
         break;
     }
@@ -2859,12 +3224,16 @@ static double update_video(struct MPContext *mpctx)
             mpctx->hrseek_framedrop = false;
         int framedrop_type = mpctx->hrseek_framedrop ? 1 :
                              check_framedrop(mpctx, sh_video->frametime);
+        decode_thread_release(mpctx);
         void *decoded_frame = decode_video(sh_video, pkt, buf, in_size,
                                            framedrop_type, pts);
+        decode_thread_acquire(mpctx);
         if (decoded_frame) {
             determine_frame_pts(mpctx);
             current_module = "filter video";
+            decode_thread_release(mpctx);
             filter_video(sh_video, decoded_frame, sh_video->pts);
+            decode_thread_acquire(mpctx);
         } else if (!pkt) {
             if (vo_get_buffered_frame(video_out, true) < 0)
                 return -1;
@@ -3049,6 +3418,7 @@ static void seek_reset(struct MPContext *mpctx, bool reset_ao, bool reset_ac)
             ao_reset(mpctx->ao);
         mpctx->ao->buffer.len = mpctx->ao->buffer_playable_size;
         mpctx->sh_audio->a_buffer_len = 0;
+        decode_thread_audio_error(mpctx);
         if (!mpctx->sh_video)
             update_subtitles(mpctx, mpctx->sh_audio->pts, true);
     }
@@ -3555,8 +3925,13 @@ static void run_playloop(struct MPContext *mpctx)
         mpctx->time_frame -= vo->flip_queue_offset;
         float aq_sleep_time = mpctx->time_frame;
         if (mpctx->time_frame > 0.001
-            && !(mpctx->sh_video->output_flags & VFCAP_TIMER))
+            && !(mpctx->sh_video->output_flags & VFCAP_TIMER)) {
+            if (idle_readahead(mpctx, mpctx->time_frame) > 0)
+                mpctx->time_frame -= get_relative_time(mpctx);
+            decode_thread_release(mpctx);
             mpctx->time_frame = timing_sleep(mpctx, mpctx->time_frame);
+            decode_thread_acquire(mpctx);
+        }
         mpctx->time_frame += vo->flip_queue_offset;
 
         unsigned int t2 = GetTimer();
@@ -3584,7 +3959,7 @@ static void run_playloop(struct MPContext *mpctx)
 
         mpctx->last_vo_flip_duration = (GetTimer() - t2) * 0.000001;
         vout_time_usage += mpctx->last_vo_flip_duration;
-        if (vo->driver->flip_page_timed) {
+        if (vo->timed_flips) {
             // No need to adjust sync based on flip speed
             mpctx->last_vo_flip_duration = 0;
             // For print_status - VO call finishing early is OK for sync
@@ -3735,7 +4110,9 @@ static void run_playloop(struct MPContext *mpctx)
                     vo_osd_changed(0);
             } else {
             novideo:
-                mp_input_get_cmd(mpctx->input, sleeptime * 1000, true);
+                sleeptime -= idle_readahead(mpctx, sleeptime);
+                if (sleeptime > 0)
+                    wait_for_input(mpctx, sleeptime);
             }
         }
     }
@@ -3835,10 +4212,11 @@ static void print_version(const char *name)
     GetCpuCaps(&gCpuCaps);
 #if ARCH_X86
     mp_msg(MSGT_CPLAYER, MSGL_V,
-           "CPUflags:  MMX: %d MMX2: %d 3DNow: %d 3DNowExt: %d SSE: %d SSE2: %d SSSE3: %d\n",
+           "CPUflags:  MMX: %d MMX2: %d 3DNow: %d 3DNowExt: %d SSE: %d SSE2: %d SSSE3: %d AVX2: %d\n",
            gCpuCaps.hasMMX, gCpuCaps.hasMMX2,
            gCpuCaps.has3DNow, gCpuCaps.has3DNowExt,
-           gCpuCaps.hasSSE, gCpuCaps.hasSSE2, gCpuCaps.hasSSSE3);
+           gCpuCaps.hasSSE, gCpuCaps.hasSSE2, gCpuCaps.hasSSSE3,
+           gCpuCaps.hasAVX2);
 #if CONFIG_RUNTIME_CPUDETECT
     mp_tmsg(MSGT_CPLAYER, MSGL_V, "Compiled with runtime CPU detection.\n");
 #else
@@ -4135,7 +4513,7 @@ int main(int argc, char *argv[])
     else if (opts->consolecontrols)
         mp_input_add_key_fd(mpctx->input, 0, 1, read_keys, NULL, mpctx->key_fifo);
     // Set the libstream interrupt callback
-    stream_set_interrupt_callback(mp_input_check_interrupt, mpctx->input);
+    init_stream_interrupt(mpctx);
 
     current_module = NULL;
 
@@ -4901,8 +5279,10 @@ goto_enable_cache:
         vo_control(mpctx->video_out,
                    mpctx->paused ? VOCTRL_PAUSE : VOCTRL_RESUME, NULL);
 
+    start_decode_thread(mpctx);
     while (!mpctx->stop_play)
         run_playloop(mpctx);
+    stop_decode_thread(mpctx);
 
     mp_msg(MSGT_GLOBAL, MSGL_V, "EOF code: %d  \n", mpctx->stop_play);
 
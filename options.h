@@ -53,12 +53,15 @@ typedef struct MPOpts {
     int stream_cache_size;
     float stream_cache_min_percent;
     float stream_cache_seek_min_percent;
+    char *stream_cache_dir;
+    int stream_cache_disk_size;
     int chapterrange[2];
     int edition_id;
     int correct_pts;
     int user_correct_pts;
     int user_pts_assoc_mode;
     int initial_audio_sync;
+    float audio_decode_ahead;
     int hr_seek;
     float hr_seek_demuxer_offset;
     float sub_delay;
@@ -90,6 +93,11 @@ typedef struct MPOpts {
     char *audio_demuxer_name;
     char *sub_demuxer_name;
     int extension_parsing;
+    int demuxer_max_packs;
+    int demuxer_max_bytes;
+    float demuxer_max_secs;
+    float demuxer_readahead_secs;
+    int demuxer_thread;
 
     int audio_output_channels;
     int audio_output_format;
@@ -101,6 +109,7 @@ typedef struct MPOpts {
     float screen_size_xy;
     int flip;
     int vd_use_slices;
+    int vf_threads;
     char **sub_name;
     char **sub_paths;
     int sub_auto;
@@ -18,6 +18,16 @@
 
 // Initial draft of my new cache system...
 // Note it runs in 2 processes (using fork()), but doesn't require locking!!
+// The buffer is split into fixed-size blocks, each caching one aligned part
+// of the file, so that several disjoint ranges can stay cached at the same
+// time and seeking back and forth over them does not refetch any data.
+// Blocks not needed for read-ahead are reused in LRU order.
+// With -cache-dir, evicted blocks are additionally kept in a memory-mapped
+// file per stream, so that data is not downloaded again even after it fell
+// out of the memory cache or when the same stream is played again later.
+// When running as a pthread, the filler and the reader wake each other up
+// with a condition variable instead of polling; the mutex only protects the
+// wakeups, buffer data and positions are still single-writer.
 // TODO: seeking, data consistency checking
 
 #define READ_SLEEP_TIME 10
@@ -38,9 +48,22 @@
 #include <errno.h>
 
 #include <libavutil/common.h>
+#include <libavutil/md5.h>
 
 #include "config.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#define DISK_CACHE 1
+#else
+#define DISK_CACHE 0
+#endif
+
+#include "talloc.h"
 #include "osdep/shmem.h"
 #include "osdep/timer.h"
 #if defined(__MINGW32__)
@@ -48,7 +71,10 @@
 static void ThreadProc( void *s );
 #elif defined(PTHREAD_CACHE)
 #include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
 static void *ThreadProc(void *s);
+#define COND_CACHE 1
 #else
 #include <sys/wait.h>
 #define FORKED_CACHE 1
@@ -56,28 +82,82 @@ static void *ThreadProc(void *s);
 #ifndef FORKED_CACHE
 #define FORKED_CACHE 0
 #endif
+#ifndef COND_CACHE
+#define COND_CACHE 0
+#endif
 
 #include "mp_msg.h"
 
 #include "stream.h"
 #include "cache2.h"
 #include "mpcommon.h"
+#include "path.h"
+#include "bstr.h"
+#include "options.h"
+
+// Block sizes are chosen so that there are at most this many blocks
+#define MAX_BLOCKS 1024
+#define MIN_BLOCKS 4
+
+#if defined(__GNUC__)
+#define cache_barrier() __sync_synchronize()
+#else
+#define cache_barrier()
+#endif
+
+typedef struct {
+  // Only the filler changes pos, and it increments seq before and after
+  // doing so. The reader copies data and then checks that seq did not
+  // change meanwhile, so it never needs to lock.
+  off_t pos;              // file position of the first byte, -1 if unused
+  volatile int len;       // valid bytes, only grows until the block is reused
+  volatile unsigned seq;  // odd while the block is being reassigned
+  volatile unsigned last_used; // for LRU replacement
+  volatile int next;      // next block in the same hash chain, -1 at the end
+} cache_block_t;
+
+#define DISK_MAGIC "MPCACHE1"
+#define DISK_URL_SIZE 1024
+
+// Layout of the disk cache file: header, block index, then block data
+// starting at a page-aligned offset.
+struct disk_header {
+  char magic[8];
+  int32_t block_size;
+  int32_t num_blocks;
+  int64_t file_size;  // stream size, the cache is dropped if it changes
+  int32_t clean;      // 0 while in use, so data of crashed sessions is dropped
+  char url[DISK_URL_SIZE];
+};
+
+struct disk_block {
+  int64_t pos;        // -1 if unused
+  int32_t len;
+  int32_t pad;
+};
 
 typedef struct {
   // constats:
   unsigned char *buffer;      // base pointer of the allocated buffer memory
   int buffer_size; // size of the allocated buffer memory
   int sector_size; // size of a single sector (2048/2324)
-  int back_size;   // we should keep back_size amount of old bytes for backward seek
-  int fill_limit;  // we should fill buffer only if space>=fill_limit
+  int block_size;  // size of a single block, multiple of sector_size
+  int num_blocks;
+  cache_block_t *blocks;
+  // Blocks are aligned to block_size, so they are indexed by pos/block_size:
+  // each entry heads a chain (linked through cache_block_t.next) of the
+  // blocks whose index hashes to it. Only the filler changes it.
+  volatile int *hash;
+  int hash_size;   // power of 2, at least num_blocks
+  int ahead_size;  // fill at most this far ahead of the read position
   int seek_limit;  // keep filling cache if distance is less that seek limit
   // filler's pointers:
   int eof;
-  off_t min_filepos; // buffer contain only a part of the file, from min-max pos
-  off_t max_filepos;
-  off_t offset;      // filepos <-> bufferpos  offset value (filepos of the buffer's first byte)
+  off_t eof_pos;   // the stream returned EOF when reading from here
+  volatile int64_t fill_count; // total number of bytes read from the stream
   // reader's pointers:
   off_t read_filepos;
+  unsigned use_count;
   // commands/locking:
 //  int seek_lock;   // 1 if we will seek/reset buffer, 2 if we are ready for cmd
 //  int fifo_flag;  // 1 if we should use FIFO to notice cache about buffer reads.
@@ -90,15 +170,171 @@ typedef struct {
   volatile off_t control_new_pos;
   volatile double stream_time_length;
   volatile double stream_time_pos;
+  // disk tier, only touched by the filler while it is running
+  int disk_fd;
+  unsigned char *disk;       // mapping of the whole cache file
+  size_t disk_size;
+  int disk_blocks;
+  int64_t disk_read;         // bytes taken from the disk instead of the stream
+#if COND_CACHE
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t wakeup;      // broadcast on any state change by either side
+  volatile unsigned wakeup_count;
+#endif
 } cache_vars_t;
 
-static int min_fill=0;
+#if COND_CACHE
+static void cache_lock(cache_vars_t *s)
+{
+  pthread_mutex_lock(&s->mutex);
+}
+
+static void cache_unlock(cache_vars_t *s)
+{
+  pthread_mutex_unlock(&s->mutex);
+}
+
+/**
+ * Wait until the other side calls cache_signal() or ms milliseconds passed.
+ * Must be called with the mutex held.
+ */
+static void cache_wait(cache_vars_t *s, int ms)
+{
+  struct timeval now;
+  struct timespec ts;
+  gettimeofday(&now, NULL);
+  ts.tv_sec = now.tv_sec + ms / 1000;
+  ts.tv_nsec = now.tv_usec * 1000 + (ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  pthread_cond_timedwait(&s->wakeup, &s->mutex, &ts);
+}
+
+static void cache_signal(cache_vars_t *s)
+{
+  cache_lock(s);
+  s->wakeup_count++;
+  pthread_cond_broadcast(&s->wakeup);
+  cache_unlock(s);
+}
+#endif
 
 static void cache_wakeup(stream_t *s)
 {
 #if FORKED_CACHE
   // signal process to wake up immediately
   kill(s->cache_pid, SIGUSR1);
+#elif COND_CACHE
+  cache_signal(s->cache_data);
+#endif
+}
+
+static volatile int *hash_chain(cache_vars_t *s, off_t pos)
+{
+  return &s->hash[(pos / s->block_size) & (s->hash_size - 1)];
+}
+
+/**
+ * Find the block whose range contains pos.
+ * Only the filler can rely on the result; the reader has to use
+ * reader_find_block() since blocks may be reassigned at any time. A reader
+ * racing with that can be led into the wrong chain and miss the block, or
+ * around in circles, hence the bound on the chain walk.
+ */
+static int find_block(cache_vars_t *s, off_t pos)
+{
+  int idx = *hash_chain(s, pos);
+  for (int i = 0; idx >= 0 && i < s->num_blocks; i++) {
+    off_t bpos = s->blocks[idx].pos;
+    if (bpos >= 0 && pos >= bpos && pos < bpos + s->block_size)
+      return idx;
+    idx = s->blocks[idx].next;
+  }
+  return -1;
+}
+
+// Filler side: remove the block from the index before changing its pos.
+static void hash_remove(cache_vars_t *s, int idx)
+{
+  volatile int *link;
+  if (s->blocks[idx].pos < 0)
+    return;
+  for (link = hash_chain(s, s->blocks[idx].pos); *link >= 0;
+       link = &s->blocks[*link].next) {
+    if (*link == idx) {
+      *link = s->blocks[idx].next;
+      return;
+    }
+  }
+}
+
+// Filler side: add the block to the index after setting its pos.
+static void hash_insert(cache_vars_t *s, int idx)
+{
+  volatile int *head = hash_chain(s, s->blocks[idx].pos);
+  s->blocks[idx].next = *head;
+  cache_barrier();
+  *head = idx;
+}
+
+/**
+ * Find the block holding the byte at pos for the reader.
+ * Returns the block index and sets bpos/blen to the file position and
+ * length of the data it contains, or returns -1 if pos is not cached.
+ * The data is only valid if the block's seq is still *seq after using it.
+ */
+static int reader_find_block(cache_vars_t *s, off_t pos, off_t *bpos,
+                             int *blen, unsigned *seq)
+{
+  int idx = find_block(s, pos);
+  if (idx < 0)
+    return -1;
+  cache_block_t *b = &s->blocks[idx];
+  *seq = b->seq;
+  cache_barrier();
+  *bpos = b->pos;
+  *blen = b->len;
+  if ((*seq & 1) || pos < *bpos || pos >= *bpos + *blen)
+    return -1;
+  return idx;
+}
+
+/**
+ * Number of bytes cached contiguously after the read position. This is
+ * only an estimate if called by the reader.
+ */
+static off_t cache_ahead(cache_vars_t *s)
+{
+  off_t pos = s->read_filepos;
+  int idx;
+  while ((idx = find_block(s, pos)) >= 0) {
+    off_t end = s->blocks[idx].pos + s->blocks[idx].len;
+    if (end <= pos)
+      break;
+    pos = end;
+  }
+  return pos - s->read_filepos;
+}
+
+// Reader side: wait up to ms milliseconds for the filler to make at least
+// min bytes available at the read position.
+// Return 1 if the user interrupted waiting.
+static int cache_wait_fill(cache_vars_t *s, int min, int ms)
+{
+#if COND_CACHE
+  cache_lock(s);
+  s->wakeup_count++;
+  pthread_cond_broadcast(&s->wakeup); // the filler might be idle
+  if (cache_ahead(s) < min)
+    if (s->read_filepos + cache_ahead(s) < s->eof_pos)
+      cache_wait(s, ms);
+  cache_unlock(s);
+  return stream_check_interrupt(0);
+#else
+  return stream_check_interrupt(ms);
 #endif
 }
 
@@ -106,24 +342,27 @@ static int cache_read(cache_vars_t *s, unsigned char *buf, int size)
 {
   int total=0;
   int sleep_count = 0;
-  int last_max = s->max_filepos;
+  int64_t last_fill = s->fill_count;
   while(size>0){
-    int pos,newb,len;
+    off_t bpos;
+    int blen, len;
+    unsigned seq;
+    int idx = reader_find_block(s, s->read_filepos, &bpos, &blen, &seq);
 
-  //printf("CACHE2_READ: 0x%X <= 0x%X <= 0x%X  \n",s->min_filepos,s->read_filepos,s->max_filepos);
+  //printf("CACHE2_READ: 0x%X block %d\n",s->read_filepos,idx);
 
-    if(s->read_filepos>=s->max_filepos || s->read_filepos<s->min_filepos){
+    if(idx < 0){
 	// eof?
-	if(s->eof) break;
-	if (s->max_filepos == last_max) {
+	if(s->read_filepos >= s->eof_pos) break;
+	if (s->fill_count == last_fill) {
 	    if (sleep_count++ == 10)
 	        mp_msg(MSGT_CACHE, MSGL_WARN, "Cache not filling, consider increasing -cache and/or -cache-min!\n");
 	} else {
-	    last_max = s->max_filepos;
+	    last_fill = s->fill_count;
 	    sleep_count = 0;
 	}
 	// waiting for buffer fill...
-	if (stream_check_interrupt(READ_SLEEP_TIME)) {
+	if (cache_wait_fill(s, 1, READ_SLEEP_TIME)) {
 	    s->eof = 1;
 	    break;
 	}
@@ -131,28 +370,16 @@ static int cache_read(cache_vars_t *s, unsigned char *buf, int size)
     }
     sleep_count = 0;
 
-    newb=s->max_filepos-s->read_filepos; // new bytes in the buffer
-    if(newb<min_fill) min_fill=newb; // statistics...
-
-//    printf("*** newb: %d bytes ***\n",newb);
-
-    pos=s->read_filepos - s->offset;
-    if(pos<0) pos+=s->buffer_size; else
-    if(pos>=s->buffer_size) pos-=s->buffer_size;
-
-    if(newb>s->buffer_size-pos) newb=s->buffer_size-pos; // handle wrap...
-    if(newb>size) newb=size;
-
-    // check:
-    if(s->read_filepos<s->min_filepos) mp_msg(MSGT_CACHE,MSGL_ERR,"Ehh. s->read_filepos<s->min_filepos !!! Report bug...\n");
-
-    // len=write(mem,newb)
-    //printf("Buffer read: %d bytes\n",newb);
-    memcpy(buf,&s->buffer[pos],newb);
-    buf+=newb;
-    len=newb;
-    // ...
+    len = bpos + blen - s->read_filepos;
+    if(len>size) len=size;
+    memcpy(buf, s->buffer + idx * s->block_size + (s->read_filepos - bpos),
+           len);
+    cache_barrier();
+    if (s->blocks[idx].seq != seq)
+        continue; // filler reused the block while we were copying, retry
+    s->blocks[idx].last_used = ++s->use_count;
 
+    buf+=len;
     s->read_filepos+=len;
     size-=len;
     total+=len;
@@ -161,108 +388,376 @@ static int cache_read(cache_vars_t *s, unsigned char *buf, int size)
   return total;
 }
 
-static int cache_fill(cache_vars_t *s)
+#if DISK_CACHE
+static struct disk_block *disk_index(cache_vars_t *s, off_t pos)
 {
-  int back,back2,newb,space,len,pos;
-  off_t read=s->read_filepos;
-  int read_chunk;
-  int wraparound_copy = 0;
-
-  if(read<s->min_filepos || read>s->max_filepos){
-      // seek...
-      mp_msg(MSGT_CACHE,MSGL_DBG2,"Out of boundaries... seeking to 0x%"PRIX64"  \n",(int64_t)read);
-      // drop cache contents only if seeking backward or too much fwd.
-      // This is also done for on-disk files, since it loses the backseek cache.
-      // That in turn can cause major bandwidth increase and performance
-      // issues with e.g. mov or badly interleaved files
-      if(read<s->min_filepos || read>=s->max_filepos+s->seek_limit)
-      {
-        s->offset= // FIXME!?
-        s->min_filepos=s->max_filepos=read; // drop cache content :(
-        if(s->stream->eof) stream_reset(s->stream);
-        stream_seek_internal(s->stream,read);
-        mp_msg(MSGT_CACHE,MSGL_DBG2,"Seek done. new pos: 0x%"PRIX64"  \n",(int64_t)stream_tell(s->stream));
-      }
+  struct disk_block *index =
+    (struct disk_block *)(s->disk + sizeof(struct disk_header));
+  return &index[pos / s->block_size % s->disk_blocks];
+}
+
+static unsigned char *disk_data(cache_vars_t *s, struct disk_block *d)
+{
+  size_t start = sizeof(struct disk_header) +
+                 s->disk_blocks * sizeof(struct disk_block);
+  int slot = d - (struct disk_block *)(s->disk + sizeof(struct disk_header));
+  start = FFALIGN(start, 4096);
+  return s->disk + start + (size_t)slot * s->block_size;
+}
+
+/**
+ * Copy a block to its slot in the disk cache (direct-mapped by position).
+ */
+static void cache_disk_store(cache_vars_t *s, int idx)
+{
+  cache_block_t *b = &s->blocks[idx];
+  struct disk_block *d;
+  if (!s->disk || b->pos < 0 || b->len <= 0)
+    return;
+  d = disk_index(s, b->pos);
+  if (d->pos == b->pos && d->len >= b->len)
+    return;
+  d->len = 0;
+  d->pos = b->pos;
+  memcpy(disk_data(s, d), s->buffer + idx * s->block_size, b->len);
+  d->len = b->len;
+}
+
+/**
+ * Fill a newly assigned block from the disk cache.
+ * \return number of bytes loaded, 0 if the block is not on disk
+ */
+static int cache_disk_load(cache_vars_t *s, int idx)
+{
+  cache_block_t *b = &s->blocks[idx];
+  struct disk_block *d;
+  if (!s->disk)
+    return 0;
+  d = disk_index(s, b->pos);
+  if (d->pos != b->pos || d->len <= 0)
+    return 0;
+  memcpy(s->buffer + idx * s->block_size, disk_data(s, d), d->len);
+  cache_barrier();
+  b->len = d->len;
+  s->fill_count += d->len;
+  s->disk_read += d->len;
+  return d->len;
+}
+
+struct disk_file {
+  char *path;
+  int64_t size;
+  time_t mtime;
+};
+
+/**
+ * Delete the least recently used cache files in dir, except keep, until
+ * their total size is at most limit. Files still locked by another player
+ * are left alone.
+ */
+static void cache_disk_trim(const char *dir, const char *keep, int64_t limit)
+{
+  void *tmp = talloc_new(NULL);
+  struct disk_file *files = NULL;
+  int num = 0;
+  int64_t total = 0;
+  struct dirent *e;
+  DIR *d = opendir(dir);
+  if (!d) {
+    talloc_free(tmp);
+    return;
+  }
+  while ((e = readdir(d))) {
+    struct stat st;
+    char *path;
+    if (strlen(e->d_name) != 38 || strcmp(e->d_name + 32, ".cache") ||
+        !strcmp(e->d_name, keep))
+      continue;
+    path = mp_path_join(tmp, bstr(dir), bstr(e->d_name));
+    if (stat(path, &st) < 0)
+      continue;
+    files = talloc_realloc(tmp, files, struct disk_file, num + 1);
+    files[num++] = (struct disk_file){ path, st.st_size, st.st_mtime };
+    total += st.st_size;
+  }
+  closedir(d);
+
+  while (total > limit && num) {
+    int oldest = 0, fd;
+    for (int i = 1; i < num; i++)
+      if (files[i].mtime < files[oldest].mtime)
+        oldest = i;
+    fd = open(files[oldest].path, O_RDWR);
+    if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0 &&
+        unlink(files[oldest].path) == 0) {
+      mp_msg(MSGT_CACHE, MSGL_V, "Removed old disk cache %s\n",
+             files[oldest].path);
+      total -= files[oldest].size;
+    }
+    if (fd >= 0)
+      close(fd);
+    files[oldest] = files[--num];
   }
+  talloc_free(tmp);
+}
 
-  // calc number of back-bytes:
-  back=read - s->min_filepos;
-  if(back<0) back=0; // strange...
-  if(back>s->back_size) back=s->back_size;
+/**
+ * Open (or create) the disk cache file for the stream. The file name is
+ * derived from the URL; data is only reused if URL, stream size and block
+ * size all match and the previous session closed the file properly.
+ */
+static void cache_disk_open(cache_vars_t *s, stream_t *stream)
+{
+  struct disk_header *h;
+  uint8_t md5[16];
+  char name[40];
+  char *filename;
+  int64_t size;
+  int fd, url_len;
+  char *dir;
+  int64_t limit;
+
+  s->disk_fd = -1;
+  // sector based streams are local media, and some remap positions on seeks
+  if (!stream->opts || !stream->opts->stream_cache_dir || !stream->url ||
+      stream->end_pos <= 0 || stream->sector_size)
+    return;
+  dir = stream->opts->stream_cache_dir;
+  limit = stream->opts->stream_cache_disk_size * (int64_t)1024;
+  url_len = strlen(stream->url);
+  if (url_len >= DISK_URL_SIZE)
+    return;
+
+  // no more blocks than the stream has, so that several files fit
+  s->disk_blocks = FFMIN(limit / s->block_size,
+                         (stream->end_pos + s->block_size - 1) / s->block_size);
+  s->disk_blocks = FFMAX(1, s->disk_blocks);
+  size = FFALIGN(sizeof(struct disk_header) +
+                 s->disk_blocks * sizeof(struct disk_block), 4096) +
+         (int64_t)s->disk_blocks * s->block_size;
+  if (size != (size_t)size) {
+    mp_msg(MSGT_CACHE, MSGL_WARN, "Disk cache too large for this system.\n");
+    return;
+  }
 
-  // calc number of new bytes:
-  newb=s->max_filepos - read;
-  if(newb<0) newb=0; // strange...
+  av_md5_sum(md5, stream->url, url_len);
+  for (int i = 0; i < 16; i++)
+    sprintf(name + i * 2, "%02x", md5[i]);
+  strcpy(name + 32, ".cache");
+  mkdir(dir, 0700);
+  cache_disk_trim(dir, name, limit - size);
+  filename = mp_path_join(NULL, bstr(dir), bstr(name));
+  fd = open(filename, O_RDWR | O_CREAT, 0600);
+  if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) < 0 || ftruncate(fd, size) < 0) {
+    mp_msg(MSGT_CACHE, MSGL_WARN, "Can't use disk cache file %s: %s\n",
+           filename, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    talloc_free(filename);
+    return;
+  }
+  s->disk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (s->disk == MAP_FAILED) {
+    mp_msg(MSGT_CACHE, MSGL_WARN, "Can't map disk cache file %s: %s\n",
+           filename, strerror(errno));
+    s->disk = NULL;
+    close(fd);
+    talloc_free(filename);
+    return;
+  }
+  s->disk_fd = fd;
+  s->disk_size = size;
 
-  // calc free buffer space:
-  space=s->buffer_size - (newb+back);
+  h = (struct disk_header *)s->disk;
+  if (memcmp(h->magic, DISK_MAGIC, 8) || h->block_size != s->block_size ||
+      h->num_blocks != s->disk_blocks || h->file_size != stream->end_pos ||
+      !h->clean || strcmp(h->url, stream->url))
+  {
+    struct disk_block *index = (struct disk_block *)(h + 1);
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, DISK_MAGIC, 8);
+    h->block_size = s->block_size;
+    h->num_blocks = s->disk_blocks;
+    h->file_size = stream->end_pos;
+    strcpy(h->url, stream->url);
+    for (int i = 0; i < s->disk_blocks; i++)
+      index[i] = (struct disk_block){ .pos = -1 };
+    mp_msg(MSGT_CACHE, MSGL_V, "Created disk cache %s\n", filename);
+  } else
+    mp_msg(MSGT_CACHE, MSGL_V, "Reusing disk cache %s\n", filename);
+  h->clean = 0;
+  talloc_free(filename);
+}
 
-  // calc bufferpos:
-  pos=s->max_filepos - s->offset;
-  if(pos>=s->buffer_size) pos-=s->buffer_size; // wrap-around
+static void cache_disk_close(cache_vars_t *s)
+{
+  if (!s->disk)
+    return;
+  for (int i = 0; i < s->num_blocks; i++)
+    cache_disk_store(s, i);
+  ((struct disk_header *)s->disk)->clean = 1;
+  msync(s->disk, s->disk_size, MS_SYNC);
+  munmap(s->disk, s->disk_size);
+  close(s->disk_fd);
+  mp_msg(MSGT_CACHE, MSGL_V, "%"PRId64" bytes were read from the disk cache.\n",
+         s->disk_read);
+  s->disk = NULL;
+}
+#else
+static void cache_disk_store(cache_vars_t *s, int idx) {}
+static int cache_disk_load(cache_vars_t *s, int idx) { return 0; }
+static void cache_disk_open(cache_vars_t *s, stream_t *stream) {}
+static void cache_disk_close(cache_vars_t *s) {}
+#endif
 
-  if(space<s->fill_limit){
-//    printf("Buffer is full (%d bytes free, limit: %d)\n",space,s->fill_limit);
-    return 0; // no fill...
+/**
+ * Choose a block for new data: an unused one if there is any, otherwise the
+ * least recently used one not holding data between read and limit.
+ */
+static int get_free_block(cache_vars_t *s, off_t read, off_t limit)
+{
+  int best = -1;
+  for (int i = 0; i < s->num_blocks; i++) {
+    cache_block_t *b = &s->blocks[i];
+    if (b->pos < 0)
+      return i;
+    if (b->pos + s->block_size > read && b->pos < limit)
+      continue;
+    if (best < 0 || (int)(b->last_used - s->blocks[best].last_used) < 0)
+      best = i;
   }
+  return best;
+}
 
-//  printf("### read=0x%X  back=%d  newb=%d  space=%d  pos=%d\n",read,back,newb,space,pos);
+static int cache_fill(cache_vars_t *s)
+{
+  off_t read=s->read_filepos;
+  off_t limit = read + s->ahead_size;
+  off_t pos = read;
+  off_t stream_pos = s->stream->pos;
+  off_t fillpos;
+  cache_block_t *b;
+  int idx, space, len, read_chunk;
+
+  // find the first byte after the read position that is not cached yet
+  while (pos < limit && (idx = find_block(s, pos)) >= 0) {
+    b = &s->blocks[idx];
+    pos = b->pos + b->len;
+    if (b->len < s->block_size)
+      break; // partially filled block, continue filling it
+  }
+  if (pos >= limit || pos >= s->eof_pos)
+    return 0; // no fill...
 
-  // try to avoid wrap-around. If not possible due to sector size
-  // do an extra copy.
-  if(space>s->buffer_size-pos) {
-    if (s->buffer_size-pos >= s->sector_size) {
-      space=s->buffer_size-pos;
-    } else {
-      space = s->sector_size;
-      wraparound_copy = 1;
+  // If the gap starts a bit after the position the stream is at anyway,
+  // read the data in between instead of seeking. This avoids the cost of
+  // many successive seeks e.g. for files without index.
+  idx = -2;
+  if (stream_pos < pos && pos - stream_pos <= s->seek_limit) {
+    int sidx = find_block(s, stream_pos);
+    if (sidx < 0 ? stream_pos % s->block_size == 0 :
+        s->blocks[sidx].pos + s->blocks[sidx].len == stream_pos) {
+      pos = stream_pos;
+      idx = sidx;
     }
   }
+  if (idx == -2)
+    idx = find_block(s, pos);
+
+  if (idx < 0) {
+    idx = get_free_block(s, read, limit);
+    if (idx < 0)
+      return 0; // all blocks are needed for read-ahead
+    b = &s->blocks[idx];
+    cache_disk_store(s, idx);
+    b->seq++;
+    cache_barrier();
+    hash_remove(s, idx);
+    b->pos = pos - pos % s->block_size;
+    b->len = 0;
+    b->last_used = s->use_count;
+    hash_insert(s, idx);
+    cache_barrier();
+    b->seq++;
+    len = cache_disk_load(s, idx);
+    if (len)
+      return len;
+  }
+  b = &s->blocks[idx];
+  fillpos = b->pos + b->len;
+
+  if (fillpos != stream_pos) {
+    mp_msg(MSGT_CACHE,MSGL_DBG2,"Not cached... seeking to 0x%"PRIX64"  \n",(int64_t)fillpos);
+    if(s->stream->eof) stream_reset(s->stream);
+    stream_seek_internal(s->stream,fillpos);
+    mp_msg(MSGT_CACHE,MSGL_DBG2,"Seek done. new pos: 0x%"PRIX64"  \n",(int64_t)stream_tell(s->stream));
+    // Linear streams can't seek; like the old single-window cache, just
+    // continue with whatever the stream returns next.
+    s->stream->pos = fillpos;
+  }
 
   // limit one-time block size
+  space = s->block_size - b->len;
   read_chunk = s->stream->read_chunk;
   if (!read_chunk) read_chunk = 4*s->sector_size;
   space = FFMIN(space, read_chunk);
 
-#if 1
-  // back+newb+space <= buffer_size
-  back2=s->buffer_size-(space+newb); // max back size
-  if(s->min_filepos<(read-back2)) s->min_filepos=read-back2;
-#else
-  s->min_filepos=read-back; // avoid seeking-back to temp area...
-#endif
-
-  if (wraparound_copy) {
-    int to_copy;
-    len = stream_read_internal(s->stream, s->stream->buffer, space);
-    to_copy = FFMIN(len, s->buffer_size-pos);
-    memcpy(s->buffer + pos, s->stream->buffer, to_copy);
-    memcpy(s->buffer, s->stream->buffer + to_copy, len - to_copy);
+  if (s->stream->sector_size && space < s->sector_size) {
+    // Sector based streams always return a whole sector, so read into a
+    // temporary buffer. The rest of the sector is dropped and will be read
+    // again after a seek when filling the next block.
+    len = stream_read_internal(s->stream, s->stream->buffer, s->sector_size);
+    len = FFMIN(len, space);
+    memcpy(s->buffer + idx * s->block_size + b->len, s->stream->buffer, len);
   } else
-  len = stream_read_internal(s->stream, &s->buffer[pos], space);
+    len = stream_read_internal(s->stream,
+                               s->buffer + idx * s->block_size + b->len, space);
   s->eof= !len;
-
-  s->max_filepos+=len;
-  if(pos+len>=s->buffer_size){
-      // wrap...
-      s->offset+=s->buffer_size;
+  if (!len) {
+    s->eof_pos = fillpos;
+    return 0;
   }
 
+  cache_barrier();
+  b->len += len;
+  s->fill_count += len;
   return len;
 
 }
 
+static void cache_invalidate(cache_vars_t *s)
+{
+  for (int i = 0; i < s->num_blocks; i++) {
+    cache_block_t *b = &s->blocks[i];
+    b->seq++;
+    cache_barrier();
+    b->pos = -1;
+    b->len = 0;
+    b->next = -1;
+    cache_barrier();
+    b->seq++;
+  }
+  for (int i = 0; i < s->hash_size; i++)
+    s->hash[i] = -1;
+  s->eof_pos = INT64_MAX;
+}
+
 static int cache_execute_control(cache_vars_t *s) {
   double double_res;
   unsigned uint_res;
   static unsigned last;
   int quit = s->control == -2;
   if (quit || !s->stream->control) {
+    int had_cmd = s->control != -1;
     s->stream_time_length = 0;
     s->stream_time_pos = MP_NOPTS_VALUE;
     s->control_new_pos = 0;
     s->control_res = STREAM_UNSUPPORTED;
     s->control = -1;
+#if COND_CACHE
+    if (had_cmd)
+      cache_signal(s);
+#endif
     return !quit;
   }
   if (GetTimerMS() - last > 99) {
@@ -300,8 +795,17 @@ static int cache_execute_control(cache_vars_t *s) {
       s->control_res = STREAM_UNSUPPORTED;
       break;
   }
+  // Streams with such controls (DVD, Blu-ray, ...) do not guarantee that
+  // byte positions map to the same data afterwards.
+  if (s->control_res == STREAM_OK && (s->control == STREAM_CTRL_SEEK_TO_TIME ||
+                                      s->control == STREAM_CTRL_SEEK_TO_CHAPTER ||
+                                      s->control == STREAM_CTRL_SET_ANGLE))
+    cache_invalidate(s);
   s->control_new_pos = s->stream->pos;
   s->control = -1;
+#if COND_CACHE
+  cache_signal(s);
+#endif
   return 1;
 }
 
@@ -322,7 +826,7 @@ static void shared_free(void *ptr, int size) {
 }
 
 static cache_vars_t* cache_init(int size,int sector){
-  int num;
+  int num, per_block;
   cache_vars_t* s=shared_alloc(sizeof(cache_vars_t));
   if(s==NULL) return NULL;
 
@@ -331,17 +835,39 @@ static cache_vars_t* cache_init(int size,int sector){
   if(num < 16){
      num = 16;
   }//32kb min_size
-  s->buffer_size=num*sector;
+  per_block = FFMAX(16, (num + MAX_BLOCKS - 1) / MAX_BLOCKS);
+  if (num / per_block < MIN_BLOCKS)
+    per_block = num / MIN_BLOCKS;
+  s->block_size=per_block*sector;
+  s->num_blocks=num/per_block;
+  s->buffer_size=s->num_blocks*s->block_size;
   s->sector_size=sector;
   s->buffer=shared_alloc(s->buffer_size);
-
-  if(s->buffer == NULL){
+  s->blocks=shared_alloc(s->num_blocks*sizeof(cache_block_t));
+  for (s->hash_size = 1; s->hash_size < s->num_blocks; s->hash_size *= 2);
+  s->hash=shared_alloc(s->hash_size*sizeof(int));
+
+  if(s->buffer == NULL || s->blocks == NULL || s->hash == NULL){
+    if (s->buffer)
+      shared_free(s->buffer, s->buffer_size);
+    if (s->blocks)
+      shared_free(s->blocks, s->num_blocks*sizeof(cache_block_t));
+    if (s->hash)
+      shared_free((void *)s->hash, s->hash_size*sizeof(int));
     shared_free(s, sizeof(cache_vars_t));
     return NULL;
   }
-
-  s->fill_limit=8*sector;
-  s->back_size=s->buffer_size/2;
+  for (int i = 0; i < s->num_blocks; i++)
+    s->blocks[i] = (cache_block_t){ .pos = -1, .next = -1 };
+  for (int i = 0; i < s->hash_size; i++)
+    s->hash[i] = -1;
+
+  s->ahead_size=s->buffer_size/2;
+  s->eof_pos=INT64_MAX;
+#if COND_CACHE
+  pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->wakeup, NULL);
+#endif
   return s;
 }
 
@@ -350,6 +876,9 @@ void cache_uninit(stream_t *s) {
   if(s->cache_pid) {
 #if !FORKED_CACHE
     cache_do_control(s, -2, NULL);
+#if COND_CACHE
+    pthread_join(c->thread, NULL);
+#endif
 #else
     kill(s->cache_pid,SIGKILL);
     waitpid(s->cache_pid,NULL,0);
@@ -357,8 +886,17 @@ void cache_uninit(stream_t *s) {
     s->cache_pid = 0;
   }
   if(!c) return;
+  cache_disk_close(c);
+#if COND_CACHE
+  pthread_cond_destroy(&c->wakeup);
+  pthread_mutex_destroy(&c->mutex);
+#endif
   shared_free(c->buffer, c->buffer_size);
   c->buffer = NULL;
+  shared_free(c->blocks, c->num_blocks*sizeof(cache_block_t));
+  c->blocks = NULL;
+  shared_free((void *)c->hash, c->hash_size*sizeof(int));
+  c->hash = NULL;
   c->stream = NULL;
   shared_free(s->cache_data, sizeof(cache_vars_t));
   s->cache_data = NULL;
@@ -378,12 +916,25 @@ static void dummy_sighandler(int x) {
  * Main loop of the cache process or thread.
  */
 static void cache_mainloop(cache_vars_t *s) {
+#if !COND_CACHE
     int sleep_count = 0;
+#endif
 #if FORKED_CACHE
     struct sigaction sa = { .sa_handler = SIG_IGN };
     sigaction(SIGUSR1, &sa, NULL);
 #endif
     do {
+#if COND_CACHE
+        unsigned wakeup_count = s->wakeup_count;
+        if (!cache_fill(s)) {
+            // Sleep until the reader seeks, runs dry or sends a command.
+            cache_lock(s);
+            if (wakeup_count == s->wakeup_count && s->control == -1)
+                cache_wait(s, FILL_USLEEP_TIME / 1000);
+            cache_unlock(s);
+        } else
+            cache_signal(s);
+#else
         if (!cache_fill(s)) {
 #if FORKED_CACHE
             // Let signal wake us up, we cannot leave this
@@ -403,6 +954,7 @@ static void cache_mainloop(cache_vars_t *s) {
 #endif
         } else
             sleep_count = 0;
+#endif
     } while (cache_execute_control(s));
 }
 
@@ -434,15 +986,16 @@ int stream_enable_cache(stream_t *stream, int size, int min, int seek_limit)
   stream->cache_data=s;
   s->stream=stream; // callback
   s->seek_limit=seek_limit;
+  cache_disk_open(s, stream);
 
 
   //make sure that we won't wait from cache_fill
   //more data than it is allowed to fill
-  if (s->seek_limit > s->buffer_size - s->fill_limit ){
-     s->seek_limit = s->buffer_size - s->fill_limit;
+  if (s->seek_limit > s->ahead_size - s->block_size) {
+     s->seek_limit = s->ahead_size - s->block_size;
   }
-  if (min > s->buffer_size - s->fill_limit) {
-     min = s->buffer_size - s->fill_limit;
+  if (min > s->ahead_size - s->block_size) {
+     min = s->ahead_size - s->block_size;
   }
   // to make sure we wait for the cache process/thread to be active
   // before continuing
@@ -461,11 +1014,8 @@ int stream_enable_cache(stream_t *stream, int size, int min, int seek_limit)
 #if defined(__MINGW32__)
     stream->cache_pid = _beginthread( ThreadProc, 0, s );
 #else
-    {
-    pthread_t tid;
-    pthread_create(&tid, NULL, ThreadProc, s);
-    stream->cache_pid = 1;
-    }
+    if (!pthread_create(&s->thread, NULL, ThreadProc, s))
+        stream->cache_pid = 1;
 #endif
 #endif
     if (!stream->cache_pid) {
@@ -474,15 +1024,15 @@ int stream_enable_cache(stream_t *stream, int size, int min, int seek_limit)
         goto err_out;
     }
     // wait until cache is filled at least prefill_init %
-    mp_msg(MSGT_CACHE,MSGL_V,"CACHE_PRE_INIT: %"PRId64" [%"PRId64"] %"PRId64"  pre:%d  eof:%d  \n",
-	(int64_t)s->min_filepos,(int64_t)s->read_filepos,(int64_t)s->max_filepos,min,s->eof);
-    while(s->read_filepos<s->min_filepos || s->max_filepos-s->read_filepos<min){
+    mp_msg(MSGT_CACHE,MSGL_V,"CACHE_PRE_INIT: [%"PRId64"] %d blocks of %d bytes  pre:%d  eof:%d  \n",
+	(int64_t)s->read_filepos,s->num_blocks,s->block_size,min,s->eof);
+    while(cache_ahead(s)<min){
 	mp_tmsg(MSGT_CACHE,MSGL_STATUS,"\rCache fill: %5.2f%% (%"PRId64" bytes)   ",
-	    100.0*(float)(s->max_filepos-s->read_filepos)/(float)(s->buffer_size),
-	    (int64_t)s->max_filepos-s->read_filepos
+	    100.0*(float)cache_ahead(s)/(float)(s->buffer_size),
+	    (int64_t)cache_ahead(s)
 	);
 	if(s->eof) break; // file is smaller than prefill size
-	if(stream_check_interrupt(PREFILL_SLEEP_TIME)) {
+	if(cache_wait_fill(s, min, PREFILL_SLEEP_TIME)) {
 	  res = 0;
 	  goto err_out;
         }
@@ -550,7 +1100,17 @@ int cache_fill_status(stream_t *s) {
   if (!s || !s->cache_data)
     return -1;
   cv = s->cache_data;
-  return (cv->max_filepos-cv->read_filepos)/(cv->buffer_size / 100);
+  return cache_ahead(cv)/(cv->buffer_size / 100);
+}
+
+/**
+ * Whether the next size bytes (or everything up to EOF) are already cached,
+ * so that reading them doesn't have to wait for the stream.
+ */
+int cache_can_read(stream_t *s, int size) {
+  cache_vars_t *cv = s->cache_data;
+  off_t ahead = cache_ahead(cv);
+  return ahead >= size || cv->read_filepos + ahead >= cv->eof_pos;
 }
 
 int cache_stream_seek_long(stream_t *stream,off_t pos){
@@ -561,11 +1121,12 @@ int cache_stream_seek_long(stream_t *stream,off_t pos){
   s=stream->cache_data;
 //  s->seek_lock=1;
 
-  mp_msg(MSGT_CACHE,MSGL_DBG2,"CACHE2_SEEK: 0x%"PRIX64" <= 0x%"PRIX64" (0x%"PRIX64") <= 0x%"PRIX64"  \n",s->min_filepos,pos,s->read_filepos,s->max_filepos);
+  mp_msg(MSGT_CACHE,MSGL_DBG2,"CACHE2_SEEK: 0x%"PRIX64" (0x%"PRIX64")  \n",(int64_t)pos,(int64_t)s->read_filepos);
 
   newpos=pos/s->sector_size; newpos*=s->sector_size; // align
   stream->pos=s->read_filepos=newpos;
   s->eof=0; // !!!!!!!
+  s->eof_pos=INT64_MAX;
   cache_wakeup(stream);
 
   cache_stream_fill_buffer(stream);
@@ -618,6 +1179,12 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
   while (s->control != -1) {
     if (sleep_count++ == 1000)
       mp_msg(MSGT_CACHE, MSGL_WARN, "Cache not responding!\n");
+#if COND_CACHE
+    cache_lock(s);
+    if (s->control != -1)
+      cache_wait(s, READ_SLEEP_TIME);
+    cache_unlock(s);
+#endif
     if (stream_check_interrupt(CONTROL_SLEEP_TIME)) {
       s->eof = 1;
       return STREAM_UNSUPPORTED;
@@ -22,6 +22,7 @@
 
 #include <libavutil/common.h>
 #include <libavutil/mem.h>
+#include <libavutil/intreadwrite.h>
 
 #include "config.h"
 
@@ -33,6 +34,7 @@
 #include "osdep/timer.h"
 
 #include "talloc.h"
+#include "mpcommon.h"
 #include "options.h"
 #include "mplayer.h"
 #include "mp_msg.h"
@@ -113,10 +115,83 @@ void osd_alloc_buf(mp_osd_obj_t* obj)
     memset(obj->alpha_buffer, sub_bg_alpha, len);
 }
 
-// renders the buffer
-static void vo_draw_text_from_buffer(mp_osd_obj_t* obj,void (*draw_alpha)(void *ctx, int x0,int y0, int w,int h, unsigned char* src, unsigned char *srca, int stride), void *ctx)
+#define OSD_RECT_BAND 16  // rows per band
+#define OSD_RECT_GAP 4     // transparent 8 pixel groups that split a band
+
+/* Find the parts of the buffer that are not fully transparent, as
+ * rectangles relative to the bbox, in bands of OSD_RECT_BAND rows.
+ * Left edges are multiples of 8 pixels, and so are widths except at the
+ * right edge of the bbox: the optimized vo_draw_alpha_* functions skip
+ * transparent groups of up to 8 pixels, so blending only the rectangles
+ * gives exactly the same result as blending the whole bbox.
+ * Called once whenever the buffer is updated, not for every frame. */
+static void osd_calc_rects(mp_osd_obj_t *obj)
 {
-    if (obj->allocated > 0) {
+    int w = obj->bbox.x2 - obj->bbox.x1;
+    int h = obj->bbox.y2 - obj->bbox.y1;
+    int groups = (w + 7) >> 3;
+    unsigned char *used;
+
+    obj->num_rects = 0;
+    if (w <= 0 || h <= 0 || obj->allocated <= 0)
+        return;
+    if (w > obj->stride || obj->stride * h > obj->allocated) {
+        // buffer doesn't match the bbox; draw it like it always was
+        MP_RESIZE_ARRAY(NULL, obj->rects, 1);
+        obj->rects[0] = (mp_osd_bbox_t){0, 0, w, h};
+        obj->num_rects = 1;
+        return;
+    }
+
+    used = talloc_size(NULL, groups);
+    for (int y0 = 0; y0 < h; y0 += OSD_RECT_BAND) {
+        int y1 = FFMIN(y0 + OSD_RECT_BAND, h);
+        int top = -1, bottom = -1;
+        memset(used, 0, groups);
+        for (int y = y0; y < y1; y++) {
+            const unsigned char *a = obj->alpha_buffer + y * obj->stride;
+            int any = 0;
+            for (int g = 0; g < groups; g++) {
+                if (AV_RN64(a + g * 8)) {
+                    used[g] = 1;
+                    any = 1;
+                }
+            }
+            if (any) {
+                if (top < 0)
+                    top = y;
+                bottom = y + 1;
+            }
+        }
+        if (top < 0)
+            continue;
+        for (int g = 0; g < groups;) {
+            int start, end;
+            if (!used[g]) {
+                g++;
+                continue;
+            }
+            start = g;
+            end = ++g;
+            for (; g < groups && g - end < OSD_RECT_GAP; g++)
+                if (used[g])
+                    end = g + 1;
+            if (obj->num_rects == MP_TALLOC_ELEMS(obj->rects))
+                MP_RESIZE_ARRAY(NULL, obj->rects, FFMAX(8, obj->num_rects * 2));
+            obj->rects[obj->num_rects++] = (mp_osd_bbox_t){
+                start * 8, top, FFMIN(end * 8, w), bottom
+            };
+        }
+    }
+    talloc_free(used);
+}
+
+// renders the buffer; with ink_only set, skip the fully transparent parts
+static void vo_draw_text_from_buffer(mp_osd_obj_t* obj, bool ink_only, void (*draw_alpha)(void *ctx, int x0,int y0, int w,int h, unsigned char* src, unsigned char *srca, int stride), void *ctx)
+{
+    if (obj->allocated <= 0)
+        return;
+    if (!ink_only) {
 	draw_alpha(ctx,
 		   obj->bbox.x1,obj->bbox.y1,
 		   obj->bbox.x2-obj->bbox.x1,
@@ -124,6 +199,15 @@ static void vo_draw_text_from_buffer(mp_osd_obj_t* obj,void (*draw_alpha)(void *
 		   obj->bitmap_buffer,
 		   obj->alpha_buffer,
 		   obj->stride);
+        return;
+    }
+    for (int n = 0; n < obj->num_rects; n++) {
+        mp_osd_bbox_t *r = &obj->rects[n];
+        int offset = r->y1 * obj->stride + r->x1;
+        draw_alpha(ctx, obj->bbox.x1 + r->x1, obj->bbox.y1 + r->y1,
+                   r->x2 - r->x1, r->y2 - r->y1,
+                   obj->bitmap_buffer + offset, obj->alpha_buffer + offset,
+                   obj->stride);
     }
 }
 
@@ -218,6 +302,7 @@ void osd_free(struct osd_state *osd)
 	mp_osd_obj_t* next=obj->next;
 	av_free(obj->alpha_buffer);
 	av_free(obj->bitmap_buffer);
+	talloc_free(obj->rects);
 	free(obj);
 	obj=next;
     }
@@ -290,6 +375,11 @@ static int osd_update_ext(struct osd_state *osd, int dxs, int dys,
 		obj->bbox.x1,obj->bbox.y1,obj->bbox.x2-obj->bbox.x1,
 		obj->bbox.y2-obj->bbox.y1);
 	}
+	// cache the visible parts of the new buffer for osd_draw_text()
+	if (obj->type != OSDTYPE_SPU && obj->flags & OSDFLAG_VISIBLE)
+	    osd_calc_rects(obj);
+	else
+	    obj->num_rects = 0;
 	// check if visibility changed:
 	if(vis != (obj->flags&OSDFLAG_VISIBLE) ) obj->flags|=OSDFLAG_CHANGED;
 	// remove the cause of automatic update:
@@ -343,18 +433,15 @@ void osd_set_text(struct osd_state *osd, const char *text) {
     osd->osd_text = talloc_strdup(osd, text);
 }
 
-void osd_draw_text_ext(struct osd_state *osd, int dxs, int dys,
-                       int left_border, int top_border, int right_border,
-                       int bottom_border, int orig_w, int orig_h,
-                       void (*draw_alpha)(void *ctx, int x0, int y0, int w,
-                                          int h, unsigned char* src,
-                                          unsigned char *srca,
-                                          int stride),
-                   void *ctx)
+static void osd_draw_objects(struct osd_state *osd, bool ink_only,
+                             void (*draw_alpha)(void *ctx, int x0, int y0,
+                                                int w, int h,
+                                                unsigned char* src,
+                                                unsigned char *srca,
+                                                int stride),
+                             void *ctx)
 {
     mp_osd_obj_t* obj=vo_osd_list;
-    osd_update_ext(osd, dxs, dys, left_border, top_border, right_border,
-                   bottom_border, orig_w, orig_h);
     while(obj){
       if(obj->flags&OSDFLAG_VISIBLE){
 	switch(obj->type){
@@ -368,7 +455,7 @@ void osd_draw_text_ext(struct osd_state *osd, int dxs, int dys,
 	case OSDTYPE_OSD:
 	case OSDTYPE_SUBTITLE:
 	case OSDTYPE_PROGBAR:
-	    vo_draw_text_from_buffer(obj, draw_alpha, ctx);
+	    vo_draw_text_from_buffer(obj, ink_only, draw_alpha, ctx);
 	    break;
 	}
 	obj->old_bbox=obj->bbox;
@@ -379,13 +466,28 @@ void osd_draw_text_ext(struct osd_state *osd, int dxs, int dys,
     }
 }
 
+void osd_draw_text_ext(struct osd_state *osd, int dxs, int dys,
+                       int left_border, int top_border, int right_border,
+                       int bottom_border, int orig_w, int orig_h,
+                       void (*draw_alpha)(void *ctx, int x0, int y0, int w,
+                                          int h, unsigned char* src,
+                                          unsigned char *srca,
+                                          int stride),
+                   void *ctx)
+{
+    osd_update_ext(osd, dxs, dys, left_border, top_border, right_border,
+                   bottom_border, orig_w, orig_h);
+    osd_draw_objects(osd, false, draw_alpha, ctx);
+}
+
 void osd_draw_text(struct osd_state *osd, int dxs, int dys,
                    void (*draw_alpha)(void *ctx, int x0, int y0, int w, int h,
                                       unsigned char* src, unsigned char *srca,
                                       int stride),
                    void *ctx)
 {
-    osd_draw_text_ext(osd, dxs, dys, 0, 0, 0, 0, dxs, dys, draw_alpha, ctx);
+    osd_update_ext(osd, dxs, dys, 0, 0, 0, 0, dxs, dys);
+    osd_draw_objects(osd, true, draw_alpha, ctx);
 }
 
 static int vo_osd_changed_status = 0;
@@ -404,15 +506,30 @@ int vo_osd_changed(int new_value)
     return ret;
 }
 
+static int bbox_in_range(mp_osd_bbox_t b, int x1, int y1, int x2, int y2)
+{
+    return (b.x1<=x2 && b.x2>=x1) && (b.y1<=y2 && b.y2>=y1) &&
+           b.y2 > b.y1 && b.x2 > b.x1;
+}
+
 // return TRUE if we have osd in the specified rectangular area:
 int vo_osd_check_range_update(int x1,int y1,int x2,int y2){
     mp_osd_obj_t* obj=vo_osd_list;
     while(obj){
 	if(obj->flags&OSDFLAG_VISIBLE){
-	    if(	(obj->bbox.x1<=x2 && obj->bbox.x2>=x1) &&
-		(obj->bbox.y1<=y2 && obj->bbox.y2>=y1) &&
-		obj->bbox.y2 > obj->bbox.y1 && obj->bbox.x2 > obj->bbox.x1
-		) return 1;
+	    if (obj->type == OSDTYPE_SPU) {
+		if (bbox_in_range(obj->bbox, x1, y1, x2, y2))
+		    return 1;
+	    } else {
+		// only the parts that osd_draw_text() actually draws
+		for (int n = 0; n < obj->num_rects; n++) {
+		    mp_osd_bbox_t r = obj->rects[n];
+		    r.x1 += obj->bbox.x1; r.x2 += obj->bbox.x1;
+		    r.y1 += obj->bbox.y1; r.y2 += obj->bbox.y1;
+		    if (bbox_in_range(r, x1, y1, x2, y2))
+			return 1;
+		}
+	    }
 	}
 	obj=obj->next;
     }
@@ -70,6 +70,11 @@ typedef struct mp_osd_obj_s {
     unsigned char *alpha_buffer;
     unsigned char *bitmap_buffer;
 
+    // parts of the buffer that are not fully transparent, relative to bbox;
+    // updated together with the buffer (talloc'ed)
+    mp_osd_bbox_t *rects;
+    int num_rects;
+
     struct ass_track *osd_track;
 } mp_osd_obj_t;
 
@@ -133,6 +138,11 @@ extern float sub_fps;
 
 extern int sub_justify;
 
+/* For blending into the video frame in software: only passes the parts of
+ * the OSD bitmaps that are not fully transparent to draw_alpha, possibly in
+ * several calls per OSD object. osd_draw_text_ext() passes each object's
+ * whole bbox in one call, for outputs that upload the bitmaps as textures.
+ */
 void osd_draw_text(struct osd_state *osd, int dxs, int dys,
                    void (*draw_alpha)(void *ctx, int x0, int y0, int w, int h,
                                       unsigned char* src, unsigned char *srca,